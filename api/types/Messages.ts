@@ -1,5 +1,12 @@
 import { UserSettings } from "./Settings";
 
+// How pixel bytes are stored in pixel strings. "string" is one byte per charCode, "dense" packs two bytes per charCode,
+// "delta" is a compressed payload applied on top of the pixels already there (see decodePixelString in the webview).
+export type PixelEncoding = "string" | "dense" | "delta";
+
+// GPU block formats the addon can send textures in, all of them sRGB. BC1 has no alpha.
+export type TextureCompression = "bc1" | "bc3" | "bc7";
+
 export interface PartialUpdate {
   type: "PARTIAL_UPDATE",
   documentID: number, 
@@ -8,9 +15,47 @@ export interface PartialUpdate {
   componentSize: number,
   pixelBatchOffset: number,
   pixelBatchSize: number,
+  encoding: PixelEncoding,
   pixelString: string,
 }
 
+// A rectangle of changed pixels, pixelString holds width * height RGBA pixels row by row, in the format given by
+// the update's componentSize. Rects with a level are texels of that mip level of the texture instead, level 1 being half
+// the document size. For compressed updates pixelString holds the 4x4 blocks covering the rect row by row instead, the
+// rect starts on a block and only ends between blocks at the edge of its level.
+export interface TileData {
+  level?: number,
+  x: number,
+  y: number,
+  width: number,
+  height: number,
+  pixelString: string,
+}
+
+export interface TileUpdate {
+  type: "TILE_UPDATE",
+  documentID: number,
+  width: number,
+  height: number,
+  // 8 for sRGB RGBA8 pixels, 16 for linear RGBA half float pixels (8 bytes each) when previewing HDR
+  componentSize: number,
+  encoding: PixelEncoding,
+  // Set when the tiles are compressed blocks of this format, the componentSize is 8 then
+  compression?: TextureCompression,
+  tiles: TileData[],
+}
+
+// Channels of a packed texture that changed. Each tile's pixelString holds width * height bytes of its channel alone,
+// row by row. Channels 0, 1 and 2 are the texture's R, G and B.
+export interface PackedUpdate {
+  type: "PACKED_UPDATE",
+  packedTextureID: number,
+  width: number,
+  height: number,
+  encoding: PixelEncoding,
+  tiles: (TileData & { channel: number })[],
+}
+
 export interface DocumentClosed {
   type: "DOCUMENT_CLOSED",
   documentID: number,
@@ -27,10 +72,17 @@ export interface PushSettings {
 }
 
 
-export interface Ready { type: "Ready" };
+// The webview tells which compressed formats its WebGL context can sample
+export interface Ready { type: "Ready", compressedFormats?: TextureCompression[] };
 export interface RequestUpdate { type: "RequestUpdate" };
 export interface UpdateSettings { type: "UpdateSettings", settings: UserSettings };
+// Documents whose texture is on a material in the viewport, their updates are converted first after the active one's
+export interface VisibleDocuments { type: "VisibleDocuments", documentIDs: number[] };
+// Feed a channel of a packed texture with the document's red channel, a documentID of -1 clears the channel
+export interface PackChannel { type: "PackChannel", packedTextureID: number, channel: 0 | 1 | 2, documentID: number };
+// A packed texture no material uses anymore
+export interface RemovePackedTexture { type: "RemovePackedTexture", packedTextureID: number };
 
 
-export type WebviewTargetMessage = PartialUpdate | DocumentChanged | DocumentClosed | PushSettings;
-export type PluginTargetMessage = Ready | RequestUpdate | UpdateSettings;
\ No newline at end of file
+export type WebviewTargetMessage = PartialUpdate | TileUpdate | PackedUpdate | DocumentChanged | DocumentClosed | PushSettings;
+export type PluginTargetMessage = Ready | RequestUpdate | UpdateSettings | VisibleDocuments | PackChannel | RemovePackedTexture;
\ No newline at end of file
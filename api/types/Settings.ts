@@ -14,6 +14,10 @@ interface GridSettings {
 interface DisplaySettings {
   cameraFOV: number,
   textureResolutionScale: number,
+  // Show 16 and 32 bit documents from half float textures instead of dithered 8 bit ones
+  hdrPreview?: boolean,
+  // Keep 8 bit textures block compressed on the GPU, encoded fast, balanced or at the highest quality
+  textureCompression?: "off" | "fast" | "balanced" | "high",
 }
 
 enum ControlSchemeType {
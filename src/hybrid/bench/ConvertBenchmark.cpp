@@ -0,0 +1,696 @@
+/**
+ * Throughput benchmark for the convert_to_string, convert_tiles and convert_image hot paths.
+ *
+ * The addon is loaded into a MockUxpHost and driven exactly the way processUpdates in src/index.ts drives it:
+ * one call per 512x512 pixel batch (or the band of whole tile rows closest to it), walking the whole document.
+ * Each scenario is reported in pixels per second and input/output bytes per second.
+ *
+ * Usage: hybrid-bench [--sizes 1024,2048,...] [--batch PIXELS] [--min-time SECONDS] [--min-passes N]
+ *                     [--kernels NAME|all] [--api string|tiles|image] [--output string|dense|buffer|delta] [--async]
+ *                     [--threads 1,2,...|all] [--depth 8|16|32] [--quantize round|ordered|blue-noise|half] [--mips]
+ *                     [--scale FACTOR] [--filter bilinear|lanczos] [--compress bc1|bc3|bc7] [--preset fast|balanced|high]
+ *                     [--detect full|hash] [--mode rgb|grayscale|lab|cmyk] [--trace FILE] [--verify]
+ *
+ * --api image converts the whole document in one convert_image call instead of a call per band.
+ * --output picks the output format passed to the addon: one charCode per byte, two bytes per charCode, a Uint8Array
+ * over native memory, or a compressed delta against the previous pass.
+ * --async calls the _async variant of the api and waits for each promise, like processUpdates awaiting it.
+ * --threads runs every scenario once per thread count given to set_thread_count, "all" being 1 up to one per core,
+ * and reports the speedup over the first count.
+ * --depth is the bits per component of the document, --quantize how 16 and 32 bit data is brought down to the texture.
+ * --mips has convert_tiles also return the changed texels of the document's mip levels.
+ * --scale has convert_tiles resample the document to its size times the factor, with the given --filter.
+ * --compress has convert_tiles send the preview as GPU compressed blocks, encoded with the given --preset.
+ * --detect hash has convert_tiles detect changes by tile hashes instead of keeping a copy of the document.
+ * --mode is the color mode of the document, with and without alpha. Modes other than rgb are converted to RGBA.
+ * --trace records the whole run with set_tracing and writes it to FILE with dump_trace, for chrome://tracing.
+ *
+ * Between passes the document is either left alone (same), inverted completely (changed) or has a short brush stroke
+ * painted on it (stroke).
+ * --verify checks the vectorized kernels against the scalar reference and the core modules against reference versions
+ * before benchmarking. During the run it also decodes every output into a texture like the webview does, and after each
+ * pass compares the texture byte for byte with the addon's cache, fetched by a forced pass with Uint8Array output.
+ * Tile outputs are only decoded with --verify, so their timings include the decoding then. Compressed textures and
+ * mip levels aren't compared.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/core/DeltaCodec.h"
+#include "../src/core/DenseEncoding.h"
+#include "../src/core/Kernels.h"
+#include "CoreCheck.h"
+#include "KernelCheck.h"
+#include "MockUxpHost.h"
+
+namespace {
+
+struct Options {
+    std::vector<int64_t> sizes{1024, 2048, 4096, 8192, 16384};
+    int64_t batch_size = 512 * 512;
+    double min_time = 0.5;
+    int min_passes = 3;
+    std::string kernels;  // empty for the default (fastest) set
+    bool tiles = false;   // drive convert_tiles instead of convert_to_string
+    bool image = false;   // drive convert_image, which takes the same arguments as convert_tiles but the tile rows
+    std::string output = "string"; // output format argument passed to the addon
+    bool async = false;   // drive the _async variants, which convert on the worker thread
+    std::vector<int64_t> threads{0}; // thread counts to sweep, 0 for the addon's default of one per core
+    int64_t depth = 8;    // bits per component
+    std::string quantize = "blue-noise"; // quantization argument passed to the addon for 16 and 32 bit documents
+    bool mips = false;    // have convert_tiles update the mip levels too
+    double scale = 1.0;   // preview size convert_tiles resamples to, relative to the document
+    std::string filter = "lanczos";
+    std::string compress; // block format convert_tiles sends, none when empty
+    std::string preset = "balanced";
+    std::string detect = "full"; // set_change_detection mode of the document
+    std::string mode = "rgb";     // color mode option passed to convert_tiles
+    std::string trace;    // file the trace of the run is written to, none when empty
+    bool verify = false;
+    bool force = false;   // pass force_full_update, for the reference pass of --verify
+};
+
+enum class Change { kSame, kChanged, kStroke };
+
+struct Scenario {
+    int64_t size;
+    bool is_chunky;
+    int64_t components;
+    int64_t depth;
+    Change change;
+};
+
+struct Result {
+    double seconds = 0;          // best full-document pass
+    int64_t batches_sent = 0;    // batches that returned data in the best pass
+    size_t output_bytes = 0;     // bytes handed back to javascript in the best pass
+};
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<int64_t> ParseSizes(const std::string& arg) {
+    std::vector<int64_t> sizes;
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty())
+            sizes.push_back(std::strtoll(item.c_str(), nullptr, 10));
+    }
+    return sizes;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) {
+            options.sizes = ParseSizes(argv[++i]);
+        } else if (arg == "--batch" && has_value) {
+            options.batch_size = std::strtoll(argv[++i], nullptr, 10);
+        } else if (arg == "--min-time" && has_value) {
+            options.min_time = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--min-passes" && has_value) {
+            options.min_passes = std::atoi(argv[++i]);
+        } else if (arg == "--kernels" && has_value) {
+            options.kernels = argv[++i];
+        } else if (arg == "--api" && has_value) {
+            std::string api = argv[++i];
+            if (api != "string" && api != "tiles" && api != "image") {
+                std::fprintf(stderr, "unknown api %s, expected string, tiles or image\n", api.c_str());
+                std::exit(1);
+            }
+            options.tiles = api == "tiles" || api == "image";
+            options.image = api == "image";
+        } else if (arg == "--output" && has_value) {
+            std::string output = argv[++i];
+            if (output != "string" && output != "dense" && output != "buffer" && output != "delta") {
+                std::fprintf(stderr, "unknown output %s, expected string, dense, buffer or delta\n", output.c_str());
+                std::exit(1);
+            }
+            options.output = output;
+        } else if (arg == "--threads" && has_value) {
+            std::string threads = argv[++i];
+            if (threads == "all") {
+                options.threads.clear();
+                for (unsigned count = 1; count <= std::max(1u, std::thread::hardware_concurrency()); count++)
+                    options.threads.push_back(count);
+            } else {
+                options.threads = ParseSizes(threads);
+            }
+        } else if (arg == "--depth" && has_value) {
+            options.depth = std::strtoll(argv[++i], nullptr, 10);
+            if (options.depth != 8 && options.depth != 16 && options.depth != 32) {
+                std::fprintf(stderr, "unknown depth %lld, expected 8, 16 or 32\n", static_cast<long long>(options.depth));
+                std::exit(1);
+            }
+        } else if (arg == "--quantize" && has_value) {
+            std::string quantize = argv[++i];
+            if (quantize != "round" && quantize != "ordered" && quantize != "blue-noise" && quantize != "half") {
+                std::fprintf(stderr, "unknown quantization %s, expected round, ordered, blue-noise or half\n", quantize.c_str());
+                std::exit(1);
+            }
+            options.quantize = quantize;
+        } else if (arg == "--mips") {
+            options.mips = true;
+        } else if (arg == "--scale" && has_value) {
+            options.scale = std::strtod(argv[++i], nullptr);
+            if (!(options.scale > 0.0)) {
+                std::fprintf(stderr, "scale must be greater than 0\n");
+                std::exit(1);
+            }
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+            if (options.filter != "bilinear" && options.filter != "lanczos") {
+                std::fprintf(stderr, "unknown filter %s, expected bilinear or lanczos\n", options.filter.c_str());
+                std::exit(1);
+            }
+        } else if (arg == "--compress" && has_value) {
+            options.compress = argv[++i];
+            if (options.compress != "bc1" && options.compress != "bc3" && options.compress != "bc7") {
+                std::fprintf(stderr, "unknown compression %s, expected bc1, bc3 or bc7\n", options.compress.c_str());
+                std::exit(1);
+            }
+        } else if (arg == "--preset" && has_value) {
+            options.preset = argv[++i];
+            if (options.preset != "fast" && options.preset != "balanced" && options.preset != "high") {
+                std::fprintf(stderr, "unknown preset %s, expected fast, balanced or high\n", options.preset.c_str());
+                std::exit(1);
+            }
+        } else if (arg == "--detect" && has_value) {
+            options.detect = argv[++i];
+            if (options.detect != "full" && options.detect != "hash") {
+                std::fprintf(stderr, "unknown change detection %s, expected full or hash\n", options.detect.c_str());
+                std::exit(1);
+            }
+        } else if (arg == "--mode" && has_value) {
+            options.mode = argv[++i];
+            if (options.mode != "rgb" && options.mode != "grayscale" && options.mode != "lab" && options.mode != "cmyk") {
+                std::fprintf(stderr, "unknown color mode %s, expected rgb, grayscale, lab or cmyk\n", options.mode.c_str());
+                std::exit(1);
+            }
+        } else if (arg == "--trace" && has_value) {
+            options.trace = argv[++i];
+        } else if (arg == "--async") {
+            options.async = true;
+        } else if (arg == "--verify") {
+            options.verify = true;
+        } else {
+            std::fprintf(stderr, "usage: %s [--sizes 1024,2048,...] [--batch PIXELS] [--min-time SECONDS] [--min-passes N] [--kernels NAME|all] [--api string|tiles|image] [--output string|dense|buffer|delta] [--async] [--threads 1,2,...|all] [--depth 8|16|32] [--quantize round|ordered|blue-noise|half] [--mips] [--scale FACTOR] [--filter bilinear|lanczos] [--compress bc1|bc3|bc7] [--preset fast|balanced|high] [--detect full|hash] [--mode rgb|grayscale|lab|cmyk] [--trace FILE] [--verify]\n", argv[0]);
+            std::exit(arg == "--help" ? 0 : 1);
+        }
+    }
+    if (options.quantize == "half" && options.depth == 8) {
+        std::fprintf(stderr, "--quantize half needs --depth 16 or 32\n");
+        std::exit(1);
+    }
+    if (!options.compress.empty() && (!options.tiles || options.quantize == "half")) {
+        std::fprintf(stderr, "--compress needs --api tiles and RGBA8 output\n");
+        std::exit(1);
+    }
+    if (options.detect == "hash" && !options.tiles) {
+        std::fprintf(stderr, "--detect hash needs --api tiles or image\n");
+        std::exit(1);
+    }
+    if (options.mode != "rgb" && !options.tiles) {
+        std::fprintf(stderr, "--mode needs --api tiles or image\n");
+        std::exit(1);
+    }
+    if ((options.mode == "lab" || options.mode == "cmyk") && options.depth == 32) {
+        std::fprintf(stderr, "--mode %s needs --depth 8 or 16\n", options.mode.c_str());
+        std::exit(1);
+    }
+    return options;
+}
+
+// Fill with a cheap deterministic pattern so the data isn't trivially compressible or constant.
+// 16 bit components are 0-32768 like Photoshop's, 32 bit components are floats in 0-1.
+void FillPixels(std::vector<uint8_t>& pixels, int64_t depth) {
+    uint32_t state = 0x12345678u;
+    size_t count = pixels.size() / static_cast<size_t>(depth / 8);
+    for (size_t i = 0; i < count; i++) {
+        state = state * 1664525u + 1013904223u;
+        if (depth == 8) {
+            pixels[i] = static_cast<uint8_t>(state >> 24);
+        } else if (depth == 16) {
+            uint16_t value = static_cast<uint16_t>((state >> 16) % 32769);
+            std::memcpy(pixels.data() + i * 2, &value, 2);
+        } else {
+            float value = static_cast<float>(state >> 8) / static_cast<float>(1 << 24);
+            std::memcpy(pixels.data() + i * 4, &value, 4);
+        }
+    }
+}
+
+// Invert the component at `index` within its range
+void InvertComponent(std::vector<uint8_t>& pixels, int64_t depth, size_t index) {
+    if (depth == 8) {
+        pixels[index] = static_cast<uint8_t>(~pixels[index]);
+    } else if (depth == 16) {
+        uint16_t value;
+        std::memcpy(&value, pixels.data() + index * 2, 2);
+        value = static_cast<uint16_t>(32768 - value);
+        std::memcpy(pixels.data() + index * 2, &value, 2);
+    } else {
+        float value;
+        std::memcpy(&value, pixels.data() + index * 4, 4);
+        value = 1.0f - value;
+        std::memcpy(pixels.data() + index * 4, &value, 4);
+    }
+}
+
+void InvertPixels(std::vector<uint8_t>& pixels, int64_t depth) {
+    size_t count = pixels.size() / static_cast<size_t>(depth / 8);
+    for (size_t i = 0; i < count; i++)
+        InvertComponent(pixels, depth, i);
+}
+
+// Paint a short 32px wide diagonal stroke, 256px long, in a different place every pass. That's roughly what one brush
+// edit looks like: a few tiles change, the rest of the document doesn't.
+void StrokePixels(std::vector<uint8_t>& pixels, const Scenario& s, int pass) {
+    const int64_t radius = 16;
+    const int64_t length = std::min<int64_t>(256, s.size);
+    int64_t plane_size = s.size * s.size;
+
+    // Where the stroke starts wanders over the document from pass to pass
+    int64_t span = s.size - length + 1;
+    int64_t start_x = (static_cast<int64_t>(pass) * 389) % span;
+    int64_t start_y = (static_cast<int64_t>(pass) * 241 + 128) % span;
+
+    for (int64_t step = 0; step < length; step++) {
+        int64_t y = start_y + step;
+        int64_t center = start_x + step;
+        for (int64_t x = std::max<int64_t>(0, center - radius); x < std::min(s.size, center + radius); x++) {
+            for (int64_t c = 0; c < std::min<int64_t>(s.components, 3); c++) {
+                int64_t pixel = y * s.size + x;
+                InvertComponent(pixels, s.depth, static_cast<size_t>(s.is_chunky ? pixel * s.components + c : c * plane_size + pixel));
+            }
+        }
+    }
+}
+
+const char* ChangeName(Change change) {
+    switch (change) {
+    case Change::kSame: return "same";
+    case Change::kChanged: return "changed";
+    case Change::kStroke: return "stroke";
+    }
+    return "";
+}
+
+// Bytes per pixel of the texture the output is written to, half floats take twice the RGBA8 size
+int64_t TextureBytesPerPixel(const Options& options) {
+    return options.depth != 8 && options.quantize == "half" ? 8 : 4;
+}
+
+// Bytes handed across the bridge for one output value
+size_t OutputByteLength(addon_value out) {
+    return out->kind == addon_value__::Kind::typedarray ? out->buffer_length : out->StringByteLength();
+}
+
+// Unpack a dense string like decodePixelString in the webview, returns the number of bytes written
+size_t DecodeDense(const std::u16string& chars, uint8_t* out) {
+    uint8_t* start = out;
+    for (size_t i = 0; i < chars.size(); i++) {
+        uint32_t unit = chars[i];
+        if (unit == dense::kEscape) {
+            uint32_t escaped = chars[++i];
+            unit = escaped == dense::kEscapedEscape ? dense::kEscape : 0xD800 + escaped;
+        }
+        *out++ = static_cast<uint8_t>(unit >> 8);
+        *out++ = static_cast<uint8_t>(unit);
+    }
+    return static_cast<size_t>(out - start);
+}
+
+/**
+ * Write a convert_to_string result into the RGBA texture the way the receiving side would, so the timings include
+ * reading the output back and not just producing it. `texture` holds `length` bytes for the batch. Also used for the
+ * pixels of each convert_tiles rect.
+ */
+void ConsumeOutput(addon_value out, const std::string& output, uint8_t* texture, size_t length) {
+    if (out->kind == addon_value__::Kind::typedarray) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(out->typedarray_buffer->buffer_data) + out->typedarray_offset;
+        std::memcpy(texture, bytes, out->buffer_length);
+    } else if (output == "delta") {
+        // Applied on top of what the texture already holds
+        static std::vector<uint8_t> payload;
+        payload.resize(out->string.size() * 2);
+        size_t payload_length = DecodeDense(out->string, payload.data());
+        codec::Decode(payload.data(), payload_length, texture, length);
+    } else if (output == "dense") {
+        DecodeDense(out->string, texture);
+    } else if (out->one_byte) {
+        // One charCodeAt per byte
+        const char* chars = out->one_byte_string.data();
+        size_t chars_length = out->one_byte_string.size();
+        for (size_t i = 0; i < chars_length; i++)
+            texture[i] = static_cast<uint8_t>(chars[i]);
+    } else {
+        const char16_t* chars = out->string.data();
+        size_t chars_length = out->string.size();
+        for (size_t i = 0; i < chars_length; i++)
+            texture[i] = static_cast<uint8_t>(chars[i]);
+    }
+}
+
+/**
+ * Call a conversion function. The async variants return a promise, which is awaited by running the scripting queue
+ * until the worker thread settles it. Used for the other functions returning promises as well.
+ */
+addon_value CallConvert(MockUxpHost& host, addon_value convert, const std::vector<addon_value>& args) {
+    addon_value out = host.Call(convert, args);
+    if (out->kind != addon_value__::Kind::promise)
+        return out;
+
+    while (!out->settled)
+        host.WaitForScriptingQueue();
+    if (out->rejected)
+        MockUxpHost::ThrowIfError(out->settled_value);
+    return out->settled_value;
+}
+
+/**
+ * Push the whole document through convert_to_string in batches, same as processUpdates.
+ */
+Result RunPass(MockUxpHost& host, addon_value convert, std::vector<uint8_t>& pixels, const Scenario& s, int64_t document_id,
+               const Options& options, std::vector<uint8_t>& texture) {
+    Result result;
+    int64_t total_pixels = s.size * s.size;
+    int64_t batch_size = options.batch_size;
+    const std::string& output = options.output;
+    int64_t bytes_per_pixel = TextureBytesPerPixel(options);
+
+    size_t mark = host.HandleMark();
+    addon_value buffer = host.ArrayBuffer(pixels.data(), pixels.size());
+    addon_value id = host.Number(static_cast<double>(document_id));
+    addon_value components = host.Number(static_cast<double>(s.components));
+    addon_value chunky = host.Boolean(s.is_chunky);
+    addon_value force = host.Boolean(options.force);
+    addon_value format = host.String(output);
+    addon_value depth = host.Number(static_cast<double>(s.depth));
+    addon_value quantize = host.String(options.quantize);
+
+    texture.resize(static_cast<size_t>(total_pixels * bytes_per_pixel));
+
+    Clock::time_point start = Clock::now();
+    for (int64_t pushed = 0; pushed < total_pixels; pushed += batch_size) {
+        size_t batch_mark = host.HandleMark();
+        int64_t next_batch_size = std::min(batch_size, total_pixels - pushed);
+
+        addon_value out = CallConvert(host, convert, {buffer, id, components, chunky, host.Number(static_cast<double>(pushed)),
+                                              host.Number(static_cast<double>(next_batch_size)), force, format, depth, quantize});
+        MockUxpHost::ThrowIfError(out);
+
+        if (out->kind == addon_value__::Kind::string || out->kind == addon_value__::Kind::typedarray) {
+            result.batches_sent++;
+            result.output_bytes += OutputByteLength(out);
+            ConsumeOutput(out, output, texture.data() + pushed * bytes_per_pixel, static_cast<size_t>(next_batch_size * bytes_per_pixel));
+        }
+
+        // The output would be posted to the webview and then collected, which runs any external buffer finalizers
+        host.ReleaseHandles(batch_mark);
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    host.ReleaseHandles(mark);
+    return result;
+}
+
+/**
+ * Write the rects of a convert_tiles result into the preview texture, `texture_width` pixels wide. Rects of mip levels
+ * are left out.
+ */
+void ConsumeTiles(addon_value out, const std::string& output, std::vector<uint8_t>& texture, int64_t texture_width,
+                  int64_t bytes_per_pixel) {
+    static std::vector<uint8_t> rect_pixels;
+    for (addon_value tile : out->elements) {
+        auto level = tile->properties.find("level");
+        if (level != tile->properties.end() && level->second->number != 0)
+            continue;
+
+        int64_t x = static_cast<int64_t>(tile->properties.at("x")->number);
+        int64_t y = static_cast<int64_t>(tile->properties.at("y")->number);
+        int64_t width = static_cast<int64_t>(tile->properties.at("width")->number);
+        int64_t height = static_cast<int64_t>(tile->properties.at("height")->number);
+        size_t row_bytes = static_cast<size_t>(width * bytes_per_pixel);
+
+        // A delta applies to what the texture holds under the rect
+        rect_pixels.resize(row_bytes * static_cast<size_t>(height));
+        for (int64_t row = 0; row < height; row++)
+            std::memcpy(rect_pixels.data() + row * row_bytes, texture.data() + ((y + row) * texture_width + x) * bytes_per_pixel, row_bytes);
+        ConsumeOutput(tile->properties.at("pixels"), output, rect_pixels.data(), rect_pixels.size());
+        for (int64_t row = 0; row < height; row++)
+            std::memcpy(texture.data() + ((y + row) * texture_width + x) * bytes_per_pixel, rect_pixels.data() + row * row_bytes, row_bytes);
+    }
+}
+
+/**
+ * Push the whole document through convert_tiles in bands of tile rows, same as processUpdates, or through a single
+ * convert_image call.
+ */
+Result RunTilePass(MockUxpHost& host, addon_value convert, std::vector<uint8_t>& pixels, const Scenario& s, int64_t document_id,
+                   const Options& options, std::vector<uint8_t>& texture) {
+    Result result;
+    int64_t batch_size = options.batch_size;
+    int64_t tile_size = static_cast<int64_t>(host.GetExport("tile_size")->number);
+    int64_t total_tile_rows = (s.size + tile_size - 1) / tile_size;
+    int64_t rows_per_batch = options.image ? total_tile_rows : std::max<int64_t>(1, batch_size / (s.size * tile_size));
+
+    size_t mark = host.HandleMark();
+    addon_value buffer = host.ArrayBuffer(pixels.data(), pixels.size());
+    const int64_t target = std::max<int64_t>(1, std::llround(s.size * options.scale));
+    std::map<std::string, addon_value> convert_options = {
+        {"document_id", host.Number(static_cast<double>(document_id))},
+        {"width", host.Number(static_cast<double>(s.size))},
+        {"height", host.Number(static_cast<double>(s.size))},
+        {"components", host.Number(static_cast<double>(s.components))},
+        {"is_chunky", host.Boolean(s.is_chunky)},
+        {"force_full_update", host.Boolean(options.force)},
+        {"output", host.String(options.output)},
+        {"component_size", host.Number(static_cast<double>(s.depth))},
+        {"quantization", host.String(options.quantize)},
+        {"generate_mips", host.Boolean(options.mips)},
+        {"target_width", host.Number(static_cast<double>(target))},
+        {"target_height", host.Number(static_cast<double>(target))},
+        {"filter", host.String(options.filter)},
+        {"compression_quality", host.String(options.preset)},
+        {"color_mode", host.String(options.mode)},
+    };
+    if (!options.compress.empty())
+        convert_options["compression"] = host.String(options.compress);
+
+    const int64_t bytes_per_pixel = TextureBytesPerPixel(options);
+    const bool consume = options.verify && options.compress.empty();
+    if (consume)
+        texture.resize(static_cast<size_t>(target * target * bytes_per_pixel));
+
+    Clock::time_point start = Clock::now();
+    for (int64_t pushed = 0; pushed < total_tile_rows; pushed += rows_per_batch) {
+        size_t batch_mark = host.HandleMark();
+        int64_t next_rows = std::min(rows_per_batch, total_tile_rows - pushed);
+
+        if (!options.image) {
+            convert_options["first_tile_row"] = host.Number(static_cast<double>(pushed));
+            convert_options["tile_rows"] = host.Number(static_cast<double>(next_rows));
+        }
+
+        addon_value out = CallConvert(host, convert, {buffer, host.Object(convert_options)});
+        MockUxpHost::ThrowIfError(out);
+
+        if (out->kind == addon_value__::Kind::array) {
+            result.batches_sent++;
+            for (addon_value tile : out->elements)
+                result.output_bytes += OutputByteLength(tile->properties.at("pixels"));
+            if (consume)
+                ConsumeTiles(out, options.output, texture, target, bytes_per_pixel);
+        }
+
+        host.ReleaseHandles(batch_mark);
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    host.ReleaseHandles(mark);
+    return result;
+}
+
+/**
+ * For --verify: compare what the webview would have after a pass with the addon's cache, which a forced pass with
+ * Uint8Array output copies out as is. Throws on the first difference.
+ */
+void VerifyTexture(MockUxpHost& host, addon_value convert, std::vector<uint8_t>& pixels, const Scenario& s, int64_t document_id,
+                   const Options& options, const std::vector<uint8_t>& texture, int pass) {
+    if (!options.verify || !options.compress.empty())
+        return;
+
+    Options reference = options;
+    reference.output = "buffer";
+    reference.force = true;
+    std::vector<uint8_t> cached;
+    (options.tiles ? RunTilePass : RunPass)(host, convert, pixels, s, document_id, reference, cached);
+
+    auto differs = std::mismatch(texture.begin(), texture.end(), cached.begin(), cached.end());
+    if (texture.size() != cached.size() || differs.first != texture.end()) {
+        throw std::runtime_error(std::string(ChangeName(s.change)) + " pass " + std::to_string(pass) + ": " + options.output +
+                                 " output doesn't match the cache at byte " + std::to_string(differs.first - texture.begin()));
+    }
+}
+
+Result RunScenario(MockUxpHost& host, const Options& options, const Scenario& s) {
+    auto run_pass = options.tiles ? RunTilePass : RunPass;
+    std::string convert_name = options.image ? "convert_image" : options.tiles ? "convert_tiles" : "convert_to_string";
+    addon_value convert = host.GetExport(options.async ? convert_name + "_async" : convert_name);
+    addon_value close = host.GetExport("close_document");
+
+    const int64_t document_id = 1;
+    std::vector<uint8_t> pixels(static_cast<size_t>(s.size * s.size * s.components * (s.depth / 8)));
+    FillPixels(pixels, s.depth);
+
+    if (options.detect != "full")
+        CallConvert(host, host.GetExport("set_change_detection"),
+                    {host.Number(static_cast<double>(document_id)), host.String(options.detect)});
+
+    // Prime the cache. This is the first push of a freshly opened document.
+    std::vector<uint8_t> texture;  // what the webview has, see ConsumeOutput
+    run_pass(host, convert, pixels, s, document_id, options, texture);
+    VerifyTexture(host, convert, pixels, s, document_id, options, texture, 0);
+
+    Result best;
+    double elapsed = 0;
+    for (int pass = 0; pass < options.min_passes || elapsed < options.min_time; pass++) {
+        // Every component differs from the cache when the pixels are inverted
+        if (s.change == Change::kChanged)
+            InvertPixels(pixels, s.depth);
+        else if (s.change == Change::kStroke)
+            StrokePixels(pixels, s, pass);
+
+        Result result = run_pass(host, convert, pixels, s, document_id, options, texture);
+        VerifyTexture(host, convert, pixels, s, document_id, options, texture, pass + 1);
+        elapsed += result.seconds;
+        if (pass == 0 || result.seconds < best.seconds)
+            best = result;
+    }
+
+    size_t mark = host.HandleMark();
+    host.Call(close, {host.Number(static_cast<double>(document_id))});
+    host.ReleaseHandles(mark);
+
+    return best;
+}
+
+std::string FormatRate(double value, const char* unit) {
+    const char* prefixes[] = {"", "K", "M", "G", "T"};
+    int prefix = 0;
+    while (value >= 1000.0 && prefix < 4) {
+        value /= 1000.0;
+        prefix++;
+    }
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%7.2f %s%s/s", value, prefixes[prefix], unit);
+    return buffer;
+}
+
+void PrintHeader() {
+    std::printf("%-7s %-7s %-7s %-5s %-5s %-9s %-7s %10s %8s %8s %16s %14s %14s\n",
+                "kernels", "size", "layout", "comps", "depth", "batches", "threads", "time(ms)", "speedup", "sent", "pixels", "bytes in",
+                "bytes out");
+}
+
+void RunSweep(MockUxpHost& host, const Options& options, const kernels::KernelSet& kernel_set) {
+    kernels::SetActiveKernels(kernel_set.name);
+    addon_value set_thread_count = host.GetExport("set_thread_count");
+    const int64_t color_components = options.mode == "grayscale" ? 1 : options.mode == "cmyk" ? 4 : 3;
+
+    for (int64_t size : options.sizes) {
+        for (bool is_chunky : {false, true}) {
+            for (int64_t components : {color_components, color_components + 1}) {
+                for (Change change : {Change::kSame, Change::kChanged, Change::kStroke}) {
+                    Scenario s{size, is_chunky, components, options.depth, change};
+                    double first_seconds = 0;
+
+                    for (int64_t threads : options.threads) {
+                        size_t mark = host.HandleMark();
+                        addon_value thread_count = host.Call(set_thread_count, {host.Number(static_cast<double>(threads))});
+                        MockUxpHost::ThrowIfError(thread_count);
+                        long long threads_used = static_cast<long long>(thread_count->number);
+                        host.ReleaseHandles(mark);
+
+                        Result r = RunScenario(host, options, s);
+                        if (first_seconds == 0)
+                            first_seconds = r.seconds;
+
+                        double pixels = static_cast<double>(size * size);
+                        double bytes_in = pixels * static_cast<double>(components * (options.depth / 8));
+
+                        std::printf("%-7s %-7lld %-7s %-5lld %-5lld %-9s %-7lld %10.2f %7.2fx %8lld %16s %14s %14s\n",
+                                    kernel_set.name, static_cast<long long>(size), is_chunky ? "chunky" : "planar",
+                                    static_cast<long long>(components), static_cast<long long>(options.depth), ChangeName(change), threads_used,
+                                    r.seconds * 1000.0, first_seconds / r.seconds, static_cast<long long>(r.batches_sent),
+                                    FormatRate(pixels / r.seconds, "px").c_str(),
+                                    FormatRate(bytes_in / r.seconds, "B").c_str(),
+                                    FormatRate(static_cast<double>(r.output_bytes) / r.seconds, "B").c_str());
+                        std::fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options = ParseOptions(argc, argv);
+
+    if (options.verify && !(CheckKernelsAgainstReference(stdout) & CheckCoreAgainstReference(stdout)))
+        return 1;
+
+    std::vector<const kernels::KernelSet*> kernel_sets;
+    if (options.kernels == "all") {
+        kernel_sets = kernels::AvailableKernels();
+    } else if (!options.kernels.empty()) {
+        if (!kernels::SetActiveKernels(options.kernels)) {
+            std::fprintf(stderr, "kernel set %s is not available on this CPU\n", options.kernels.c_str());
+            return 1;
+        }
+        kernel_sets.push_back(&kernels::ActiveKernels());
+    } else {
+        kernel_sets.push_back(&kernels::ActiveKernels());
+    }
+
+    try {
+        MockUxpHost host;
+        host.LoadAddon();
+
+        if (!options.trace.empty())
+            MockUxpHost::ThrowIfError(host.Call(host.GetExport("set_tracing"), {host.Boolean(true)}));
+
+        PrintHeader();
+        for (const kernels::KernelSet* kernel_set : kernel_sets)
+            RunSweep(host, options, *kernel_set);
+
+        if (!options.trace.empty()) {
+            addon_value spans = host.Call(host.GetExport("dump_trace"), {host.String(options.trace)});
+            MockUxpHost::ThrowIfError(spans);
+            std::printf("wrote %lld spans to %s\n", static_cast<long long>(spans->number), options.trace.c_str());
+        }
+    } catch (const std::exception& exc) {
+        std::fprintf(stderr, "benchmark failed: %s\n", exc.what());
+        return 1;
+    }
+
+    return 0;
+}
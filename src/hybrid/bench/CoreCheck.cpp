@@ -0,0 +1,553 @@
+#include "CoreCheck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/core/ChannelPacking.h"
+#include "../src/core/ColorModes.h"
+#include "../src/core/DeltaCodec.h"
+#include "../src/core/DenseEncoding.h"
+#include "../src/core/JobQueue.h"
+#include "../src/core/Lz4.h"
+#include "../src/core/PixelCache.h"
+#include "../src/core/TileConversion.h"
+#include "../src/core/TileHash.h"
+
+namespace {
+
+/**
+ * Counts the cases of one module, reporting the ones that fail
+ */
+class Tally {
+ public:
+    Tally(const char* name, FILE* out) : name_(name), out_(out) {}
+
+    void Check(bool ok, const char* format, ...) {
+        cases_++;
+        if (ok)
+            return;
+
+        failures_++;
+        std::fprintf(out_, "MISMATCH %s: ", name_);
+        va_list args;
+        va_start(args, format);
+        std::vfprintf(out_, format, args);
+        va_end(args);
+        std::fprintf(out_, "\n");
+    }
+
+    // Print the summary line, returns whether every case passed
+    bool Report() const {
+        std::fprintf(out_, "core    %-8s %zu/%zu cases pass\n", name_, cases_ - failures_, cases_);
+        return failures_ == 0;
+    }
+
+ private:
+    const char* name_;
+    FILE* out_;
+    size_t cases_ = 0;
+    size_t failures_ = 0;
+};
+
+std::vector<uint8_t> RandomBytes(std::mt19937& rng, size_t length) {
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> bytes(length);
+    for (uint8_t& value : bytes)
+        value = static_cast<uint8_t>(byte(rng));
+    return bytes;
+}
+
+const size_t kLengths[] = {0, 1, 2, 3, 4, 5, 15, 16, 17, 255, 256, 1000, 4096, 65539};
+
+bool CheckDeltaCodec(std::mt19937& rng, FILE* out) {
+    Tally tally("codec", out);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    for (size_t length : kLengths) {
+        for (double changed : {0.0, 0.01, 0.5, 1.0}) {
+            std::vector<uint8_t> previous = RandomBytes(rng, length);
+            std::vector<uint8_t> pixels = previous;
+            std::vector<uint8_t> noise = RandomBytes(rng, length);
+            for (size_t i = 0; i < length; i++) {
+                if (unit(rng) < changed)
+                    pixels[i] = noise[i];
+            }
+
+            for (bool delta : {false, true}) {
+                std::vector<uint8_t> encoded;
+                codec::Encode(pixels.data(), delta ? previous.data() : nullptr, length, encoded);
+
+                // A delta is applied to what the receiver has, a standalone payload overwrites whatever is there
+                std::vector<uint8_t> decoded = delta ? previous : RandomBytes(rng, length);
+                bool threw = false;
+                try {
+                    codec::Decode(encoded.data(), encoded.size(), decoded.data(), length);
+                } catch (const std::exception&) {
+                    threw = true;
+                }
+                tally.Check(!threw && encoded[0] == codec::kVersion && decoded == pixels, "%s of %zu bytes, %.0f%% changed",
+                            delta ? "delta" : "standalone", length, changed * 100.0);
+            }
+        }
+
+        // Decoding into the wrong number of pixels must be refused rather than write out of bounds
+        std::vector<uint8_t> pixels = RandomBytes(rng, length);
+        std::vector<uint8_t> encoded;
+        codec::Encode(pixels.data(), nullptr, length, encoded);
+        std::vector<uint8_t> larger(length + 1);
+        bool threw = false;
+        try {
+            codec::Decode(encoded.data(), encoded.size(), larger.data(), larger.size());
+        } catch (const std::exception&) {
+            threw = true;
+        }
+        tally.Check(threw, "payload of %zu bytes decoded into %zu", length, larger.size());
+    }
+    return tally.Report();
+}
+
+bool CheckLz4(std::mt19937& rng, FILE* out) {
+    Tally tally("lz4", out);
+
+    for (size_t length : kLengths) {
+        std::vector<uint8_t> noise = RandomBytes(rng, length);
+        std::vector<uint8_t> zeros(length, 0);
+        std::vector<uint8_t> pattern(length);
+        for (size_t i = 0; i < length; i++)
+            pattern[i] = static_cast<uint8_t>((i % 7) * 31);
+        // Runs of zeros between literals, like the run-length stream of a small edit
+        std::vector<uint8_t> sparse(length, 0);
+        for (size_t i = 0; i < length; i += 97)
+            std::fill(sparse.begin() + static_cast<std::ptrdiff_t>(i), sparse.begin() + static_cast<std::ptrdiff_t>(std::min(length, i + 9)), noise[i]);
+
+        for (const std::vector<uint8_t>* input : {&noise, &zeros, &pattern, &sparse}) {
+            std::vector<uint8_t> compressed(lz4::CompressBound(length));
+            size_t compressed_length = lz4::Compress(input->data(), length, compressed.data());
+
+            std::vector<uint8_t> decompressed(length);
+            size_t decompressed_length = 0;
+            bool threw = false;
+            try {
+                decompressed_length = lz4::Decompress(compressed.data(), compressed_length, decompressed.data(), length);
+            } catch (const std::exception&) {
+                threw = true;
+            }
+            tally.Check(!threw && compressed_length <= compressed.size() && decompressed_length == length && decompressed == *input,
+                        "%zu bytes", length);
+
+            // A block that doesn't fit must be refused, the capacity is all the decoder may write
+            if (length > 0) {
+                threw = false;
+                try {
+                    lz4::Decompress(compressed.data(), compressed_length, decompressed.data(), length - 1);
+                } catch (const std::exception&) {
+                    threw = true;
+                }
+                tally.Check(threw, "%zu bytes decompressed into %zu", length, length - 1);
+            }
+        }
+    }
+    return tally.Report();
+}
+
+// Decoder written from the format description in DenseEncoding.h
+bool DecodeDenseReference(const std::vector<char16_t>& units, size_t byte_length, std::vector<uint8_t>& bytes) {
+    bytes.clear();
+    for (size_t i = 0; i < units.size() && bytes.size() < byte_length; i++) {
+        uint32_t unit = units[i];
+        if (unit == 0xFFFF) {
+            if (i + 1 >= units.size())
+                return false;
+            uint32_t escaped = units[++i];
+            unit = escaped == 0x0800 ? 0xFFFF : 0xD800 + escaped;
+        }
+        bytes.push_back(static_cast<uint8_t>(unit >> 8));
+        if (bytes.size() < byte_length)
+            bytes.push_back(static_cast<uint8_t>(unit & 0xFF));
+    }
+    return bytes.size() == byte_length;
+}
+
+bool CheckDense(std::mt19937& rng, FILE* out) {
+    Tally tally("dense", out);
+
+    // Byte pairs that need escaping, and their neighbours that don't
+    const uint8_t special[][2] = {{0xD7, 0xFF}, {0xD8, 0x00}, {0xDB, 0xFF}, {0xDC, 0x00}, {0xDF, 0xFF}, {0xE0, 0x00},
+                                  {0xFF, 0xFE}, {0xFF, 0xFF}};
+
+    for (size_t length : kLengths) {
+        for (bool escapes : {false, true}) {
+            std::vector<uint8_t> bytes = RandomBytes(rng, length);
+            if (escapes) {
+                for (size_t i = 0; i + 1 < length; i += 2) {
+                    const uint8_t* pair = special[(i / 2) % (sizeof(special) / sizeof(special[0]))];
+                    bytes[i] = pair[0];
+                    bytes[i + 1] = pair[1];
+                }
+            }
+
+            std::vector<char16_t> units(dense::MaxEncodedLength(length));
+            units.resize(dense::Encode(bytes.data(), length, units.data()));
+
+            bool no_surrogates = std::none_of(units.begin(), units.end(), [](char16_t unit) { return unit >= 0xD800 && unit <= 0xDFFF; });
+            std::vector<uint8_t> decoded;
+            bool decodes = DecodeDenseReference(units, length, decoded) && decoded == bytes;
+            tally.Check(no_surrogates && decodes, "%zu bytes%s", length, escapes ? " of escaped pairs" : "");
+        }
+    }
+    return tally.Report();
+}
+
+bool CheckTileHashes(std::mt19937& rng, FILE* out) {
+    Tally tally("hash", out);
+
+    // Published XXH64 values with seed 0
+    struct Vector {
+        const char* text;
+        uint64_t hash;
+    };
+    const Vector vectors[] = {
+        {"", 0xEF46DB3751D8E999ull},
+        {"a", 0xD24EC4F1A98C6E5Bull},
+        {"abc", 0x44BC2CF5AD770999ull},
+        {"Nobody inspects the spammish repetition", 0xFBCEA83C8A378BF1ull},
+    };
+    for (const Vector& vector : vectors) {
+        uint64_t hash = HashBytes(vector.text, std::strlen(vector.text));
+        tally.Check(hash == vector.hash, "XXH64(\"%s\") is %016llx", vector.text, static_cast<unsigned long long>(hash));
+    }
+
+    // Rows hash the same wherever they are stored
+    std::vector<uint8_t> wide = RandomBytes(rng, 300 * 40);
+    std::vector<uint8_t> packed(100 * 40);
+    for (int64_t row = 0; row < 40; row++)
+        std::memcpy(packed.data() + row * 100, wide.data() + row * 300 + 17, 100);
+    tally.Check(HashRows(wide.data() + 17, 300, 100, 40) == HashRows(packed.data(), 100, 100, 40), "rows at another stride");
+
+    // HashTileRows of the source agrees with HashTile of the cache converted from it, and finds exactly the tile that
+    // changed. Sizes that aren't whole tiles check the edge tiles.
+    for (bool is_chunky : {true, false}) {
+        for (int64_t components : {3, 4}) {
+            const int64_t width = 200, height = 150;
+            std::vector<uint8_t> pixels = RandomBytes(rng, static_cast<size_t>(width * height * components));
+            SourcePixels source = {pixels.data(), pixels.size(), width, height, components, is_chunky};
+
+            TileHashes hashes(width, height, 0);
+            PixelCache cache(width, height);
+            std::vector<DirtyRect> first = HashTileRows(source, hashes, 0, hashes.TilesY(), false);
+            ConvertTileRows(source, cache, 0, cache.TilesY(), false);
+
+            bool all_match = true;
+            for (int64_t tile_y = 0; tile_y < cache.TilesY(); tile_y++) {
+                for (int64_t tile_x = 0; tile_x < cache.TilesX(); tile_x++)
+                    all_match = all_match && HashTile(cache, tile_x, tile_y) == hashes.At(tile_x, tile_y);
+            }
+            tally.Check(all_match && first.size() == static_cast<size_t>(hashes.TilesY()),
+                        "%s %lld components, cache hashes", is_chunky ? "chunky" : "planar", static_cast<long long>(components));
+
+            std::vector<DirtyRect> unchanged = HashTileRows(source, hashes, 0, hashes.TilesY(), false);
+            tally.Check(unchanged.empty(), "%s %lld components, unchanged pixels", is_chunky ? "chunky" : "planar",
+                        static_cast<long long>(components));
+
+            // One component of the pixel at (195, 140), in the corner tile (3, 2) that is only 8 x 22 pixels
+            const int64_t pixel = 140 * width + 195;
+            pixels[static_cast<size_t>(is_chunky ? pixel * components + 1 : width * height + pixel)] ^= 0x40;
+            std::vector<DirtyRect> changed = HashTileRows(source, hashes, 0, hashes.TilesY(), false);
+            tally.Check(changed.size() == 1 && changed[0].x == 192 && changed[0].y == 128 && changed[0].width == 8 &&
+                            changed[0].height == 22,
+                        "%s %lld components, one changed pixel", is_chunky ? "chunky" : "planar", static_cast<long long>(components));
+        }
+    }
+    return tally.Report();
+}
+
+// Write the tiles of an update into planes of the packed texture, like the webview does
+void ApplyPackedUpdate(const ChannelPacker::Update& update, std::vector<uint8_t> (&planes)[ChannelPacker::kChannels]) {
+    for (const ChannelPacker::ChannelTile& tile : update.tiles) {
+        for (int64_t row = 0; row < tile.rect.height; row++) {
+            std::memcpy(planes[tile.channel].data() + (tile.rect.y + row) * update.width + tile.rect.x,
+                        tile.values.data() + row * tile.rect.width, static_cast<size_t>(tile.rect.width));
+        }
+    }
+}
+
+bool CheckChannelPacker(std::mt19937& rng, FILE* out) {
+    Tally tally("packer", out);
+
+    const int64_t width = 150, height = 100;
+    const int64_t packed_id = 5, document_id = 7;
+    PixelCache cache(width, height);
+    std::vector<uint8_t> random = RandomBytes(rng, cache.ByteSize());
+    std::memcpy(cache.Data(), random.data(), random.size());
+
+    // R from the document's G, B from its alpha, G left to the material
+    ChannelPacker packer;
+    packer.Map(packed_id, 0, document_id, 1);
+    packer.Map(packed_id, 2, document_id, 3);
+    tally.Check(packer.Feeds(document_id) && !packer.Feeds(document_id + 1), "feeds");
+
+    auto expected = [&](int channel) {
+        std::vector<uint8_t> plane(static_cast<size_t>(width * height), 255);
+        int source_channel = channel == 0 ? 1 : channel == 2 ? 3 : -1;
+        if (source_channel >= 0) {
+            for (int64_t i = 0; i < width * height; i++)
+                plane[static_cast<size_t>(i)] = cache.Data()[i * 4 + source_channel];
+        }
+        return plane;
+    };
+
+    std::vector<uint8_t> planes[ChannelPacker::kChannels];
+    for (std::vector<uint8_t>& plane : planes)
+        plane.assign(static_cast<size_t>(width * height), 0);
+
+    packer.Write(document_id, cache, {{0, 0, width, height}});
+    std::vector<ChannelPacker::Update> updates = packer.TakeUpdates();
+    tally.Check(updates.size() == 1 && updates[0].packed_id == packed_id && updates[0].width == width && updates[0].height == height,
+                "first write");
+    if (updates.size() == 1)
+        ApplyPackedUpdate(updates[0], planes);
+    for (int channel = 0; channel < ChannelPacker::kChannels; channel++)
+        tally.Check(planes[channel] == expected(channel), "channel %d after the first write", channel);
+    tally.Check(packer.TakeUpdates().empty(), "updates taken twice");
+
+    // G of a pixel in tile (1, 0) feeds R, B of one in tile (0, 1) feeds nothing. Only the R tile is sent.
+    cache.PixelAt(70, 10)[1] ^= 0x11;
+    cache.PixelAt(5, 80)[2] ^= 0x22;
+    packer.Write(document_id, cache, {{0, 0, width, height}});
+    updates = packer.TakeUpdates();
+    bool one_tile = updates.size() == 1 && updates[0].tiles.size() == 1 && updates[0].tiles[0].channel == 0 &&
+                    updates[0].tiles[0].rect.x == 64 && updates[0].tiles[0].rect.y == 0 && updates[0].tiles[0].rect.width == 64 &&
+                    updates[0].tiles[0].rect.height == 64;
+    tally.Check(one_tile, "one changed value");
+    if (updates.size() == 1)
+        ApplyPackedUpdate(updates[0], planes);
+    for (int channel = 0; channel < ChannelPacker::kChannels; channel++)
+        tally.Check(planes[channel] == expected(channel), "channel %d after an edit", channel);
+
+    // Unmapping puts the channel back to 255 and sends all of it
+    packer.Unmap(document_id);
+    updates = packer.TakeUpdates();
+    if (updates.size() == 1)
+        ApplyPackedUpdate(updates[0], planes);
+    bool cleared = !packer.Feeds(document_id);
+    for (const std::vector<uint8_t>& plane : planes)
+        cleared = cleared && std::all_of(plane.begin(), plane.end(), [](uint8_t value) { return value == 255; });
+    tally.Check(cleared, "unmapped document");
+    tally.Check(packer.Remove(packed_id) && !packer.Remove(packed_id) && packer.Size() == 0, "remove");
+    return tally.Report();
+}
+
+// sRGB encoding of linear light, as a byte
+double EncodeSrgb(double linear) {
+    linear = std::min(std::max(linear, 0.0), 1.0);
+    double encoded = linear <= 0.0031308 ? 12.92 * linear : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+    return encoded * 255.0;
+}
+
+// Linear sRGB of a Lab color, by the CIE formulas in double precision
+void LabToLinearReference(double l, double a, double b, double* rgb) {
+    auto inverse = [](double t) {
+        const double delta = 6.0 / 29.0;
+        return t > delta ? t * t * t : 3.0 * delta * delta * (t - 4.0 / 29.0);
+    };
+    double fy = (l + 16.0) / 116.0;
+    double x = 0.96422 * inverse(fy + a / 500.0);
+    double y = inverse(fy);
+    double z = 0.82521 * inverse(fy - b / 200.0);
+    rgb[0] = 3.1338561 * x - 1.6168667 * y - 0.4906146 * z;
+    rgb[1] = -0.9787684 * x + 1.9161415 * y + 0.0334540 * z;
+    rgb[2] = 0.0719453 * x - 0.2289914 * y + 1.4052427 * z;
+}
+
+template <typename T>
+T Component(const std::vector<uint8_t>& src, bool is_chunky, int64_t components, size_t count, size_t i, int64_t c) {
+    size_t index = is_chunky ? i * static_cast<size_t>(components) + static_cast<size_t>(c) : static_cast<size_t>(c) * count + i;
+    T value;
+    std::memcpy(&value, src.data() + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+/**
+ * The RGBA ToRgba should write for pixel i, as doubles in the units of the output components
+ */
+void ReferenceRgba(color::Mode mode, int64_t component_size, const std::vector<uint8_t>& src, bool is_chunky, int64_t components,
+                   size_t count, size_t i, double* rgba) {
+    const int64_t color_components = color::ColorComponents(mode);
+    const bool alpha = components > color_components;
+    auto at = [&](int64_t c) -> double {
+        if (component_size == 8)
+            return Component<uint8_t>(src, is_chunky, components, count, i, c);
+        if (component_size == 16)
+            return Component<uint16_t>(src, is_chunky, components, count, i, c);
+        return Component<float>(src, is_chunky, components, count, i, c);
+    };
+    const double max = component_size == 8 ? 255.0 : component_size == 16 ? 32768.0 : 1.0;
+
+    switch (mode) {
+    case color::Mode::kGrayscale:
+        rgba[0] = rgba[1] = rgba[2] = at(0);
+        rgba[3] = alpha ? at(1) : max;
+        break;
+    case color::Mode::kCmyk:
+        for (int c = 0; c < 3; c++)
+            rgba[c] = std::round(at(c) * at(3) / max);
+        rgba[3] = alpha ? at(4) : max;
+        break;
+    case color::Mode::kLab: {
+        double half = component_size == 8 ? 128.0 : 16384.0;
+        double ab_scale = component_size == 8 ? 1.0 : 1.0 / 128.0;
+        double rgb[3];
+        LabToLinearReference(at(0) * 100.0 / max, (at(1) - half) * ab_scale, (at(2) - half) * ab_scale, rgb);
+        // 8 bit Lab is encoded to sRGB bytes, 16 bit Lab is left linear for the deep conversion
+        for (int c = 0; c < 3; c++)
+            rgba[c] = component_size == 8 ? EncodeSrgb(rgb[c]) : std::max(rgb[c], 0.0);
+        rgba[3] = alpha ? (component_size == 8 ? at(3) : at(3) / 32768.0) : (component_size == 8 ? 255.0 : 1.0);
+        break;
+    }
+    case color::Mode::kRgb:
+        break;
+    }
+}
+
+bool CheckColorModes(std::mt19937& rng, FILE* out) {
+    Tally tally("color", out);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_int_distribution<int> deep(0, 32768);
+
+    const size_t count = 3001;
+    for (color::Mode mode : {color::Mode::kGrayscale, color::Mode::kLab, color::Mode::kCmyk}) {
+        for (int64_t component_size : {8, 16, 32}) {
+            if (!color::SupportsComponentSize(mode, component_size))
+                continue;
+            for (bool is_chunky : {true, false}) {
+                for (int64_t components : {color::ColorComponents(mode), color::ColorComponents(mode) + 1}) {
+                    std::vector<uint8_t> src = RandomBytes(rng, count * static_cast<size_t>(components * component_size / 8));
+                    for (size_t v = 0; component_size != 8 && v < count * static_cast<size_t>(components); v++) {
+                        if (component_size == 16) {
+                            uint16_t value = static_cast<uint16_t>(deep(rng));
+                            std::memcpy(src.data() + v * 2, &value, 2);
+                        } else {
+                            float value = unit(rng);
+                            std::memcpy(src.data() + v * 4, &value, 4);
+                        }
+                    }
+
+                    const int64_t out_size = color::RgbaComponentSize(mode, component_size);
+                    std::vector<uint8_t> dst(count * 4 * static_cast<size_t>(out_size / 8));
+                    size_t plane_stride = count * static_cast<size_t>(component_size / 8);
+                    color::ToRgba(mode, src.data(), plane_stride, is_chunky, components, component_size, dst.data(), count);
+
+                    // Integer outputs are exact except for 8 bit Lab, which goes through lookup tables and may be off
+                    // by one. Floats are compared relative to their size.
+                    const double tolerance = mode == color::Mode::kLab && component_size == 8 ? 1.0 : 0.0;
+                    double worst = 0.0;
+                    bool ok = true;
+                    for (size_t i = 0; i < count; i++) {
+                        double rgba[4];
+                        ReferenceRgba(mode, component_size, src, is_chunky, components, count, i, rgba);
+                        for (int c = 0; c < 4; c++) {
+                            double actual;
+                            if (out_size == 8) {
+                                actual = dst[i * 4 + static_cast<size_t>(c)];
+                                ok = ok && std::abs(actual - std::round(rgba[c])) <= tolerance;
+                            } else if (out_size == 16) {
+                                uint16_t value;
+                                std::memcpy(&value, dst.data() + (i * 4 + static_cast<size_t>(c)) * 2, 2);
+                                actual = value;
+                                ok = ok && actual == rgba[c];
+                            } else {
+                                float value;
+                                std::memcpy(&value, dst.data() + (i * 4 + static_cast<size_t>(c)) * 4, 4);
+                                actual = value;
+                                ok = ok && std::abs(actual - rgba[c]) <= 1e-4 * std::max(1.0, std::abs(rgba[c]));
+                            }
+                            worst = std::max(worst, std::abs(actual - rgba[c]));
+                        }
+                    }
+                    tally.Check(ok, "%s %lld bit, %s %lld components (off by up to %g)", color::ModeName(mode),
+                                static_cast<long long>(component_size), is_chunky ? "chunky" : "planar",
+                                static_cast<long long>(components), worst);
+                }
+            }
+        }
+    }
+    return tally.Report();
+}
+
+bool CheckJobQueue(FILE* out) {
+    Tally tally("jobs", out);
+
+    // A band is one tile row of a 640 pixel wide document
+    auto one_row = [](int64_t) { return int64_t{640 * PixelCache::kTileSize}; };
+    struct Taken {
+        int64_t document_id;
+        int64_t first_tile_row;
+        bool last;
+    };
+    auto take = [&](JobQueue& queue, std::vector<Taken>& taken) {
+        JobQueue::Band band;
+        while (queue.Next(one_row, band))
+            taken.push_back({band.document_id, band.first_tile_row, band.last});
+    };
+    auto same = [](const std::vector<Taken>& taken, const std::vector<Taken>& expected) {
+        return taken.size() == expected.size() &&
+               std::equal(taken.begin(), taken.end(), expected.begin(), [](const Taken& a, const Taken& b) {
+                   return a.document_id == b.document_id && a.first_tile_row == b.first_tile_row && a.last == b.last;
+               });
+    };
+
+    // Full pushes wait behind edits, background documents behind visible ones and everything behind the active one
+    JobQueue queue;
+    queue.Push(1, 640, 130, true);
+    queue.Push(2, 640, 64, false);
+    queue.Push(3, 640, 64, true);
+    queue.Push(4, 640, 64, false);
+    queue.SetVisible({3});
+    queue.SetActive(4);
+    std::vector<Taken> taken;
+    take(queue, taken);
+    tally.Check(same(taken, {{4, 0, true}, {3, 0, true}, {2, 0, true}, {1, 0, false}, {1, 1, false}, {1, 2, true}}),
+                "priority order");
+    tally.Check(queue.Size() == 0, "queue empty after every band");
+
+    // A newer snapshot takes over the rows the older job hadn't handed out, and marks the older one stale
+    queue.SetActive(-1);
+    queue.SetVisible({});
+    int64_t older = queue.Push(1, 640, 256, false);
+    JobQueue::Band band;
+    queue.Next(one_row, band);
+    int64_t newer = queue.Push(1, 640, 256, false);
+    tally.Check(queue.Superseded(1, older) && !queue.Superseded(1, newer) && queue.Size() == 1, "superseded job");
+    taken.clear();
+    take(queue, taken);
+    tally.Check(same(taken, {{1, 0, false}, {1, 1, false}, {1, 2, false}, {1, 3, true}}), "newer snapshot starts over");
+    tally.Check(!queue.Finish(newer), "finishing a job that was handed out");
+
+    // Dropping a document forgets its jobs and generations
+    int64_t dropped = queue.Push(2, 640, 64, false);
+    tally.Check(queue.Drop(2) == 1 && queue.Size() == 0 && !queue.Superseded(2, dropped - 1), "drop");
+    return tally.Report();
+}
+
+}  // namespace
+
+bool CheckCoreAgainstReference(FILE* out) {
+    std::mt19937 rng(4321);
+
+    // Every check runs, so one failing module doesn't hide another
+    bool ok = CheckDeltaCodec(rng, out);
+    ok = CheckLz4(rng, out) && ok;
+    ok = CheckDense(rng, out) && ok;
+    ok = CheckTileHashes(rng, out) && ok;
+    ok = CheckChannelPacker(rng, out) && ok;
+    ok = CheckColorModes(rng, out) && ok;
+    ok = CheckJobQueue(out) && ok;
+    return ok;
+}
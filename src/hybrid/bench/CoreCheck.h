@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdio>
+
+/**
+ * Check the core modules that don't have a scalar twin like the kernels against straightforward reference versions:
+ * the delta codec, LZ4 and dense encodings round trip, tile hashes match XXH64 and each other, packed channels and
+ * color mode conversions match per pixel reimplementations, and the job queue hands out bands in priority order.
+ * Mismatches are reported to `out`. Returns true when every check passes.
+ */
+bool CheckCoreAgainstReference(FILE* out);
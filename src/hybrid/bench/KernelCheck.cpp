@@ -0,0 +1,87 @@
+#include "KernelCheck.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../src/core/Kernels.h"
+
+namespace {
+
+struct Case {
+    bool is_chunky;
+    int components;
+    size_t count;
+    bool cache_matches;  // start with the cache already holding the pixels, so nothing should change
+};
+
+std::vector<Case> MakeCases() {
+    std::vector<Case> cases;
+    const size_t counts[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 10, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 4099};
+    // Grayscale has 1 or 2 components. A single gray plane is the same chunky or planar, it is only checked once.
+    for (bool is_chunky : {false, true})
+        for (int components : {1, 2, 3, 4})
+            for (size_t count : counts)
+                for (bool cache_matches : {false, true})
+                    if (!(is_chunky && components == 1))
+                        cases.push_back({is_chunky, components, count, cache_matches});
+    return cases;
+}
+
+bool RunCase(const kernels::KernelSet& candidate, const Case& c, std::mt19937& rng, FILE* out) {
+    const kernels::KernelSet& reference = kernels::ScalarKernels();
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    // Planar data gets some slack between planes, so a kernel reading past the batch would pick up wrong values.
+    size_t plane_stride = c.count + 13;
+    std::vector<uint8_t> src(c.is_chunky ? c.count * c.components : plane_stride * c.components);
+    for (uint8_t& value : src)
+        value = static_cast<uint8_t>(byte(rng));
+
+    std::vector<uint8_t> reference_cache(c.count * 4);
+    for (uint8_t& value : reference_cache)
+        value = static_cast<uint8_t>(byte(rng));
+
+    auto run = [&](const kernels::KernelSet& kernels, std::vector<uint8_t>& cache) {
+        if (c.components <= 2) {
+            return c.is_chunky ? kernels.chunky_gray_alpha(src.data(), cache.data(), c.count)
+                               : kernels.PlanarGray(c.components)(src.data(), plane_stride, cache.data(), c.count);
+        }
+        return c.is_chunky ? kernels.Chunky(c.components)(src.data(), cache.data(), c.count)
+                           : kernels.Planar(c.components)(src.data(), plane_stride, cache.data(), c.count);
+    };
+
+    if (c.cache_matches)
+        run(reference, reference_cache);
+
+    std::vector<uint8_t> candidate_cache = reference_cache;
+    bool reference_changed = run(reference, reference_cache);
+    bool candidate_changed = run(candidate, candidate_cache);
+
+    if (reference_changed == candidate_changed && reference_cache == candidate_cache)
+        return true;
+
+    std::fprintf(out, "MISMATCH %s: %s %d components, %zu pixels, %s cache (changed %d vs reference %d)\n",
+                 candidate.name, c.is_chunky ? "chunky" : "planar", c.components, c.count,
+                 c.cache_matches ? "matching" : "stale", candidate_changed, reference_changed);
+    return false;
+}
+
+}  // namespace
+
+bool CheckKernelsAgainstReference(FILE* out) {
+    std::mt19937 rng(1234);
+    std::vector<Case> cases = MakeCases();
+
+    bool ok = true;
+    for (const kernels::KernelSet* candidate : kernels::AvailableKernels()) {
+        size_t failures = 0;
+        for (const Case& c : cases) {
+            if (!RunCase(*candidate, c, rng, out))
+                failures++;
+        }
+        std::fprintf(out, "kernels %-8s %zu/%zu cases match the scalar reference\n", candidate->name, cases.size() - failures, cases.size());
+        ok = ok && failures == 0;
+    }
+    return ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdio>
+
+/**
+ * Run every vectorized kernel set this CPU supports against the scalar reference kernels on randomized batches,
+ * including odd lengths that exercise the scalar tails. Mismatches are reported to `out`.
+ * Returns true when every kernel set agrees with the reference.
+ */
+bool CheckKernelsAgainstReference(FILE* out);
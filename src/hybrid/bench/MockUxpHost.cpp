@@ -0,0 +1,719 @@
+#include "MockUxpHost.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+struct addon_callback_info__ {
+    std::vector<addon_value> args;
+    void* data = nullptr;
+};
+
+struct addon_deferred__ {
+    addon_value promise = nullptr;
+};
+
+struct addon_ref__ {
+    addon_value value = nullptr;
+    uint32_t count = 0;
+};
+
+struct addon_handle_scope__ {
+    size_t mark = 0;
+};
+
+/**
+ * The whole fake scripting environment. addon_env handles point at the single instance of this struct.
+ */
+struct addon_env__ {
+    std::deque<std::unique_ptr<addon_value__>> handles;
+    std::deque<std::unique_ptr<addon_deferred__>> deferreds;
+    std::deque<std::unique_ptr<addon_ref__>> refs;
+
+    addon_value exports = nullptr;
+    bool loaded = false;
+
+    struct ScheduledTask {
+        addon_task task;
+        addon_task_data data;
+        addon_task_destructor deleter;
+    };
+
+    // Tasks may be scheduled from native worker threads, so the queues need locking.
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<ScheduledTask> scripting_queue;
+    std::deque<ScheduledTask> main_queue;
+
+    std::string last_error;
+    addon_extended_error_info error_info{};
+
+    addon_value NewValue(addon_value__::Kind kind) {
+        handles.emplace_back(std::make_unique<addon_value__>());
+        handles.back()->kind = kind;
+        return handles.back().get();
+    }
+};
+
+namespace {
+
+addon_env__ mock_env;
+
+using Kind = addon_value__::Kind;
+
+std::u16string Widen(const char* str, size_t length) {
+    if (length == static_cast<size_t>(-1))
+        length = std::strlen(str);
+    std::u16string result;
+    result.reserve(length);
+    for (size_t i = 0; i < length; i++)
+        result.push_back(static_cast<unsigned char>(str[i]));
+    return result;
+}
+
+std::string Narrow(const std::u16string& str) {
+    std::string result;
+    result.reserve(str.size());
+    for (char16_t c : str)
+        result.push_back(static_cast<char>(c < 0x80 ? c : '?'));
+    return result;
+}
+
+size_t TypedArrayElementSize(addon_typedarray_type type) {
+    switch (type) {
+    case addon_int8_array:
+    case addon_uint8_array:
+    case addon_uint8_clamped_array: return 1;
+    case addon_int16_array:
+    case addon_uint16_array: return 2;
+    case addon_int32_array:
+    case addon_uint32_array:
+    case addon_float32_array: return 4;
+    default: return 8;
+    }
+}
+
+addon_status CreateInt32(addon_env env, int32_t value, addon_value* result) {
+    *result = env->NewValue(Kind::number);
+    (*result)->number = value;
+    return addon_ok;
+}
+
+addon_status GetCbInfo(addon_env env, addon_callback_info cbinfo, size_t* argc, addon_value* argv, addon_value* this_arg, void** data) {
+    if (argc != nullptr) {
+        // Like the real host, arguments the caller left out read as undefined
+        for (size_t i = 0; i < *argc; i++)
+            argv[i] = i < cbinfo->args.size() ? cbinfo->args[i] : env->NewValue(Kind::undefined);
+        *argc = cbinfo->args.size();
+    }
+    if (this_arg != nullptr)
+        *this_arg = nullptr;
+    if (data != nullptr)
+        *data = cbinfo->data;
+    return addon_ok;
+}
+
+addon_status ThrowError(addon_env env, const char*, const char* msg) {
+    env->last_error = msg != nullptr ? msg : "";
+    throw std::runtime_error("Addon threw: " + env->last_error);
+}
+
+addon_status GetValueInt32(addon_env, addon_value value, int32_t* result) {
+    if (value == nullptr || value->kind != Kind::number)
+        return addon_number_expected;
+    *result = static_cast<int32_t>(value->number);
+    return addon_ok;
+}
+
+addon_status CreateFunction(addon_env env, const char*, size_t, addon_callback cb, void* data, addon_value* result) {
+    *result = env->NewValue(Kind::function);
+    (*result)->callback = cb;
+    (*result)->callback_data = data;
+    return addon_ok;
+}
+
+addon_status SetNamedProperty(addon_env, addon_value object, const char* utf8name, addon_value value) {
+    if (object == nullptr)
+        return addon_object_expected;
+    object->properties[utf8name] = value;
+    return addon_ok;
+}
+
+addon_status GetLastErrorInfo(addon_env env, const addon_extended_error_info** result) {
+    env->error_info.error_message = env->last_error.c_str();
+    *result = &env->error_info;
+    return addon_ok;
+}
+
+addon_status GetUndefined(addon_env env, addon_value* result) {
+    *result = env->NewValue(Kind::undefined);
+    return addon_ok;
+}
+
+addon_status GetNull(addon_env env, addon_value* result) {
+    *result = env->NewValue(Kind::null);
+    return addon_ok;
+}
+
+addon_status GetBoolean(addon_env env, bool value, addon_value* result) {
+    *result = env->NewValue(Kind::boolean);
+    (*result)->boolean = value;
+    return addon_ok;
+}
+
+addon_status CreateObject(addon_env env, addon_value* result) {
+    *result = env->NewValue(Kind::object);
+    return addon_ok;
+}
+
+addon_status CreateArray(addon_env env, addon_value* result) {
+    *result = env->NewValue(Kind::array);
+    return addon_ok;
+}
+
+addon_status CreateArrayWithLength(addon_env env, size_t length, addon_value* result) {
+    *result = env->NewValue(Kind::array);
+    (*result)->elements.resize(length, nullptr);
+    return addon_ok;
+}
+
+addon_status CreateDouble(addon_env env, double value, addon_value* result) {
+    *result = env->NewValue(Kind::number);
+    (*result)->number = value;
+    return addon_ok;
+}
+
+addon_status CreateUint32(addon_env env, uint32_t value, addon_value* result) {
+    *result = env->NewValue(Kind::number);
+    (*result)->number = value;
+    return addon_ok;
+}
+
+addon_status CreateInt64(addon_env env, int64_t value, addon_value* result) {
+    *result = env->NewValue(Kind::number);
+    (*result)->number = static_cast<double>(value);
+    return addon_ok;
+}
+
+addon_status CreateStringUtf8(addon_env env, const char* str, size_t length, addon_value* result) {
+    *result = env->NewValue(Kind::string);
+    (*result)->string = Widen(str, length);
+    return addon_ok;
+}
+
+addon_status CreateStringLatin1(addon_env env, const char* str, size_t length, addon_value* result) {
+    *result = env->NewValue(Kind::string);
+    if (length == static_cast<size_t>(-1))
+        length = std::strlen(str);
+    (*result)->one_byte_string.assign(str, length);
+    (*result)->one_byte = true;
+    return addon_ok;
+}
+
+addon_status CreateStringUtf16(addon_env env, const char16_t* str, size_t length, addon_value* result) {
+    *result = env->NewValue(Kind::string);
+    // Like V8, this copies the characters into a heap string owned by the engine.
+    (*result)->string.assign(str, length);
+    return addon_ok;
+}
+
+addon_status CreateError(addon_env env, addon_value, addon_value msg, addon_value* result) {
+    *result = env->NewValue(Kind::error);
+    if (msg != nullptr)
+        (*result)->string = msg->string;
+    return addon_ok;
+}
+
+addon_status TypeOf(addon_env, addon_value value, addon_valuetype* result) {
+    switch (value->kind) {
+    case Kind::undefined: *result = addon_undefined; break;
+    case Kind::null: *result = addon_null; break;
+    case Kind::boolean: *result = addon_boolean; break;
+    case Kind::number: *result = addon_number; break;
+    case Kind::string: *result = addon_string; break;
+    case Kind::function: *result = addon_function; break;
+    default: *result = addon_object; break;
+    }
+    return addon_ok;
+}
+
+addon_status GetValueDouble(addon_env, addon_value value, double* result) {
+    if (value == nullptr || value->kind != Kind::number)
+        return addon_number_expected;
+    *result = value->number;
+    return addon_ok;
+}
+
+addon_status GetValueUint32(addon_env, addon_value value, uint32_t* result) {
+    if (value == nullptr || value->kind != Kind::number)
+        return addon_number_expected;
+    *result = static_cast<uint32_t>(value->number);
+    return addon_ok;
+}
+
+addon_status GetValueInt64(addon_env, addon_value value, int64_t* result) {
+    if (value == nullptr || value->kind != Kind::number)
+        return addon_number_expected;
+    *result = static_cast<int64_t>(value->number);
+    return addon_ok;
+}
+
+addon_status GetValueBool(addon_env, addon_value value, bool* result) {
+    if (value == nullptr || value->kind != Kind::boolean)
+        return addon_boolean_expected;
+    *result = value->boolean;
+    return addon_ok;
+}
+
+addon_status GetValueStringUtf8(addon_env, addon_value value, char* buf, size_t bufsize, size_t* result) {
+    if (value == nullptr || value->kind != Kind::string)
+        return addon_string_expected;
+    std::string narrow = Narrow(value->string);
+    if (buf == nullptr) {
+        *result = narrow.size();
+        return addon_ok;
+    }
+    size_t copied = bufsize > 0 ? std::min(bufsize - 1, narrow.size()) : 0;
+    std::memcpy(buf, narrow.data(), copied);
+    if (bufsize > 0)
+        buf[copied] = 0;
+    if (result != nullptr)
+        *result = copied;
+    return addon_ok;
+}
+
+addon_status GetPropertyNames(addon_env env, addon_value object, addon_value* result) {
+    *result = env->NewValue(Kind::array);
+    for (const auto& property : object->properties) {
+        addon_value key = nullptr;
+        CreateStringUtf8(env, property.first.c_str(), property.first.size(), &key);
+        (*result)->elements.push_back(key);
+    }
+    return addon_ok;
+}
+
+addon_status SetProperty(addon_env, addon_value object, addon_value key, addon_value value) {
+    if (object == nullptr || key == nullptr || key->kind != Kind::string)
+        return addon_invalid_arg;
+    object->properties[Narrow(key->string)] = value;
+    return addon_ok;
+}
+
+addon_status HasProperty(addon_env, addon_value object, addon_value key, bool* result) {
+    *result = object->properties.count(Narrow(key->string)) > 0;
+    return addon_ok;
+}
+
+addon_status GetProperty(addon_env env, addon_value object, addon_value key, addon_value* result) {
+    auto iter = object->properties.find(Narrow(key->string));
+    if (iter == object->properties.end())
+        return GetUndefined(env, result);
+    *result = iter->second;
+    return addon_ok;
+}
+
+addon_status HasNamedProperty(addon_env, addon_value object, const char* utf8name, bool* result) {
+    *result = object->properties.count(utf8name) > 0;
+    return addon_ok;
+}
+
+addon_status GetNamedProperty(addon_env env, addon_value object, const char* utf8name, addon_value* result) {
+    auto iter = object->properties.find(utf8name);
+    if (iter == object->properties.end())
+        return GetUndefined(env, result);
+    *result = iter->second;
+    return addon_ok;
+}
+
+addon_status SetElement(addon_env, addon_value object, uint32_t index, addon_value value) {
+    if (object == nullptr || object->kind != Kind::array)
+        return addon_array_expected;
+    if (object->elements.size() <= index)
+        object->elements.resize(index + 1, nullptr);
+    object->elements[index] = value;
+    return addon_ok;
+}
+
+addon_status GetElement(addon_env env, addon_value object, uint32_t index, addon_value* result) {
+    if (object == nullptr || object->kind != Kind::array)
+        return addon_array_expected;
+    if (index >= object->elements.size() || object->elements[index] == nullptr)
+        return GetUndefined(env, result);
+    *result = object->elements[index];
+    return addon_ok;
+}
+
+addon_status IsArray(addon_env, addon_value value, bool* result) {
+    *result = value->kind == Kind::array;
+    return addon_ok;
+}
+
+addon_status GetArrayLength(addon_env, addon_value value, uint32_t* result) {
+    if (value == nullptr || value->kind != Kind::array)
+        return addon_array_expected;
+    *result = static_cast<uint32_t>(value->elements.size());
+    return addon_ok;
+}
+
+addon_status CreateReference(addon_env env, addon_value value, uint32_t initial_refcount, addon_ref* result) {
+    env->refs.emplace_back(std::make_unique<addon_ref__>());
+    env->refs.back()->value = value;
+    env->refs.back()->count = initial_refcount;
+    *result = env->refs.back().get();
+    return addon_ok;
+}
+
+addon_status DeleteReference(addon_env, addon_ref ref) {
+    ref->value = nullptr;
+    ref->count = 0;
+    return addon_ok;
+}
+
+addon_status ReferenceRef(addon_env, addon_ref ref, uint32_t* result) {
+    ref->count++;
+    if (result != nullptr)
+        *result = ref->count;
+    return addon_ok;
+}
+
+addon_status ReferenceUnref(addon_env, addon_ref ref, uint32_t* result) {
+    if (ref->count == 0)
+        return addon_generic_failure;
+    ref->count--;
+    if (result != nullptr)
+        *result = ref->count;
+    return addon_ok;
+}
+
+addon_status GetReferenceValue(addon_env, addon_ref ref, addon_value* result) {
+    *result = ref->value;
+    return addon_ok;
+}
+
+addon_status OpenHandleScope(addon_env env, addon_handle_scope* result) {
+    // Handle scopes are tracked by the caller through HandleMark/ReleaseHandles, values are kept alive here.
+    static addon_handle_scope__ scope;
+    scope.mark = env->handles.size();
+    *result = &scope;
+    return addon_ok;
+}
+
+addon_status CloseHandleScope(addon_env, addon_handle_scope) {
+    return addon_ok;
+}
+
+addon_status IsError(addon_env, addon_value value, bool* result) {
+    *result = value->kind == Kind::error;
+    return addon_ok;
+}
+
+addon_status IsExceptionPending(addon_env, bool* result) {
+    *result = false;
+    return addon_ok;
+}
+
+addon_status IsArrayBuffer(addon_env, addon_value value, bool* result) {
+    *result = value->kind == Kind::arraybuffer;
+    return addon_ok;
+}
+
+addon_status CreateArrayBuffer(addon_env env, size_t byte_length, void** data, addon_value* result) {
+    *result = env->NewValue(Kind::arraybuffer);
+    (*result)->owned_buffer.resize(byte_length);
+    (*result)->buffer_data = (*result)->owned_buffer.data();
+    (*result)->buffer_length = byte_length;
+    if (data != nullptr)
+        *data = (*result)->buffer_data;
+    return addon_ok;
+}
+
+addon_status CreateExternalArrayBuffer(
+    addon_env env, void* external_data, size_t byte_length, addon_finalize finalize_cb, void* finalize_hint, addon_value* result) {
+    *result = env->NewValue(Kind::arraybuffer);
+    (*result)->buffer_data = external_data;
+    (*result)->buffer_length = byte_length;
+    (*result)->finalize_cb = finalize_cb;
+    (*result)->finalize_hint = finalize_hint;
+    return addon_ok;
+}
+
+addon_status GetArrayBufferInfo(addon_env, addon_value arraybuffer, void** data, size_t* byte_length) {
+    if (arraybuffer == nullptr || arraybuffer->kind != Kind::arraybuffer)
+        return addon_arraybuffer_expected;
+    if (data != nullptr)
+        *data = arraybuffer->buffer_data;
+    if (byte_length != nullptr)
+        *byte_length = arraybuffer->buffer_length;
+    return addon_ok;
+}
+
+addon_status IsTypedArray(addon_env, addon_value value, bool* result) {
+    *result = value->kind == Kind::typedarray;
+    return addon_ok;
+}
+
+addon_status CreateTypedArray(
+    addon_env env, addon_typedarray_type type, size_t length, addon_value arraybuffer, size_t byte_offset, addon_value* result) {
+    if (arraybuffer == nullptr || arraybuffer->kind != Kind::arraybuffer)
+        return addon_arraybuffer_expected;
+    if (byte_offset + length * TypedArrayElementSize(type) > arraybuffer->buffer_length)
+        return addon_invalid_arg;
+    *result = env->NewValue(Kind::typedarray);
+    (*result)->typedarray_type = type;
+    (*result)->typedarray_buffer = arraybuffer;
+    (*result)->typedarray_offset = byte_offset;
+    (*result)->buffer_length = length;
+    return addon_ok;
+}
+
+addon_status CreatePromise(addon_env env, addon_deferred* deferred, addon_value* promise) {
+    *promise = env->NewValue(Kind::promise);
+    env->deferreds.emplace_back(std::make_unique<addon_deferred__>());
+    env->deferreds.back()->promise = *promise;
+    *deferred = env->deferreds.back().get();
+    return addon_ok;
+}
+
+addon_status ResolveDeferred(addon_env, addon_deferred deferred, addon_value resolution) {
+    if (deferred == nullptr || deferred->promise->settled)
+        return addon_invalid_arg;
+    deferred->promise->settled = true;
+    deferred->promise->settled_value = resolution;
+    return addon_ok;
+}
+
+addon_status RejectDeferred(addon_env, addon_deferred deferred, addon_value rejection) {
+    if (deferred == nullptr || deferred->promise->settled)
+        return addon_invalid_arg;
+    deferred->promise->settled = true;
+    deferred->promise->rejected = true;
+    deferred->promise->settled_value = rejection;
+    return addon_ok;
+}
+
+addon_status IsPromise(addon_env, addon_value value, bool* is_promise) {
+    *is_promise = value->kind == Kind::promise;
+    return addon_ok;
+}
+
+void ScheduleOnJavascriptQueue(addon_env env, addon_task task, addon_task_data data, addon_task_destructor deleter) {
+    {
+        std::lock_guard<std::mutex> lock(env->queue_mutex);
+        env->scripting_queue.push_back({task, data, deleter});
+    }
+    env->queue_cv.notify_all();
+}
+
+void ScheduleOnMainQueue(addon_env env, addon_task task, addon_task_data data, addon_task_destructor deleter) {
+    {
+        std::lock_guard<std::mutex> lock(env->queue_mutex);
+        env->main_queue.push_back({task, data, deleter});
+    }
+    env->queue_cv.notify_all();
+}
+
+size_t DrainQueue(std::deque<addon_env__::ScheduledTask>& queue) {
+    size_t count = 0;
+    while (true) {
+        addon_env__::ScheduledTask next;
+        {
+            std::lock_guard<std::mutex> lock(mock_env.queue_mutex);
+            if (queue.empty())
+                break;
+            next = queue.front();
+            queue.pop_front();
+        }
+        next.task(next.data);
+        if (next.deleter != nullptr)
+            next.deleter(next.data);
+        count++;
+    }
+    return count;
+}
+
+}  // namespace
+
+MockUxpHost::MockUxpHost() : apis_{} {
+    apis_.uxp_addon_create_int32 = CreateInt32;
+    apis_.uxp_addon_get_cb_info = GetCbInfo;
+    apis_.uxp_addon_throw_error = ThrowError;
+    apis_.uxp_addon_get_value_int32 = GetValueInt32;
+    apis_.uxp_addon_create_function = CreateFunction;
+    apis_.uxp_addon_set_named_property = SetNamedProperty;
+    apis_.uxp_addon_get_last_error_info = GetLastErrorInfo;
+    apis_.uxp_addon_get_undefined = GetUndefined;
+    apis_.uxp_addon_get_null = GetNull;
+    apis_.uxp_addon_get_boolean = GetBoolean;
+    apis_.uxp_addon_create_object = CreateObject;
+    apis_.uxp_addon_create_array = CreateArray;
+    apis_.uxp_addon_create_array_with_length = CreateArrayWithLength;
+    apis_.uxp_addon_create_double = CreateDouble;
+    apis_.uxp_addon_create_uint32 = CreateUint32;
+    apis_.uxp_addon_create_int64 = CreateInt64;
+    apis_.uxp_addon_create_string_latin1 = CreateStringLatin1;
+    apis_.uxp_addon_create_string_utf8 = CreateStringUtf8;
+    apis_.uxp_addon_create_string_utf16 = CreateStringUtf16;
+    apis_.uxp_addon_create_error = CreateError;
+    apis_.uxp_addon_create_type_error = CreateError;
+    apis_.uxp_addon_create_range_error = CreateError;
+    apis_.uxp_addon_typeof = TypeOf;
+    apis_.uxp_addon_get_value_double = GetValueDouble;
+    apis_.uxp_addon_get_value_uint32 = GetValueUint32;
+    apis_.uxp_addon_get_value_int64 = GetValueInt64;
+    apis_.uxp_addon_get_value_bool = GetValueBool;
+    apis_.uxp_addon_get_value_string_latin1 = GetValueStringUtf8;
+    apis_.uxp_addon_get_value_string_utf8 = GetValueStringUtf8;
+    apis_.uxp_addon_get_property_names = GetPropertyNames;
+    apis_.uxp_addon_set_property = SetProperty;
+    apis_.uxp_addon_has_property = HasProperty;
+    apis_.uxp_addon_get_property = GetProperty;
+    apis_.uxp_addon_has_own_property = HasProperty;
+    apis_.uxp_addon_has_named_property = HasNamedProperty;
+    apis_.uxp_addon_get_named_property = GetNamedProperty;
+    apis_.uxp_addon_set_element = SetElement;
+    apis_.uxp_addon_get_element = GetElement;
+    apis_.uxp_addon_is_array = IsArray;
+    apis_.uxp_addon_get_array_length = GetArrayLength;
+    apis_.uxp_addon_create_reference = CreateReference;
+    apis_.uxp_addon_delete_reference = DeleteReference;
+    apis_.uxp_addon_reference_ref = ReferenceRef;
+    apis_.uxp_addon_reference_unref = ReferenceUnref;
+    apis_.uxp_addon_get_reference_value = GetReferenceValue;
+    apis_.uxp_addon_open_handle_scope = OpenHandleScope;
+    apis_.uxp_addon_close_handle_scope = CloseHandleScope;
+    apis_.uxp_addon_is_error = IsError;
+    apis_.uxp_addon_is_exception_pending = IsExceptionPending;
+    apis_.uxp_addon_is_arraybuffer = IsArrayBuffer;
+    apis_.uxp_addon_create_arraybuffer = CreateArrayBuffer;
+    apis_.uxp_addon_create_external_arraybuffer = CreateExternalArrayBuffer;
+    apis_.uxp_addon_get_arraybuffer_info = GetArrayBufferInfo;
+    apis_.uxp_addon_is_typedarray = IsTypedArray;
+    apis_.uxp_addon_create_typedarray = CreateTypedArray;
+    apis_.uxp_addon_create_promise = CreatePromise;
+    apis_.uxp_addon_resolve_deferred = ResolveDeferred;
+    apis_.uxp_addon_reject_deferred = RejectDeferred;
+    apis_.uxp_addon_is_promise = IsPromise;
+    apis_.uxp_addon_schedule_on_javascript_queue = ScheduleOnJavascriptQueue;
+    apis_.uxp_addon_schedule_on_main_queue = ScheduleOnMainQueue;
+}
+
+MockUxpHost::~MockUxpHost() {
+    UnloadAddon();
+    ReleaseHandles(0);
+}
+
+addon_env MockUxpHost::Env() {
+    return &mock_env;
+}
+
+addon_value MockUxpHost::LoadAddon() {
+    if (mock_env.loaded)
+        return mock_env.exports;
+
+    mock_env.exports = mock_env.NewValue(Kind::object);
+    addon_apis apis = apis_;
+    addon_value exports = ADDON_INITIALIZER(&mock_env, mock_env.exports, std::move(apis));
+    if (exports == nullptr)
+        throw std::runtime_error("Addon failed to initialize");
+
+    mock_env.exports = exports;
+    mock_env.loaded = true;
+    return exports;
+}
+
+void MockUxpHost::UnloadAddon() {
+    if (!mock_env.loaded)
+        return;
+    DrainScriptingQueue();
+    ADDON_TERMINATE(&mock_env);
+    mock_env.loaded = false;
+}
+
+addon_value MockUxpHost::GetExport(const std::string& name) {
+    auto iter = LoadAddon()->properties.find(name);
+    if (iter == mock_env.exports->properties.end())
+        throw std::runtime_error("Addon does not export " + name);
+    return iter->second;
+}
+
+addon_value MockUxpHost::Call(addon_value function, const std::vector<addon_value>& args) {
+    if (function == nullptr || function->kind != Kind::function)
+        throw std::runtime_error("Value is not a function");
+
+    addon_callback_info__ info;
+    info.args = args;
+    info.data = function->callback_data;
+    return function->callback(&mock_env, &info);
+}
+
+addon_value MockUxpHost::Undefined() {
+    return mock_env.NewValue(Kind::undefined);
+}
+
+addon_value MockUxpHost::Number(double value) {
+    addon_value result = mock_env.NewValue(Kind::number);
+    result->number = value;
+    return result;
+}
+
+addon_value MockUxpHost::Boolean(bool value) {
+    addon_value result = mock_env.NewValue(Kind::boolean);
+    result->boolean = value;
+    return result;
+}
+
+addon_value MockUxpHost::String(const std::string& value) {
+    addon_value result = mock_env.NewValue(Kind::string);
+    result->string = Widen(value.c_str(), value.size());
+    return result;
+}
+
+addon_value MockUxpHost::ArrayBuffer(void* data, size_t byte_length) {
+    addon_value result = mock_env.NewValue(Kind::arraybuffer);
+    result->buffer_data = data;
+    result->buffer_length = byte_length;
+    return result;
+}
+
+addon_value MockUxpHost::Object(const std::map<std::string, addon_value>& properties) {
+    addon_value result = mock_env.NewValue(Kind::object);
+    result->properties = properties;
+    return result;
+}
+
+size_t MockUxpHost::DrainScriptingQueue() {
+    return DrainQueue(mock_env.scripting_queue);
+}
+
+size_t MockUxpHost::DrainMainQueue() {
+    return DrainQueue(mock_env.main_queue);
+}
+
+size_t MockUxpHost::WaitForScriptingQueue() {
+    {
+        std::unique_lock<std::mutex> lock(mock_env.queue_mutex);
+        mock_env.queue_cv.wait(lock, [] { return !mock_env.scripting_queue.empty(); });
+    }
+    return DrainScriptingQueue();
+}
+
+size_t MockUxpHost::HandleMark() const {
+    return mock_env.handles.size();
+}
+
+void MockUxpHost::ReleaseHandles(size_t mark) {
+    while (mock_env.handles.size() > mark) {
+        addon_value__& value = *mock_env.handles.back();
+        // External array buffers hand their memory back to the addon when collected
+        if (value.kind == Kind::arraybuffer && value.finalize_cb != nullptr)
+            value.finalize_cb(&mock_env, value.buffer_data, value.finalize_hint);
+        mock_env.handles.pop_back();
+    }
+}
+
+void MockUxpHost::ThrowIfError(addon_value value) {
+    if (value != nullptr && value->kind == Kind::error)
+        throw std::runtime_error("Addon returned error: " + Narrow(value->string));
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../src/api/UxpAddonShared.h"
+
+/**
+ * Stand-in for the javascript values UXP hands to the addon. The real host keeps these opaque,
+ * so the mock is free to define the struct behind the addon_value handle however it likes.
+ */
+struct addon_value__ {
+    enum class Kind { undefined, null, boolean, number, string, object, array, function, arraybuffer, typedarray, promise, error };
+
+    Kind kind = Kind::undefined;
+
+    bool boolean = false;
+    double number = 0;
+
+    // Strings made from Latin-1 are kept one byte per character, like V8 does
+    std::u16string string;
+    std::string one_byte_string;
+    bool one_byte = false;
+
+    size_t StringByteLength() const { return one_byte ? one_byte_string.size() : string.size() * sizeof(char16_t); }
+
+    std::map<std::string, addon_value> properties;
+    std::vector<addon_value> elements;
+
+    addon_callback callback = nullptr;
+    void* callback_data = nullptr;
+
+    // Array buffers either point at memory owned by the benchmark or at memory owned by the addon (external buffers)
+    void* buffer_data = nullptr;
+    size_t buffer_length = 0;
+    std::vector<uint8_t> owned_buffer;
+    addon_finalize finalize_cb = nullptr;
+    void* finalize_hint = nullptr;
+
+    // Typed arrays are views into an array buffer value
+    addon_typedarray_type typedarray_type = addon_uint8_array;
+    addon_value typedarray_buffer = nullptr;
+    size_t typedarray_offset = 0;
+
+    // Promises
+    bool settled = false;
+    bool rejected = false;
+    addon_value settled_value = nullptr;
+};
+
+/**
+ * A minimal fake of the UXP scripting host. Fills in the addon_apis function table with local implementations so the
+ * addon can be loaded and driven from a plain executable, without Photoshop.
+ *
+ * Only a single host may exist at a time, since UXP_ADDON_INIT stores the api table in a process-wide singleton.
+ */
+class MockUxpHost {
+ public:
+    MockUxpHost();
+    ~MockUxpHost();
+
+    MockUxpHost(const MockUxpHost&) = delete;
+    MockUxpHost& operator=(const MockUxpHost&) = delete;
+
+    // Load the addon by invoking its registered uxp_addon_init entrypoint. Returns the populated exports object.
+    addon_value LoadAddon();
+    void UnloadAddon();
+
+    addon_value GetExport(const std::string& name);
+
+    // Invoke a javascript function value created by the addon
+    addon_value Call(addon_value function, const std::vector<addon_value>& args);
+
+    // @{ Value creation for arguments
+    addon_value Undefined();
+    addon_value Number(double value);
+    addon_value Boolean(bool value);
+    addon_value String(const std::string& value);
+    addon_value ArrayBuffer(void* data, size_t byte_length); // wraps caller-owned memory, no copy
+    addon_value Object(const std::map<std::string, addon_value>& properties);
+    // @}
+
+    // Run any tasks the addon scheduled onto the javascript queue. Returns the number of tasks run.
+    size_t DrainScriptingQueue();
+
+    // Run any tasks the addon scheduled onto the main queue. Returns the number of tasks run.
+    size_t DrainMainQueue();
+
+    // Block until at least one task is queued onto the javascript queue, then drain it.
+    size_t WaitForScriptingQueue();
+
+    // Values created after the mark are released by ReleaseHandles, mirroring a handle scope closing
+    size_t HandleMark() const;
+    void ReleaseHandles(size_t mark);
+
+    // Throws if the value is an error object returned by the addon
+    static void ThrowIfError(addon_value value);
+
+    const addon_apis& Apis() const { return apis_; }
+    addon_env Env();
+
+ private:
+    addon_apis apis_;
+};
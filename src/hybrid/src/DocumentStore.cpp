@@ -0,0 +1,480 @@
+#include "DocumentStore.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#if defined(__GLIBC__) || defined(_WIN32)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+#include "./core/MappedFile.h"
+#include "./core/Stats.h"
+#include "./core/Trace.h"
+
+DocumentShard shards[kDocumentShards];
+std::atomic<size_t> memory_budget{kDefaultMemoryBudget};
+std::atomic<int64_t> active_document_id{-1};
+
+Pacer pacing;
+JobQueue jobs;
+ChannelPacker packer;
+
+namespace {
+
+// Ticks for DocumentEntry::last_used
+std::atomic<uint64_t> use_clock{0};
+
+constexpr uint32_t kHibernationMagic = 0x48443350;  // "P3DH"
+constexpr uint32_t kHibernationVersion = 2;
+
+/**
+ * Writes or reads a hibernation file field by field. Without data it only counts the bytes, to size the file before
+ * mapping it. Reading past the end throws, the file is then dropped like any other that can't be restored.
+ */
+class HibernationStream {
+public:
+    explicit HibernationStream(uint8_t* data = nullptr, size_t size = 0) : data_(data), size_(size) {}
+
+    size_t Offset() const { return offset_; }
+    size_t Remaining() const { return size_ - offset_; }
+
+    void Write(const void* bytes, size_t length) {
+        if (data_) {
+            std::memcpy(data_ + offset_, bytes, length);
+        }
+        offset_ += length;
+    }
+
+    void Read(void* bytes, size_t length) {
+        if (length > size_ - offset_) {
+            throw std::runtime_error("Hibernation file is truncated");
+        }
+        std::memcpy(bytes, data_ + offset_, length);
+        offset_ += length;
+    }
+
+    template <typename T>
+    void WriteValue(T value) { Write(&value, sizeof(value)); }
+
+    template <typename T>
+    T ReadValue() {
+        T value;
+        Read(&value, sizeof(value));
+        return value;
+    }
+
+private:
+    uint8_t* data_;
+    size_t size_;
+    size_t offset_ = 0;
+};
+
+void WriteTileHashes(const TileHashes& hashes, HibernationStream& out) {
+    out.WriteValue<int64_t>(hashes.Width());
+    out.WriteValue<int64_t>(hashes.Height());
+    out.WriteValue<uint64_t>(hashes.Format());
+    for (int64_t y = 0; y < hashes.TilesY(); y++) {
+        for (int64_t x = 0; x < hashes.TilesX(); x++) {
+            out.WriteValue<uint8_t>(hashes.Written(x, y) ? 1 : 0);
+            out.WriteValue<uint64_t>(hashes.At(x, y));
+        }
+    }
+}
+
+std::unique_ptr<TileHashes> ReadTileHashes(HibernationStream& in) {
+    int64_t width = in.ReadValue<int64_t>();
+    int64_t height = in.ReadValue<int64_t>();
+    uint64_t format = in.ReadValue<uint64_t>();
+    if (width < 0 || height < 0 || width > INT32_MAX || height > INT32_MAX ||
+        static_cast<uint64_t>((width + PixelCache::kTileSize - 1) / PixelCache::kTileSize) *
+            static_cast<uint64_t>((height + PixelCache::kTileSize - 1) / PixelCache::kTileSize) * 9 > in.Remaining()) {
+        throw std::runtime_error("Hibernation file is corrupt");
+    }
+
+    auto hashes = std::make_unique<TileHashes>(width, height, format);
+    for (int64_t y = 0; y < hashes->TilesY(); y++) {
+        for (int64_t x = 0; x < hashes->TilesX(); x++) {
+            if (in.ReadValue<uint8_t>())
+                hashes->MarkWritten(x, y);
+            hashes->Set(x, y, in.ReadValue<uint64_t>());
+        }
+    }
+    return hashes;
+}
+
+void WritePixelCache(const PixelCache& cache, HibernationStream& out) {
+    out.WriteValue<int64_t>(cache.Width());
+    out.WriteValue<int64_t>(cache.Height());
+    out.WriteValue<int64_t>(cache.BytesPerPixel());
+    for (int64_t y = 0; y < cache.TilesY(); y++) {
+        for (int64_t x = 0; x < cache.TilesX(); x++)
+            out.WriteValue<uint8_t>(cache.TilesWritten(x, x + 1, y, y + 1) ? 1 : 0);
+    }
+    out.Write(cache.Data(), cache.ByteSize());
+}
+
+std::unique_ptr<PixelCache> ReadPixelCache(HibernationStream& in) {
+    int64_t width = in.ReadValue<int64_t>();
+    int64_t height = in.ReadValue<int64_t>();
+    int64_t bytes_per_pixel = in.ReadValue<int64_t>();
+    if (width < 0 || height < 0 || width > INT32_MAX || height > INT32_MAX || (bytes_per_pixel != 4 && bytes_per_pixel != 8) ||
+        static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * bytes_per_pixel > in.Remaining()) {
+        throw std::runtime_error("Hibernation file is corrupt");
+    }
+
+    auto cache = std::make_unique<PixelCache>(width, height, bytes_per_pixel);
+    for (int64_t y = 0; y < cache->TilesY(); y++) {
+        for (int64_t x = 0; x < cache->TilesX(); x++) {
+            if (in.ReadValue<uint8_t>())
+                cache->MarkTilesWritten(x, x + 1, y, y + 1);
+        }
+    }
+    in.Read(cache->Data(), cache->ByteSize());
+    return cache;
+}
+
+/**
+ * Write everything the addon keeps for a document, so it can be rebuilt exactly as it was. Derived state, the
+ * resampler weights and the sizes of mip levels and block images, is recreated from the cached sizes instead.
+ */
+void WriteHibernatedDocument(const DocumentCache& doc, HibernationStream& out) {
+    out.WriteValue<uint32_t>(kHibernationMagic);
+    out.WriteValue<uint32_t>(kHibernationVersion);
+    out.WriteValue<uint8_t>(doc.pixels ? 1 : 0);
+    out.WriteValue<uint8_t>(doc.source ? 1 : 0);
+    out.WriteValue<uint8_t>(doc.resampler ? 1 : 0);
+    out.WriteValue<uint8_t>(doc.mips ? 1 : 0);
+    out.WriteValue<uint32_t>(static_cast<uint32_t>(doc.blocks.size()));
+    out.WriteValue<uint8_t>(doc.hash_only ? 1 : 0);
+    out.WriteValue<uint8_t>(doc.hashes ? 1 : 0);
+
+    if (doc.hashes) {
+        WriteTileHashes(*doc.hashes, out);
+    }
+    if (doc.pixels) {
+        WritePixelCache(*doc.pixels, out);
+    }
+    if (doc.source) {
+        WritePixelCache(*doc.source, out);
+    }
+    if (doc.resampler) {
+        out.WriteValue<int32_t>(static_cast<int32_t>(doc.resampler->Filter()));
+    }
+    if (doc.mips) {
+        for (int64_t level = 1; level <= doc.mips->Levels(); level++)
+            out.Write(doc.mips->LevelData(level),
+                      static_cast<size_t>(doc.mips->LevelWidth(level) * doc.mips->LevelHeight(level) * doc.mips->BytesPerPixel()));
+    }
+    if (!doc.blocks.empty()) {
+        out.WriteValue<int32_t>(static_cast<int32_t>(doc.blocks[0].BlockFormat()));
+        out.WriteValue<int32_t>(static_cast<int32_t>(doc.blocks[0].EncodeQuality()));
+        for (const bc::BlockImage& image : doc.blocks)
+            out.Write(image.Data(), image.ByteSize());
+    }
+}
+
+DocumentCache ReadHibernatedDocument(HibernationStream& in) {
+    if (in.ReadValue<uint32_t>() != kHibernationMagic || in.ReadValue<uint32_t>() != kHibernationVersion) {
+        throw std::runtime_error("Not a hibernation file");
+    }
+
+    bool has_pixels = in.ReadValue<uint8_t>() != 0;
+    bool has_source = in.ReadValue<uint8_t>() != 0;
+    bool has_resampler = in.ReadValue<uint8_t>() != 0;
+    bool has_mips = in.ReadValue<uint8_t>() != 0;
+    uint32_t block_images = in.ReadValue<uint32_t>();
+    bool hash_only = in.ReadValue<uint8_t>() != 0;
+    bool has_hashes = in.ReadValue<uint8_t>() != 0;
+
+    DocumentCache doc;
+    doc.hash_only = hash_only;
+    if (has_hashes) {
+        doc.hashes = ReadTileHashes(in);
+    }
+
+    // Everything else hangs off the pixels webview has
+    if (!has_pixels) {
+        return doc;
+    }
+    doc.pixels = ReadPixelCache(in);
+
+    if (has_source) {
+        doc.source = ReadPixelCache(in);
+    }
+    if (has_resampler) {
+        int32_t filter = in.ReadValue<int32_t>();
+        if (!doc.source || (filter != static_cast<int32_t>(ResampleFilter::kBilinear) &&
+                            filter != static_cast<int32_t>(ResampleFilter::kLanczos3))) {
+            throw std::runtime_error("Hibernation file is corrupt");
+        }
+        doc.resampler = std::make_unique<Resampler>(doc.source->Width(), doc.source->Height(), doc.pixels->Width(),
+                                                    doc.pixels->Height(), static_cast<ResampleFilter>(filter));
+    }
+    if (has_mips) {
+        doc.mips = std::make_unique<MipPyramid>(doc.pixels->Width(), doc.pixels->Height(), doc.pixels->BytesPerPixel());
+        for (int64_t level = 1; level <= doc.mips->Levels(); level++)
+            in.Read(doc.mips->LevelData(level),
+                    static_cast<size_t>(doc.mips->LevelWidth(level) * doc.mips->LevelHeight(level) * doc.mips->BytesPerPixel()));
+    }
+    if (block_images > 0) {
+        int32_t format = in.ReadValue<int32_t>();
+        int32_t quality = in.ReadValue<int32_t>();
+        if (block_images != 1 + (doc.mips ? doc.mips->Levels() : 0) || format < 0 || format > 2 || quality < 0 ||
+            quality > 2) {
+            throw std::runtime_error("Hibernation file is corrupt");
+        }
+
+        for (uint32_t level = 0; level < block_images; level++) {
+            int64_t width = level == 0 ? doc.pixels->Width() : doc.mips->LevelWidth(level);
+            int64_t height = level == 0 ? doc.pixels->Height() : doc.mips->LevelHeight(level);
+            doc.blocks.emplace_back(width, height, static_cast<bc::Format>(format), static_cast<bc::Quality>(quality));
+            in.Read(doc.blocks.back().Data(), doc.blocks.back().ByteSize());
+        }
+    }
+    return doc;
+}
+
+/**
+ * Read a hibernated document back in, if it was hibernated. The file is mapped and copied into new caches on the heap,
+ * then deleted. A file that can't be read is dropped, the document then starts from nothing like an evicted one. Holds
+ * the entry's lock.
+ */
+void RestoreHibernated(DocumentEntry& entry) {
+    if (entry.hibernated_path.empty()) {
+        return;
+    }
+
+    std::string path = std::move(entry.hibernated_path);
+    entry.hibernated_path.clear();
+
+    try {
+        std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+        HibernationStream in(file->Data(), file->Size());
+        entry.cache = ReadHibernatedDocument(in);
+        stats::Add(stats::Cache().restores, 1);
+    } catch (const std::exception&) {
+        entry.cache = DocumentCache();
+    }
+    entry.bytes.store(entry.cache.ByteSize(), std::memory_order_relaxed);
+
+    std::error_code error;
+    std::filesystem::remove(std::filesystem::u8path(path), error);
+}
+
+}  // namespace
+
+DocumentLock LockDocument(int64_t document_id, bool create) {
+    trace::Span span("wait for document", "document", document_id);
+    DocumentShard& shard = ShardOf(document_id);
+
+    for (;;) {
+        std::shared_ptr<DocumentEntry> entry;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.documents.find(document_id);
+            if (found != shard.documents.end()) {
+                entry = found->second;
+            } else {
+                auto file = shard.hibernated.find(document_id);
+                if (!create && file == shard.hibernated.end()) {
+                    return DocumentLock();
+                }
+
+                entry = std::make_shared<DocumentEntry>();
+                if (file != shard.hibernated.end()) {
+                    entry->hibernated_path = std::move(file->second);
+                    shard.hibernated.erase(file);
+                }
+                shard.documents.emplace(document_id, entry);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(entry->mutex);
+        if (entry->unlinked.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        entry->last_used.store(++use_clock, std::memory_order_relaxed);
+        RestoreHibernated(*entry);
+        return DocumentLock{std::move(entry), std::move(lock)};
+    }
+}
+
+bool UnlinkDocument(DocumentShard& shard, int64_t document_id, const DocumentEntry* entry) {
+    auto found = shard.documents.find(document_id);
+    if (found == shard.documents.end() || (entry && found->second.get() != entry)) {
+        return false;
+    }
+
+    found->second->unlinked.store(true, std::memory_order_release);
+    shard.documents.erase(found);
+    return true;
+}
+
+size_t EnforceMemoryBudget(const DocumentLock& converted) {
+    if (converted) {
+        converted.entry->bytes.store(converted.entry->cache.ByteSize(), std::memory_order_relaxed);
+    }
+
+    const size_t budget = memory_budget.load();
+    if (budget == 0) {
+        return 0;
+    }
+    trace::Span span("enforce memory budget");
+
+    struct Candidate {
+        uint64_t last_used;
+        int64_t document_id;
+        std::shared_ptr<DocumentEntry> entry;
+    };
+
+    size_t used = 0;
+    std::vector<Candidate> evictable;
+    const int64_t active = active_document_id.load();
+    for (DocumentShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.documents) {
+            used += entry.second->bytes.load(std::memory_order_relaxed);
+            if (entry.second != converted.entry && entry.first != active) {
+                evictable.push_back({entry.second->last_used.load(std::memory_order_relaxed), entry.first, entry.second});
+            }
+        }
+    }
+    if (used <= budget) {
+        return 0;
+    }
+
+    std::sort(evictable.begin(), evictable.end(),
+              [](const Candidate& a, const Candidate& b) { return a.last_used < b.last_used; });
+
+    // Documents another thread is converting are passed over
+    size_t freed = 0;
+    for (size_t i = 0; i < evictable.size() && used > budget; i++) {
+        const Candidate& candidate = evictable[i];
+        std::unique_lock<std::mutex> entry_lock(candidate.entry->mutex, std::try_to_lock);
+        if (!entry_lock.owns_lock()) {
+            continue;
+        }
+
+        DocumentShard& shard = ShardOf(candidate.document_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (UnlinkDocument(shard, candidate.document_id, candidate.entry.get())) {
+            size_t size = candidate.entry->bytes.load(std::memory_order_relaxed);
+            used -= std::min(used, size);
+            freed += size;
+            stats::Add(stats::Cache().evictions, 1);
+        }
+    }
+
+    // The last references to the evicted entries go with the candidates
+    evictable.clear();
+    if (freed > 0) {
+        ReleaseFreedMemory();
+    }
+    return freed;
+}
+
+void ReleaseFreedMemory() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#elif defined(_WIN32)
+    _heapmin();
+#elif defined(__APPLE__)
+    malloc_zone_pressure_relief(nullptr, 0);
+#endif
+}
+
+size_t HibernateDocuments(const std::string& directory) {
+    const std::filesystem::path folder = std::filesystem::u8path(directory);
+    if (!std::filesystem::is_directory(folder)) {
+        throw std::invalid_argument("Not a directory: " + directory);
+    }
+
+    // Files left behind by an earlier session that never resumed, those of documents the store knows may still be
+    // read back in
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(folder, error)) {
+        std::string name = entry.path().filename().u8string();
+        const std::string prefix = "document-";
+        const std::string suffix = ".cache";
+        bool ours = name.size() > prefix.size() + suffix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        if (!ours) {
+            continue;
+        }
+
+        char* id_end = nullptr;
+        int64_t document_id = std::strtoll(name.c_str() + prefix.size(), &id_end, 10);
+        if (id_end != name.c_str() + name.size() - suffix.size()) {
+            continue;
+        }
+        DocumentShard& shard = ShardOf(document_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.hibernated.find(document_id);
+        bool current = shard.documents.count(document_id) > 0 ||
+            (found != shard.hibernated.end() && std::filesystem::u8path(found->second) == entry.path());
+        if (!current) {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+
+    // Documents being converted stay in memory
+    size_t written = 0;
+    for (DocumentShard& shard : shards) {
+        std::vector< std::pair<int64_t, std::shared_ptr<DocumentEntry>> > entries;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            entries.assign(shard.documents.begin(), shard.documents.end());
+        }
+
+        for (auto& entry : entries) {
+            std::unique_lock<std::mutex> entry_lock(entry.second->mutex, std::try_to_lock);
+            if (!entry_lock.owns_lock() || entry.second->unlinked.load(std::memory_order_acquire)) {
+                continue;
+            }
+            RestoreHibernated(*entry.second);
+
+            std::string path = (folder / ("document-" + std::to_string(entry.first) + ".cache")).u8string();
+            try {
+                HibernationStream counter;
+                WriteHibernatedDocument(entry.second->cache, counter);
+
+                std::unique_ptr<MappedFile> file = MappedFile::Create(path, counter.Offset());
+                HibernationStream out(file->Data(), file->Size());
+                WriteHibernatedDocument(entry.second->cache, out);
+                file.reset();
+
+                // Closed while it was written
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                if (UnlinkDocument(shard, entry.first, entry.second.get())) {
+                    shard.hibernated[entry.first] = path;
+                    written += counter.Offset();
+                    stats::Add(stats::Cache().hibernations, 1);
+                } else {
+                    std::filesystem::remove(std::filesystem::u8path(path), error);
+                }
+            } catch (const std::exception&) {
+                std::filesystem::remove(std::filesystem::u8path(path), error);
+
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                UnlinkDocument(shard, entry.first, entry.second.get());
+            }
+        }
+    }
+    ReleaseFreedMemory();
+
+    return written;
+}
+
+void DropPixelCaches(DocumentCache& doc) {
+    doc.pixels.reset();
+    doc.source.reset();
+    doc.resampler.reset();
+    doc.mips.reset();
+    doc.blocks.clear();
+}
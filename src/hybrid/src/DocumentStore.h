@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./core/BlockCompression.h"
+#include "./core/ChannelPacking.h"
+#include "./core/JobQueue.h"
+#include "./core/MipPyramid.h"
+#include "./core/Pacing.h"
+#include "./core/PixelCache.h"
+#include "./core/Resampler.h"
+#include "./core/TileHash.h"
+
+/**
+ * What the addon keeps for one document. `pixels` is what the webview has, packed RGBA8 or RGBA half floats for HDR
+ * preview. When the webview previews the document at another size, `source` holds the full resolution pixels and
+ * `pixels` is resampled from it.
+ *
+ * Documents set to hash only change detection keep just `hashes` while they aren't edited. Their caches are
+ * rebuilt from the source when a pass finds a changed tile, so the changed rects can be sent. While edits keep
+ * coming the caches stay and the document is converted like any other, and once a pass finds nothing changed
+ * kHashCachesIdle (module.cpp) after the last edit they are hashed and dropped again. A document switched back to full change
+ * detection keeps the caches of its next such pass and drops the hashes.
+ */
+struct DocumentCache {
+    std::unique_ptr<PixelCache> pixels;
+    std::unique_ptr<PixelCache> source;       // tile conversion at another preview size only
+    std::unique_ptr<Resampler> resampler;     // from source to pixels
+    std::unique_ptr<MipPyramid> mips;         // mip levels below pixels, tile conversion only
+    std::vector<bc::BlockImage> blocks;       // pixels and then each mip level block compressed, when compressing
+    std::unique_ptr<TileHashes> hashes;       // what the webview has at full resolution, while changes are hashed
+
+    bool hash_only = false;                   // set_change_detection "hash"
+    uint64_t changed_at = 0;                  // Pacer::Now() of the last pass that found a change, hash only
+
+    // Job of the snapshot last converted into the caches, see JobQueue. 0 when it wasn't queued as a job.
+    int64_t generation = 0;
+
+    size_t ByteSize() const {
+        size_t size = (pixels ? pixels->ByteSize() : 0) + (source ? source->ByteSize() : 0) + (mips ? mips->ByteSize() : 0) +
+            (hashes ? hashes->ByteSize() : 0);
+        for (const bc::BlockImage& image : blocks)
+            size += image.ByteSize();
+        return size;
+    }
+};
+
+/**
+ * A document in the store. Conversions of the document hold its mutex from start to end, conversions of different
+ * documents run in parallel.
+ *
+ * Entries are shared. Closing, evicting or hibernating a document only unlinks its entry from the store, without
+ * waiting for its lock: a conversion still holding the entry finishes with it, and its memory is freed when the last
+ * holder lets go. A conversion that was waiting for the lock of an unlinked entry starts over with a new one.
+ */
+struct DocumentEntry {
+    std::mutex mutex;
+    DocumentCache cache;
+
+    // What the webview has under the batch or band being converted, to compute deltas against
+    std::vector<uint8_t> previous;
+
+    // Hibernation file to read back in before the next conversion, see RestoreHibernated
+    std::string hibernated_path;
+
+    std::atomic<bool> unlinked{false};
+    std::atomic<size_t> bytes{0};      // cache.ByteSize() when the document was last converted
+    std::atomic<uint64_t> last_used{0};  // use_clock when the document was last converted
+};
+
+/**
+ * Documents by id, spread over shards so looking one up never waits for another document's. Shard locks are only
+ * held to find, add and unlink entries, never while waiting for an entry's lock.
+ */
+struct DocumentShard {
+    std::mutex mutex;
+    std::unordered_map<int64_t, std::shared_ptr<DocumentEntry>> documents;
+
+    // Documents spilled to disk by hibernate, by id. Each is read back in when the document is next converted.
+    std::unordered_map<int64_t, std::string> hibernated;
+};
+
+/**
+ * A document locked for a conversion, see LockDocument. Empty when there was no document to lock.
+ */
+struct DocumentLock {
+    std::shared_ptr<DocumentEntry> entry;
+    std::unique_lock<std::mutex> lock;
+
+    explicit operator bool() const { return entry != nullptr; }
+};
+
+constexpr size_t kDocumentShards = 16;
+extern DocumentShard shards[kDocumentShards];
+
+inline DocumentShard& ShardOf(int64_t document_id) {
+    return shards[static_cast<uint64_t>(document_id) % kDocumentShards];
+}
+
+// Documents are evicted least recently used first once the caches take more than the budget, except for the
+// active document and the ones being converted. An evicted document is converted from nothing the next time, which
+// sends all of it like a forced update.
+constexpr size_t kDefaultMemoryBudget = size_t{2} << 30;
+extern std::atomic<size_t> memory_budget;  // 0 for no limit
+extern std::atomic<int64_t> active_document_id;
+
+// Measured conversion costs and edits, for get_pacing. Has its own lock.
+extern Pacer pacing;
+
+// Passes over documents waiting to be converted, most urgent first, see JobQueue.h. Has its own lock.
+extern JobQueue jobs;
+
+// Textures packing one channel of several documents each, see ChannelPacking.h. Has its own lock.
+extern ChannelPacker packer;
+
+/**
+ * Lock a document about to be converted, read back in if it was hibernated and marked as the most recently used.
+ * With `create` a document the store doesn't have is added empty, otherwise the lock comes back empty. The time spent
+ * waiting for another conversion of the document shows up in traces.
+ */
+DocumentLock LockDocument(int64_t document_id, bool create = true);
+
+/**
+ * Take a document out of the store, if it's there and, when given, still `entry`. Holds the shard's lock. Whoever
+ * holds the entry still can finish with it, see DocumentEntry. Returns whether it was unlinked.
+ */
+bool UnlinkDocument(DocumentShard& shard, int64_t document_id, const DocumentEntry* entry = nullptr);
+
+/**
+ * Evict the least recently used documents until the caches fit the memory budget again. The active document and the
+ * one just converted are kept even if they don't fit on their own. Records the size of the converted document first,
+ * which may be an empty lock. Returns the bytes freed.
+ */
+size_t EnforceMemoryBudget(const DocumentLock& converted);
+
+/**
+ * Hand memory the allocator keeps around after frees back to the OS, where the platform allows it. Large caches are
+ * allocated on their own pages and are returned on free anyway, this also covers the fragments between small ones.
+ */
+void ReleaseFreedMemory();
+
+/**
+ * Spill every document cache to a file in the directory, written through a memory mapping, and free it, so the addon
+ * takes next to no memory while the panel is hidden. Each document is read back into memory the next time it is
+ * converted, with the tiles the webview has, so only tiles that changed in between are sent again. Documents that
+ * can't be written are dropped. Returns the bytes written.
+ */
+size_t HibernateDocuments(const std::string& directory);
+
+/**
+ * Free everything kept for a document except its tile hashes
+ */
+void DropPixelCaches(DocumentCache& doc);
@@ -0,0 +1,113 @@
+#include "PixelOutput.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "./core/DeltaCodec.h"
+#include "./core/DenseEncoding.h"
+#include "./core/Trace.h"
+#include "./utilities/UxpAddon.h"
+
+namespace {
+
+/**
+ * Hand the bytes to javascript as a Uint8Array over an external ArrayBuffer. The engine uses our allocation
+ * directly instead of copying it, and frees it through the finalizer once the array is garbage collected.
+ */
+addon_value CreateExternalUint8Array(addon_env env, std::vector<uint8_t>&& data) {
+    addon_value buffer;
+    const size_t length = data.size();
+
+    // An empty vector has no allocation, and engines may refuse an external buffer over a null pointer. There is
+    // nothing to share either, so empty output is an ordinary empty array.
+    if (length == 0) {
+        void* unused = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_arraybuffer(env, 0, &unused, &buffer));
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_typedarray(env, addon_uint8_array, 0, buffer, 0, &result));
+        return result;
+    }
+
+    auto* bytes = new std::vector<uint8_t>(std::move(data));
+    addon_status status = UxpAddonApis.uxp_addon_create_external_arraybuffer(env, bytes->data(), length,
+        [](addon_env, void*, void* hint) { delete static_cast<std::vector<uint8_t>*>(hint); }, bytes, &buffer);
+    if (status != addon_ok) {
+        delete bytes;
+        Check(status);
+    }
+
+    addon_value result;
+    Check(UxpAddonApis.uxp_addon_create_typedarray(env, addon_uint8_array, length, buffer, 0, &result));
+    return result;
+}
+
+}  // namespace
+
+OutputFormat GetOutputFormat(addon_env env, addon_value value) {
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    if (type == addon_undefined) {
+        return OutputFormat::kString;
+    }
+
+    std::string format = ReadString(env, value);
+    if (format == "string") return OutputFormat::kString;
+    if (format == "dense") return OutputFormat::kDense;
+    if (format == "buffer") return OutputFormat::kUint8Array;
+    if (format == "delta") return OutputFormat::kDelta;
+
+    throw std::invalid_argument("Unknown output format " + format + ", expected string, dense, buffer or delta");
+}
+
+void EncodePixels(const uint8_t* data, const uint8_t* previous, size_t length, OutputFormat format, PixelPayload& out) {
+    switch (format) {
+    case OutputFormat::kDense:
+        // Half as many characters to push through postMessage, at the cost of one encoding pass
+        out.units.resize(dense::MaxEncodedLength(length));
+        out.units.resize(dense::Encode(data, length, out.units.data()));
+        break;
+
+    case OutputFormat::kDelta: {
+        // Usually only a few pixels in a dirty tile changed, everything else compresses down to almost nothing
+        thread_local std::vector<uint8_t> encoded;
+        codec::Encode(data, previous, length, encoded);
+        out.units.resize(dense::MaxEncodedLength(encoded.size()));
+        out.units.resize(dense::Encode(encoded.data(), encoded.size(), out.units.data()));
+        break;
+    }
+
+    case OutputFormat::kString:
+    case OutputFormat::kUint8Array:
+    default:
+        // The cache is overwritten by the next conversion, so the payload needs bytes of its own
+        out.bytes.assign(data, data + length);
+        break;
+    }
+}
+
+addon_value CreatePixelOutput(addon_env env, PixelPayload& payload, OutputFormat format) {
+    trace::Span span("create output", "bytes", static_cast<int64_t>(payload.bytes.size() + payload.units.size() * 2));
+    addon_value result;
+
+    switch (format) {
+    case OutputFormat::kUint8Array:
+        // Skips building a string entirely, useful when the caller can consume bytes instead of charCodes
+        return CreateExternalUint8Array(env, std::move(payload.bytes));
+
+    case OutputFormat::kDense:
+    case OutputFormat::kDelta:
+        // Two bytes per charCode, see DenseEncoding.h
+        Check(UxpAddonApis.uxp_addon_create_string_utf16(env, payload.units.data(), payload.units.size(), &result));
+        return result;
+
+    case OutputFormat::kString:
+    default:
+        // This copies the buffer into the result var and will show up in js as a string.
+        // Every component is 0-255, so the cached bytes are already valid Latin-1 and the engine can keep them as a one byte
+        // string. charCodeAt returns the same values a UTF-16 string would, without us widening anything.
+        Check(UxpAddonApis.uxp_addon_create_string_latin1(
+            env, reinterpret_cast<const char*>(payload.bytes.data()), payload.bytes.size(), &result));
+        return result;
+    }
+}
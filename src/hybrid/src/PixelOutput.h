@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "./api/UxpAddonTypes.h"
+
+/**
+ * How converted pixels are handed back to javascript
+ */
+enum class OutputFormat {
+    kString,     // one charCode per byte
+    kDense,      // two bytes per charCode, see DenseEncoding.h
+    kUint8Array, // bytes in native memory, no string at all
+    kDelta,      // compressed against what the webview has, see DeltaCodec.h, then packed like kDense
+};
+
+/**
+ * Converted pixels for one batch or rect, already encoded in the output format. Building it doesn't touch any
+ * javascript value, so it can happen on a worker thread and be turned into a value on the scripting thread afterwards.
+ */
+struct PixelPayload {
+    std::vector<uint8_t> bytes;   // kString and kUint8Array
+    std::vector<char16_t> units;  // kDense and kDelta
+};
+
+/**
+ * Read the optional output format argument: "string" (the default when left out), "dense", "buffer" or "delta"
+ */
+OutputFormat GetOutputFormat(addon_env env, addon_value value);
+
+/**
+ * Encode converted RGBA bytes in the requested format. `previous` holds the bytes the webview has for the same pixels,
+ * or is null when that isn't known, and is only used by the delta format.
+ */
+void EncodePixels(const uint8_t* data, const uint8_t* previous, size_t length, OutputFormat format, PixelPayload& out);
+
+/**
+ * Create the javascript value for an encoded payload. A Uint8Array takes over the payload's memory.
+ */
+addon_value CreatePixelOutput(addon_env env, PixelPayload& payload, OutputFormat format);
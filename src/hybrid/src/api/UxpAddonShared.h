@@ -43,10 +43,10 @@
 
 #ifdef _WIN32
 #define UXP_EXTERN_API_STDCALL(type) __declspec(dllexport) type __stdcall
-#elif __GNUC__ && defined(__APPLE__)
+#elif __GNUC__
 #define UXP_EXTERN_API_STDCALL(type) __attribute__((visibility("default"))) type
 #else
-UXP_EXTERN_API_STDCALL(type)
+#define UXP_EXTERN_API_STDCALL(type) type
 #endif
 
 #define HYBRID_PLUGIN_SDK_VERSION "0.1.0"
@@ -0,0 +1,492 @@
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "Stats.h"
+
+namespace bc {
+
+namespace {
+
+constexpr int kPixels = 16;
+
+// A block as floats, the channels a format encodes together
+struct Block {
+    float pixels[kPixels][4];
+    int channels;
+};
+
+// Endpoints of a line through the block's colors, before quantization
+struct Line {
+    float start[4];
+    float end[4];
+};
+
+float Clamp255(float value) {
+    return std::min(255.0f, std::max(0.0f, value));
+}
+
+float Distance(const float* a, const float* b, int channels) {
+    float sum = 0.0f;
+    for (int c = 0; c < channels; c++)
+        sum += (a[c] - b[c]) * (a[c] - b[c]);
+    return sum;
+}
+
+/**
+ * Fast: the diagonal of the bounding box that follows the colors, each channel flipped when it falls while the widest
+ * channel rises. Otherwise the principal axis through the mean, found by power iteration on the covariance.
+ */
+Line FitLine(const Block& block, Quality quality) {
+    const int channels = block.channels;
+    float mean[4] = {};
+    for (int i = 0; i < kPixels; i++) {
+        for (int c = 0; c < channels; c++)
+            mean[c] += block.pixels[i][c] / kPixels;
+    }
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < kPixels; i++) {
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++)
+                covariance[a][b] += (block.pixels[i][a] - mean[a]) * (block.pixels[i][b] - mean[b]);
+        }
+    }
+
+    Line line = {};
+    if (quality == Quality::kFast) {
+        float low[4], high[4];
+        int widest = 0;
+        for (int c = 0; c < channels; c++) {
+            low[c] = high[c] = block.pixels[0][c];
+            for (int i = 1; i < kPixels; i++) {
+                low[c] = std::min(low[c], block.pixels[i][c]);
+                high[c] = std::max(high[c], block.pixels[i][c]);
+            }
+            if (high[c] - low[c] > high[widest] - low[widest])
+                widest = c;
+        }
+        for (int c = 0; c < channels; c++) {
+            bool flip = covariance[widest][c] < 0.0f;
+            line.start[c] = flip ? high[c] : low[c];
+            line.end[c] = flip ? low[c] : high[c];
+        }
+        return line;
+    }
+
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+        }
+        float length = 0.0f;
+        for (int c = 0; c < channels; c++)
+            length = std::max(length, std::fabs(next[c]));
+        if (length == 0.0f)
+            break;
+        for (int c = 0; c < channels; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float norm = 0.0f;
+    for (int c = 0; c < channels; c++)
+        norm += axis[c] * axis[c];
+    norm = norm > 0.0f ? 1.0f / std::sqrt(norm) : 0.0f;
+
+    float low = 0.0f, high = 0.0f;
+    for (int i = 0; i < kPixels; i++) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++)
+            t += (block.pixels[i][c] - mean[c]) * axis[c] * norm;
+        low = std::min(low, t);
+        high = std::max(high, t);
+    }
+    for (int c = 0; c < channels; c++) {
+        line.start[c] = Clamp255(mean[c] + axis[c] * norm * low);
+        line.end[c] = Clamp255(mean[c] + axis[c] * norm * high);
+    }
+    return line;
+}
+
+/**
+ * Least squares endpoints for the given indices, where index i sits `weights[i]` of the way from start to end.
+ * Returns false when the indices don't pin down a line, e.g. all pixels use the same index.
+ */
+bool RefineLine(const Block& block, const int* indices, const float* weights, Line& line) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float start_sum[4] = {}, end_sum[4] = {};
+    for (int i = 0; i < kPixels; i++) {
+        float w = weights[indices[i]];
+        aa += (1.0f - w) * (1.0f - w);
+        ab += (1.0f - w) * w;
+        bb += w * w;
+        for (int c = 0; c < block.channels; c++) {
+            start_sum[c] += (1.0f - w) * block.pixels[i][c];
+            end_sum[c] += w * block.pixels[i][c];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+
+    for (int c = 0; c < block.channels; c++) {
+        line.start[c] = Clamp255((bb * start_sum[c] - ab * end_sum[c]) / determinant);
+        line.end[c] = Clamp255((aa * end_sum[c] - ab * start_sum[c]) / determinant);
+    }
+    return true;
+}
+
+/**
+ * Pick the closest palette entry for every pixel, returns the total squared error. Entry i lies `weights[i]` of the
+ * way along the line, so all but high quality pick the entry closest to each pixel's projection onto the line instead
+ * of measuring the distance to every entry.
+ */
+float AssignIndices(const Block& block, const float (*palette)[4], const float* weights, int palette_size, int end,
+                    Quality quality, int* indices) {
+    if (quality != Quality::kHigh) {
+        float direction[4] = {};
+        float length = 0.0f;
+        for (int c = 0; c < block.channels; c++) {
+            direction[c] = palette[end][c] - palette[0][c];
+            length += direction[c] * direction[c];
+        }
+        float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+        float total = 0.0f;
+        for (int i = 0; i < kPixels; i++) {
+            float t = 0.0f;
+            for (int c = 0; c < block.channels; c++)
+                t += (block.pixels[i][c] - palette[0][c]) * direction[c];
+            t *= scale;
+
+            int best = 0;
+            for (int p = 1; p < palette_size; p++) {
+                if (std::fabs(weights[p] - t) < std::fabs(weights[best] - t))
+                    best = p;
+            }
+            indices[i] = best;
+            total += Distance(block.pixels[i], palette[best], block.channels);
+        }
+        return total;
+    }
+
+    float total = 0.0f;
+    for (int i = 0; i < kPixels; i++) {
+        float best = Distance(block.pixels[i], palette[0], block.channels);
+        indices[i] = 0;
+        for (int p = 1; p < palette_size; p++) {
+            float error = Distance(block.pixels[i], palette[p], block.channels);
+            if (error < best) {
+                best = error;
+                indices[i] = p;
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+int RefineIterations(Quality quality) {
+    switch (quality) {
+    case Quality::kFast: return 0;
+    case Quality::kBalanced: return 1;
+    case Quality::kHigh: return 4;
+    }
+    return 0;
+}
+
+void StoreLe16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+// Writes bit fields least significant bit first, the way BC7 blocks are laid out
+class BitWriter {
+ public:
+    explicit BitWriter(uint8_t* out) : out_(out) { std::memset(out_, 0, 16); }
+
+    void Write(uint32_t value, int bits) {
+        for (int b = 0; b < bits; b++, position_++) {
+            if ((value >> b) & 1)
+                out_[position_ / 8] |= static_cast<uint8_t>(1 << (position_ % 8));
+        }
+    }
+
+ private:
+    uint8_t* out_;
+    int position_ = 0;
+};
+
+//
+// BC1 color
+//
+
+uint16_t To565(const float* color) {
+    uint16_t r = static_cast<uint16_t>(std::lround(color[0] * 31.0f / 255.0f));
+    uint16_t g = static_cast<uint16_t>(std::lround(color[1] * 63.0f / 255.0f));
+    uint16_t b = static_cast<uint16_t>(std::lround(color[2] * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void From565(uint16_t color, float* out) {
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    out[0] = static_cast<float>((r << 3) | (r >> 2));
+    out[1] = static_cast<float>((g << 2) | (g >> 4));
+    out[2] = static_cast<float>((b << 3) | (b >> 2));
+    out[3] = 255.0f;
+}
+
+// Palette of the 4 color mode, index 0 and 1 being the endpoints
+void ColorPalette(uint16_t color0, uint16_t color1, float (*palette)[4]) {
+    From565(color0, palette[0]);
+    From565(color1, palette[1]);
+    for (int c = 0; c < 4; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+}
+
+void EncodeColor(const uint8_t* pixels, Quality quality, uint8_t* out) {
+    Block block;
+    block.channels = 3;
+    for (int i = 0; i < kPixels; i++) {
+        for (int c = 0; c < 4; c++)
+            block.pixels[i][c] = pixels[i * 4 + c];
+    }
+
+    static const float kWeights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+    Line line = FitLine(block, quality);
+    uint16_t best_color0 = 0, best_color1 = 0;
+    int best_indices[kPixels] = {};
+    float best_error = -1.0f;
+
+    for (int iteration = 0; iteration <= RefineIterations(quality); iteration++) {
+        uint16_t color0 = To565(line.start);
+        uint16_t color1 = To565(line.end);
+
+        float palette[4][4];
+        ColorPalette(color0, color1, palette);
+        int indices[kPixels];
+        float error = AssignIndices(block, palette, kWeights, 4, 1, quality, indices);
+
+        if (best_error >= 0.0f && error >= best_error)
+            break;
+        best_error = error;
+        best_color0 = color0;
+        best_color1 = color1;
+        std::memcpy(best_indices, indices, sizeof(indices));
+
+        if (!RefineLine(block, indices, kWeights, line))
+            break;
+    }
+
+    // color0 > color1 selects the 4 color mode. Swapping the endpoints swaps indices 0/1 and 2/3.
+    if (best_color0 < best_color1) {
+        std::swap(best_color0, best_color1);
+        for (int& index : best_indices)
+            index ^= 1;
+    } else if (best_color0 == best_color1) {
+        for (int& index : best_indices)
+            index = 0;
+    }
+
+    StoreLe16(out, best_color0);
+    StoreLe16(out + 2, best_color1);
+    uint32_t bits = 0;
+    for (int i = 0; i < kPixels; i++)
+        bits |= static_cast<uint32_t>(best_indices[i]) << (2 * i);
+    for (int b = 0; b < 4; b++)
+        out[4 + b] = static_cast<uint8_t>(bits >> (8 * b));
+}
+
+//
+// BC3 alpha
+//
+
+void EncodeAlpha(const uint8_t* pixels, uint8_t* out) {
+    uint8_t low = 255, high = 0;
+    for (int i = 0; i < kPixels; i++) {
+        low = std::min(low, pixels[i * 4 + 3]);
+        high = std::max(high, pixels[i * 4 + 3]);
+    }
+
+    // alpha0 > alpha1 selects 8 alphas: the endpoints and 6 steps between them. Equal endpoints only need index 0.
+    out[0] = high;
+    out[1] = low;
+
+    float palette[8] = {static_cast<float>(high), static_cast<float>(low)};
+    for (int i = 1; i < 7; i++)
+        palette[i + 1] = ((7 - i) * static_cast<float>(high) + i * static_cast<float>(low)) / 7.0f;
+
+    uint64_t bits = 0;
+    for (int i = 0; i < kPixels && high != low; i++) {
+        float alpha = pixels[i * 4 + 3];
+        int best = 0;
+        for (int p = 1; p < 8; p++) {
+            if (std::fabs(palette[p] - alpha) < std::fabs(palette[best] - alpha))
+                best = p;
+        }
+        bits |= static_cast<uint64_t>(best) << (3 * i);
+    }
+    for (int b = 0; b < 6; b++)
+        out[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+}
+
+//
+// BC7 mode 6
+//
+
+const int kBc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// An endpoint is 7 bits per channel plus a p-bit shared by its channels, the p-bit being the lowest bit of all of them
+struct Bc7Endpoint {
+    int values[4];
+    int p;
+};
+
+Bc7Endpoint QuantizeBc7(const float* color) {
+    Bc7Endpoint best = {};
+    float best_error = -1.0f;
+    for (int p = 0; p < 2; p++) {
+        Bc7Endpoint endpoint = {};
+        endpoint.p = p;
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            endpoint.values[c] = std::min(127, std::max(0, static_cast<int>(std::lround((color[c] - p) / 2.0f))));
+            float value = static_cast<float>(endpoint.values[c] * 2 + p);
+            error += (value - color[c]) * (value - color[c]);
+        }
+        if (best_error < 0.0f || error < best_error) {
+            best = endpoint;
+            best_error = error;
+        }
+    }
+    return best;
+}
+
+void Bc7Palette(const Bc7Endpoint& start, const Bc7Endpoint& end, float (*palette)[4]) {
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) {
+            int a = start.values[c] * 2 + start.p;
+            int b = end.values[c] * 2 + end.p;
+            palette[i][c] = static_cast<float>(((64 - kBc7Weights[i]) * a + kBc7Weights[i] * b + 32) >> 6);
+        }
+    }
+}
+
+void EncodeBc7(const uint8_t* pixels, Quality quality, uint8_t* out) {
+    Block block;
+    block.channels = 4;
+    for (int i = 0; i < kPixels; i++) {
+        for (int c = 0; c < 4; c++)
+            block.pixels[i][c] = pixels[i * 4 + c];
+    }
+
+    float weights[16];
+    for (int i = 0; i < 16; i++)
+        weights[i] = kBc7Weights[i] / 64.0f;
+
+    Line line = FitLine(block, quality);
+    Bc7Endpoint best_start = {}, best_end = {};
+    int best_indices[kPixels] = {};
+    float best_error = -1.0f;
+
+    for (int iteration = 0; iteration <= RefineIterations(quality); iteration++) {
+        Bc7Endpoint start = QuantizeBc7(line.start);
+        Bc7Endpoint end = QuantizeBc7(line.end);
+
+        float palette[16][4];
+        Bc7Palette(start, end, palette);
+        int indices[kPixels];
+        float error = AssignIndices(block, palette, weights, 16, 15, quality, indices);
+
+        if (best_error >= 0.0f && error >= best_error)
+            break;
+        best_error = error;
+        best_start = start;
+        best_end = end;
+        std::memcpy(best_indices, indices, sizeof(indices));
+
+        if (!RefineLine(block, indices, weights, line))
+            break;
+    }
+
+    // The first pixel's index is stored without its top bit, which must be 0. Swapping the endpoints mirrors the indices.
+    if (best_indices[0] >= 8) {
+        std::swap(best_start, best_end);
+        for (int& index : best_indices)
+            index = 15 - index;
+    }
+
+    BitWriter writer(out);
+    writer.Write(1 << 6, 7);  // mode 6
+    for (int c = 0; c < 4; c++) {
+        writer.Write(static_cast<uint32_t>(best_start.values[c]), 7);
+        writer.Write(static_cast<uint32_t>(best_end.values[c]), 7);
+    }
+    writer.Write(static_cast<uint32_t>(best_start.p), 1);
+    writer.Write(static_cast<uint32_t>(best_end.p), 1);
+    for (int i = 0; i < kPixels; i++)
+        writer.Write(static_cast<uint32_t>(best_indices[i]), i == 0 ? 3 : 4);
+}
+
+}  // namespace
+
+int64_t BlockBytes(Format format) {
+    return format == Format::kBc1 ? 8 : 16;
+}
+
+void EncodeBlock(const uint8_t* pixels, Format format, Quality quality, uint8_t* out) {
+    switch (format) {
+    case Format::kBc1:
+        EncodeColor(pixels, quality, out);
+        break;
+    case Format::kBc3:
+        EncodeAlpha(pixels, out);
+        EncodeColor(pixels, quality, out + 8);
+        break;
+    case Format::kBc7:
+        EncodeBc7(pixels, quality, out);
+        break;
+    }
+}
+
+BlockImage::BlockImage(int64_t width, int64_t height, Format format, Quality quality)
+    : width_(width), height_(height), format_(format), quality_(quality) {
+    if (width < 0 || height < 0)
+        throw std::invalid_argument("Image size can't be negative");
+    blocks_.assign(static_cast<size_t>(BlocksX() * BlocksY() * BlockBytes()), 0);
+    stats::RecordAllocation(blocks_.size());
+}
+
+void BlockImage::Encode(const uint8_t* pixels, const DirtyRect& block_rect) {
+    uint8_t block[kPixels * 4];
+    for (int64_t block_y = block_rect.y; block_y < block_rect.y + block_rect.height; block_y++) {
+        for (int64_t block_x = block_rect.x; block_x < block_rect.x + block_rect.width; block_x++) {
+            for (int64_t y = 0; y < kBlockSize; y++) {
+                int64_t source_y = std::min(block_y * kBlockSize + y, height_ - 1);
+                for (int64_t x = 0; x < kBlockSize; x++) {
+                    int64_t source_x = std::min(block_x * kBlockSize + x, width_ - 1);
+                    std::memcpy(block + (y * kBlockSize + x) * 4, pixels + (source_y * width_ + source_x) * 4, 4);
+                }
+            }
+            EncodeBlock(block, format_, quality_, blocks_.data() + (block_y * BlocksX() + block_x) * BlockBytes());
+        }
+    }
+}
+
+DirtyRect BlocksUnder(const DirtyRect& rect) {
+    int64_t x = rect.x / kBlockSize;
+    int64_t y = rect.y / kBlockSize;
+    return {x, y, (rect.x + rect.width + kBlockSize - 1) / kBlockSize - x,
+            (rect.y + rect.height + kBlockSize - 1) / kBlockSize - y};
+}
+
+}  // namespace bc
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "TileConversion.h"
+
+/**
+ * GPU block compression of sRGB RGBA8 pixels, so the webview can keep document textures compressed in VRAM.
+ *
+ * Every 4x4 block of pixels is encoded on its own. Blocks on the right and bottom edges of images that aren't a
+ * multiple of 4 repeat the edge pixels. Endpoints are fitted to the sRGB encoded values, which is what GPUs interpolate
+ * between for the sRGB variants of the formats.
+ *
+ *   BC1  8 bytes per block, RGB with 2 bit indices between two 565 endpoints. Alpha is dropped.
+ *   BC3  16 bytes per block, BC1 color plus 3 bit alpha indices between two 8 bit alpha endpoints.
+ *   BC7  16 bytes per block, always mode 6: RGBA with 4 bit indices between two 7 bit + p-bit endpoints.
+ */
+namespace bc {
+
+enum class Format {
+    kBc1,
+    kBc3,
+    kBc7,
+};
+
+enum class Quality {
+    kFast,      // endpoints from the bounding box of the block
+    kBalanced,  // endpoints along the principal axis of the block, refined once
+    kHigh,      // like balanced, refined until the error stops improving
+};
+
+constexpr int64_t kBlockSize = 4;
+
+int64_t BlockBytes(Format format);
+
+/**
+ * Encode 16 RGBA8 pixels (row-major, 64 bytes) into one block of `format`
+ */
+void EncodeBlock(const uint8_t* pixels, Format format, Quality quality, uint8_t* out);
+
+/**
+ * The blocks of one compressed image (a document or one of its mip levels), row-major like the pixels, as the webview
+ * has them.
+ */
+class BlockImage {
+ public:
+    BlockImage(int64_t width, int64_t height, Format format, Quality quality);
+
+    bool Matches(int64_t width, int64_t height, Format format, Quality quality) const {
+        return width_ == width && height_ == height && format_ == format && quality_ == quality;
+    }
+
+    int64_t BlocksX() const { return (width_ + kBlockSize - 1) / kBlockSize; }
+    int64_t BlocksY() const { return (height_ + kBlockSize - 1) / kBlockSize; }
+    int64_t BlockBytes() const { return bc::BlockBytes(format_); }
+    Format BlockFormat() const { return format_; }
+    Quality EncodeQuality() const { return quality_; }
+
+    uint8_t* Data() { return blocks_.data(); }
+    const uint8_t* Data() const { return blocks_.data(); }
+    size_t ByteSize() const { return blocks_.size(); }
+
+    /**
+     * Re-encode the blocks of `block_rect` (counted in blocks) from the image's RGBA8 pixels. Rects that don't overlap
+     * can be encoded on different threads.
+     */
+    void Encode(const uint8_t* pixels, const DirtyRect& block_rect);
+
+ private:
+    int64_t width_;
+    int64_t height_;
+    Format format_;
+    Quality quality_;
+    std::vector<uint8_t> blocks_;
+};
+
+// The blocks covering a rect of pixels
+DirtyRect BlocksUnder(const DirtyRect& rect);
+
+}  // namespace bc
@@ -0,0 +1,133 @@
+#include "BlueNoise.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace blue_noise {
+
+namespace {
+
+constexpr int64_t kSize = kBlueNoiseSize;
+constexpr int64_t kCells = kSize * kSize;
+
+/**
+ * Gaussian energy of each cell from the set cells around it, on a torus so the tile wraps. The tightest cluster is the
+ * set cell with the most energy, the largest void the empty cell with the least.
+ */
+class EnergyField {
+ public:
+    EnergyField() : kernel_(kCells), energy_(kCells, 0.0f), set_(kCells, false) {
+        const float sigma = 1.5f;
+        for (int64_t dy = 0; dy < kSize; dy++) {
+            for (int64_t dx = 0; dx < kSize; dx++) {
+                float x = static_cast<float>(std::min(dx, kSize - dx));
+                float y = static_cast<float>(std::min(dy, kSize - dy));
+                kernel_[dy * kSize + dx] = std::exp(-(x * x + y * y) / (2.0f * sigma * sigma));
+            }
+        }
+    }
+
+    bool IsSet(int64_t cell) const { return set_[cell]; }
+
+    void Set(int64_t cell, bool value) {
+        if (set_[cell] == value)
+            return;
+        set_[cell] = value;
+
+        float sign = value ? 1.0f : -1.0f;
+        int64_t cx = cell % kSize;
+        int64_t cy = cell / kSize;
+        for (int64_t y = 0; y < kSize; y++) {
+            const float* kernel_row = kernel_.data() + ((y - cy + kSize) % kSize) * kSize;
+            float* energy_row = energy_.data() + y * kSize;
+            for (int64_t x = 0; x < kSize; x++)
+                energy_row[x] += sign * kernel_row[(x - cx + kSize) % kSize];
+        }
+    }
+
+    int64_t TightestCluster() const {
+        int64_t best = -1;
+        for (int64_t i = 0; i < kCells; i++) {
+            if (set_[i] && (best < 0 || energy_[i] > energy_[best]))
+                best = i;
+        }
+        return best;
+    }
+
+    int64_t LargestVoid() const {
+        int64_t best = -1;
+        for (int64_t i = 0; i < kCells; i++) {
+            if (!set_[i] && (best < 0 || energy_[i] < energy_[best]))
+                best = i;
+        }
+        return best;
+    }
+
+ private:
+    std::vector<float> kernel_;
+    std::vector<float> energy_;
+    std::vector<bool> set_;
+};
+
+std::vector<float> Generate() {
+    // Initial pattern: a tenth of the cells set at pseudo random positions
+    const int64_t initial_count = kCells / 10;
+    EnergyField prototype;
+    uint32_t state = 0x9E3779B9u;
+    for (int64_t placed = 0; placed < initial_count;) {
+        state = state * 1664525u + 1013904223u;
+        int64_t cell = static_cast<int64_t>(state >> 8) % kCells;
+        if (!prototype.IsSet(cell)) {
+            prototype.Set(cell, true);
+            placed++;
+        }
+    }
+
+    // Move points from the tightest cluster into the largest void until that stops changing anything
+    for (int64_t step = 0; step < kCells; step++) {
+        int64_t cluster = prototype.TightestCluster();
+        prototype.Set(cluster, false);
+        int64_t void_cell = prototype.LargestVoid();
+        prototype.Set(void_cell, true);
+        if (void_cell == cluster)
+            break;
+    }
+
+    std::vector<int64_t> rank(kCells, 0);
+
+    // Rank the initial points by removing them tightest cluster first
+    {
+        EnergyField field = prototype;
+        for (int64_t r = initial_count - 1; r >= 0; r--) {
+            int64_t cluster = field.TightestCluster();
+            field.Set(cluster, false);
+            rank[cluster] = r;
+        }
+    }
+
+    // Rank everything else by filling the largest void first
+    {
+        EnergyField field = prototype;
+        for (int64_t r = initial_count; r < kCells; r++) {
+            int64_t void_cell = field.LargestVoid();
+            field.Set(void_cell, true);
+            rank[void_cell] = r;
+        }
+    }
+
+    std::vector<float> thresholds(kCells);
+    for (int64_t i = 0; i < kCells; i++)
+        thresholds[i] = (static_cast<float>(rank[i]) + 0.5f) / static_cast<float>(kCells);
+    return thresholds;
+}
+
+}  // namespace
+
+const float* Thresholds() {
+    static const std::vector<float> thresholds = Generate();
+    return thresholds.data();
+}
+
+}  // namespace blue_noise
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * A kBlueNoiseSize x kBlueNoiseSize tile of dither thresholds in [0, 1) with a blue noise spectrum: neighbouring
+ * thresholds are as different as possible, so quantization error ends up as fine grain instead of the visible cross
+ * hatching of an ordered dither. Every threshold appears exactly once, so the mean of a flat area is preserved.
+ *
+ * The tile is generated with the void-and-cluster method on first use, row-major, and wraps seamlessly.
+ */
+namespace blue_noise {
+
+constexpr int64_t kBlueNoiseSize = 64;
+
+const float* Thresholds();
+
+}  // namespace blue_noise
@@ -0,0 +1,187 @@
+#include "ChannelPacking.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void ChannelPacker::Packed::ResetChannel(int channel) {
+    if (width == 0)
+        return;
+
+    planes[channel].assign(static_cast<size_t>(width * height), 255);
+    for (uint8_t& tile : dirty)
+        tile = static_cast<uint8_t>(tile | (1 << channel));
+}
+
+void ChannelPacker::Map(int64_t packed_id, int channel, int64_t document_id, int source_channel) {
+    if (channel < 0 || channel >= kChannels)
+        throw std::out_of_range("Packed channel must be 0, 1 or 2");
+    if (source_channel < 0 || source_channel > 3)
+        throw std::out_of_range("Source channel must be 0 to 3");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Packed& packed = packed_[packed_id];
+    packed.sources[channel] = document_id < 0 ? Source() : Source{document_id, source_channel};
+    packed.ResetChannel(channel);
+}
+
+bool ChannelPacker::Remove(int64_t packed_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return packed_.erase(packed_id) != 0;
+}
+
+void ChannelPacker::Unmap(int64_t document_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : packed_) {
+        Packed& packed = entry.second;
+        for (int channel = 0; channel < kChannels; channel++) {
+            if (packed.sources[channel].document_id == document_id) {
+                packed.sources[channel] = Source();
+                packed.ResetChannel(channel);
+            }
+        }
+    }
+}
+
+bool ChannelPacker::Feeds(int64_t document_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : packed_) {
+        for (const Source& source : entry.second.sources) {
+            if (source.document_id == document_id)
+                return true;
+        }
+    }
+    return false;
+}
+
+size_t ChannelPacker::Write(int64_t document_id, const PixelCache& pixels, const std::vector<DirtyRect>& rects) {
+    if (pixels.BytesPerPixel() != 4)
+        return 0;
+
+    const int64_t tile_size = PixelCache::kTileSize;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t dirtied = 0;
+    for (auto& entry : packed_) {
+        Packed& packed = entry.second;
+        for (int channel = 0; channel < kChannels; channel++) {
+            const Source& source = packed.sources[channel];
+            if (source.document_id != document_id)
+                continue;
+
+            if (packed.width == 0) {
+                packed.width = pixels.Width();
+                packed.height = pixels.Height();
+                packed.dirty.assign(static_cast<size_t>(packed.TilesX() * packed.TilesY()), 0);
+                for (int reset = 0; reset < kChannels; reset++)
+                    packed.ResetChannel(reset);
+            }
+            if (!pixels.HasSize(packed.width, packed.height))
+                continue;
+
+            // Compared tile by tile, so a channel tile is only dirty when one of its own values changed
+            const uint8_t bit = static_cast<uint8_t>(1 << channel);
+            uint8_t* plane = packed.planes[channel].data();
+            for (const DirtyRect& rect : rects) {
+                for (int64_t tile_y = rect.y / tile_size; tile_y * tile_size < rect.y + rect.height; tile_y++) {
+                    int64_t y_begin = std::max(rect.y, tile_y * tile_size);
+                    int64_t y_end = std::min(rect.y + rect.height, (tile_y + 1) * tile_size);
+
+                    for (int64_t tile_x = rect.x / tile_size; tile_x * tile_size < rect.x + rect.width; tile_x++) {
+                        int64_t x_begin = std::max(rect.x, tile_x * tile_size);
+                        int64_t count = std::min(rect.x + rect.width, (tile_x + 1) * tile_size) - x_begin;
+
+                        uint32_t diff = 0;
+                        for (int64_t y = y_begin; y < y_end; y++) {
+                            const uint8_t* src = pixels.PixelAt(x_begin, y) + source.channel;
+                            uint8_t* dst = plane + y * packed.width + x_begin;
+                            for (int64_t x = 0; x < count; x++) {
+                                diff |= static_cast<uint32_t>(dst[x] ^ src[x * 4]);
+                                dst[x] = src[x * 4];
+                            }
+                        }
+
+                        uint8_t& tile = packed.dirty[static_cast<size_t>(tile_y * packed.TilesX() + tile_x)];
+                        if (diff != 0 && !(tile & bit)) {
+                            tile = static_cast<uint8_t>(tile | bit);
+                            dirtied++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return dirtied;
+}
+
+std::vector<ChannelPacker::Update> ChannelPacker::TakeUpdates() {
+    const int64_t tile_size = PixelCache::kTileSize;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<Update> updates;
+    for (auto& entry : packed_) {
+        Packed& packed = entry.second;
+        if (packed.width == 0)
+            continue;
+
+        Update update = {entry.first, packed.width, packed.height, {}};
+        const int64_t tiles_x = packed.TilesX();
+        for (int channel = 0; channel < kChannels; channel++) {
+            const uint8_t bit = static_cast<uint8_t>(1 << channel);
+            for (int64_t tile_y = 0; tile_y < packed.TilesY(); tile_y++) {
+                uint8_t* row_dirty = packed.dirty.data() + tile_y * tiles_x;
+                for (int64_t tile_x = 0; tile_x < tiles_x; tile_x++) {
+                    if (!(row_dirty[tile_x] & bit))
+                        continue;
+
+                    int64_t run_end = tile_x + 1;
+                    while (run_end < tiles_x && (row_dirty[run_end] & bit))
+                        run_end++;
+
+                    ChannelTile tile;
+                    tile.channel = channel;
+                    tile.rect.x = tile_x * tile_size;
+                    tile.rect.y = tile_y * tile_size;
+                    tile.rect.width = std::min(run_end * tile_size, packed.width) - tile.rect.x;
+                    tile.rect.height = std::min(tile.rect.y + tile_size, packed.height) - tile.rect.y;
+                    tile.values.resize(static_cast<size_t>(tile.rect.width * tile.rect.height));
+                    for (int64_t row = 0; row < tile.rect.height; row++) {
+                        std::memcpy(tile.values.data() + row * tile.rect.width,
+                                    packed.planes[channel].data() + (tile.rect.y + row) * packed.width + tile.rect.x,
+                                    static_cast<size_t>(tile.rect.width));
+                    }
+                    update.tiles.push_back(std::move(tile));
+
+                    for (int64_t cleared = tile_x; cleared < run_end; cleared++)
+                        row_dirty[cleared] = static_cast<uint8_t>(row_dirty[cleared] & ~bit);
+                    tile_x = run_end;
+                }
+            }
+        }
+
+        if (!update.tiles.empty())
+            updates.push_back(std::move(update));
+    }
+    return updates;
+}
+
+size_t ChannelPacker::Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return packed_.size();
+}
+
+size_t ChannelPacker::ByteSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t size = 0;
+    for (const auto& entry : packed_) {
+        for (const std::vector<uint8_t>& plane : entry.second.planes)
+            size += plane.size();
+        size += entry.second.dirty.size();
+    }
+    return size;
+}
+
+void ChannelPacker::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    packed_.clear();
+}
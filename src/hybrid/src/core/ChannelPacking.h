@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "PixelCache.h"
+#include "TileConversion.h"
+
+/**
+ * Textures that pack one channel of several documents into their R, G and B, the way ambient occlusion, roughness and
+ * metalness share one ORM texture in MeshStandardMaterial. Each packed channel is fed by one channel of a document's
+ * RGBA8 cache at full resolution.
+ *
+ * Converting a document writes its changed rects into the channels it feeds, and a tile of a channel is only marked
+ * dirty when its values changed. Dirty state is kept per channel: a roughness edit sends the changed tiles of the
+ * roughness channel alone, one byte per pixel, instead of the tiles of a whole extra RGBA texture.
+ *
+ * Channels without a document are 255, which leaves occlusion, roughness and metalness at the material's own values.
+ * A packed texture takes the size of the first document written into it. Documents of another size, and documents
+ * cached as half floats for HDR preview, don't feed it.
+ *
+ * Conversions of different documents write concurrently, the packer has its own lock.
+ */
+class ChannelPacker {
+ public:
+    static constexpr int kChannels = 3;
+
+    struct ChannelTile {
+        int channel;
+        DirtyRect rect;
+        std::vector<uint8_t> values;  // rect.width * rect.height bytes, row by row
+    };
+
+    struct Update {
+        int64_t packed_id;
+        int64_t width;
+        int64_t height;
+        std::vector<ChannelTile> tiles;
+    };
+
+    /**
+     * Feed `channel` of packed texture `packed_id` with `source_channel` (0-3, R to A) of a document, or clear it with
+     * a document id of -1. The packed texture is created by its first mapping. The channel goes back to 255 and is
+     * dirty as a whole until the document is written into it.
+     */
+    void Map(int64_t packed_id, int channel, int64_t document_id, int source_channel);
+
+    // Drop a packed texture, false if it didn't exist
+    bool Remove(int64_t packed_id);
+
+    // Clear every channel the document feeds, when it is closed
+    void Unmap(int64_t document_id);
+
+    // Whether the document feeds any channel, conversions of other documents skip the packer
+    bool Feeds(int64_t document_id) const;
+
+    /**
+     * Write `rects` of the document's cache into the channels it feeds. Returns how many channel tiles became dirty.
+     */
+    size_t Write(int64_t document_id, const PixelCache& pixels, const std::vector<DirtyRect>& rects);
+
+    // The dirty tiles of every packed texture as runs of tiles within a tile row per channel, clearing them
+    std::vector<Update> TakeUpdates();
+
+    size_t Size() const;
+    size_t ByteSize() const;
+    void Clear();
+
+ private:
+    struct Source {
+        int64_t document_id = -1;
+        int channel = 0;
+    };
+
+    struct Packed {
+        int64_t width = 0;  // 0 until a document was written into it
+        int64_t height = 0;
+        Source sources[kChannels];
+        std::vector<uint8_t> planes[kChannels];
+        std::vector<uint8_t> dirty;  // a bit per channel for each tile
+
+        int64_t TilesX() const { return (width + PixelCache::kTileSize - 1) / PixelCache::kTileSize; }
+        int64_t TilesY() const { return (height + PixelCache::kTileSize - 1) / PixelCache::kTileSize; }
+        void ResetChannel(int channel);
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<int64_t, Packed> packed_;
+};
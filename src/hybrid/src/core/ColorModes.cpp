@@ -0,0 +1,234 @@
+#include "ColorModes.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "Srgb.h"
+
+namespace color {
+namespace {
+
+// D50 white point, Photoshop's Lab is relative to it
+constexpr float kWhiteX = 0.96422f;
+constexpr float kWhiteZ = 0.82521f;
+
+// XYZ (D50) to linear sRGB, Bradford adapted
+constexpr float kXyzToRgb[3][3] = {
+    {3.1338561f, -1.6168667f, -0.4906146f},
+    {-0.9787684f, 1.9161415f, 0.0334540f},
+    {0.0719453f, -0.2289914f, 1.4052427f},
+};
+
+constexpr float kLabDelta = 6.0f / 29.0f;
+
+template <typename T>
+constexpr T MaxValue() {
+    if constexpr (sizeof(T) == 1)
+        return 255;
+    else if constexpr (sizeof(T) == 2)
+        return 32768;
+    else
+        return 1.0f;
+}
+
+/**
+ * Component `c` of pixel `i`, for chunky or planar pixels. `plane_stride` counts components.
+ */
+template <typename T, bool Chunky>
+inline T At(const T* src, size_t plane_stride, int64_t components, size_t i, int64_t c) {
+    return Chunky ? src[i * static_cast<size_t>(components) + static_cast<size_t>(c)] : src[static_cast<size_t>(c) * plane_stride + i];
+}
+
+template <typename T, bool Chunky>
+void GrayToRgba(const T* src, size_t plane_stride, int64_t components, T* dst, size_t count) {
+    const bool alpha = components == 2;
+    for (size_t i = 0; i < count; i++) {
+        T gray = At<T, Chunky>(src, plane_stride, components, i, 0);
+        dst[i * 4] = gray;
+        dst[i * 4 + 1] = gray;
+        dst[i * 4 + 2] = gray;
+        dst[i * 4 + 3] = alpha ? At<T, Chunky>(src, plane_stride, components, i, 1) : MaxValue<T>();
+    }
+}
+
+// What `ink` and black let through, both as stored: 0 is full ink
+inline uint8_t LetThrough(uint8_t ink, uint8_t black) {
+    return static_cast<uint8_t>((ink * black + 127) / 255);
+}
+
+inline uint16_t LetThrough(uint16_t ink, uint16_t black) {
+    return static_cast<uint16_t>((static_cast<uint32_t>(ink) * black + 16384) >> 15);
+}
+
+template <typename T, bool Chunky>
+void CmykToRgba(const T* src, size_t plane_stride, int64_t components, T* dst, size_t count) {
+    const bool alpha = components == 5;
+    for (size_t i = 0; i < count; i++) {
+        T black = At<T, Chunky>(src, plane_stride, components, i, 3);
+        dst[i * 4] = LetThrough(At<T, Chunky>(src, plane_stride, components, i, 0), black);
+        dst[i * 4 + 1] = LetThrough(At<T, Chunky>(src, plane_stride, components, i, 1), black);
+        dst[i * 4 + 2] = LetThrough(At<T, Chunky>(src, plane_stride, components, i, 2), black);
+        dst[i * 4 + 3] = alpha ? At<T, Chunky>(src, plane_stride, components, i, 4) : MaxValue<T>();
+    }
+}
+
+// Both sides are computed and blended by the compare, a branch would mispredict on noisy colors
+inline float LabInverse(float t) {
+    float cube = t * t * t;
+    float linear = 3.0f * kLabDelta * kLabDelta * (t - 4.0f / 29.0f);
+    return linear + static_cast<float>(t > kLabDelta) * (cube - linear);
+}
+
+// Linear sRGB of the Lab color given by f(Y) and the offsets of f(X) and f(Z) from it
+inline void LabToLinear(float fy, float a_offset, float b_offset, float* rgb) {
+    float x = kWhiteX * LabInverse(fy + a_offset);
+    float y = LabInverse(fy);
+    float z = kWhiteZ * LabInverse(fy - b_offset);
+    for (int c = 0; c < 3; c++)
+        rgb[c] = kXyzToRgb[c][0] * x + kXyzToRgb[c][1] * y + kXyzToRgb[c][2] * z;
+}
+
+/**
+ * XYZ of 8 bit Lab: Y by L*, X by L* and a*, Z by L* and b*, indexed [L * 256 + a] and [L * 256 + b]. With them a pixel
+ * is three lookups and the matrix, the cube roots' inverse never runs per pixel.
+ */
+struct LabTables {
+    float y[256];
+    float x[256 * 256];
+    float z[256 * 256];
+};
+
+const LabTables& Lab8Tables() {
+    static const std::unique_ptr<LabTables> tables = [] {
+        auto result = std::make_unique<LabTables>();
+        for (int l = 0; l < 256; l++) {
+            float fy = (static_cast<float>(l) * 100.0f / 255.0f + 16.0f) / 116.0f;
+            result->y[l] = LabInverse(fy);
+            for (int v = 0; v < 256; v++) {
+                result->x[l * 256 + v] = kWhiteX * LabInverse(fy + static_cast<float>(v - 128) / 500.0f);
+                result->z[l * 256 + v] = kWhiteZ * LabInverse(fy - static_cast<float>(v - 128) / 200.0f);
+            }
+        }
+        return result;
+    }();
+    return *tables;
+}
+
+template <bool Chunky>
+void Lab8ToRgba(const uint8_t* src, size_t plane_stride, int64_t components, uint8_t* dst, size_t count) {
+    const LabTables& tables = Lab8Tables();
+    const uint8_t* encode = srgb::EncodeTable();
+    const int max_index = (1 << srgb::kEncodeBits) - 1;
+    const float steps = static_cast<float>(max_index);
+    const bool alpha = components == 4;
+    for (size_t i = 0; i < count; i++) {
+        size_t l = At<uint8_t, Chunky>(src, plane_stride, components, i, 0);
+        float x = tables.x[l * 256 + At<uint8_t, Chunky>(src, plane_stride, components, i, 1)];
+        float y = tables.y[l];
+        float z = tables.z[l * 256 + At<uint8_t, Chunky>(src, plane_stride, components, i, 2)];
+        for (int c = 0; c < 3; c++) {
+            // srgb::Encode clamping the index instead of the float, out of gamut colors are common in Lab and the
+            // compares mispredict. The linear values stay well inside int's range.
+            float linear = kXyzToRgb[c][0] * x + kXyzToRgb[c][1] * y + kXyzToRgb[c][2] * z;
+            int index = static_cast<int>(linear * steps + 0.5f);
+            dst[i * 4 + c] = encode[std::min(std::max(index, 0), max_index)];
+        }
+        dst[i * 4 + 3] = alpha ? At<uint8_t, Chunky>(src, plane_stride, components, i, 3) : 255;
+    }
+}
+
+// 16 bit Lab has too many values for tables, it is converted to linear floats directly
+template <bool Chunky>
+void Lab16ToRgba(const uint16_t* src, size_t plane_stride, int64_t components, float* dst, size_t count) {
+    const bool alpha = components == 4;
+    // f(Y) and the offsets of f(X) and f(Z) straight from the components, as multiplications
+    const float l_scale = 100.0f / 32768.0f / 116.0f;
+    const float a_scale = 1.0f / 128.0f / 500.0f;
+    const float b_scale = 1.0f / 128.0f / 200.0f;
+    for (size_t i = 0; i < count; i++) {
+        float fy = static_cast<float>(At<uint16_t, Chunky>(src, plane_stride, components, i, 0)) * l_scale + 16.0f / 116.0f;
+        float a = static_cast<float>(At<uint16_t, Chunky>(src, plane_stride, components, i, 1) - 16384) * a_scale;
+        float b = static_cast<float>(At<uint16_t, Chunky>(src, plane_stride, components, i, 2) - 16384) * b_scale;
+        float rgb[3];
+        LabToLinear(fy, a, b, rgb);
+        for (int c = 0; c < 3; c++)
+            dst[i * 4 + c] = std::max(rgb[c], 0.0f);
+        dst[i * 4 + 3] = alpha ? static_cast<float>(At<uint16_t, Chunky>(src, plane_stride, components, i, 3)) / 32768.0f : 1.0f;
+    }
+}
+
+template <typename T, typename Out, void (*ChunkyConvert)(const T*, size_t, int64_t, Out*, size_t),
+          void (*PlanarConvert)(const T*, size_t, int64_t, Out*, size_t)>
+void Dispatch(const uint8_t* src, size_t plane_stride, bool is_chunky, int64_t components, uint8_t* dst, size_t count) {
+    const T* typed_src = reinterpret_cast<const T*>(src);
+    Out* typed_dst = reinterpret_cast<Out*>(dst);
+    if (is_chunky)
+        ChunkyConvert(typed_src, plane_stride / sizeof(T), components, typed_dst, count);
+    else
+        PlanarConvert(typed_src, plane_stride / sizeof(T), components, typed_dst, count);
+}
+
+}  // namespace
+
+const char* ModeName(Mode mode) {
+    switch (mode) {
+    case Mode::kRgb: return "RGB";
+    case Mode::kGrayscale: return "grayscale";
+    case Mode::kLab: return "Lab";
+    case Mode::kCmyk: return "CMYK";
+    }
+    return "unknown";
+}
+
+int64_t ColorComponents(Mode mode) {
+    switch (mode) {
+    case Mode::kGrayscale: return 1;
+    case Mode::kCmyk: return 4;
+    default: return 3;
+    }
+}
+
+bool SupportsComponentSize(Mode mode, int64_t component_size) {
+    if (component_size == 8 || component_size == 16)
+        return true;
+    return component_size == 32 && (mode == Mode::kRgb || mode == Mode::kGrayscale);
+}
+
+int64_t RgbaComponentSize(Mode mode, int64_t component_size) {
+    return mode == Mode::kLab && component_size == 16 ? 32 : component_size;
+}
+
+void ToRgba(Mode mode, const uint8_t* src, size_t plane_stride, bool is_chunky, int64_t components, int64_t component_size,
+            uint8_t* dst, size_t count) {
+    if (!SupportsComponentSize(mode, component_size))
+        throw std::invalid_argument(std::string("No ") + ModeName(mode) + " pixels of this component size");
+
+    switch (mode) {
+    case Mode::kGrayscale:
+        if (component_size == 8)
+            Dispatch<uint8_t, uint8_t, GrayToRgba<uint8_t, true>, GrayToRgba<uint8_t, false>>(src, plane_stride, is_chunky, components, dst, count);
+        else if (component_size == 16)
+            Dispatch<uint16_t, uint16_t, GrayToRgba<uint16_t, true>, GrayToRgba<uint16_t, false>>(src, plane_stride, is_chunky, components, dst, count);
+        else
+            Dispatch<float, float, GrayToRgba<float, true>, GrayToRgba<float, false>>(src, plane_stride, is_chunky, components, dst, count);
+        break;
+    case Mode::kLab:
+        if (component_size == 8)
+            Dispatch<uint8_t, uint8_t, Lab8ToRgba<true>, Lab8ToRgba<false>>(src, plane_stride, is_chunky, components, dst, count);
+        else
+            Dispatch<uint16_t, float, Lab16ToRgba<true>, Lab16ToRgba<false>>(src, plane_stride, is_chunky, components, dst, count);
+        break;
+    case Mode::kCmyk:
+        if (component_size == 8)
+            Dispatch<uint8_t, uint8_t, CmykToRgba<uint8_t, true>, CmykToRgba<uint8_t, false>>(src, plane_stride, is_chunky, components, dst, count);
+        else
+            Dispatch<uint16_t, uint16_t, CmykToRgba<uint16_t, true>, CmykToRgba<uint16_t, false>>(src, plane_stride, is_chunky, components, dst, count);
+        break;
+    case Mode::kRgb:
+        throw std::invalid_argument("RGB pixels don't need converting");
+    }
+}
+
+}  // namespace color
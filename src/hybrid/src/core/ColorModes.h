@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Grayscale, Lab and CMYK documents, converted to RGBA on their way into the cache so they preview like RGB documents
+ * without Photoshop converting them on every edit. Pixels come in the components of the document's color mode,
+ * optionally followed by alpha, as 8 bit, 16 bit (0-32768) or, for RGB and grayscale only, 32 bit linear floats:
+ *
+ *   grayscale  one gray component, sRGB encoded like RGB
+ *   Lab        L* over the whole range, a* and b* neutral at half of it (128 or 16384), D50 like Photoshop's Lab. It is
+ *              converted to sRGB through lookup tables of the 8 bit components and the sRGB encoding.
+ *   CMYK       inks as Photoshop stores them, 0 for full ink. The conversion is naive, the document's profile isn't
+ *              applied: each of R, G and B is what its complementary ink and the black ink let through.
+ *
+ * 8 bit grayscale has kernels of its own, see Kernels.h. The other modes are converted with ToRgba a tile row at a time
+ * into scratch memory, which then goes through the RGBA paths.
+ */
+namespace color {
+
+enum class Mode { kRgb, kGrayscale, kLab, kCmyk };
+
+const char* ModeName(Mode mode);
+
+// Components of a pixel, without alpha
+int64_t ColorComponents(Mode mode);
+
+// Photoshop only has 32 bit RGB and grayscale documents
+bool SupportsComponentSize(Mode mode, int64_t component_size);
+
+// Bits per component of the pixels ToRgba writes. 16 bit Lab becomes linear 32 bit floats, which the deep conversion
+// quantizes like any 32 bit document. Everything else keeps its size.
+int64_t RgbaComponentSize(Mode mode, int64_t component_size);
+
+/**
+ * Convert `count` pixels of one row into chunky RGBA with RgbaComponentSize bits per component, opaque when the source
+ * has no alpha. `src` points at the first pixel, in the first plane for planar data, and planes follow every
+ * `plane_stride` bytes.
+ */
+void ToRgba(Mode mode, const uint8_t* src, size_t plane_stride, bool is_chunky, int64_t components, int64_t component_size,
+            uint8_t* dst, size_t count);
+
+}  // namespace color
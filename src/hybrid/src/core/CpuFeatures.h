@@ -0,0 +1,13 @@
+#pragma once
+
+/**
+ * Instruction set extensions available on the CPU we're running on. Queried once, since Photoshop can run the same
+ * x64 build on machines with and without AVX2.
+ */
+struct CpuFeatures {
+    bool sse2 = false;
+    bool avx2 = false;
+    bool neon = false;
+};
+
+const CpuFeatures& GetCpuFeatures();
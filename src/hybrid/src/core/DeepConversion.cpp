@@ -0,0 +1,382 @@
+#include "DeepConversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BlueNoise.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DEEP_SSE2 1
+#endif
+
+namespace deep {
+
+namespace {
+
+// Pixels are converted in blocks: the components are first read into planes of normalized floats, then quantized or
+// converted to half floats into the cache. Splitting it up keeps each step a simple loop over contiguous floats.
+constexpr size_t kBlock = 64;
+
+struct Block {
+    alignas(16) float channels[4][kBlock];
+    alignas(16) float thresholds[kBlock];
+};
+
+constexpr float kMax16 = 32768.0f;  // Photoshop's 16 bit white
+constexpr int kEncodeSteps = 4096;  // entries of the linear to sRGB table, interpolated in between
+
+// Added to float bits to move the exponent from float to half bias, (15 - 127) << 23, plus 0xFFF for rounding
+constexpr uint32_t kHalfRebias = 0xC8000FFFu;
+
+float LinearToSrgb(float value) {
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+float SrgbToLinear(float value) {
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Linear to sRGB at kEncodeSteps + 1 evenly spaced points over [0, 1], plus one so interpolation never reads past it
+const float* EncodeTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> values(kEncodeSteps + 2);
+        for (int i = 0; i <= kEncodeSteps + 1; i++)
+            values[i] = LinearToSrgb(std::min(1.0f, static_cast<float>(i) / kEncodeSteps));
+        return values;
+    }();
+    return table.data();
+}
+
+// Linear value of every 16 bit sRGB component
+const float* DecodeTable16() {
+    static const std::vector<float> table = [] {
+        std::vector<float> values(static_cast<size_t>(kMax16) + 1);
+        for (size_t i = 0; i < values.size(); i++)
+            values[i] = SrgbToLinear(static_cast<float>(i) / kMax16);
+        return values;
+    }();
+    return table.data();
+}
+
+const float* OrderedThresholds() {
+    static const std::vector<float> table = [] {
+        static const int bayer[8][8] = {
+            { 0, 32,  8, 40,  2, 34, 10, 42},
+            {48, 16, 56, 24, 50, 18, 58, 26},
+            {12, 44,  4, 36, 14, 46,  6, 38},
+            {60, 28, 52, 20, 62, 30, 54, 22},
+            { 3, 35, 11, 43,  1, 33,  9, 41},
+            {51, 19, 59, 27, 49, 17, 57, 25},
+            {15, 47,  7, 39, 13, 45,  5, 37},
+            {63, 31, 55, 23, 61, 29, 53, 21},
+        };
+        std::vector<float> values(64);
+        for (int i = 0; i < 64; i++)
+            values[i] = (static_cast<float>(bayer[i / 8][i % 8]) + 0.5f) / 64.0f;
+        return values;
+    }();
+    return table.data();
+}
+
+// Clamp to [0, 1], NaN becomes 0
+inline float Clamp01(float value) {
+    return value > 0.0f ? std::min(value, 1.0f) : 0.0f;
+}
+
+void EncodeSrgb(float* values, size_t count) {
+    const float* table = EncodeTable();
+    for (size_t i = 0; i < count; i++) {
+        float position = Clamp01(values[i]) * kEncodeSteps;
+        int index = static_cast<int>(position);
+        float fraction = position - static_cast<float>(index);
+        values[i] = table[index] + (table[index + 1] - table[index]) * fraction;
+    }
+}
+
+/**
+ * Read one component of `count` pixels into normalized floats. `stride` is the distance between pixels in bytes.
+ * 16 bit values are either scaled to [0, 1] or, with `decode`, looked up as linear light.
+ */
+void LoadChannel16(const uint8_t* src, size_t stride, size_t count, bool decode, float* out) {
+    if (decode) {
+        const float* table = DecodeTable16();
+        for (size_t i = 0; i < count; i++) {
+            uint16_t value;
+            std::memcpy(&value, src + i * stride, sizeof(value));
+            out[i] = table[std::min<uint16_t>(value, static_cast<uint16_t>(kMax16))];
+        }
+        return;
+    }
+
+    const float scale = 1.0f / kMax16;
+    size_t i = 0;
+#if defined(DEEP_SSE2)
+    if (stride == sizeof(uint16_t)) {
+        const __m128 scale4 = _mm_set1_ps(scale);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= count; i += 8) {
+            __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+            __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero));
+            __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero));
+            _mm_store_ps(out + i, _mm_mul_ps(lo, scale4));
+            _mm_store_ps(out + i + 4, _mm_mul_ps(hi, scale4));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t value;
+        std::memcpy(&value, src + i * stride, sizeof(value));
+        out[i] = static_cast<float>(value) * scale;
+    }
+}
+
+// Same for 32 bit floats, optionally encoded to sRGB
+void LoadChannel32(const uint8_t* src, size_t stride, size_t count, bool encode, float* out) {
+    if (stride == sizeof(float)) {
+        std::memcpy(out, src, count * sizeof(float));
+    } else {
+        for (size_t i = 0; i < count; i++)
+            std::memcpy(out + i, src + i * stride, sizeof(float));
+    }
+
+    if (encode)
+        EncodeSrgb(out, count);
+}
+
+void FillThresholds(Quantization quantization, int64_t x, int64_t y, size_t count, float* out) {
+    if (quantization == Quantization::kOrdered) {
+        const float* row = OrderedThresholds() + (y & 7) * 8;
+        for (size_t i = 0; i < count; i++)
+            out[i] = row[(x + static_cast<int64_t>(i)) & 7];
+    } else if (quantization == Quantization::kBlueNoise) {
+        const int64_t size = blue_noise::kBlueNoiseSize;
+        const float* row = blue_noise::Thresholds() + (y & (size - 1)) * size;
+        for (size_t i = 0; i < count; i++)
+            out[i] = row[(x + static_cast<int64_t>(i)) & (size - 1)];
+    } else {
+        std::fill(out, out + count, 0.5f);
+    }
+}
+
+inline uint8_t Quantize(float value, float threshold) {
+    return static_cast<uint8_t>(Clamp01(value) * 255.0f + threshold);
+}
+
+uint16_t FloatToHalfBits(uint32_t bits) {
+    if (bits < (113u << 23)) {
+        // Half denormal, let the float adder do the shifting and rounding
+        const uint32_t magic = 126u << 23;
+        float value, magic_value;
+        std::memcpy(&value, &bits, sizeof(value));
+        std::memcpy(&magic_value, &magic, sizeof(magic_value));
+        value += magic_value;
+        uint32_t result;
+        std::memcpy(&result, &value, sizeof(result));
+        return static_cast<uint16_t>(result - magic);
+    }
+
+    // Rebias the exponent and round the mantissa to nearest even
+    uint32_t mantissa_odd = (bits >> 13) & 1;
+    bits += kHalfRebias;
+    bits += mantissa_odd;
+    return static_cast<uint16_t>(bits >> 13);
+}
+
+// Quantize the block into RGBA8 at dst, returns whether anything was different
+bool StoreRgba8(const Block& block, size_t count, uint8_t* dst) {
+    bool changed = false;
+    size_t i = 0;
+
+#if defined(DEEP_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    __m128i diff = _mm_setzero_si128();
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 threshold = _mm_load_ps(block.thresholds + i);
+        __m128i q[4];
+        for (int c = 0; c < 4; c++) {
+            // max first so NaN becomes 0
+            __m128 value = _mm_min_ps(_mm_max_ps(_mm_load_ps(block.channels[c] + i), zero), one);
+            q[c] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), threshold));
+        }
+
+        // r0-3 g0-3 b0-3 a0-3, then transposed to r0 g0 b0 a0 r1 ...
+        __m128i planes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        __m128i pairs = _mm_unpacklo_epi8(planes, _mm_srli_si128(planes, 8));
+        __m128i rgba = _mm_unpacklo_epi8(pairs, _mm_srli_si128(pairs, 8));
+
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i * 4);
+        diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128(out), rgba));
+        _mm_storeu_si128(out, rgba);
+    }
+    changed = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+#endif
+
+    for (; i < count; i++) {
+        for (int c = 0; c < 4; c++) {
+            uint8_t value = Quantize(block.channels[c][i], block.thresholds[i]);
+            changed |= dst[i * 4 + c] != value;
+            dst[i * 4 + c] = value;
+        }
+    }
+    return changed;
+}
+
+#if defined(DEEP_SSE2)
+// Vector version of FloatToHalf, four values at once
+inline __m128i FloatToHalf4(__m128 value) {
+    __m128 clamped = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(65504.0f));
+    __m128i bits = _mm_castps_si128(clamped);
+
+    __m128i mantissa_odd = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(bits, _mm_set1_epi32(static_cast<int>(kHalfRebias)));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissa_odd), 13);
+
+    const __m128i magic = _mm_set1_epi32(126 << 23);
+    __m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(clamped, _mm_castsi128_ps(magic))), magic);
+
+    __m128i is_denormal = _mm_cmplt_epi32(bits, _mm_set1_epi32(113 << 23));
+    return _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+}
+#endif
+
+// Convert the block into RGBA half floats at dst, returns whether anything was different
+bool StoreHalf(const Block& block, size_t count, uint8_t* dst) {
+    bool changed = false;
+    size_t i = 0;
+
+#if defined(DEEP_SSE2)
+    __m128i diff = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i h[4];
+        for (int c = 0; c < 4; c++)
+            h[c] = FloatToHalf4(_mm_load_ps(block.channels[c] + i));
+
+        // Halves are at most 0x7BFF, so the signed pack doesn't saturate
+        __m128i rg = _mm_packs_epi32(h[0], h[1]);
+        __m128i ba = _mm_packs_epi32(h[2], h[3]);
+        __m128i rb = _mm_unpacklo_epi16(rg, ba);
+        __m128i ga = _mm_unpackhi_epi16(rg, ba);
+        __m128i rgba[2] = {_mm_unpacklo_epi16(rb, ga), _mm_unpackhi_epi16(rb, ga)};
+
+        for (int half = 0; half < 2; half++) {
+            __m128i* out = reinterpret_cast<__m128i*>(dst + i * 8 + half * 16);
+            diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128(out), rgba[half]));
+            _mm_storeu_si128(out, rgba[half]);
+        }
+    }
+    changed = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+#endif
+
+    for (; i < count; i++) {
+        for (int c = 0; c < 4; c++) {
+            uint16_t value = FloatToHalf(block.channels[c][i]);
+            uint16_t old;
+            std::memcpy(&old, dst + i * 8 + c * 2, sizeof(old));
+            changed |= old != value;
+            std::memcpy(dst + i * 8 + c * 2, &value, sizeof(value));
+        }
+    }
+    return changed;
+}
+
+}  // namespace
+
+uint16_t FloatToHalf(float value) {
+    // Written so NaN fails the comparison and becomes 0
+    float clamped = value > 0.0f ? std::min(value, 65504.0f) : 0.0f;
+    uint32_t bits;
+    std::memcpy(&bits, &clamped, sizeof(bits));
+    return FloatToHalfBits(bits);
+}
+
+float HalfToFloat(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+
+    float value;
+    if (exponent == 0) {
+        // Denormal, mantissa * 2^-24
+        value = static_cast<float>(mantissa) * (1.0f / 16777216.0f);
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits |= sign;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Infinity and NaN keep an all ones exponent
+    uint32_t bits = sign | (exponent == 0x1F ? 0x7F800000u : (exponent + 127 - 15) << 23) | (mantissa << 13);
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+const float* HalfTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> values(65536);
+        for (size_t i = 0; i < values.size(); i++)
+            values[i] = HalfToFloat(static_cast<uint16_t>(i));
+        return values;
+    }();
+    return table.data();
+}
+
+bool ConvertPixels(const uint8_t* src, size_t plane_stride, bool is_chunky, int64_t components, int64_t component_size,
+                   Quantization quantization, int64_t x, int64_t y, uint8_t* dst, size_t count) {
+    if (component_size != 16 && component_size != 32) {
+        throw std::invalid_argument("Expected 16 or 32 bit components, got " + std::to_string(component_size));
+    }
+
+    const size_t component_bytes = static_cast<size_t>(component_size / 8);
+    const size_t pixel_stride = is_chunky ? component_bytes * components : component_bytes;
+    const size_t channel_offset = is_chunky ? component_bytes : plane_stride;
+    const bool half = quantization == Quantization::kHalf;
+    const size_t cache_pixel_bytes = static_cast<size_t>(CacheBytesPerPixel(quantization));
+
+    // 8 bit output is sRGB encoded, half floats are linear. Alpha is never transformed.
+    const bool decode = half && component_size == 16;
+    const bool encode = !half && component_size == 32;
+
+    Block block;
+    bool changed = false;
+
+    for (size_t start = 0; start < count; start += kBlock) {
+        size_t n = std::min(kBlock, count - start);
+        const uint8_t* pixels = src + start * pixel_stride;
+
+        for (int64_t c = 0; c < 4; c++) {
+            float* channel = block.channels[c];
+            if (c >= components) {
+                std::fill(channel, channel + n, 1.0f);
+                continue;
+            }
+
+            bool color = c < 3;
+            const uint8_t* component = pixels + channel_offset * c;
+            if (component_size == 16)
+                LoadChannel16(component, pixel_stride, n, color && decode, channel);
+            else
+                LoadChannel32(component, pixel_stride, n, color && encode, channel);
+        }
+
+        uint8_t* out = dst + start * cache_pixel_bytes;
+        if (half) {
+            changed |= StoreHalf(block, n, out);
+        } else {
+            FillThresholds(quantization, x + static_cast<int64_t>(start), y, n, block.thresholds);
+            changed |= StoreRgba8(block, n, out);
+        }
+    }
+
+    return changed;
+}
+
+}  // namespace deep
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Conversion of 16 bit and 32 bit Photoshop pixel data into the cache, so deep documents can be read as they are
+ * instead of having Photoshop down-convert them on every edit.
+ *
+ * 16 bit components use Photoshop's 0-32768 range and are gamma encoded like 8 bit data. 32 bit components are linear
+ * light floats that may go past 1.0. For the 8 bit cache both are quantized to sRGB encoded RGBA8, optionally dithered
+ * so smooth gradients don't band. For HDR preview the cache instead holds linear RGBA half floats, 8 bytes per pixel.
+ *
+ * Like the kernels in Kernels.h, every conversion stores the new pixels in the cache and reports whether any cached
+ * value was different. Dithering only depends on the pixel position, so an unchanged source still compares equal.
+ */
+namespace deep {
+
+enum class Quantization {
+    kRound,      // nearest 8 bit value
+    kOrdered,    // 8x8 Bayer matrix dither
+    kBlueNoise,  // 64x64 blue noise dither, see BlueNoise.h
+    kHalf,       // no quantization, linear RGBA half floats
+};
+
+// Cache bytes per pixel when converting with the quantization
+inline int64_t CacheBytesPerPixel(Quantization quantization) {
+    return quantization == Quantization::kHalf ? 8 : 4;
+}
+
+/**
+ * Convert `count` pixels of one image row. `src` points at the first pixel, in the R plane for planar data, and
+ * planes follow every `plane_stride` bytes. `x` and `y` is the image position of the first pixel, which picks the
+ * dither thresholds. `component_size` is 16 or 32.
+ */
+bool ConvertPixels(const uint8_t* src, size_t plane_stride, bool is_chunky, int64_t components, int64_t component_size,
+                   Quantization quantization, int64_t x, int64_t y, uint8_t* dst, size_t count);
+
+// Half float conversion for non-negative values, rounded to nearest even and clamped to 65504. Exposed for checks.
+uint16_t FloatToHalf(float value);
+
+// The float value of half float bits
+float HalfToFloat(uint16_t half);
+
+// HalfToFloat of every half float, indexed by its bits
+const float* HalfTable();
+
+}  // namespace deep
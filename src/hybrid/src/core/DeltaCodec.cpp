@@ -0,0 +1,173 @@
+#include "DeltaCodec.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "Lz4.h"
+
+namespace codec {
+
+namespace {
+
+inline void WriteVarint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline size_t ReadVarint(const uint8_t*& in, const uint8_t* end) {
+    size_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in >= end)
+            throw std::runtime_error("Truncated run-length stream");
+        uint8_t byte = *in++;
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return value;
+    }
+    throw std::runtime_error("Varint is too long");
+}
+
+inline void WriteU32(uint8_t* out, size_t value) {
+    for (int i = 0; i < 4; i++)
+        out[i] = static_cast<uint8_t>(value >> (i * 8));
+}
+
+inline size_t ReadU32(const uint8_t* in) {
+    return static_cast<size_t>(in[0]) | (static_cast<size_t>(in[1]) << 8) | (static_cast<size_t>(in[2]) << 16) |
+           (static_cast<size_t>(in[3]) << 24);
+}
+
+// Length of the run of zero bytes starting at data, up to length. Checks a word at a time.
+inline size_t ZeroRun(const uint8_t* data, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        if (word != 0)
+            break;
+    }
+    while (i < length && data[i] == 0)
+        i++;
+    return i;
+}
+
+// Whether all 8 bytes at data are zero
+inline bool IsZeroWord(const uint8_t* data) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    return word == 0;
+}
+
+// Runs are found a word at a time, so zero runs only start on a multiple of 8 bytes from the last literal. Shorter
+// zero runs stay in the literals, which LZ4 still squeezes.
+void RunLengthEncode(const uint8_t* data, size_t length, std::vector<uint8_t>& out) {
+    size_t i = 0;
+    while (i < length) {
+        size_t zeros = ZeroRun(data + i, length - i);
+        i += zeros;
+
+        size_t literal_start = i;
+        while (i + 8 <= length && !IsZeroWord(data + i))
+            i += 8;
+        // Less than a word left, keep it as literals unless it's all zero
+        if (i + 8 > length && ZeroRun(data + i, length - i) != length - i)
+            i = length;
+
+        WriteVarint(out, zeros);
+        WriteVarint(out, i - literal_start);
+        out.insert(out.end(), data + literal_start, data + i);
+    }
+}
+
+}  // namespace
+
+void Encode(const uint8_t* pixels, const uint8_t* previous, size_t length, std::vector<uint8_t>& out) {
+    if (length > 0xFFFFFFFFu)
+        throw std::length_error("Pixel payload is too large to encode");
+
+    // Scratch space reused between calls. Rects are encoded on several threads at once, so each has its own.
+    thread_local std::vector<uint8_t> delta;
+    thread_local std::vector<uint8_t> runs;
+
+    const uint8_t* source = pixels;
+    if (previous != nullptr) {
+        delta.resize(length);
+        for (size_t i = 0; i < length; i++)
+            delta[i] = pixels[i] ^ previous[i];
+        source = delta.data();
+    }
+
+    runs.clear();
+    RunLengthEncode(source, length, runs);
+
+    out.resize(kHeaderSize + lz4::CompressBound(runs.size()));
+    size_t compressed = lz4::Compress(runs.data(), runs.size(), out.data() + kHeaderSize);
+
+    uint8_t flags = previous != nullptr ? kFlagDelta : 0;
+    if (compressed < runs.size()) {
+        flags |= kFlagLz4;
+        out.resize(kHeaderSize + compressed);
+    } else {
+        std::memcpy(out.data() + kHeaderSize, runs.data(), runs.size());
+        out.resize(kHeaderSize + runs.size());
+    }
+
+    out[0] = kVersion;
+    out[1] = flags;
+    out[2] = out[3] = 0;
+    WriteU32(out.data() + 4, length);
+    WriteU32(out.data() + 8, runs.size());
+    WriteU32(out.data() + 12, out.size() - kHeaderSize);
+}
+
+void Decode(const uint8_t* encoded, size_t encoded_length, uint8_t* pixels, size_t length) {
+    if (encoded_length < kHeaderSize || encoded[0] != kVersion)
+        throw std::runtime_error("Not an encoded pixel payload");
+    if (ReadU32(encoded + 4) != length)
+        throw std::runtime_error("Encoded pixel payload doesn't match the pixel count");
+
+    uint8_t flags = encoded[1];
+    size_t runs_length = ReadU32(encoded + 8);
+    size_t payload_length = ReadU32(encoded + 12);
+    if (payload_length > encoded_length - kHeaderSize)
+        throw std::runtime_error("Truncated pixel payload");
+
+    std::vector<uint8_t> decompressed;
+    const uint8_t* runs = encoded + kHeaderSize;
+    if (flags & kFlagLz4) {
+        decompressed.resize(runs_length);
+        if (lz4::Decompress(runs, payload_length, decompressed.data(), runs_length) != runs_length)
+            throw std::runtime_error("Run-length stream size doesn't match");
+        runs = decompressed.data();
+    } else if (payload_length != runs_length) {
+        throw std::runtime_error("Run-length stream size doesn't match");
+    }
+
+    const uint8_t* in = runs;
+    const uint8_t* end = runs + runs_length;
+    size_t i = 0;
+    while (in < end) {
+        size_t zeros = ReadVarint(in, end);
+        size_t literals = ReadVarint(in, end);
+        if (zeros > length - i || literals > length - i - zeros || literals > static_cast<size_t>(end - in))
+            throw std::runtime_error("Run-length stream overruns the pixels");
+
+        // Zeros leave delta pixels as they were
+        if (!(flags & kFlagDelta))
+            std::memset(pixels + i, 0, zeros);
+        i += zeros;
+
+        for (size_t j = 0; j < literals; j++)
+            pixels[i + j] = (flags & kFlagDelta) ? pixels[i + j] ^ in[j] : in[j];
+        in += literals;
+        i += literals;
+    }
+
+    if (i != length)
+        throw std::runtime_error("Run-length stream is shorter than the pixels");
+}
+
+}  // namespace codec
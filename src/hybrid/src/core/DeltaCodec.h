@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Compressed pixel payloads for the webview. Pixels are XORed against what the webview already has, the zero runs that
+ * leaves behind for unchanged pixels are run-length encoded, and the result is LZ4 compressed.
+ *
+ * Layout, all integers little endian:
+ *   u8  version (kVersion)
+ *   u8  flags (kFlagDelta, kFlagLz4)
+ *   u16 reserved, 0
+ *   u32 pixel byte count
+ *   u32 run-length stream byte count
+ *   u32 payload byte count
+ *   ... payload: the run-length stream, LZ4 block compressed when kFlagLz4 is set, stored as is otherwise
+ *
+ * Anything after the payload is ignored, so the bytes can be padded (e.g. to a whole number of dense code units).
+ *
+ * The run-length stream repeats (varint zero count, varint literal count, literal bytes) until the pixel byte count is
+ * reached. Varints are LEB128. With kFlagDelta the decoded bytes are XORed into the previous pixels, otherwise they
+ * replace them.
+ */
+namespace codec {
+
+constexpr uint8_t kVersion = 1;
+constexpr uint8_t kFlagDelta = 1;
+constexpr uint8_t kFlagLz4 = 2;
+constexpr size_t kHeaderSize = 16;
+
+/**
+ * Encode `length` bytes of pixels into `out`, replacing its contents. With `previous` (the bytes the receiver currently
+ * holds for the same pixels) the payload is a delta, without it the payload stands on its own.
+ */
+void Encode(const uint8_t* pixels, const uint8_t* previous, size_t length, std::vector<uint8_t>& out);
+
+/**
+ * Apply an encoded payload to `pixels` (`length` bytes, holding the previous pixels for a delta). Throws when the
+ * payload is malformed or its size doesn't match.
+ */
+void Decode(const uint8_t* encoded, size_t encoded_length, uint8_t* pixels, size_t length);
+
+}  // namespace codec
@@ -0,0 +1,64 @@
+#include "DenseEncoding.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DENSE_ENCODING_SSE2 1
+#endif
+
+namespace dense {
+
+namespace {
+
+// Branch free, since with image data the escapes land at random and would be mispredicted. Always writes two code
+// units but only advances past the second one when the unit was escaped.
+inline char16_t* EncodeUnit(char16_t unit, char16_t* out) {
+    bool surrogate = static_cast<char16_t>(unit - 0xD800) < 0x800;
+    bool escape = surrogate || unit == kEscape;
+
+    out[0] = escape ? kEscape : unit;
+    out[1] = surrogate ? static_cast<char16_t>(unit - 0xD800) : kEscapedEscape;
+    return out + (escape ? 2 : 1);
+}
+
+}  // namespace
+
+size_t Encode(const uint8_t* bytes, size_t byte_length, char16_t* out) {
+    char16_t* start = out;
+    size_t pairs = byte_length / 2;
+    size_t i = 0;
+
+#if DENSE_ENCODING_SSE2
+    // Most blocks of 8 code units need no escapes and can be stored as is
+    const __m128i surrogate_mask = _mm_set1_epi16(static_cast<short>(0xF800));
+    const __m128i surrogate_bits = _mm_set1_epi16(static_cast<short>(0xD800));
+    const __m128i escape = _mm_set1_epi16(static_cast<short>(kEscape));
+
+    for (; i + 8 <= pairs; i += 8) {
+        __m128i bytes16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i * 2));
+        __m128i units = _mm_or_si128(_mm_slli_epi16(bytes16, 8), _mm_srli_epi16(bytes16, 8));
+
+        __m128i needs_escape = _mm_or_si128(
+            _mm_cmpeq_epi16(_mm_and_si128(units, surrogate_mask), surrogate_bits), _mm_cmpeq_epi16(units, escape));
+
+        if (_mm_movemask_epi8(needs_escape) == 0) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), units);
+            out += 8;
+        } else {
+            for (size_t j = i; j < i + 8; j++)
+                out = EncodeUnit(static_cast<char16_t>((bytes[j * 2] << 8) | bytes[j * 2 + 1]), out);
+        }
+    }
+#endif
+
+    for (; i < pairs; i++) {
+        out = EncodeUnit(static_cast<char16_t>((bytes[i * 2] << 8) | bytes[i * 2 + 1]), out);
+    }
+
+    if (byte_length % 2 != 0) {
+        out = EncodeUnit(static_cast<char16_t>(bytes[byte_length - 1] << 8), out);
+    }
+
+    return static_cast<size_t>(out - start);
+}
+
+}  // namespace dense
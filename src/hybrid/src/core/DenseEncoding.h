@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Packs two bytes into each UTF-16 code unit, halving the size of pixel strings compared to one byte per charCode.
+ *
+ * Format, decoded left to right one code unit c at a time:
+ *   c != 0xFFFF             -> bytes (c >> 8, c & 0xFF)
+ *   c == 0xFFFF, next is d  -> d == 0x0800 ? bytes (0xFF, 0xFF) : bytes of (0xD800 + d)
+ *
+ * Byte pairs that would land in the surrogate range 0xD800-0xDFFF are escaped, so the string never holds a lone
+ * surrogate that the bridge could replace with U+FFFD. 0xFFFF is the escape, so a literal 0xFFFF pair is escaped too.
+ * An odd trailing byte is paired with 0, the decoder stops once it has the number of bytes it expects.
+ */
+namespace dense {
+
+constexpr char16_t kEscape = 0xFFFF;
+constexpr char16_t kEscapedEscape = 0x0800;
+
+// Worst case every byte pair is escaped into two code units
+inline size_t MaxEncodedLength(size_t byte_length) { return (byte_length + 1) / 2 * 2; }
+
+// Returns the number of code units written to out
+size_t Encode(const uint8_t* bytes, size_t byte_length, char16_t* out);
+
+}  // namespace dense
@@ -0,0 +1,117 @@
+#include "JobQueue.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "PixelCache.h"
+
+int64_t JobQueue::Push(int64_t document_id, int64_t width, int64_t height, bool forced) {
+    if (width <= 0 || height <= 0)
+        throw std::invalid_argument("Image size must be positive");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Job job;
+    job.id = next_id_++;
+    job.document_id = document_id;
+    job.width = width;
+    job.next_tile_row = 0;
+    job.tile_rows = (height + PixelCache::kTileSize - 1) / PixelCache::kTileSize;
+    job.forced = forced;
+    latest_[document_id] = job.id;
+
+    // The new snapshot goes where the old one was. Rows a superseded full push already sent are forced again, the
+    // push then still covers every row the webview didn't get.
+    auto older = std::find_if(jobs_.begin(), jobs_.end(), [document_id](const Job& queued) { return queued.document_id == document_id; });
+    if (older != jobs_.end()) {
+        job.forced = job.forced || older->forced;
+        *older = job;
+        return job.id;
+    }
+
+    jobs_.push_back(job);
+    return job.id;
+}
+
+bool JobQueue::Superseded(int64_t document_id, int64_t job) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = latest_.find(document_id);
+    return found != latest_.end() && found->second > job;
+}
+
+bool JobQueue::Next(const std::function<int64_t(int64_t document_id)>& batch_pixels, Band& band) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto best = jobs_.end();
+    Priority best_priority = Priority::kBackground;
+    for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+        Priority priority = PriorityLocked(it->document_id);
+        if (best == jobs_.end() || priority > best_priority || (priority == best_priority && best->forced && !it->forced)) {
+            best = it;
+            best_priority = priority;
+        }
+    }
+    if (best == jobs_.end())
+        return false;
+
+    // Bands cover whole tile rows, so a preempted job resumes on a tile boundary
+    int64_t row_pixels = best->width * PixelCache::kTileSize;
+    int64_t rows = std::max<int64_t>(1, batch_pixels(best->document_id) / row_pixels);
+
+    band.job = best->id;
+    band.document_id = best->document_id;
+    band.first_tile_row = best->next_tile_row;
+    band.tile_rows = std::min(rows, best->tile_rows - best->next_tile_row);
+    band.last = band.first_tile_row + band.tile_rows >= best->tile_rows;
+
+    best->next_tile_row += band.tile_rows;
+    if (band.last)
+        jobs_.erase(best);
+    return true;
+}
+
+bool JobQueue::Finish(int64_t job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = std::find_if(jobs_.begin(), jobs_.end(), [job](const Job& queued) { return queued.id == job; });
+    if (found == jobs_.end())
+        return false;
+    jobs_.erase(found);
+    return true;
+}
+
+size_t JobQueue::Drop(int64_t document_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    latest_.erase(document_id);
+    size_t before = jobs_.size();
+    jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), [document_id](const Job& job) { return job.document_id == document_id; }),
+                jobs_.end());
+    return before - jobs_.size();
+}
+
+void JobQueue::SetActive(int64_t document_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_ = document_id;
+}
+
+void JobQueue::SetVisible(const std::vector<int64_t>& document_ids) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    visible_ = std::unordered_set<int64_t>(document_ids.begin(), document_ids.end());
+}
+
+JobQueue::Priority JobQueue::PriorityLocked(int64_t document_id) const {
+    if (document_id == active_)
+        return Priority::kActive;
+    if (visible_.count(document_id) != 0)
+        return Priority::kVisible;
+    return Priority::kBackground;
+}
+
+size_t JobQueue::Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.size();
+}
+
+void JobQueue::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.clear();
+    latest_.clear();
+}
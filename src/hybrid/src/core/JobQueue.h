@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Conversion jobs waiting for their turn, so the document the user is working on isn't stuck behind a full push of
+ * every background document. A job is one pass over a document's tile rows. It is handed out a band at a time, and
+ * each band goes to the most urgent job at that moment: a job queued for the active document preempts the job in
+ * progress at its next tile row boundary instead of waiting for the whole pass.
+ *
+ * Documents are served in this order:
+ *   1. the active document
+ *   2. documents whose texture is visible in the viewport
+ *   3. the rest
+ * and at the same priority edits before full pushes, then in the order they were queued.
+ *
+ * A document has one job at most. A newer snapshot of it supersedes the older job: it takes over the older job's place
+ * in the queue, and the tile rows the older job hadn't handed out yet are never converted, since the newer pass covers
+ * them. Job ids grow with every push, so they double as the generation of a document's snapshots, see Superseded.
+ */
+class JobQueue {
+ public:
+    enum class Priority { kBackground, kVisible, kActive };
+
+    struct Band {
+        int64_t job;
+        int64_t document_id;
+        int64_t first_tile_row;
+        int64_t tile_rows;
+        bool last;  // the band ends the job, it is no longer queued
+    };
+
+    /**
+     * Queue a pass over a width x height document. `forced` is a full push rather than an edit. A job the document
+     * already has is superseded, the new one stays forced if the old one was. Returns the job id.
+     */
+    int64_t Push(int64_t document_id, int64_t width, int64_t height, bool forced);
+
+    // Whether a newer job than `job` was pushed for the document since, so the pixels of `job` are stale
+    bool Superseded(int64_t document_id, int64_t job) const;
+
+    /**
+     * Take the next band of the most urgent job. `batch_pixels` gives the source pixels one band of a document should
+     * cover, a band is always at least one tile row. False when no job is queued.
+     */
+    bool Next(const std::function<int64_t(int64_t document_id)>& batch_pixels, Band& band);
+
+    // Drop what is left of a job, false if it wasn't queued anymore
+    bool Finish(int64_t job);
+
+    // Drop the document's job and forget its generations, returns how many jobs were dropped
+    size_t Drop(int64_t document_id);
+
+    void SetActive(int64_t document_id);
+    void SetVisible(const std::vector<int64_t>& document_ids);
+
+    size_t Size() const;
+    void Clear();
+
+ private:
+    struct Job {
+        int64_t id;
+        int64_t document_id;
+        int64_t width;
+        int64_t next_tile_row;
+        int64_t tile_rows;
+        bool forced;
+    };
+
+    Priority PriorityLocked(int64_t document_id) const;
+
+    mutable std::mutex mutex_;
+    std::deque<Job> jobs_;  // in the order they were queued
+    std::unordered_map<int64_t, int64_t> latest_;  // newest job pushed by document
+    int64_t next_id_ = 1;
+    int64_t active_ = -1;
+    std::unordered_set<int64_t> visible_;
+};
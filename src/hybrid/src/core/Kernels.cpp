@@ -0,0 +1,113 @@
+#include "Kernels.h"
+
+#include <atomic>
+
+#include "CpuFeatures.h"
+
+namespace kernels {
+namespace {
+
+template <int Components>
+bool Planar(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    uint32_t diff = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int component = 0; component < 4; component++) {
+            // Force alpha = 255 for every pixel when ps only sends us 3 components
+            uint8_t value = component < Components ? src[plane_stride * component + i] : 255;
+            diff |= dst[component] ^ value;
+            dst[component] = value;
+        }
+        dst += 4;
+    }
+    return diff != 0;
+}
+
+template <int Components>
+bool Chunky(const uint8_t* src, uint8_t* dst, size_t count) {
+    uint32_t diff = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int component = 0; component < 4; component++) {
+            uint8_t value = component < Components ? src[component] : 255;
+            diff |= dst[component] ^ value;
+            dst[component] = value;
+        }
+        src += Components;
+        dst += 4;
+    }
+    return diff != 0;
+}
+
+// Components is 1 for gray only, or 2 with an alpha plane
+template <int Components>
+bool PlanarGray(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    uint32_t diff = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t gray = src[i];
+        uint8_t alpha = Components == 2 ? src[plane_stride + i] : 255;
+        for (int component = 0; component < 4; component++) {
+            uint8_t value = component < 3 ? gray : alpha;
+            diff |= dst[component] ^ value;
+            dst[component] = value;
+        }
+        dst += 4;
+    }
+    return diff != 0;
+}
+
+bool ChunkyGrayAlpha(const uint8_t* src, uint8_t* dst, size_t count) {
+    uint32_t diff = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int component = 0; component < 4; component++) {
+            uint8_t value = component < 3 ? src[0] : src[1];
+            diff |= dst[component] ^ value;
+            dst[component] = value;
+        }
+        src += 2;
+        dst += 4;
+    }
+    return diff != 0;
+}
+
+const KernelSet scalar_kernels = {"scalar", Planar<3>, Planar<4>, Chunky<3>, Chunky<4>, PlanarGray<1>, PlanarGray<2>, ChunkyGrayAlpha};
+
+std::atomic<const KernelSet*> active_kernels{nullptr};
+
+}  // namespace
+
+const KernelSet& ScalarKernels() {
+    return scalar_kernels;
+}
+
+std::vector<const KernelSet*> AvailableKernels() {
+    const CpuFeatures& cpu = GetCpuFeatures();
+
+    std::vector<const KernelSet*> result{&scalar_kernels};
+    if (cpu.sse2 && Sse2Kernels() != nullptr)
+        result.push_back(Sse2Kernels());
+    if (cpu.avx2 && Avx2Kernels() != nullptr)
+        result.push_back(Avx2Kernels());
+    if (cpu.neon && NeonKernels() != nullptr)
+        result.push_back(NeonKernels());
+    return result;
+}
+
+const KernelSet& ActiveKernels() {
+    const KernelSet* kernels = active_kernels.load(std::memory_order_acquire);
+    if (kernels == nullptr) {
+        kernels = AvailableKernels().back();
+        active_kernels.store(kernels, std::memory_order_release);
+    }
+    return *kernels;
+}
+
+bool SetActiveKernels(const std::string& name) {
+    for (const KernelSet* kernels : AvailableKernels()) {
+        if (name == kernels->name) {
+            active_kernels.store(kernels, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace kernels
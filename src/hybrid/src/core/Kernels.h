@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Pixel conversion kernels for the hot paths: convert_to_string batches, the tile rows of convert_tiles and
+ * convert_image, and the tile rows hashed for documents whose changes are detected by tile hashes.
+ *
+ * Every kernel converts `count` pixels of Photoshop 8-bit RGB(A) or grayscale data into packed RGBA8 in the cache at
+ * `dst`, and returns whether any cached value was different from the new value. The cache is always left holding the new pixels.
+ *
+ * There is one KernelSet per instruction set. The scalar set is the reference implementation the vectorized sets are
+ * checked against, and is also used for the tail of each batch that doesn't fill a full vector.
+ */
+namespace kernels {
+
+/**
+ * Planar source: `src` points at the first pixel of the batch in the R plane, further planes follow every
+ * `plane_stride` bytes (RRRGGGBBB(AAA)).
+ */
+using PlanarKernel = bool (*)(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count);
+
+/**
+ * Chunky source: `src` points at the first pixel of the batch (RGBRGB or RGBARGBA).
+ */
+using ChunkyKernel = bool (*)(const uint8_t* src, uint8_t* dst, size_t count);
+
+struct KernelSet {
+    const char* name;
+
+    PlanarKernel planar_rgb;   // 3 planes, alpha filled with 255
+    PlanarKernel planar_rgba;  // 4 planes
+    ChunkyKernel chunky_rgb;   // RGB -> RGBA, alpha filled with 255
+    ChunkyKernel chunky_rgba;  // compare + copy
+
+    // Grayscale, gray spread to R, G and B
+    PlanarKernel planar_gray;        // 1 plane, alpha filled with 255. The same as chunky for a single component.
+    PlanarKernel planar_gray_alpha;  // gray and alpha planes
+    ChunkyKernel chunky_gray_alpha;  // GAGA -> RGBA
+
+    PlanarKernel Planar(int64_t components) const { return components == 4 ? planar_rgba : planar_rgb; }
+    ChunkyKernel Chunky(int64_t components) const { return components == 4 ? chunky_rgba : chunky_rgb; }
+    PlanarKernel PlanarGray(int64_t components) const { return components == 2 ? planar_gray_alpha : planar_gray; }
+};
+
+// Reference implementation, always available.
+const KernelSet& ScalarKernels();
+
+// @{ Instruction set specific kernels. Return nullptr when not compiled for this architecture.
+// The caller is responsible for checking the CPU supports the instruction set (see GetCpuFeatures).
+const KernelSet* Sse2Kernels();
+const KernelSet* Avx2Kernels();
+const KernelSet* NeonKernels();
+// @}
+
+// All kernel sets this CPU can run, scalar first and fastest last.
+std::vector<const KernelSet*> AvailableKernels();
+
+// The kernel set used for conversions. Defaults to the fastest available set.
+const KernelSet& ActiveKernels();
+
+// Force a specific kernel set by name (e.g. "scalar" for comparisons). Returns false if it isn't available.
+bool SetActiveKernels(const std::string& name);
+
+}  // namespace kernels
@@ -0,0 +1,176 @@
+#include "Kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+// The rest of the addon is built for baseline x64, so only these functions may use AVX2. They're only reached
+// when GetCpuFeatures reports AVX2 support. MSVC allows AVX2 intrinsics without any per-function annotation.
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+namespace kernels {
+namespace {
+
+// Store 8 RGBA8 pixels into the cache and accumulate any bits that differ from the old ones.
+AVX2_TARGET inline void StoreAndCompare(uint8_t* dst, __m256i rgba, __m256i& diff) {
+    __m256i* out = reinterpret_cast<__m256i*>(dst);
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256(out), rgba));
+    _mm256_storeu_si256(out, rgba);
+}
+
+AVX2_TARGET inline bool AnySet(__m256i diff) {
+    return !_mm256_testz_si256(diff, diff);
+}
+
+template <int Components>
+AVX2_TARGET bool Planar(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    __m256i diff = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + plane_stride + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + plane_stride * 2 + i));
+        __m256i a;
+        if constexpr (Components == 4)
+            a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + plane_stride * 3 + i));
+        else
+            a = _mm256_set1_epi8(static_cast<char>(0xFF));
+
+        // Unpacks work within each 128 bit lane, so lane 1 ends up holding pixels 16-31.
+        __m256i rg_lo = _mm256_unpacklo_epi8(r, g);  // pixels 0-7  | 16-23
+        __m256i rg_hi = _mm256_unpackhi_epi8(r, g);  // pixels 8-15 | 24-31
+        __m256i ba_lo = _mm256_unpacklo_epi8(b, a);
+        __m256i ba_hi = _mm256_unpackhi_epi8(b, a);
+
+        __m256i q0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);  // pixels 0-3   | 16-19
+        __m256i q1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);  // pixels 4-7   | 20-23
+        __m256i q2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);  // pixels 8-11  | 24-27
+        __m256i q3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);  // pixels 12-15 | 28-31
+
+        // Undo the per-lane ordering
+        uint8_t* out = dst + i * 4;
+        StoreAndCompare(out, _mm256_permute2x128_si256(q0, q1, 0x20), diff);
+        StoreAndCompare(out + 32, _mm256_permute2x128_si256(q2, q3, 0x20), diff);
+        StoreAndCompare(out + 64, _mm256_permute2x128_si256(q0, q1, 0x31), diff);
+        StoreAndCompare(out + 96, _mm256_permute2x128_si256(q2, q3, 0x31), diff);
+    }
+
+    bool tail_changed = ScalarKernels().Planar(Components)(src + i, plane_stride, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+AVX2_TARGET bool ChunkyRgb(const uint8_t* src, uint8_t* dst, size_t count) {
+    // Spread 4 RGB triplets out to 4 RGBA pixels within each 128 bit lane. 0x80 zeroes the byte for alpha.
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128,
+        0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+    const __m256i opaque = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+    __m256i diff = _mm256_setzero_si256();
+
+    // Each iteration converts 8 pixels (24 bytes) but the second 16 byte load ends 4 bytes past them.
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {
+        const uint8_t* in = src + i * 3;
+        __m256i rgb = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)), 1);
+
+        StoreAndCompare(dst + i * 4, _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), opaque), diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_rgb(src + i * 3, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+AVX2_TARGET bool ChunkyRgba(const uint8_t* src, uint8_t* dst, size_t count) {
+    __m256i diff = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        StoreAndCompare(dst + i * 4, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4)), diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_rgba(src + i * 4, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+template <int Components>
+AVX2_TARGET bool PlanarGray(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    __m256i diff = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i a;
+        if constexpr (Components == 2)
+            a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + plane_stride + i));
+        else
+            a = _mm256_set1_epi8(static_cast<char>(0xFF));
+
+        // Like Planar with the gray plane as R, G and B
+        __m256i gg_lo = _mm256_unpacklo_epi8(g, g);  // pixels 0-7  | 16-23
+        __m256i gg_hi = _mm256_unpackhi_epi8(g, g);  // pixels 8-15 | 24-31
+        __m256i ga_lo = _mm256_unpacklo_epi8(g, a);
+        __m256i ga_hi = _mm256_unpackhi_epi8(g, a);
+
+        __m256i q0 = _mm256_unpacklo_epi16(gg_lo, ga_lo);  // pixels 0-3   | 16-19
+        __m256i q1 = _mm256_unpackhi_epi16(gg_lo, ga_lo);  // pixels 4-7   | 20-23
+        __m256i q2 = _mm256_unpacklo_epi16(gg_hi, ga_hi);  // pixels 8-11  | 24-27
+        __m256i q3 = _mm256_unpackhi_epi16(gg_hi, ga_hi);  // pixels 12-15 | 28-31
+
+        uint8_t* out = dst + i * 4;
+        StoreAndCompare(out, _mm256_permute2x128_si256(q0, q1, 0x20), diff);
+        StoreAndCompare(out + 32, _mm256_permute2x128_si256(q2, q3, 0x20), diff);
+        StoreAndCompare(out + 64, _mm256_permute2x128_si256(q0, q1, 0x31), diff);
+        StoreAndCompare(out + 96, _mm256_permute2x128_si256(q2, q3, 0x31), diff);
+    }
+
+    bool tail_changed = ScalarKernels().PlanarGray(Components)(src + i, plane_stride, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+AVX2_TARGET bool ChunkyGrayAlpha(const uint8_t* src, uint8_t* dst, size_t count) {
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    __m256i diff = _mm256_setzero_si256();
+
+    // See the SSE2 version, each 16 bit lane holds a pixel
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i ga = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+        __m256i gg = _mm256_or_si256(_mm256_and_si256(ga, low_bytes), _mm256_slli_epi16(ga, 8));
+
+        __m256i lo = _mm256_unpacklo_epi16(gg, ga);  // pixels 0-3 | 8-11
+        __m256i hi = _mm256_unpackhi_epi16(gg, ga);  // pixels 4-7 | 12-15
+
+        StoreAndCompare(dst + i * 4, _mm256_permute2x128_si256(lo, hi, 0x20), diff);
+        StoreAndCompare(dst + i * 4 + 32, _mm256_permute2x128_si256(lo, hi, 0x31), diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_gray_alpha(src + i * 2, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+const KernelSet avx2_kernels = {"avx2", Planar<3>, Planar<4>, ChunkyRgb, ChunkyRgba, PlanarGray<1>, PlanarGray<2>, ChunkyGrayAlpha};
+
+}  // namespace
+
+const KernelSet* Avx2Kernels() {
+    return &avx2_kernels;
+}
+
+}  // namespace kernels
+
+#else
+
+namespace kernels {
+const KernelSet* Avx2Kernels() {
+    return nullptr;
+}
+}  // namespace kernels
+
+#endif
@@ -0,0 +1,139 @@
+#include "Kernels.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+
+#include <arm_neon.h>
+
+namespace kernels {
+namespace {
+
+// Compare 16 pixels against the interleaved pixels already in the cache, then store the new ones interleaved.
+inline void StoreAndCompare(uint8_t* dst, const uint8x16x4_t& pixels, uint8x16_t& diff) {
+    uint8x16x4_t old = vld4q_u8(dst);
+    diff = vorrq_u8(diff, veorq_u8(old.val[0], pixels.val[0]));
+    diff = vorrq_u8(diff, veorq_u8(old.val[1], pixels.val[1]));
+    diff = vorrq_u8(diff, veorq_u8(old.val[2], pixels.val[2]));
+    diff = vorrq_u8(diff, veorq_u8(old.val[3], pixels.val[3]));
+    vst4q_u8(dst, pixels);
+}
+
+template <int Components>
+bool Planar(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    uint8x16_t diff = vdupq_n_u8(0);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t pixels;
+        pixels.val[0] = vld1q_u8(src + i);
+        pixels.val[1] = vld1q_u8(src + plane_stride + i);
+        pixels.val[2] = vld1q_u8(src + plane_stride * 2 + i);
+        if constexpr (Components == 4)
+            pixels.val[3] = vld1q_u8(src + plane_stride * 3 + i);
+        else
+            pixels.val[3] = vdupq_n_u8(255);
+
+        StoreAndCompare(dst + i * 4, pixels, diff);
+    }
+
+    bool tail_changed = ScalarKernels().Planar(Components)(src + i, plane_stride, dst + i * 4, count - i);
+    return vmaxvq_u8(diff) != 0 || tail_changed;
+}
+
+bool ChunkyRgb(const uint8_t* src, uint8_t* dst, size_t count) {
+    uint8x16_t diff = vdupq_n_u8(0);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = rgb.val[0];
+        pixels.val[1] = rgb.val[1];
+        pixels.val[2] = rgb.val[2];
+        pixels.val[3] = vdupq_n_u8(255);
+
+        StoreAndCompare(dst + i * 4, pixels, diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_rgb(src + i * 3, dst + i * 4, count - i);
+    return vmaxvq_u8(diff) != 0 || tail_changed;
+}
+
+bool ChunkyRgba(const uint8_t* src, uint8_t* dst, size_t count) {
+    uint8x16_t diff = vdupq_n_u8(0);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // Already interleaved, so compare and copy as-is
+        uint8x16_t rgba = vld1q_u8(src + i * 4);
+        diff = vorrq_u8(diff, veorq_u8(vld1q_u8(dst + i * 4), rgba));
+        vst1q_u8(dst + i * 4, rgba);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_rgba(src + i * 4, dst + i * 4, count - i);
+    return vmaxvq_u8(diff) != 0 || tail_changed;
+}
+
+template <int Components>
+bool PlanarGray(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    uint8x16_t diff = vdupq_n_u8(0);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t gray = vld1q_u8(src + i);
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = gray;
+        pixels.val[1] = gray;
+        pixels.val[2] = gray;
+        if constexpr (Components == 2)
+            pixels.val[3] = vld1q_u8(src + plane_stride + i);
+        else
+            pixels.val[3] = vdupq_n_u8(255);
+
+        StoreAndCompare(dst + i * 4, pixels, diff);
+    }
+
+    bool tail_changed = ScalarKernels().PlanarGray(Components)(src + i, plane_stride, dst + i * 4, count - i);
+    return vmaxvq_u8(diff) != 0 || tail_changed;
+}
+
+bool ChunkyGrayAlpha(const uint8_t* src, uint8_t* dst, size_t count) {
+    uint8x16_t diff = vdupq_n_u8(0);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t gray_alpha = vld2q_u8(src + i * 2);
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = gray_alpha.val[0];
+        pixels.val[1] = gray_alpha.val[0];
+        pixels.val[2] = gray_alpha.val[0];
+        pixels.val[3] = gray_alpha.val[1];
+
+        StoreAndCompare(dst + i * 4, pixels, diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_gray_alpha(src + i * 2, dst + i * 4, count - i);
+    return vmaxvq_u8(diff) != 0 || tail_changed;
+}
+
+const KernelSet neon_kernels = {"neon", Planar<3>, Planar<4>, ChunkyRgb, ChunkyRgba, PlanarGray<1>, PlanarGray<2>, ChunkyGrayAlpha};
+
+}  // namespace
+
+const KernelSet* NeonKernels() {
+    return &neon_kernels;
+}
+
+}  // namespace kernels
+
+#else
+
+namespace kernels {
+const KernelSet* NeonKernels() {
+    return nullptr;
+}
+}  // namespace kernels
+
+#endif
@@ -0,0 +1,156 @@
+#include "Kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#include <cstring>
+
+namespace kernels {
+namespace {
+
+// Store 4 RGBA8 pixels into the cache and accumulate any bits that differ from the old ones.
+inline void StoreAndCompare(uint8_t* dst, __m128i rgba, __m128i& diff) {
+    __m128i* out = reinterpret_cast<__m128i*>(dst);
+    diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128(out), rgba));
+    _mm_storeu_si128(out, rgba);
+}
+
+inline bool AnySet(__m128i diff) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+}
+
+template <int Components>
+bool Planar(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    __m128i diff = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + plane_stride + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + plane_stride * 2 + i));
+        __m128i a;
+        if constexpr (Components == 4)
+            a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + plane_stride * 3 + i));
+        else
+            a = _mm_set1_epi8(static_cast<char>(0xFF));
+
+        __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+        __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+        __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+        __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+        uint8_t* out = dst + i * 4;
+        StoreAndCompare(out, _mm_unpacklo_epi16(rg_lo, ba_lo), diff);
+        StoreAndCompare(out + 16, _mm_unpackhi_epi16(rg_lo, ba_lo), diff);
+        StoreAndCompare(out + 32, _mm_unpacklo_epi16(rg_hi, ba_hi), diff);
+        StoreAndCompare(out + 48, _mm_unpackhi_epi16(rg_hi, ba_hi), diff);
+    }
+
+    bool tail_changed = ScalarKernels().Planar(Components)(src + i, plane_stride, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+bool ChunkyRgb(const uint8_t* src, uint8_t* dst, size_t count) {
+    const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    __m128i diff = _mm_setzero_si128();
+
+    // SSE2 has no byte shuffle, so gather each RGB triplet with an unaligned 32 bit load and overwrite the 4th byte.
+    // The load for the last pixel of each group reads one byte into the next pixel, hence the extra pixel of slack.
+    size_t i = 0;
+    for (; i + 5 <= count; i += 4) {
+        const uint8_t* in = src + i * 3;
+        uint32_t p0, p1, p2, p3;
+        std::memcpy(&p0, in, 4);
+        std::memcpy(&p1, in + 3, 4);
+        std::memcpy(&p2, in + 6, 4);
+        std::memcpy(&p3, in + 9, 4);
+
+        __m128i rgba = _mm_or_si128(_mm_set_epi32(static_cast<int>(p3), static_cast<int>(p2), static_cast<int>(p1), static_cast<int>(p0)), opaque);
+        StoreAndCompare(dst + i * 4, rgba, diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_rgb(src + i * 3, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+bool ChunkyRgba(const uint8_t* src, uint8_t* dst, size_t count) {
+    __m128i diff = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        StoreAndCompare(dst + i * 4, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4)), diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_rgba(src + i * 4, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+template <int Components>
+bool PlanarGray(const uint8_t* src, size_t plane_stride, uint8_t* dst, size_t count) {
+    __m128i diff = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i a;
+        if constexpr (Components == 2)
+            a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + plane_stride + i));
+        else
+            a = _mm_set1_epi8(static_cast<char>(0xFF));
+
+        // Like Planar with the gray plane as R, G and B
+        __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+        __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+        __m128i ga_lo = _mm_unpacklo_epi8(g, a);
+        __m128i ga_hi = _mm_unpackhi_epi8(g, a);
+
+        uint8_t* out = dst + i * 4;
+        StoreAndCompare(out, _mm_unpacklo_epi16(gg_lo, ga_lo), diff);
+        StoreAndCompare(out + 16, _mm_unpackhi_epi16(gg_lo, ga_lo), diff);
+        StoreAndCompare(out + 32, _mm_unpacklo_epi16(gg_hi, ga_hi), diff);
+        StoreAndCompare(out + 48, _mm_unpackhi_epi16(gg_hi, ga_hi), diff);
+    }
+
+    bool tail_changed = ScalarKernels().PlanarGray(Components)(src + i, plane_stride, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+bool ChunkyGrayAlpha(const uint8_t* src, uint8_t* dst, size_t count) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    __m128i diff = _mm_setzero_si128();
+
+    // Each 16 bit lane holds a pixel, gray in its low byte. Doubling the gray byte gives the RG half of the RGBA pixel,
+    // the lane as it is the BA half.
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i ga = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i gg = _mm_or_si128(_mm_and_si128(ga, low_bytes), _mm_slli_epi16(ga, 8));
+
+        StoreAndCompare(dst + i * 4, _mm_unpacklo_epi16(gg, ga), diff);
+        StoreAndCompare(dst + i * 4 + 16, _mm_unpackhi_epi16(gg, ga), diff);
+    }
+
+    bool tail_changed = ScalarKernels().chunky_gray_alpha(src + i * 2, dst + i * 4, count - i);
+    return AnySet(diff) || tail_changed;
+}
+
+const KernelSet sse2_kernels = {"sse2", Planar<3>, Planar<4>, ChunkyRgb, ChunkyRgba, PlanarGray<1>, PlanarGray<2>, ChunkyGrayAlpha};
+
+}  // namespace
+
+const KernelSet* Sse2Kernels() {
+    return &sse2_kernels;
+}
+
+}  // namespace kernels
+
+#else
+
+namespace kernels {
+const KernelSet* Sse2Kernels() {
+    return nullptr;
+}
+}  // namespace kernels
+
+#endif
@@ -0,0 +1,163 @@
+#include "Lz4.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace lz4 {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;     // the block must end with at least this many literals
+constexpr size_t kMatchSearchLimit = 12; // no match may start closer than this to the end
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashBits = 12;
+
+inline uint32_t Read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t Hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+inline uint8_t* WriteLength(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+inline uint8_t* WriteSequence(uint8_t* out, const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length) {
+    uint8_t* token = out++;
+    *token = static_cast<uint8_t>((literal_length < 15 ? literal_length : 15) << 4);
+    if (literal_length >= 15)
+        out = WriteLength(out, literal_length - 15);
+
+    if (literal_length > 0)
+        std::memcpy(out, literals, literal_length);
+    out += literal_length;
+
+    // The last sequence is literals only
+    if (match_length == 0)
+        return out;
+
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+
+    size_t length_code = match_length - kMinMatch;
+    *token |= static_cast<uint8_t>(length_code < 15 ? length_code : 15);
+    if (length_code >= 15)
+        out = WriteLength(out, length_code - 15);
+
+    return out;
+}
+
+}  // namespace
+
+size_t Compress(const uint8_t* src, size_t length, uint8_t* dst) {
+    uint8_t* out = dst;
+    size_t anchor = 0;
+
+    if (length > kMatchSearchLimit) {
+        uint32_t table[1 << kHashBits] = {};
+        size_t match_limit = length - kLastLiterals;
+        size_t ip = 1;
+        unsigned misses = 0;
+
+        table[Hash(Read32(src))] = 0;
+
+        while (ip + kMatchSearchLimit <= length) {
+            uint32_t sequence = Read32(src + ip);
+            uint32_t hash = Hash(sequence);
+            size_t ref = table[hash];
+            table[hash] = static_cast<uint32_t>(ip);
+
+            if (ref >= ip || ip - ref > kMaxOffset || Read32(src + ref) != sequence) {
+                // Skip ahead faster through data that doesn't compress
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            // Extend backwards into the pending literals, then forwards
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t match_length = kMinMatch;
+            while (ip + match_length < match_limit && src[ref + match_length] == src[ip + match_length])
+                match_length++;
+
+            out = WriteSequence(out, src + anchor, ip - anchor, ip - ref, match_length);
+            ip += match_length;
+            anchor = ip;
+
+            if (ip + kMatchSearchLimit <= length)
+                table[Hash(Read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2);
+        }
+    }
+
+    out = WriteSequence(out, src + anchor, length - anchor, 0, 0);
+    return static_cast<size_t>(out - dst);
+}
+
+size_t Decompress(const uint8_t* src, size_t length, uint8_t* dst, size_t dst_capacity) {
+    const uint8_t* in = src;
+    const uint8_t* in_end = src + length;
+    size_t op = 0;
+
+    auto read_length = [&](size_t value) {
+        if (value != 15)
+            return value;
+        uint8_t next;
+        do {
+            if (in >= in_end)
+                throw std::runtime_error("Truncated LZ4 block");
+            next = *in++;
+            value += next;
+        } while (next == 255);
+        return value;
+    };
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        size_t literal_length = read_length(token >> 4);
+        if (literal_length > static_cast<size_t>(in_end - in) || literal_length > dst_capacity - op)
+            throw std::runtime_error("LZ4 literals overrun the block");
+        if (literal_length > 0)
+            std::memcpy(dst + op, in, literal_length);
+        in += literal_length;
+        op += literal_length;
+
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            throw std::runtime_error("Truncated LZ4 block");
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        size_t match_length = read_length(token & 15) + kMinMatch;
+        if (offset == 0 || offset > op || match_length > dst_capacity - op)
+            throw std::runtime_error("LZ4 match is out of range");
+
+        if (offset >= match_length) {
+            std::memcpy(dst + op, dst + op - offset, match_length);
+            op += match_length;
+        } else {
+            // The match overlaps its own output, so copy forwards one byte at a time
+            for (size_t i = 0; i < match_length; i++, op++)
+                dst[op] = dst[op - offset];
+        }
+    }
+
+    return op;
+}
+
+}  // namespace lz4
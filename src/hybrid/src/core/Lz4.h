@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Compressor for the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md).
+ *
+ * Only the block format is implemented, there is no frame header or checksum. The webview has a matching decoder in
+ * util.ts. Greedy matching with a single hash table, which is plenty for the run heavy data we feed it.
+ */
+namespace lz4 {
+
+// Largest possible output for `length` bytes of input
+inline size_t CompressBound(size_t length) { return length + length / 255 + 16; }
+
+// Compress `length` bytes from src into dst, which must hold CompressBound(length) bytes. Returns the compressed size.
+size_t Compress(const uint8_t* src, size_t length, uint8_t* dst);
+
+// Decompress a block into dst, which holds dst_capacity bytes. Returns the decompressed size. Throws on malformed input.
+size_t Decompress(const uint8_t* src, size_t length, uint8_t* dst, size_t dst_capacity);
+
+}  // namespace lz4
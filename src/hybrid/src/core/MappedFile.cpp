@@ -0,0 +1,136 @@
+#include "MappedFile.h"
+
+#include <filesystem>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+std::unique_ptr<MappedFile> MappedFile::Create(const std::string& path, size_t size) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    std::wstring wide_path = std::filesystem::u8path(path).wstring();
+
+    file->file_ = CreateFileW(wide_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file->file_ == INVALID_HANDLE_VALUE) {
+        file->file_ = nullptr;
+        throw std::runtime_error("Unable to create " + path);
+    }
+
+    uint64_t length = static_cast<uint64_t>(size);
+    file->mapping_ = CreateFileMappingW(file->file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(length >> 32),
+                                        static_cast<DWORD>(length), nullptr);
+    if (!file->mapping_) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+
+    file->data_ = static_cast<uint8_t*>(MapViewOfFile(file->mapping_, FILE_MAP_WRITE, 0, 0, size));
+    if (!file->data_) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+    file->size_ = size;
+    return file;
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    std::wstring wide_path = std::filesystem::u8path(path).wstring();
+
+    file->file_ = CreateFileW(wide_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file->file_ == INVALID_HANDLE_VALUE) {
+        file->file_ = nullptr;
+        throw std::runtime_error("Unable to open " + path);
+    }
+
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file->file_, &length) || length.QuadPart <= 0) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+
+    file->mapping_ = CreateFileMappingW(file->file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file->mapping_) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+
+    file->data_ = static_cast<uint8_t*>(MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!file->data_) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+    file->size_ = static_cast<size_t>(length.QuadPart);
+    return file;
+}
+
+MappedFile::~MappedFile() {
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle(mapping_);
+    if (file_)
+        CloseHandle(file_);
+}
+
+#else
+
+std::unique_ptr<MappedFile> MappedFile::Create(const std::string& path, size_t size) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+
+    file->descriptor_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (file->descriptor_ < 0) {
+        throw std::runtime_error("Unable to create " + path);
+    }
+    if (ftruncate(file->descriptor_, static_cast<off_t>(size)) != 0) {
+        throw std::runtime_error("Unable to size " + path);
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->descriptor_, 0);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+    file->data_ = static_cast<uint8_t*>(data);
+    file->size_ = size;
+    return file;
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+
+    file->descriptor_ = open(path.c_str(), O_RDONLY);
+    if (file->descriptor_ < 0) {
+        throw std::runtime_error("Unable to open " + path);
+    }
+
+    struct stat info;
+    if (fstat(file->descriptor_, &info) != 0 || info.st_size <= 0) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file->descriptor_, 0);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    file->data_ = static_cast<uint8_t*>(data);
+    file->size_ = size;
+    return file;
+}
+
+MappedFile::~MappedFile() {
+    if (data_)
+        munmap(data_, size_);
+    if (descriptor_ >= 0)
+        close(descriptor_);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * A file mapped into memory, for spilling caches to disk without holding them in the heap. Pages are only read in
+ * when touched and written back by the OS, so a mapped file costs next to no resident memory once it is unmapped.
+ *
+ * Paths are UTF-8. Failures throw std::runtime_error.
+ */
+class MappedFile {
+ public:
+    // Create the file, or truncate an existing one, to `size` bytes and map it for writing
+    static std::unique_ptr<MappedFile> Create(const std::string& path, size_t size);
+
+    // Map an existing file for reading
+    static std::unique_ptr<MappedFile> Open(const std::string& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    uint8_t* Data() { return data_; }
+    const uint8_t* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+ private:
+    MappedFile() = default;
+
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#else
+    int descriptor_ = -1;
+#endif
+};
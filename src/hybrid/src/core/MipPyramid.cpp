@@ -0,0 +1,149 @@
+#include "MipPyramid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "DeepConversion.h"
+#include "Srgb.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// Box filter `rect` of a level from the level above it, `src` being `src_width` x `src_height` texels
+void DownsampleRgba8(const uint8_t* src, int64_t src_width, int64_t src_height, uint8_t* dst, int64_t dst_width,
+                     const DirtyRect& rect) {
+    const uint16_t* decode = srgb::DecodeTable16();
+    const uint8_t* encode = srgb::EncodeTable();
+    const int shift = 18 - srgb::kEncodeBits;
+
+    for (int64_t y = rect.y; y < rect.y + rect.height; y++) {
+        const uint8_t* row0 = src + (2 * y) * src_width * 4;
+        const uint8_t* row1 = src + std::min(2 * y + 1, src_height - 1) * src_width * 4;
+        uint8_t* out = dst + (y * dst_width + rect.x) * 4;
+
+        for (int64_t x = rect.x; x < rect.x + rect.width; x++) {
+            int64_t x0 = 2 * x * 4;
+            int64_t x1 = std::min(2 * x + 1, src_width - 1) * 4;
+            for (int64_t c = 0; c < 3; c++) {
+                uint32_t sum = decode[row0[x0 + c]] + decode[row0[x1 + c]] + decode[row1[x0 + c]] + decode[row1[x1 + c]];
+                out[c] = encode[sum >> shift];
+            }
+            out[3] = static_cast<uint8_t>((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2);
+            out += 4;
+        }
+    }
+}
+
+// Same as DownsampleRgba8 for linear RGBA half floats
+void DownsampleHalf(const uint8_t* src, int64_t src_width, int64_t src_height, uint8_t* dst, int64_t dst_width,
+                    const DirtyRect& rect) {
+    const float* table = deep::HalfTable();
+    auto load = [table](const uint8_t* pixel, int64_t c) {
+        uint16_t half;
+        std::memcpy(&half, pixel + c * 2, sizeof(half));
+        return table[half];
+    };
+
+    for (int64_t y = rect.y; y < rect.y + rect.height; y++) {
+        const uint8_t* row0 = src + (2 * y) * src_width * 8;
+        const uint8_t* row1 = src + std::min(2 * y + 1, src_height - 1) * src_width * 8;
+        uint8_t* out = dst + (y * dst_width + rect.x) * 8;
+
+        for (int64_t x = rect.x; x < rect.x + rect.width; x++) {
+            int64_t x0 = 2 * x * 8;
+            int64_t x1 = std::min(2 * x + 1, src_width - 1) * 8;
+            for (int64_t c = 0; c < 4; c++) {
+                float sum = load(row0 + x0, c) + load(row0 + x1, c) + load(row1 + x0, c) + load(row1 + x1, c);
+                uint16_t half = deep::FloatToHalf(sum * 0.25f);
+                std::memcpy(out + c * 2, &half, sizeof(half));
+            }
+            out += 8;
+        }
+    }
+}
+
+}  // namespace
+
+MipPyramid::MipPyramid(int64_t width, int64_t height, int64_t bytes_per_pixel)
+    : width_(width), height_(height), bytes_per_pixel_(bytes_per_pixel) {
+    if (width < 0 || height < 0)
+        throw std::invalid_argument("Image size can't be negative");
+    if (bytes_per_pixel != 4 && bytes_per_pixel != 8)
+        throw std::invalid_argument("Expected RGBA8 or RGBA half float pixels");
+
+    // Levels start out all 0 like the cache, which is what a pyramid of an all 0 document is
+    int64_t level_width = width;
+    int64_t level_height = height;
+    while (level_width > 1 || level_height > 1) {
+        level_width = std::max<int64_t>(1, level_width / 2);
+        level_height = std::max<int64_t>(1, level_height / 2);
+        levels_.push_back({level_width, level_height,
+                           std::vector<uint8_t>(static_cast<size_t>(level_width * level_height * bytes_per_pixel), 0)});
+    }
+    stats::RecordAllocation(ByteSize());
+}
+
+size_t MipPyramid::ByteSize() const {
+    size_t size = 0;
+    for (const Level& level : levels_)
+        size += level.pixels.size();
+    return size;
+}
+
+std::vector<MipRect> MipPyramid::RegionsUnder(const std::vector<DirtyRect>& rects) const {
+    std::vector<MipRect> regions;
+    std::vector<DirtyRect> above = rects;
+
+    for (int64_t level = 1; level <= Levels() && !above.empty(); level++) {
+        int64_t level_width = LevelWidth(level);
+        int64_t level_height = LevelHeight(level);
+
+        // Texel x is averaged from 2x and 2x + 1 on the level above
+        std::vector<DirtyRect> current;
+        for (const DirtyRect& rect : above) {
+            int64_t x_begin = rect.x / 2;
+            int64_t y_begin = rect.y / 2;
+            int64_t x_end = std::min(level_width, (rect.x + rect.width - 1) / 2 + 1);
+            int64_t y_end = std::min(level_height, (rect.y + rect.height - 1) / 2 + 1);
+            if (x_begin < x_end && y_begin < y_end)
+                current.push_back({x_begin, y_begin, x_end - x_begin, y_end - y_begin});
+        }
+        MergeOverlappingRects(current);
+
+        for (const DirtyRect& rect : current)
+            regions.push_back({level, rect});
+        above = std::move(current);
+    }
+
+    return regions;
+}
+
+void MipPyramid::Update(const PixelCache& base, const std::vector<MipRect>& regions) {
+    if (!HasFormat(base))
+        throw std::invalid_argument("Mip pyramid doesn't match the cache");
+
+    auto downsample = bytes_per_pixel_ == 8 ? DownsampleHalf : DownsampleRgba8;
+
+    // Regions on one level never overlap, so each level is split across the thread pool. Levels are done in order,
+    // every level reads from the one above it.
+    size_t begin = 0;
+    while (begin < regions.size()) {
+        int64_t level = regions[begin].level;
+        size_t end = begin;
+        while (end < regions.size() && regions[end].level == level)
+            end++;
+
+        const uint8_t* src = level == 1 ? base.Data() : LevelData(level - 1);
+        int64_t src_width = level == 1 ? width_ : LevelWidth(level - 1);
+        int64_t src_height = level == 1 ? height_ : LevelHeight(level - 1);
+        Level& dst = levels_[static_cast<size_t>(level - 1)];
+
+        ThreadPool::Shared().ParallelFor(end - begin, [&](size_t i) {
+            downsample(src, src_width, src_height, dst.pixels.data(), dst.width, regions[begin + i].rect);
+        });
+
+        begin = end;
+    }
+}
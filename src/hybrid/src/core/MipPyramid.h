@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PixelCache.h"
+#include "TileConversion.h"
+
+/**
+ * A rect of texels on one level of a MipPyramid, level 1 being half the size of the document.
+ */
+struct MipRect {
+    int64_t level;
+    DirtyRect rect;
+};
+
+/**
+ * The mip levels below a document's PixelCache, down to 1x1 like a complete WebGL mip chain. Each level halves the
+ * size of the one above it, rounding down, and every texel is the box filtered average of the 2x2 texels above it.
+ * Odd rows and columns at the far edge are left out, same as the usual glGenerateMipmap implementations.
+ *
+ * RGBA8 levels are averaged in linear light and encoded back to sRGB, so minified textures don't darken. Half float
+ * levels are already linear. Alpha is averaged as is.
+ *
+ * Only the texels under changed pixels are recomputed, see RegionsUnder and Update.
+ */
+class MipPyramid {
+ public:
+    MipPyramid(int64_t width, int64_t height, int64_t bytes_per_pixel);
+
+    // Number of levels below the document, 0 for a 1x1 document
+    int64_t Levels() const { return static_cast<int64_t>(levels_.size()); }
+
+    // Sizes of levels 1 to Levels()
+    int64_t LevelWidth(int64_t level) const { return levels_[static_cast<size_t>(level - 1)].width; }
+    int64_t LevelHeight(int64_t level) const { return levels_[static_cast<size_t>(level - 1)].height; }
+
+    int64_t BytesPerPixel() const { return bytes_per_pixel_; }
+
+    // Whether the pyramid was made for a cache of this size and pixel format
+    bool HasFormat(const PixelCache& base) const {
+        return base.HasFormat(width_, height_, bytes_per_pixel_);
+    }
+
+    uint8_t* LevelData(int64_t level) { return levels_[static_cast<size_t>(level - 1)].pixels.data(); }
+    const uint8_t* LevelData(int64_t level) const { return levels_[static_cast<size_t>(level - 1)].pixels.data(); }
+
+    // Bytes of all levels together
+    size_t ByteSize() const;
+
+    /**
+     * The texels on every level that depend on the given rects of the document, ordered by level. Rects on the same
+     * level never overlap, overlapping ones are merged into their bounding box.
+     */
+    std::vector<MipRect> RegionsUnder(const std::vector<DirtyRect>& rects) const;
+
+    /**
+     * Recompute the given regions from the cache, which must be ordered by level as RegionsUnder returns them.
+     */
+    void Update(const PixelCache& base, const std::vector<MipRect>& regions);
+
+ private:
+    struct Level {
+        int64_t width;
+        int64_t height;
+        std::vector<uint8_t> pixels;
+    };
+
+    int64_t width_;
+    int64_t height_;
+    int64_t bytes_per_pixel_;
+    std::vector<Level> levels_;
+};
@@ -0,0 +1,114 @@
+#include "Pacing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+namespace {
+
+// Weight of a new sample in the moving averages
+constexpr double kSmoothing = 0.25;
+
+// Edits further apart than this are separate edits, not a stroke being painted
+constexpr double kMaxEditIntervalMilliseconds = 2000.0;
+
+// Fraction of the time between fetches a pass may take, the rest leaves Photoshop room to breathe
+constexpr double kPassShare = 0.8;
+
+double Average(double average, double sample) {
+    return average == 0.0 ? sample : average + (sample - average) * kSmoothing;
+}
+
+}  // namespace
+
+uint64_t Pacer::Now() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Pacer::RecordEdit(int64_t document_id, uint64_t time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DocumentPacing& doc = documents_[document_id];
+
+    if (doc.last_edit != 0 && time > doc.last_edit) {
+        double interval = static_cast<double>(time - doc.last_edit) / 1e6;
+        if (interval < kMaxEditIntervalMilliseconds)
+            doc.edit_interval = Average(doc.edit_interval, interval);
+        else
+            doc.edit_interval = 0.0;
+    }
+    doc.last_edit = time;
+}
+
+void Pacer::RecordConversion(int64_t document_id, int64_t width, int64_t height, int64_t pixels, uint64_t begin,
+                             uint64_t end, bool first_band, bool last_band) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DocumentPacing& doc = documents_[document_id];
+    doc.pixels = width * height;
+
+    if (pixels > 0 && end > begin) {
+        double cost = static_cast<double>(end - begin) / static_cast<double>(pixels);
+        doc.pixel_cost = Average(doc.pixel_cost, cost);
+        pixel_cost_ = Average(pixel_cost_, cost);
+    }
+
+    if (first_band) {
+        doc.pass_begin = begin;
+        doc.in_pass = true;
+    }
+    if (last_band && doc.in_pass && end > doc.pass_begin) {
+        doc.pass = Average(doc.pass, static_cast<double>(end - doc.pass_begin) / 1e6);
+        doc.in_pass = false;
+    }
+}
+
+Pacer::Recommendation Pacer::Recommend(int64_t document_id, double frame_budget_milliseconds) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    DocumentPacing doc;
+    auto found = documents_.find(document_id);
+    if (found != documents_.end())
+        doc = found->second;
+
+    Recommendation result;
+    result.pixel_cost_nanoseconds = doc.pixel_cost != 0.0 ? doc.pixel_cost : pixel_cost_;
+    result.pass_milliseconds = doc.pass;
+    result.edit_interval_milliseconds = doc.edit_interval;
+
+    if (result.pixel_cost_nanoseconds == 0.0) {
+        result.batch_pixels = kDefaultBatchPixels;
+        result.throttle_milliseconds = kDefaultThrottleMilliseconds;
+        return result;
+    }
+
+    // Documents of unknown size aren't capped to their size
+    double batch = frame_budget_milliseconds * 1e6 / result.pixel_cost_nanoseconds;
+    int64_t max_batch = doc.pixels > 0 ? std::max(kMinBatchPixels, doc.pixels) : INT64_MAX;
+    result.batch_pixels = std::min<int64_t>(max_batch, std::max<int64_t>(kMinBatchPixels, static_cast<int64_t>(std::min(batch, 1e15))));
+
+    if (doc.pixels == 0) {
+        result.throttle_milliseconds = kDefaultThrottleMilliseconds;
+        return result;
+    }
+
+    // A pass that wasn't timed yet takes at least as long as converting every pixel
+    double pass = doc.pass != 0.0 ? doc.pass : static_cast<double>(doc.pixels) * result.pixel_cost_nanoseconds / 1e6;
+    double throttle = pass / kPassShare;
+    if (doc.edit_interval != 0.0 && doc.edit_interval < throttle)
+        throttle = std::max(throttle, doc.edit_interval * 2.0);
+
+    result.throttle_milliseconds = std::min(kMaxThrottleMilliseconds, std::max(kMinThrottleMilliseconds, std::ceil(throttle)));
+    return result;
+}
+
+void Pacer::Forget(int64_t document_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    documents_.erase(document_id);
+}
+
+void Pacer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    documents_.clear();
+    pixel_cost_ = 0.0;
+}
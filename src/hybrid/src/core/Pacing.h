@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Recommends how the plugin paces its work from what conversions actually cost on this machine, instead of fixed
+ * constants that are too small for big documents and too big for slow machines:
+ *
+ *   batch pixels  the pixels one call can convert within the frame budget, at the measured cost per pixel
+ *   throttle      how often a document's pixels should be fetched from Photoshop. A pass over the document must be
+ *                 able to finish before the next one starts, and while edits come in faster than that the throttle
+ *                 spans at least two of them, so intermediate states are skipped instead of queued.
+ *
+ * Costs are moving averages per document, since the features a document uses (resampling, mips, compression) change
+ * its cost per pixel a lot. Documents that weren't converted yet start from the average of all conversions.
+ */
+class Pacer {
+ public:
+    // What the plugin did before measuring anything
+    static constexpr int64_t kDefaultBatchPixels = 512 * 512;
+    static constexpr double kDefaultThrottleMilliseconds = 1000.0;
+
+    static constexpr int64_t kMinBatchPixels = 64 * 64;
+    static constexpr double kMinThrottleMilliseconds = 100.0;
+    static constexpr double kMaxThrottleMilliseconds = 1000.0;
+
+    struct Recommendation {
+        int64_t batch_pixels;
+        double throttle_milliseconds;
+
+        // What the recommendation is based on, 0 when not measured yet
+        double pixel_cost_nanoseconds;
+        double pass_milliseconds;
+        double edit_interval_milliseconds;
+    };
+
+    // Steady clock nanoseconds, the time base of the record calls
+    static uint64_t Now();
+
+    // An edit of the document was observed at `time`
+    void RecordEdit(int64_t document_id, uint64_t time);
+
+    /**
+     * A call converted `pixels` source pixels of a width x height document from `begin` to `end`. The first band of a
+     * pass over the document starts timing the pass, the last one ends it.
+     */
+    void RecordConversion(int64_t document_id, int64_t width, int64_t height, int64_t pixels, uint64_t begin,
+                          uint64_t end, bool first_band, bool last_band);
+
+    Recommendation Recommend(int64_t document_id, double frame_budget_milliseconds) const;
+
+    void Forget(int64_t document_id);
+    void Reset();
+
+ private:
+    struct DocumentPacing {
+        int64_t pixels = 0;                // size of the document at the last conversion
+        double pixel_cost = 0.0;           // ns per source pixel
+        double pass = 0.0;                 // ms from the first band of a pass to the end of its last
+        double edit_interval = 0.0;        // ms between edits
+        uint64_t last_edit = 0;
+        uint64_t pass_begin = 0;
+        bool in_pass = false;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<int64_t, DocumentPacing> documents_;
+    double pixel_cost_ = 0.0;  // over all documents
+};
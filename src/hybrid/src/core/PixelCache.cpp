@@ -0,0 +1,39 @@
+#include "PixelCache.h"
+
+#include <stdexcept>
+
+#include "Stats.h"
+
+PixelCache::PixelCache(int64_t width, int64_t height, int64_t bytes_per_pixel)
+    : width_(width), height_(height), bytes_per_pixel_(bytes_per_pixel) {
+    if (width < 0 || height < 0)
+        throw std::invalid_argument("Image size can't be negative");
+    if (bytes_per_pixel != 4 && bytes_per_pixel != 8)
+        throw std::invalid_argument("Expected RGBA8 or RGBA half float pixels");
+
+    // New documents start out all 0, so the first snapshot always differs (alpha is never 0 in what we store)
+    pixels_.assign(static_cast<size_t>(width * height * bytes_per_pixel), 0);
+    stats::RecordAllocation(pixels_.size());
+    tiles_written_.assign(static_cast<size_t>(TilesX() * TilesY()), false);
+}
+
+bool PixelCache::TilesWritten(int64_t tile_x_begin, int64_t tile_x_end, int64_t tile_y_begin, int64_t tile_y_end) const {
+    for (int64_t tile_y = tile_y_begin; tile_y < tile_y_end; tile_y++) {
+        for (int64_t tile_x = tile_x_begin; tile_x < tile_x_end; tile_x++) {
+            if (!tiles_written_[static_cast<size_t>(tile_y * TilesX() + tile_x)])
+                return false;
+        }
+    }
+    return true;
+}
+
+void PixelCache::ClearTilesWritten() {
+    tiles_written_.assign(tiles_written_.size(), false);
+}
+
+void PixelCache::MarkTilesWritten(int64_t tile_x_begin, int64_t tile_x_end, int64_t tile_y_begin, int64_t tile_y_end) {
+    for (int64_t tile_y = tile_y_begin; tile_y < tile_y_end; tile_y++) {
+        for (int64_t tile_x = tile_x_begin; tile_x < tile_x_end; tile_x++)
+            tiles_written_[static_cast<size_t>(tile_y * TilesX() + tile_x)] = true;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The last RGBA8 pixels sent to the webview for one document, row-major. New snapshots of the document are compared
+ * against this to find out what actually needs to be sent. Deep documents previewed in HDR are kept as RGBA half floats
+ * instead, 8 bytes per pixel.
+ *
+ * Changes are tracked on a grid of kTileSize x kTileSize tiles. Tiles on the right and bottom edges are clipped to the
+ * image size.
+ */
+class PixelCache {
+ public:
+    static constexpr int64_t kTileSize = 64;
+
+    PixelCache(int64_t width, int64_t height, int64_t bytes_per_pixel = 4);
+
+    int64_t Width() const { return width_; }
+    int64_t Height() const { return height_; }
+    int64_t TilesX() const { return (width_ + kTileSize - 1) / kTileSize; }
+    int64_t TilesY() const { return (height_ + kTileSize - 1) / kTileSize; }
+
+    int64_t BytesPerPixel() const { return bytes_per_pixel_; }
+
+    bool HasSize(int64_t width, int64_t height) const { return width_ == width && height_ == height; }
+    bool HasFormat(int64_t width, int64_t height, int64_t bytes_per_pixel) const {
+        return HasSize(width, height) && bytes_per_pixel_ == bytes_per_pixel;
+    }
+
+    size_t ByteSize() const { return pixels_.size(); }
+
+    uint8_t* Data() { return pixels_.data(); }
+    const uint8_t* Data() const { return pixels_.data(); }
+
+    uint8_t* PixelAt(int64_t x, int64_t y) { return pixels_.data() + (y * width_ + x) * bytes_per_pixel_; }
+    const uint8_t* PixelAt(int64_t x, int64_t y) const { return pixels_.data() + (y * width_ + x) * bytes_per_pixel_; }
+
+    // Tiles count as written once they have been converted since the cache was created. Until then the webview may
+    // still hold older pixels for them, so they can't be sent as a delta against the cache. Ranges are [begin, end).
+    bool TilesWritten(int64_t tile_x_begin, int64_t tile_x_end, int64_t tile_y_begin, int64_t tile_y_end) const;
+    void MarkTilesWritten(int64_t tile_x_begin, int64_t tile_x_end, int64_t tile_y_begin, int64_t tile_y_end);
+
+    // Forget which tiles were written while keeping the pixels, for when the webview no longer has them
+    void ClearTilesWritten();
+
+ private:
+    int64_t width_;
+    int64_t height_;
+    int64_t bytes_per_pixel_;
+    std::vector<uint8_t> pixels_;
+    std::vector<bool> tiles_written_;
+};
@@ -0,0 +1,264 @@
+#include "Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "DeepConversion.h"
+#include "Srgb.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2 1
+#endif
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+double FilterSupport(ResampleFilter filter) {
+    return filter == ResampleFilter::kLanczos3 ? 3.0 : 1.0;
+}
+
+double Sinc(double x) {
+    if (x == 0.0)
+        return 1.0;
+    x *= kPi;
+    return std::sin(x) / x;
+}
+
+double FilterWeight(ResampleFilter filter, double x) {
+    x = std::fabs(x);
+    if (filter == ResampleFilter::kLanczos3)
+        return x < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+// Read `count` cached pixels into linear RGBA floats
+void DecodeRow(const uint8_t* pixels, int64_t count, int64_t bytes_per_pixel, float* out) {
+    if (bytes_per_pixel == 8) {
+        const float* table = deep::HalfTable();
+        for (int64_t i = 0; i < count * 4; i++) {
+            uint16_t half;
+            std::memcpy(&half, pixels + i * 2, sizeof(half));
+            out[i] = table[half];
+        }
+        return;
+    }
+
+    const float* decode = srgb::DecodeTable();
+    for (int64_t i = 0; i < count; i++) {
+        out[i * 4 + 0] = decode[pixels[i * 4 + 0]];
+        out[i * 4 + 1] = decode[pixels[i * 4 + 1]];
+        out[i * 4 + 2] = decode[pixels[i * 4 + 2]];
+        out[i * 4 + 3] = pixels[i * 4 + 3] * (1.0f / 255.0f);
+    }
+}
+
+// Write linear RGBA floats back in the cache format
+void EncodeRow(const float* values, int64_t count, int64_t bytes_per_pixel, uint8_t* pixels) {
+    if (bytes_per_pixel == 8) {
+        for (int64_t i = 0; i < count * 4; i++) {
+            uint16_t half = deep::FloatToHalf(values[i]);
+            std::memcpy(pixels + i * 2, &half, sizeof(half));
+        }
+        return;
+    }
+
+    for (int64_t i = 0; i < count; i++) {
+        pixels[i * 4 + 0] = srgb::Encode(values[i * 4 + 0]);
+        pixels[i * 4 + 1] = srgb::Encode(values[i * 4 + 1]);
+        pixels[i * 4 + 2] = srgb::Encode(values[i * 4 + 2]);
+        float alpha = std::min(1.0f, std::max(0.0f, values[i * 4 + 3]));
+        pixels[i * 4 + 3] = static_cast<uint8_t>(alpha * 255.0f + 0.5f);
+    }
+}
+
+// out[i] = sum of weights[t] * in[t][i] over the taps, for `length` floats
+void WeightedSum(const float* const* in, const float* weights, int64_t taps, int64_t length, float* out) {
+    int64_t i = 0;
+#if RESAMPLER_SSE2
+    for (; i + 4 <= length; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int64_t t = 0; t < taps; t++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in[t] + i), _mm_set1_ps(weights[t])));
+        _mm_storeu_ps(out + i, sum);
+    }
+#endif
+    for (; i < length; i++) {
+        float sum = 0.0f;
+        for (int64_t t = 0; t < taps; t++)
+            sum += in[t][i] * weights[t];
+        out[i] = sum;
+    }
+}
+
+}  // namespace
+
+std::pair<int64_t, int64_t> Resampler::Axis::TargetRange(int64_t source_begin, int64_t source_end) const {
+    // Both the first and the end of the source pixels only grow along the axis
+    size_t size = first.size();
+    size_t begin = 0;
+    size_t end = size;
+    {
+        size_t low = 0, high = size;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (first[mid] + count[mid] <= source_begin)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        begin = low;
+    }
+    {
+        size_t low = begin, high = size;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (first[mid] < source_end)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        end = low;
+    }
+    return {static_cast<int64_t>(begin), static_cast<int64_t>(std::max(begin, end))};
+}
+
+std::pair<int64_t, int64_t> Resampler::Axis::SourceRange(int64_t target_begin, int64_t target_end) const {
+    if (target_begin >= target_end)
+        return {0, 0};
+    size_t last = static_cast<size_t>(target_end - 1);
+    return {first[static_cast<size_t>(target_begin)], first[last] + count[last]};
+}
+
+Resampler::Axis Resampler::BuildAxis(int64_t source_size, int64_t target_size, ResampleFilter filter) {
+    Axis axis;
+    if (source_size <= 0 || target_size <= 0)
+        return axis;
+
+    // Downscaling widens the filter to cover every source pixel
+    double scale = static_cast<double>(source_size) / static_cast<double>(target_size);
+    double filter_scale = std::max(scale, 1.0);
+    double support = FilterSupport(filter) * filter_scale;
+
+    axis.max_taps = static_cast<int64_t>(std::ceil(support)) * 2 + 1;
+    axis.first.resize(static_cast<size_t>(target_size));
+    axis.count.resize(static_cast<size_t>(target_size));
+    axis.weights.assign(static_cast<size_t>(target_size * axis.max_taps), 0.0f);
+
+    std::vector<double> weights(static_cast<size_t>(axis.max_taps));
+    for (int64_t i = 0; i < target_size; i++) {
+        double center = (static_cast<double>(i) + 0.5) * scale;
+        int64_t begin = std::max<int64_t>(0, static_cast<int64_t>(center - support + 0.5));
+        int64_t end = std::min<int64_t>(source_size, static_cast<int64_t>(center + support + 0.5));
+        end = std::max(end, begin + 1);
+        end = std::min(end, begin + axis.max_taps);
+
+        double total = 0.0;
+        for (int64_t s = begin; s < end; s++) {
+            double weight = FilterWeight(filter, (static_cast<double>(s) - center + 0.5) / filter_scale);
+            weights[static_cast<size_t>(s - begin)] = weight;
+            total += weight;
+        }
+
+        float* out = axis.weights.data() + i * axis.max_taps;
+        for (int64_t s = begin; s < end; s++)
+            out[s - begin] = static_cast<float>(total != 0.0 ? weights[static_cast<size_t>(s - begin)] / total : 0.0);
+
+        axis.first[static_cast<size_t>(i)] = begin;
+        axis.count[static_cast<size_t>(i)] = end - begin;
+    }
+    return axis;
+}
+
+Resampler::Resampler(int64_t source_width, int64_t source_height, int64_t target_width, int64_t target_height,
+                     ResampleFilter filter)
+    : source_width_(source_width),
+      source_height_(source_height),
+      target_width_(target_width),
+      target_height_(target_height),
+      filter_(filter) {
+    if (source_width < 0 || source_height < 0 || target_width < 0 || target_height < 0)
+        throw std::invalid_argument("Image size can't be negative");
+
+    horizontal_ = BuildAxis(source_width, target_width, filter);
+    vertical_ = BuildAxis(source_height, target_height, filter);
+}
+
+bool Resampler::Matches(int64_t source_width, int64_t source_height, int64_t target_width, int64_t target_height,
+                        ResampleFilter filter) const {
+    return source_width_ == source_width && source_height_ == source_height && target_width_ == target_width &&
+           target_height_ == target_height && filter_ == filter;
+}
+
+DirtyRect Resampler::TargetRectUnder(const DirtyRect& source_rect) const {
+    auto x = horizontal_.TargetRange(source_rect.x, source_rect.x + source_rect.width);
+    auto y = vertical_.TargetRange(source_rect.y, source_rect.y + source_rect.height);
+    return {x.first, y.first, x.second - x.first, y.second - y.first};
+}
+
+DirtyRect Resampler::SourceRectUnder(const DirtyRect& target_rect) const {
+    auto x = horizontal_.SourceRange(target_rect.x, target_rect.x + target_rect.width);
+    auto y = vertical_.SourceRange(target_rect.y, target_rect.y + target_rect.height);
+    return {x.first, y.first, x.second - x.first, y.second - y.first};
+}
+
+void Resampler::Resample(const PixelCache& source, PixelCache& target, const DirtyRect& target_rect) const {
+    if (!source.HasSize(source_width_, source_height_) || !target.HasSize(target_width_, target_height_) ||
+        source.BytesPerPixel() != target.BytesPerPixel())
+        throw std::invalid_argument("Caches don't match the resampler");
+    if (target_rect.width <= 0 || target_rect.height <= 0)
+        return;
+
+    const int64_t bytes_per_pixel = source.BytesPerPixel();
+    const DirtyRect source_rect = SourceRectUnder(target_rect);
+    const int64_t width = target_rect.width;
+
+    // The source rows are filtered horizontally first, then every target row is a weighted sum of those rows
+    thread_local std::vector<float> line;
+    thread_local std::vector<float> rows;
+    thread_local std::vector<float> out;
+    thread_local std::vector<const float*> taps;
+    line.resize(static_cast<size_t>(source_rect.width * 4));
+    rows.resize(static_cast<size_t>(source_rect.height * width * 4));
+    out.resize(static_cast<size_t>(width * 4));
+    taps.resize(static_cast<size_t>(std::max(horizontal_.max_taps, vertical_.max_taps)));
+
+    for (int64_t y = 0; y < source_rect.height; y++) {
+        DecodeRow(source.PixelAt(source_rect.x, source_rect.y + y), source_rect.width, bytes_per_pixel, line.data());
+
+        float* row = rows.data() + y * width * 4;
+        for (int64_t x = 0; x < width; x++) {
+            size_t target_x = static_cast<size_t>(target_rect.x + x);
+            const float* weights = horizontal_.weights.data() + target_x * horizontal_.max_taps;
+            const float* first = line.data() + (horizontal_.first[target_x] - source_rect.x) * 4;
+            int64_t count = horizontal_.count[target_x];
+
+#if RESAMPLER_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for (int64_t t = 0; t < count; t++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(first + t * 4), _mm_set1_ps(weights[t])));
+            _mm_storeu_ps(row + x * 4, sum);
+#else
+            float sum[4] = {};
+            for (int64_t t = 0; t < count; t++) {
+                for (int64_t c = 0; c < 4; c++)
+                    sum[c] += first[t * 4 + c] * weights[t];
+            }
+            std::memcpy(row + x * 4, sum, sizeof(sum));
+#endif
+        }
+    }
+
+    for (int64_t y = 0; y < target_rect.height; y++) {
+        size_t target_y = static_cast<size_t>(target_rect.y + y);
+        int64_t count = vertical_.count[target_y];
+        for (int64_t t = 0; t < count; t++)
+            taps[static_cast<size_t>(t)] = rows.data() + (vertical_.first[target_y] - source_rect.y + t) * width * 4;
+
+        WeightedSum(taps.data(), vertical_.weights.data() + target_y * vertical_.max_taps, count, width * 4, out.data());
+        EncodeRow(out.data(), width, bytes_per_pixel, target.PixelAt(target_rect.x, target_rect.y + y));
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "PixelCache.h"
+#include "TileConversion.h"
+
+enum class ResampleFilter {
+    kBilinear,  // triangle filter, 2 taps per axis at full size
+    kLanczos3,  // windowed sinc, 6 taps per axis at full size
+};
+
+/**
+ * Resamples a full resolution PixelCache down (or up) to the size the webview previews it at, one rect at a time, so
+ * only the preview pixels under changed source tiles have to be recomputed.
+ *
+ * The filter is separable and widened by the downscale factor, so every source pixel contributes to the result
+ * instead of aliasing. RGBA8 pixels are filtered in linear light and encoded back to sRGB, half floats are already
+ * linear. Rows of RGBA are filtered four channels at a time with SSE2 where available.
+ */
+class Resampler {
+ public:
+    Resampler(int64_t source_width, int64_t source_height, int64_t target_width, int64_t target_height,
+              ResampleFilter filter);
+
+    bool Matches(int64_t source_width, int64_t source_height, int64_t target_width, int64_t target_height,
+                 ResampleFilter filter) const;
+
+    ResampleFilter Filter() const { return filter_; }
+
+    // The target pixels that depend on the source rect, empty when none do
+    DirtyRect TargetRectUnder(const DirtyRect& source_rect) const;
+
+    // The source pixels the target rect depends on
+    DirtyRect SourceRectUnder(const DirtyRect& target_rect) const;
+
+    /**
+     * Recompute the target rect from the source. Both caches must have the sizes the resampler was made for and the
+     * same bytes per pixel. Rects that don't overlap can be resampled on different threads.
+     */
+    void Resample(const PixelCache& source, PixelCache& target, const DirtyRect& target_rect) const;
+
+ private:
+    // Which source pixels each target pixel along one axis is made of, and their weights
+    struct Axis {
+        std::vector<int64_t> first;  // first source pixel
+        std::vector<int64_t> count;  // number of source pixels
+        std::vector<float> weights;  // max_taps weights per target pixel, the first count of them are used
+        int64_t max_taps = 0;
+
+        std::pair<int64_t, int64_t> TargetRange(int64_t source_begin, int64_t source_end) const;
+        std::pair<int64_t, int64_t> SourceRange(int64_t target_begin, int64_t target_end) const;
+    };
+
+    static Axis BuildAxis(int64_t source_size, int64_t target_size, ResampleFilter filter);
+
+    int64_t source_width_;
+    int64_t source_height_;
+    int64_t target_width_;
+    int64_t target_height_;
+    ResampleFilter filter_;
+    Axis horizontal_;
+    Axis vertical_;
+};
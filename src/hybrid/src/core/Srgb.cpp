@@ -0,0 +1,54 @@
+#include "Srgb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace srgb {
+
+namespace {
+
+double ToLinear(double value) {
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+double FromLinear(double value) {
+    return value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+}
+
+}  // namespace
+
+const uint16_t* DecodeTable16() {
+    static const std::vector<uint16_t> table = [] {
+        std::vector<uint16_t> values(256);
+        for (int i = 0; i < 256; i++)
+            values[static_cast<size_t>(i)] = static_cast<uint16_t>(std::lround(ToLinear(i / 255.0) * 65535.0));
+        return values;
+    }();
+    return table.data();
+}
+
+const float* DecodeTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; i++)
+            values[static_cast<size_t>(i)] = static_cast<float>(ToLinear(i / 255.0));
+        return values;
+    }();
+    return table.data();
+}
+
+const uint8_t* EncodeTable() {
+    static const std::vector<uint8_t> table = [] {
+        std::vector<uint8_t> values(size_t{1} << kEncodeBits);
+        for (size_t i = 0; i < values.size(); i++) {
+            double linear = (static_cast<double>(i) + 0.5) / static_cast<double>(values.size());
+            values[i] = static_cast<uint8_t>(std::lround(std::min(1.0, FromLinear(linear)) * 255.0));
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+}  // namespace srgb
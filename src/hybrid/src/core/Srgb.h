@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Lookup tables between sRGB encoded bytes and linear light, for filtering RGBA8 pixels without darkening them.
+ */
+namespace srgb {
+
+// Bits of the linear values EncodeTable is indexed with
+constexpr int kEncodeBits = 14;
+
+// sRGB encoded byte to 16 bit linear light
+const uint16_t* DecodeTable16();
+
+// sRGB encoded byte to linear light in [0, 1]
+const float* DecodeTable();
+
+// Linear light in kEncodeBits to the nearest sRGB encoded byte
+const uint8_t* EncodeTable();
+
+// Linear light in [0, 1] to the nearest sRGB encoded byte, values outside are clamped
+inline uint8_t Encode(float linear) {
+    const float steps = static_cast<float>((1 << kEncodeBits) - 1);
+    float index = linear > 0.0f ? (linear < 1.0f ? linear * steps + 0.5f : steps) : 0.0f;
+    return EncodeTable()[static_cast<int>(index)];
+}
+
+}  // namespace srgb
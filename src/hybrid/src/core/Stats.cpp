@@ -0,0 +1,110 @@
+#include "Stats.h"
+
+namespace stats {
+
+namespace {
+
+CallStats call_stats[static_cast<size_t>(Call::kCount)];
+CacheStats cache_stats;
+
+}  // namespace
+
+const char* CallName(Call call) {
+    switch (call) {
+    case Call::kConvertToString:
+        return "convert_to_string";
+    case Call::kConvertTiles:
+        return "convert_tiles";
+    case Call::kConvertImage:
+        return "convert_image";
+    case Call::kResampleDocument:
+        return "resample_document";
+    case Call::kCloseDocument:
+        return "close_document";
+    default:
+        return "unknown";
+    }
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds) {
+    uint64_t microseconds = nanoseconds / 1000;
+    size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (microseconds >> (bucket + 1)) != 0)
+        bucket++;
+
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !max_.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::Reset() {
+    for (auto& bucket : buckets_)
+        bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    total_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::PercentileMicroseconds(double fraction) const {
+    uint64_t counts[kBuckets];
+    uint64_t count = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        counts[i] = Bucket(i);
+        count += counts[i];
+    }
+    if (count == 0)
+        return 0.0;
+
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count) + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += counts[i];
+        if (seen >= rank && seen > 0)
+            return static_cast<double>(uint64_t{2} << i);
+    }
+    return static_cast<double>(uint64_t{2} << (kBuckets - 1));
+}
+
+void CallStats::Reset() {
+    latency.Reset();
+    errors.store(0, std::memory_order_relaxed);
+    unchanged.store(0, std::memory_order_relaxed);
+    superseded.store(0, std::memory_order_relaxed);
+    bytes_in.store(0, std::memory_order_relaxed);
+    bytes_out.store(0, std::memory_order_relaxed);
+}
+
+void CacheStats::Reset() {
+    allocations.store(0, std::memory_order_relaxed);
+    allocated_bytes.store(0, std::memory_order_relaxed);
+    evictions.store(0, std::memory_order_relaxed);
+    hibernations.store(0, std::memory_order_relaxed);
+    restores.store(0, std::memory_order_relaxed);
+}
+
+CallStats& For(Call call) {
+    return call_stats[static_cast<size_t>(call)];
+}
+
+CacheStats& Cache() {
+    return cache_stats;
+}
+
+void Reset() {
+    for (CallStats& stats : call_stats)
+        stats.Reset();
+    cache_stats.Reset();
+}
+
+ScopedCall::~ScopedCall() {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    stats_.latency.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    if (!succeeded_)
+        stats_.errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace stats
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Process wide counters of what the addon does, for dashboards. Everything is a relaxed atomic, so recording from the
+ * conversion threads costs a few uncontended increments and nothing ever blocks. Counters are read one at a time, a
+ * snapshot taken during a call may be off by that call.
+ */
+namespace stats {
+
+// The entrypoints that are timed. The _async variants count with their sync counterparts.
+enum class Call {
+    kConvertToString,
+    kConvertTiles,
+    kConvertImage,
+    kResampleDocument,
+    kCloseDocument,
+    kCount,
+};
+
+const char* CallName(Call call);
+
+/**
+ * Call latencies in power of two buckets of microseconds: bucket 0 holds calls under 2us, bucket i calls from 2^i us
+ * up to 2^(i+1) us, the last bucket everything longer.
+ */
+class LatencyHistogram {
+ public:
+    static constexpr size_t kBuckets = 28;  // the last bucket starts at about 2 minutes
+
+    void Record(uint64_t nanoseconds);
+    void Reset();
+
+    uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t TotalNanoseconds() const { return total_.load(std::memory_order_relaxed); }
+    uint64_t MaxNanoseconds() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t Bucket(size_t index) const { return buckets_[index].load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket the given fraction of calls fall under, in microseconds. 0 without calls.
+    double PercentileMicroseconds(double fraction) const;
+
+ private:
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+struct CallStats {
+    LatencyHistogram latency;
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> unchanged{0};  // calls that had nothing to send
+    std::atomic<uint64_t> superseded{0}; // calls skipped because a newer snapshot of the document was queued
+    std::atomic<uint64_t> bytes_in{0};   // pixel bytes read from Photoshop's buffers
+    std::atomic<uint64_t> bytes_out{0};  // payload bytes handed back to javascript
+
+    void Reset();
+};
+
+// Buffers the document caches allocate, counted where they are created
+struct CacheStats {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocated_bytes{0};
+    std::atomic<uint64_t> evictions{0};      // documents evicted for the memory budget
+    std::atomic<uint64_t> hibernations{0};   // documents written out by hibernate
+    std::atomic<uint64_t> restores{0};       // documents mapped back in
+
+    void Reset();
+};
+
+CallStats& For(Call call);
+CacheStats& Cache();
+
+inline void RecordAllocation(size_t bytes) {
+    Cache().allocations.fetch_add(1, std::memory_order_relaxed);
+    Cache().allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+// Zero every counter
+void Reset();
+
+/**
+ * Times a call from construction to destruction. Calls that leave through an exception count as errors unless
+ * Succeeded was called first.
+ */
+class ScopedCall {
+ public:
+    explicit ScopedCall(Call call) : stats_(For(call)), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedCall();
+
+    ScopedCall(const ScopedCall&) = delete;
+    ScopedCall& operator=(const ScopedCall&) = delete;
+
+    CallStats& Stats() { return stats_; }
+    void Succeeded() { succeeded_ = true; }
+
+ private:
+    CallStats& stats_;
+    std::chrono::steady_clock::time_point start_;
+    bool succeeded_ = false;
+};
+
+}  // namespace stats
@@ -0,0 +1,203 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+#include "Trace.h"
+
+struct ThreadPool::Job {
+    const std::function<void(size_t)>* body;
+
+    std::atomic<size_t> remaining;  // items not finished yet
+
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;  // first exception thrown by an item, guarded by mutex
+};
+
+namespace {
+
+// Set while this thread runs inside ParallelFor, either its own or as a worker running items. SetThreadCount can't get
+// past the shared lock held by the outermost ParallelFor then, so nested calls skip taking it again: a second shared
+// lock would block behind a waiting SetThreadCount and never be released.
+thread_local bool inside_pool = false;
+
+class InsidePool {
+ public:
+    InsidePool() : previous_(inside_pool) { inside_pool = true; }
+    ~InsidePool() { inside_pool = previous_; }
+
+ private:
+    bool previous_;
+};
+
+}  // namespace
+
+ThreadPool& ThreadPool::Shared() {
+    static ThreadPool pool(0);
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    StartWorkers(thread_count);
+}
+
+ThreadPool::~ThreadPool() {
+    StopWorkers();
+}
+
+size_t ThreadPool::ThreadCount() const {
+    return thread_count_.load(std::memory_order_acquire);
+}
+
+void ThreadPool::SetThreadCount(size_t thread_count) {
+    std::unique_lock<std::shared_mutex> lock(resize_mutex_);
+    StopWorkers();
+    StartWorkers(thread_count);
+}
+
+void ThreadPool::StartWorkers(size_t thread_count) {
+    if (thread_count == 0)
+        thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    stopping_ = false;
+    pending_ = 0;
+    queues_.clear();
+    for (size_t i = 0; i < thread_count; i++)
+        queues_.push_back(std::make_unique<Queue>());
+    thread_count_.store(thread_count, std::memory_order_release);
+
+    for (size_t i = 0; i + 1 < thread_count; i++)
+        workers_.emplace_back([this, i] { WorkerLoop(i); });
+}
+
+void ThreadPool::StopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    for (std::thread& worker : workers_)
+        worker.join();
+    workers_.clear();
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& body) {
+    if (count == 0)
+        return;
+
+    std::shared_lock<std::shared_mutex> lock(resize_mutex_, std::defer_lock);
+    if (!inside_pool)
+        lock.lock();
+    InsidePool inside;
+
+    size_t threads = queues_.size();
+    if (threads == 1 || count == 1) {
+        for (size_t i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+
+    Job job;
+    job.body = &body;
+    job.remaining = count;
+
+    // A few ranges per thread, so there is something left to steal when one thread gets the expensive items
+    size_t ranges = std::min(count, threads * 4);
+    {
+        size_t begin = 0;
+        for (size_t r = 0; r < ranges; r++) {
+            size_t end = count * (r + 1) / ranges;
+            Queue& queue = *queues_[r % threads];
+            std::lock_guard<std::mutex> queue_lock(queue.mutex);
+            queue.items.push_back({&job, begin, end});
+            begin = end;
+        }
+    }
+    {
+        // Counted once the items are visible, so a woken worker always finds something to take instead of spinning
+        // on an empty set of queues
+        std::lock_guard<std::mutex> wake_lock(wake_mutex_);
+        pending_ += static_cast<std::ptrdiff_t>(ranges);
+    }
+    wake_.notify_all();
+
+    // Help out until nothing is left to take, then wait for items still running on the workers. Items of other jobs
+    // may be run here too, which is fine since they never wait on us.
+    Work work;
+    while (job.remaining.load(std::memory_order_acquire) > 0 && TakeWork(threads - 1, work))
+        RunWork(work);
+
+    std::unique_lock<std::mutex> job_lock(job.mutex);
+    job.done.wait(job_lock, [&job] { return job.remaining.load(std::memory_order_acquire) == 0; });
+
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    trace::NameThread("pool worker");
+    InsidePool inside;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_.wait(lock, [this] { return stopping_ || pending_ > 0; });
+            if (stopping_)
+                return;
+        }
+
+        Work work;
+        while (TakeWork(index, work))
+            RunWork(work);
+    }
+}
+
+bool ThreadPool::TakeWork(size_t index, Work& work) {
+    size_t threads = queues_.size();
+    for (size_t i = 0; i < threads; i++) {
+        // Our own queue from the front, everyone else's from the back
+        bool own = i == 0;
+        Queue& queue = *queues_[(index + i) % threads];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.items.empty())
+            continue;
+
+        if (own) {
+            work = queue.items.front();
+            queue.items.pop_front();
+        } else {
+            work = queue.items.back();
+            queue.items.pop_back();
+        }
+
+        std::lock_guard<std::mutex> wake_lock(wake_mutex_);
+        pending_--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::RunWork(const Work& work) {
+    Job& job = *work.job;
+    trace::Span span("parallel for", "items", static_cast<int64_t>(work.end - work.begin));
+
+    for (size_t i = work.begin; i < work.end; i++) {
+        try {
+            (*job.body)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!job.error)
+                job.error = std::current_exception();
+        }
+    }
+
+    // The job lives on the stack of ParallelFor, which returns as soon as it sees remaining at zero. Counting down
+    // under the lock makes it wait until we're done touching the job.
+    size_t finished = work.end - work.begin;
+    std::lock_guard<std::mutex> lock(job.mutex);
+    if (job.remaining.fetch_sub(finished, std::memory_order_acq_rel) == finished)
+        job.done.notify_all();
+}
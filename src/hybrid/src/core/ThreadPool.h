@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker threads for the data parallel parts of a conversion: running the kernels over tiles, and encoding the dirty
+ * rects. Work is split into items that are dealt out to per-thread queues up front. A thread that runs out of items
+ * steals from the back of another thread's queue, so an uneven split (some tiles changed, most didn't) still keeps
+ * every core busy.
+ *
+ * The thread calling ParallelFor works on the job as well, so a pool with a thread count of 1 has no workers and runs
+ * everything inline.
+ */
+class ThreadPool {
+ public:
+    // The pool used by conversions, sized to the number of cores until SetThreadCount is called
+    static ThreadPool& Shared();
+
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads working on each job, including the calling thread. Safe to call while the pool is being resized.
+    size_t ThreadCount() const;
+
+    // 0 picks one thread per core. Waits for running jobs to finish first.
+    void SetThreadCount(size_t thread_count);
+
+    // Run body(i) for every i in [0, count) and return once all of them are done. The order items run in is
+    // unspecified. If any item throws, the first exception is rethrown here. May be called from inside an item.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+ private:
+    struct Job;
+
+    // A range of item indices of one job
+    struct Work {
+        Job* job;
+        size_t begin;
+        size_t end;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Work> items;
+    };
+
+    void StartWorkers(size_t thread_count);
+    void StopWorkers();
+    void WorkerLoop(size_t index);
+
+    // Pop from our own queue, or steal from someone else's. Returns false when every queue is empty.
+    bool TakeWork(size_t index, Work& work);
+    void RunWork(const Work& work);
+
+    // Held shared by ParallelFor, exclusively while the workers are being replaced
+    std::shared_mutex resize_mutex_;
+
+    // One queue per thread. The last queue belongs to the threads calling ParallelFor.
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> thread_count_{0};  // queues_.size(), readable without resize_mutex_
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    // Items queued and not yet taken, guarded by wake_mutex_. Counted after the items are pushed, so it can dip below
+    // zero for a moment when a thread takes an item first.
+    std::ptrdiff_t pending_ = 0;
+    bool stopping_ = false;
+};
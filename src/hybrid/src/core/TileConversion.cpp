@@ -0,0 +1,391 @@
+#include "TileConversion.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "Kernels.h"
+#include "ThreadPool.h"
+
+void SourcePixels::Validate() const {
+    const int64_t color_components = color::ColorComponents(color_mode);
+    if (components != color_components && components != color_components + 1) {
+        if (color_mode == color::Mode::kRgb)
+            throw std::invalid_argument("Expected RGB or RGBA pixel data, got " + std::to_string(components) + " components");
+        throw std::invalid_argument(std::string("Expected ") + color::ModeName(color_mode) + " pixel data with or without alpha, got " +
+                                    std::to_string(components) + " components");
+    }
+    if (component_size != 8 && component_size != 16 && component_size != 32) {
+        throw std::invalid_argument("Expected 8, 16 or 32 bit components, got " + std::to_string(component_size));
+    }
+    if (!color::SupportsComponentSize(color_mode, component_size)) {
+        throw std::invalid_argument(std::string("Expected 8 or 16 bit components for ") + color::ModeName(color_mode) + " pixel data");
+    }
+    if (width < 0 || height < 0 || static_cast<size_t>(width * height * components * (component_size / 8)) > byte_length) {
+        throw std::out_of_range("Image size doesn't match the pixel data");
+    }
+}
+
+namespace {
+
+/**
+ * Where a span's converted pixels go: the cache, or a scratch buffer holding the pixels from (x, y) on
+ */
+struct SpanTarget {
+    uint8_t* data;
+    int64_t x;
+    int64_t y;
+    int64_t width;
+    int64_t bytes_per_pixel;
+
+    uint8_t* PixelAt(int64_t pixel_x, int64_t pixel_y) const {
+        return data + ((pixel_y - y) * width + pixel_x - x) * bytes_per_pixel;
+    }
+};
+
+/**
+ * Same as ConvertSpan for 16 and 32 bit RGB sources
+ */
+void ConvertDeepSpan(const SourcePixels& source, const SpanTarget& cache, deep::Quantization quantization, int64_t y_begin,
+                     int64_t y_end, int64_t tile_x_begin, int64_t tile_x_end, uint8_t* dirty) {
+    const int64_t tile_size = PixelCache::kTileSize;
+    const size_t component_bytes = static_cast<size_t>(source.component_size / 8);
+    const size_t plane_stride = static_cast<size_t>(source.width * source.height) * component_bytes;
+    const size_t pixel_bytes = source.is_chunky ? component_bytes * source.components : component_bytes;
+
+    for (int64_t y = y_begin; y < y_end; y++) {
+        for (int64_t tile_x = tile_x_begin; tile_x < tile_x_end; tile_x++) {
+            int64_t x = tile_x * tile_size;
+            size_t count = static_cast<size_t>(std::min(tile_size, source.width - x));
+            size_t pixel_index = static_cast<size_t>(y * source.width + x);
+
+            if (deep::ConvertPixels(source.data + pixel_index * pixel_bytes, plane_stride, source.is_chunky,
+                                    source.components, source.component_size, quantization, x, y,
+                                    cache.PixelAt(x, y), count))
+                dirty[tile_x] = 1;
+        }
+    }
+}
+
+/**
+ * Same as ConvertSpan for Lab and CMYK sources, and deep grayscale ones. Each tile's part of a row is converted to RGBA
+ * into scratch memory first, then stored like an RGBA source of that component size.
+ */
+void ConvertColorSpan(const SourcePixels& source, const SpanTarget& cache, deep::Quantization quantization, int64_t y_begin,
+                      int64_t y_end, int64_t tile_x_begin, int64_t tile_x_end, uint8_t* dirty) {
+    thread_local std::vector<uint8_t> rgba;
+
+    const int64_t tile_size = PixelCache::kTileSize;
+    const size_t component_bytes = static_cast<size_t>(source.component_size / 8);
+    const size_t plane_stride = static_cast<size_t>(source.width * source.height) * component_bytes;
+    const size_t pixel_bytes = source.is_chunky ? component_bytes * source.components : component_bytes;
+    const int64_t rgba_size = color::RgbaComponentSize(source.color_mode, source.component_size);
+    const kernels::ChunkyKernel copy = kernels::ActiveKernels().chunky_rgba;
+    rgba.resize(static_cast<size_t>(tile_size * 4 * rgba_size / 8));
+
+    for (int64_t y = y_begin; y < y_end; y++) {
+        for (int64_t tile_x = tile_x_begin; tile_x < tile_x_end; tile_x++) {
+            int64_t x = tile_x * tile_size;
+            size_t count = static_cast<size_t>(std::min(tile_size, source.width - x));
+            size_t pixel_index = static_cast<size_t>(y * source.width + x);
+
+            color::ToRgba(source.color_mode, source.data + pixel_index * pixel_bytes, plane_stride, source.is_chunky,
+                          source.components, source.component_size, rgba.data(), count);
+            bool changed = rgba_size == 8
+                ? copy(rgba.data(), cache.PixelAt(x, y), count)
+                : deep::ConvertPixels(rgba.data(), 0, true, 4, rgba_size, quantization, x, y, cache.PixelAt(x, y), count);
+            if (changed)
+                dirty[tile_x] = 1;
+        }
+    }
+}
+
+/**
+ * Convert the tiles [tile_x_begin, tile_x_end) of the pixel rows [y_begin, y_end) into the cache, and set dirty[tile_x]
+ * for each tile that differed from the cache.
+ */
+void ConvertSpan(const SourcePixels& source, const SpanTarget& cache, int64_t y_begin, int64_t y_end,
+                 int64_t tile_x_begin, int64_t tile_x_end, uint8_t* dirty) {
+    const int64_t tile_size = PixelCache::kTileSize;
+    const int64_t width = source.width;
+    const int64_t components = source.components;
+    const uint8_t* data = source.data;
+    const size_t plane_size = static_cast<size_t>(source.width * source.height);
+    const kernels::KernelSet& k = kernels::ActiveKernels();
+    const bool gray = source.color_mode == color::Mode::kGrayscale;
+    const kernels::PlanarKernel planar = gray ? k.PlanarGray(components) : k.Planar(components);
+    const kernels::ChunkyKernel chunky = gray ? k.chunky_gray_alpha : k.Chunky(components);
+    // A single gray plane is laid out the same either way
+    const bool is_chunky = source.is_chunky && components > 1;
+
+    // Walk the span row by row so the source planes are read sequentially. Each row is split at tile boundaries
+    // so we know which tile a difference belongs to. The kernels always store the new pixels, even once a tile is
+    // known to be dirty.
+    for (int64_t y = y_begin; y < y_end; y++) {
+        for (int64_t tile_x = tile_x_begin; tile_x < tile_x_end; tile_x++) {
+            int64_t x = tile_x * tile_size;
+            size_t count = static_cast<size_t>(std::min(tile_size, width - x));
+            size_t pixel_index = static_cast<size_t>(y * width + x);
+
+            bool changed = is_chunky
+                ? chunky(data + pixel_index * components, cache.PixelAt(x, y), count)
+                : planar(data + pixel_index, plane_size, cache.PixelAt(x, y), count);
+            if (changed)
+                dirty[tile_x] = 1;
+        }
+    }
+}
+
+/**
+ * Convert a span with whichever of the above fits the source
+ */
+void ConvertSourceSpan(const SourcePixels& source, const SpanTarget& cache, deep::Quantization quantization, int64_t y_begin,
+                       int64_t y_end, int64_t tile_x_begin, int64_t tile_x_end, uint8_t* dirty) {
+    bool rgb_or_gray = source.color_mode == color::Mode::kRgb || source.color_mode == color::Mode::kGrayscale;
+    if (source.component_size == 8 && rgb_or_gray)
+        ConvertSpan(source, cache, y_begin, y_end, tile_x_begin, tile_x_end, dirty);
+    else if (source.color_mode == color::Mode::kRgb)
+        ConvertDeepSpan(source, cache, quantization, y_begin, y_end, tile_x_begin, tile_x_end, dirty);
+    else
+        ConvertColorSpan(source, cache, quantization, y_begin, y_end, tile_x_begin, tile_x_end, dirty);
+}
+
+/**
+ * How a band is split into spans of tiles within one tile row for the thread pool. Whole tile rows read the source
+ * planes most sequentially, so rows are only split when the band has too few of them to give every thread a few spans.
+ */
+struct SpanLayout {
+    int64_t span_tiles;
+    int64_t spans_x;
+
+    SpanLayout(int64_t tiles_x, int64_t tile_row_count) {
+        ThreadPool& pool = ThreadPool::Shared();
+        int64_t spans_per_row = 1;
+        if (pool.ThreadCount() > 1 && tile_row_count > 0) {
+            int64_t wanted_spans = static_cast<int64_t>(pool.ThreadCount()) * 4;
+            spans_per_row = std::min(tiles_x, (wanted_spans + tile_row_count - 1) / tile_row_count);
+        }
+        span_tiles = std::max<int64_t>(1, (tiles_x + spans_per_row - 1) / spans_per_row);
+        spans_x = (tiles_x + span_tiles - 1) / span_tiles;
+    }
+};
+
+/**
+ * One rect per run of dirty tiles in each tile row of the band, dirty holding a flag per tile row by row
+ */
+std::vector<DirtyRect> DirtyRuns(const std::vector<uint8_t>& dirty, int64_t tiles_x, int64_t first_tile_row,
+                                 int64_t tile_row_count, int64_t width, int64_t height) {
+    const int64_t tile_size = PixelCache::kTileSize;
+
+    std::vector<DirtyRect> result;
+    for (int64_t row = 0; row < tile_row_count; row++) {
+        int64_t y_begin = (first_tile_row + row) * tile_size;
+        int64_t y_end = std::min(y_begin + tile_size, height);
+        const uint8_t* row_dirty = dirty.data() + row * tiles_x;
+
+        for (int64_t tile_x = 0; tile_x < tiles_x; tile_x++) {
+            if (!row_dirty[tile_x])
+                continue;
+
+            int64_t run_end = tile_x + 1;
+            while (run_end < tiles_x && row_dirty[run_end])
+                run_end++;
+
+            int64_t x = tile_x * tile_size;
+            result.push_back({x, y_begin, std::min(run_end * tile_size, width) - x, y_end - y_begin});
+            tile_x = run_end;
+        }
+    }
+    return result;
+}
+
+}  // namespace
+
+std::vector<DirtyRect> ConvertTileRows(
+    const SourcePixels& source, PixelCache& cache, int64_t first_tile_row, int64_t tile_row_count, bool force_full_update,
+    deep::Quantization quantization) {
+    if (!cache.HasSize(source.width, source.height))
+        throw std::invalid_argument("Cache size doesn't match the pixel data");
+
+    // 8 bit sources are copied as they are, only deep sources can be kept as half floats
+    bool deep_source = source.component_size != 8;
+    if (cache.BytesPerPixel() != (deep_source ? deep::CacheBytesPerPixel(quantization) : 4))
+        throw std::invalid_argument("Cache pixel format doesn't match the conversion");
+    if (first_tile_row < 0 || tile_row_count < 0 || first_tile_row + tile_row_count > cache.TilesY())
+        throw std::out_of_range("Tile rows are outside of the image");
+
+    const int64_t tile_size = PixelCache::kTileSize;
+    const int64_t tiles_x = cache.TilesX();
+
+    // The band is converted on the thread pool in spans of tiles within one tile row. A span only writes its own tiles
+    // of the cache and its own dirty flags.
+    const SpanLayout layout(tiles_x, tile_row_count);
+    const SpanTarget target = {cache.Data(), 0, 0, cache.Width(), cache.BytesPerPixel()};
+
+    std::vector<uint8_t> dirty(static_cast<size_t>(tiles_x * tile_row_count), 1);
+    for (int64_t row = 0; row < tile_row_count && !force_full_update; row++) {
+        for (int64_t tile_x = 0; tile_x < tiles_x; tile_x++) {
+            int64_t tile_y = first_tile_row + row;
+            dirty[static_cast<size_t>(row * tiles_x + tile_x)] = !cache.TilesWritten(tile_x, tile_x + 1, tile_y, tile_y + 1);
+        }
+    }
+
+    ThreadPool::Shared().ParallelFor(static_cast<size_t>(layout.spans_x * tile_row_count), [&](size_t item) {
+        int64_t row = static_cast<int64_t>(item) / layout.spans_x;
+        int64_t span_begin = static_cast<int64_t>(item) % layout.spans_x * layout.span_tiles;
+
+        int64_t y_begin = (first_tile_row + row) * tile_size;
+        int64_t y_end = std::min(y_begin + tile_size, source.height);
+        int64_t span_end = std::min(span_begin + layout.span_tiles, tiles_x);
+        uint8_t* row_dirty = dirty.data() + row * tiles_x;
+
+        ConvertSourceSpan(source, target, quantization, y_begin, y_end, span_begin, span_end, row_dirty);
+    });
+
+    cache.MarkTilesWritten(0, tiles_x, first_tile_row, first_tile_row + tile_row_count);
+    return DirtyRuns(dirty, tiles_x, first_tile_row, tile_row_count, source.width, source.height);
+}
+
+std::vector<DirtyRect> HashTileRows(
+    const SourcePixels& source, TileHashes& hashes, int64_t first_tile_row, int64_t tile_row_count, bool force_full_update,
+    deep::Quantization quantization) {
+    if (hashes.Width() != source.width || hashes.Height() != source.height)
+        throw std::invalid_argument("Hash size doesn't match the pixel data");
+    if (first_tile_row < 0 || tile_row_count < 0 || first_tile_row + tile_row_count > hashes.TilesY())
+        throw std::out_of_range("Tile rows are outside of the image");
+
+    const bool deep_source = source.component_size != 8;
+    const int64_t bytes_per_pixel = deep_source ? deep::CacheBytesPerPixel(quantization) : 4;
+    const int64_t tile_size = PixelCache::kTileSize;
+    const int64_t tiles_x = hashes.TilesX();
+    const SpanLayout layout(tiles_x, tile_row_count);
+
+    // Each span is converted like ConvertTileRows would into a scratch buffer of its own, then hashed tile by tile
+    std::vector<uint8_t> dirty(static_cast<size_t>(tiles_x * tile_row_count), 0);
+    ThreadPool::Shared().ParallelFor(static_cast<size_t>(layout.spans_x * tile_row_count), [&](size_t item) {
+        thread_local std::vector<uint8_t> scratch;
+        thread_local std::vector<uint8_t> unused_dirty;
+
+        int64_t row = static_cast<int64_t>(item) / layout.spans_x;
+        int64_t span_begin = static_cast<int64_t>(item) % layout.spans_x * layout.span_tiles;
+        int64_t tile_y = first_tile_row + row;
+
+        int64_t y_begin = tile_y * tile_size;
+        int64_t y_end = std::min(y_begin + tile_size, source.height);
+        int64_t span_end = std::min(span_begin + layout.span_tiles, tiles_x);
+        int64_t x_begin = span_begin * tile_size;
+        int64_t span_width = std::min(span_end * tile_size, source.width) - x_begin;
+
+        scratch.resize(static_cast<size_t>(span_width * (y_end - y_begin) * bytes_per_pixel));
+        unused_dirty.resize(static_cast<size_t>(tiles_x));
+        const SpanTarget target = {scratch.data(), x_begin, y_begin, span_width, bytes_per_pixel};
+        ConvertSourceSpan(source, target, quantization, y_begin, y_end, span_begin, span_end, unused_dirty.data());
+
+        for (int64_t tile_x = span_begin; tile_x < span_end; tile_x++) {
+            int64_t x = tile_x * tile_size;
+            int64_t tile_width = std::min(tile_size, source.width - x);
+            uint64_t hash = HashRows(target.PixelAt(x, y_begin), static_cast<size_t>(span_width * bytes_per_pixel),
+                                     static_cast<size_t>(tile_width * bytes_per_pixel), y_end - y_begin);
+
+            if (force_full_update || !hashes.Written(tile_x, tile_y) || hashes.At(tile_x, tile_y) != hash)
+                dirty[static_cast<size_t>(row * tiles_x + tile_x)] = 1;
+            hashes.Set(tile_x, tile_y, hash);
+        }
+    });
+
+    for (int64_t row = 0; row < tile_row_count; row++) {
+        for (int64_t tile_x = 0; tile_x < tiles_x; tile_x++)
+            hashes.MarkWritten(tile_x, first_tile_row + row);
+    }
+    return DirtyRuns(dirty, tiles_x, first_tile_row, tile_row_count, source.width, source.height);
+}
+
+uint64_t HashTile(const PixelCache& cache, int64_t tile_x, int64_t tile_y) {
+    const int64_t tile_size = PixelCache::kTileSize;
+    int64_t x = tile_x * tile_size;
+    int64_t y = tile_y * tile_size;
+    return HashRows(cache.PixelAt(x, y), static_cast<size_t>(cache.Width() * cache.BytesPerPixel()),
+                    static_cast<size_t>(std::min(tile_size, cache.Width() - x) * cache.BytesPerPixel()),
+                    std::min(tile_size, cache.Height() - y));
+}
+
+namespace {
+
+bool Overlaps(const DirtyRect& a, const DirtyRect& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+}  // namespace
+
+void MergeOverlappingRects(std::vector<DirtyRect>& rects) {
+    // Sweep from left to right over the rects sorted by x. Each one is merged into the open rects it overlaps, those
+    // the sweep is still inside of, and closed rects can't overlap anything further right. A merge that grows a rect
+    // up or down can reach a rect closed earlier though, so the sweep is repeated until one merges nothing. That's a
+    // single extra sweep in practice, instead of starting over after every merge.
+    bool merged = rects.size() > 1;
+    while (merged) {
+        merged = false;
+        std::sort(rects.begin(), rects.end(), [](const DirtyRect& a, const DirtyRect& b) { return a.x < b.x; });
+
+        std::vector<DirtyRect> swept;
+        std::vector<bool> alive;
+        std::vector<size_t> open;  // indices into swept
+        swept.reserve(rects.size());
+        alive.reserve(rects.size());
+
+        for (const DirtyRect& rect : rects) {
+            open.erase(std::remove_if(open.begin(), open.end(),
+                                      [&](size_t i) { return swept[i].x + swept[i].width <= rect.x; }),
+                       open.end());
+
+            // Growing may make the rect overlap open rects it didn't before, so look again after every merge
+            DirtyRect current = rect;
+            for (size_t k = 0; k < open.size();) {
+                const DirtyRect& other = swept[open[k]];
+                if (!Overlaps(current, other)) {
+                    k++;
+                    continue;
+                }
+
+                int64_t right = std::max(current.x + current.width, other.x + other.width);
+                int64_t bottom = std::max(current.y + current.height, other.y + other.height);
+                current.x = std::min(current.x, other.x);
+                current.y = std::min(current.y, other.y);
+                current.width = right - current.x;
+                current.height = bottom - current.y;
+
+                alive[open[k]] = false;
+                open.erase(open.begin() + static_cast<std::ptrdiff_t>(k));
+                merged = true;
+                k = 0;
+            }
+
+            open.push_back(swept.size());
+            swept.push_back(current);
+            alive.push_back(true);
+        }
+
+        rects.clear();
+        for (size_t i = 0; i < swept.size(); i++) {
+            if (alive[i])
+                rects.push_back(swept[i]);
+        }
+    }
+
+    // Back in the order of rows the rects came in
+    std::sort(rects.begin(), rects.end(),
+              [](const DirtyRect& a, const DirtyRect& b) { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+}
+
+void CopyRect(const PixelCache& cache, const DirtyRect& rect, uint8_t* out) {
+    CopyRect(cache.Data(), cache.Width(), rect, out, cache.BytesPerPixel());
+}
+
+void CopyRect(const uint8_t* pixels, int64_t image_width, const DirtyRect& rect, uint8_t* out, int64_t bytes_per_pixel) {
+    size_t row_bytes = static_cast<size_t>(rect.width * bytes_per_pixel);
+    for (int64_t y = rect.y; y < rect.y + rect.height; y++) {
+        std::memcpy(out, pixels + (y * image_width + rect.x) * bytes_per_pixel, row_bytes);
+        out += row_bytes;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ColorModes.h"
+#include "DeepConversion.h"
+#include "PixelCache.h"
+#include "TileHash.h"
+
+/**
+ * Pixel data for a whole document as handed to us by the Photoshop imaging API, in the components of its color mode
+ * with optional alpha. Components are 8 or 16 bit integers or 32 bit floats, see DeepConversion.h. Modes other than
+ * RGB are converted to RGBA on the way into the cache, see ColorModes.h.
+ */
+struct SourcePixels {
+    const uint8_t* data;
+    size_t byte_length;
+
+    int64_t width;
+    int64_t height;
+    int64_t components;
+    bool is_chunky;
+    int64_t component_size = 8;
+    color::Mode color_mode = color::Mode::kRgb;
+
+    // Throws if the description doesn't match the buffer
+    void Validate() const;
+};
+
+/**
+ * A rectangle of the image in pixels, y = 0 is the top row.
+ */
+struct DirtyRect {
+    int64_t x;
+    int64_t y;
+    int64_t width;
+    int64_t height;
+};
+
+/**
+ * Convert the tile rows [first_tile_row, first_tile_row + tile_row_count) of the source into the cache, and return
+ * the tiles whose pixels differ from what was cached. Horizontally adjacent dirty tiles are merged into one rect, so
+ * there is at most one rect per run of dirty tiles in each tile row.
+ *
+ * With force_full_update every tile is reported, so a full tile row comes back as a single rect. Tiles that weren't
+ * written yet are always reported, even if the cache already had their pixels.
+ * The converted tiles are marked as written in the cache.
+ *
+ * 16 and 32 bit sources are reduced with `quantization`, which must match the cache's bytes per pixel.
+ */
+std::vector<DirtyRect> ConvertTileRows(
+    const SourcePixels& source, PixelCache& cache, int64_t first_tile_row, int64_t tile_row_count, bool force_full_update,
+    deep::Quantization quantization = deep::Quantization::kBlueNoise);
+
+/**
+ * Same as ConvertTileRows, but for a document whose tiles are only known by their hashes. The tiles are converted into
+ * scratch memory and reported when their hash changed, the new hashes are kept. Nothing is cached, the caller converts
+ * the dirty rects again from the source to send them.
+ */
+std::vector<DirtyRect> HashTileRows(
+    const SourcePixels& source, TileHashes& hashes, int64_t first_tile_row, int64_t tile_row_count, bool force_full_update,
+    deep::Quantization quantization = deep::Quantization::kBlueNoise);
+
+/**
+ * The hash of a tile of the cache, equal to what HashTileRows computes for the same pixels
+ */
+uint64_t HashTile(const PixelCache& cache, int64_t tile_x, int64_t tile_y);
+
+/**
+ * Merge rects that overlap into their bounding box, until none of them overlap
+ */
+void MergeOverlappingRects(std::vector<DirtyRect>& rects);
+
+/**
+ * Copy a rect out of the cache into `out` as tightly packed rows (rect.width * rect.height * cache.BytesPerPixel() bytes).
+ */
+void CopyRect(const PixelCache& cache, const DirtyRect& rect, uint8_t* out);
+
+/**
+ * Same as above for rows of `image_width` pixels starting at `pixels`, with rect.y counted from the first row.
+ */
+void CopyRect(const uint8_t* pixels, int64_t image_width, const DirtyRect& rect, uint8_t* out, int64_t bytes_per_pixel = 4);
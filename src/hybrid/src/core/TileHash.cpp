@@ -0,0 +1,109 @@
+#include "TileHash.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "PixelCache.h"
+#include "Stats.h"
+
+namespace {
+
+constexpr uint64_t kPrime1 = 11400714785074694791ULL;
+constexpr uint64_t kPrime2 = 14029467366897019727ULL;
+constexpr uint64_t kPrime3 = 1609587929392839161ULL;
+constexpr uint64_t kPrime4 = 9650029242287828579ULL;
+constexpr uint64_t kPrime5 = 2870177450012600261ULL;
+
+inline uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Every platform we build for is little endian
+inline uint64_t Read64(const uint8_t* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline uint32_t Read32(const uint8_t* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline uint64_t Round(uint64_t accumulator, uint64_t lane) {
+    accumulator += lane * kPrime2;
+    return RotateLeft(accumulator, 31) * kPrime1;
+}
+
+inline uint64_t Merge(uint64_t hash, uint64_t accumulator) {
+    hash ^= Round(0, accumulator);
+    return hash * kPrime1 + kPrime4;
+}
+
+}  // namespace
+
+uint64_t HashBytes(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + length;
+    uint64_t hash;
+
+    // Four independent lanes of 8 bytes, so the multiplies of a stripe overlap
+    if (length >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        for (; end - p >= 32; p += 32) {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+        }
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = Merge(Merge(Merge(Merge(hash, v1), v2), v3), v4);
+    } else {
+        hash = seed + kPrime5;
+    }
+    hash += static_cast<uint64_t>(length);
+
+    for (; end - p >= 8; p += 8)
+        hash = RotateLeft(hash ^ Round(0, Read64(p)), 27) * kPrime1 + kPrime4;
+    if (end - p >= 4) {
+        hash = RotateLeft(hash ^ (Read32(p) * kPrime1), 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        hash = RotateLeft(hash ^ (*p * kPrime5), 11) * kPrime1;
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t HashRows(const uint8_t* data, size_t stride, size_t row_bytes, int64_t rows) {
+    uint64_t hash = 0;
+    for (int64_t y = 0; y < rows; y++)
+        hash = HashBytes(data + static_cast<size_t>(y) * stride, row_bytes, hash);
+    return hash;
+}
+
+TileHashes::TileHashes(int64_t width, int64_t height, uint64_t format) : width_(width), height_(height), format_(format) {
+    if (width < 0 || height < 0)
+        throw std::invalid_argument("Image size can't be negative");
+
+    hashes_.assign(static_cast<size_t>(TilesX() * TilesY()), 0);
+    stats::RecordAllocation(hashes_.size() * sizeof(uint64_t));
+    written_.assign(hashes_.size(), false);
+}
+
+int64_t TileHashes::TilesX() const {
+    return (width_ + PixelCache::kTileSize - 1) / PixelCache::kTileSize;
+}
+
+int64_t TileHashes::TilesY() const {
+    return (height_ + PixelCache::kTileSize - 1) / PixelCache::kTileSize;
+}
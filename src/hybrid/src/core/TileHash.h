@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * 64 bit content hash of `length` bytes (XXH64), chained through `seed` to hash data that isn't contiguous
+ */
+uint64_t HashBytes(const void* data, size_t length, uint64_t seed = 0);
+
+/**
+ * Hash of `rows` rows of `row_bytes` bytes each, `stride` bytes apart. The same pixels hash the same whatever buffer
+ * they are in.
+ */
+uint64_t HashRows(const uint8_t* data, size_t stride, size_t row_bytes, int64_t rows);
+
+/**
+ * A hash of every kTileSize x kTileSize tile of the pixels the webview has for one document, in place of the pixels
+ * themselves. A tile changed when the hash of its new pixels differs, so change detection costs 8 bytes per tile
+ * instead of 4 or 8 per pixel. The tile grid is the one of PixelCache.
+ *
+ * `format` identifies everything besides the size that decides which pixels the webview has for the document, hashes
+ * only compare within one format.
+ */
+class TileHashes {
+ public:
+    TileHashes(int64_t width, int64_t height, uint64_t format);
+
+    int64_t Width() const { return width_; }
+    int64_t Height() const { return height_; }
+    int64_t TilesX() const;
+    int64_t TilesY() const;
+    uint64_t Format() const { return format_; }
+
+    bool Matches(int64_t width, int64_t height, uint64_t format) const {
+        return width_ == width && height_ == height && format_ == format;
+    }
+
+    size_t ByteSize() const { return hashes_.size() * sizeof(uint64_t) + written_.size() / 8; }
+
+    uint64_t At(int64_t tile_x, int64_t tile_y) const { return hashes_[Index(tile_x, tile_y)]; }
+    void Set(int64_t tile_x, int64_t tile_y, uint64_t hash) { hashes_[Index(tile_x, tile_y)] = hash; }
+
+    // Same as PixelCache::TilesWritten for a single tile, a hash only means something once its tile was written
+    bool Written(int64_t tile_x, int64_t tile_y) const { return written_[Index(tile_x, tile_y)]; }
+    void MarkWritten(int64_t tile_x, int64_t tile_y) { written_[Index(tile_x, tile_y)] = true; }
+
+ private:
+    size_t Index(int64_t tile_x, int64_t tile_y) const { return static_cast<size_t>(tile_y * TilesX() + tile_x); }
+
+    int64_t width_;
+    int64_t height_;
+    uint64_t format_;
+    std::vector<uint64_t> hashes_;
+    std::vector<bool> written_;
+};
@@ -0,0 +1,222 @@
+#include "Trace.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+
+namespace detail {
+
+std::atomic<bool> enabled{false};
+
+}  // namespace detail
+
+namespace {
+
+// Fields are atomics so Dump can read a ring while its thread writes to it. Slots it reads half written are dropped.
+struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<const char*> arg_name{nullptr};
+    std::atomic<int64_t> arg{0};
+    std::atomic<uint64_t> begin{0};
+    std::atomic<uint64_t> end{0};
+};
+
+struct Ring {
+    uint32_t tid = 0;
+    std::atomic<bool> in_use{true};
+    std::atomic<const char*> thread_name{nullptr};
+
+    // The trace the events belong to. The owning thread starts over when it sees a newer one.
+    std::atomic<uint64_t> epoch{0};
+    // Events ever written in this epoch, the last kEventsPerThread of them are kept
+    std::atomic<uint64_t> head{0};
+    std::unique_ptr<Event[]> events{new Event[kEventsPerThread]};
+};
+
+std::atomic<uint64_t> current_epoch{0};
+std::atomic<uint64_t> origin{0};
+
+// Rings are never freed, a thread that exits hands its ring to the next thread that starts recording
+std::mutex rings_mutex;
+std::vector<std::unique_ptr<Ring>> rings;
+
+struct ThreadRing {
+    Ring* ring = nullptr;
+    const char* name = nullptr;
+
+    ~ThreadRing() {
+        if (ring)
+            ring->in_use.store(false, std::memory_order_release);
+    }
+};
+
+thread_local ThreadRing thread_ring;
+
+Ring* AcquireRing() {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    uint64_t epoch = current_epoch.load(std::memory_order_acquire);
+
+    Ring* ring = nullptr;
+    for (const std::unique_ptr<Ring>& candidate : rings) {
+        // Rings of exited threads still holding events of this trace are kept for Dump
+        if (candidate->in_use.load(std::memory_order_acquire) || candidate->epoch.load(std::memory_order_relaxed) == epoch)
+            continue;
+        candidate->in_use.store(true, std::memory_order_relaxed);
+        ring = candidate.get();
+        break;
+    }
+
+    if (!ring) {
+        rings.push_back(std::make_unique<Ring>());
+        ring = rings.back().get();
+        ring->tid = static_cast<uint32_t>(rings.size());
+    }
+    ring->thread_name.store(thread_ring.name, std::memory_order_relaxed);
+    return ring;
+}
+
+struct EventCopy {
+    const char* name;
+    const char* arg_name;
+    int64_t arg;
+    uint64_t begin;
+    uint64_t end;
+};
+
+void WriteString(std::ostream& out, const char* text) {
+    out << '"';
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            out << '\\';
+        out << *c;
+    }
+    out << '"';
+}
+
+// Chrome trace timestamps are microseconds
+void WriteMicroseconds(std::ostream& out, uint64_t nanoseconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3f", static_cast<double>(nanoseconds) / 1000.0);
+    out << buffer;
+}
+
+}  // namespace
+
+namespace detail {
+
+void Record(const char* name, uint64_t begin, uint64_t end, const char* arg_name, int64_t arg) {
+    Ring* ring = thread_ring.ring;
+    if (!ring)
+        ring = thread_ring.ring = AcquireRing();
+
+    uint64_t epoch = current_epoch.load(std::memory_order_acquire);
+    uint64_t head;
+    if (ring->epoch.load(std::memory_order_relaxed) != epoch) {
+        head = 0;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->epoch.store(epoch, std::memory_order_release);
+    } else {
+        head = ring->head.load(std::memory_order_relaxed);
+    }
+
+    Event& event = ring->events[head % kEventsPerThread];
+    event.name.store(name, std::memory_order_relaxed);
+    event.arg_name.store(arg_name, std::memory_order_relaxed);
+    event.arg.store(arg, std::memory_order_relaxed);
+    event.begin.store(begin, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+}  // namespace detail
+
+void SetEnabled(bool enabled) {
+    if (enabled) {
+        origin.store(detail::Now(), std::memory_order_relaxed);
+        current_epoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+    detail::enabled.store(enabled, std::memory_order_release);
+}
+
+void NameThread(const char* name) {
+    thread_ring.name = name;
+    if (thread_ring.ring)
+        thread_ring.ring->thread_name.store(name, std::memory_order_relaxed);
+}
+
+size_t Dump(const std::string& path) {
+    std::ofstream out(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Unable to write the trace to " + path);
+
+    uint64_t epoch = current_epoch.load(std::memory_order_acquire);
+    uint64_t start = origin.load(std::memory_order_relaxed);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    size_t written = 0;
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    std::vector<EventCopy> events;
+    for (const std::unique_ptr<Ring>& ring : rings) {
+        if (ring->epoch.load(std::memory_order_acquire) != epoch)
+            continue;
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t oldest = head > kEventsPerThread ? head - kEventsPerThread : 0;
+        events.clear();
+        for (uint64_t i = oldest; i < head; i++) {
+            const Event& event = ring->events[i % kEventsPerThread];
+            events.push_back({event.name.load(std::memory_order_relaxed), event.arg_name.load(std::memory_order_relaxed),
+                              event.arg.load(std::memory_order_relaxed), event.begin.load(std::memory_order_relaxed),
+                              event.end.load(std::memory_order_relaxed)});
+        }
+
+        // The thread may have lapped the copy, or started over for a newer trace
+        uint64_t head_after = ring->head.load(std::memory_order_acquire);
+        if (ring->epoch.load(std::memory_order_acquire) != epoch)
+            continue;
+        uint64_t valid_from = head_after >= kEventsPerThread ? head_after - kEventsPerThread + 1 : 0;
+
+        const char* thread_name = ring->thread_name.load(std::memory_order_relaxed);
+        std::string name = thread_name ? thread_name : "thread " + std::to_string(ring->tid);
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->tid
+            << ",\"args\":{\"name\":";
+        WriteString(out, name.c_str());
+        out << "}}";
+        first = false;
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const EventCopy& event = events[i];
+            if (oldest + i < valid_from || !event.name || event.begin < start || event.end < event.begin)
+                continue;
+
+            out << ",\n{\"name\":";
+            WriteString(out, event.name);
+            out << ",\"cat\":\"hybrid\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":";
+            WriteMicroseconds(out, event.begin - start);
+            out << ",\"dur\":";
+            WriteMicroseconds(out, event.end - event.begin);
+            if (event.arg_name) {
+                out << ",\"args\":{";
+                WriteString(out, event.arg_name);
+                out << ":" << event.arg << "}";
+            }
+            out << "}";
+            written++;
+        }
+    }
+    out << "\n]}\n";
+
+    if (!out)
+        throw std::runtime_error("Unable to write the trace to " + path);
+    return written;
+}
+
+}  // namespace trace
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Opt-in recording of where the time in the addon goes, written out as Chrome trace event JSON that chrome://tracing
+ * and ui.perfetto.dev open.
+ *
+ * Every thread records into its own ring buffer of the last kEventsPerThread spans, so recording never takes a lock
+ * and a long session keeps only its end. While tracing is off a span is a single relaxed load and a branch.
+ */
+namespace trace {
+
+constexpr size_t kEventsPerThread = 1 << 15;
+
+namespace detail {
+
+extern std::atomic<bool> enabled;
+
+inline uint64_t Now() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Record(const char* name, uint64_t begin, uint64_t end, const char* arg_name, int64_t arg);
+
+}  // namespace detail
+
+inline bool Enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Turning tracing on starts a new trace, dropping whatever was recorded before
+void SetEnabled(bool enabled);
+
+// Name the calling thread in the trace. `name` must outlive the trace, a string literal.
+void NameThread(const char* name);
+
+// Write the spans recorded so far to `path` (UTF-8) and return how many there were. Recording carries on.
+size_t Dump(const std::string& path);
+
+/**
+ * Records the time from construction to destruction as a span of the calling thread, with an optional number shown
+ * under `arg_name` in the trace. Names must be string literals.
+ */
+class Span {
+ public:
+    explicit Span(const char* name, const char* arg_name = nullptr, int64_t arg = 0)
+        : name_(Enabled() ? name : nullptr), arg_name_(arg_name), arg_(arg), begin_(name_ ? detail::Now() : 0) {}
+
+    ~Span() {
+        if (name_)
+            detail::Record(name_, begin_, detail::Now(), arg_name_, arg_);
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+ private:
+    const char* name_;
+    const char* arg_name_;
+    int64_t arg_;
+    uint64_t begin_;
+};
+
+}  // namespace trace
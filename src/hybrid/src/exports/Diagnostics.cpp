@@ -0,0 +1,189 @@
+#include "Exports.h"
+
+#include <mutex>
+#include <string>
+
+#include "../DocumentStore.h"
+#include "../core/Stats.h"
+#include "../core/ThreadPool.h"
+#include "../core/Trace.h"
+#include "../utilities/UxpAddon.h"
+#include "../utilities/UxpValue.h"
+
+namespace {
+
+// The get_stats entry of one entrypoint
+Value CallStatsToValue(const stats::CallStats& stats) {
+    const stats::LatencyHistogram& latency = stats.latency;
+
+    Value value(Value::Kind::map);
+    Value::MapType& map = value.GetMap();
+    map.emplace("count", Value(static_cast<double>(latency.Count())));
+    map.emplace("errors", Value(static_cast<double>(stats.errors.load(std::memory_order_relaxed))));
+    map.emplace("unchanged", Value(static_cast<double>(stats.unchanged.load(std::memory_order_relaxed))));
+    map.emplace("superseded", Value(static_cast<double>(stats.superseded.load(std::memory_order_relaxed))));
+    map.emplace("bytes_in", Value(static_cast<double>(stats.bytes_in.load(std::memory_order_relaxed))));
+    map.emplace("bytes_out", Value(static_cast<double>(stats.bytes_out.load(std::memory_order_relaxed))));
+    map.emplace("total_ms", Value(static_cast<double>(latency.TotalNanoseconds()) / 1e6));
+    map.emplace("max_ms", Value(static_cast<double>(latency.MaxNanoseconds()) / 1e6));
+    map.emplace("p50_ms", Value(latency.PercentileMicroseconds(0.5) / 1e3));
+    map.emplace("p90_ms", Value(latency.PercentileMicroseconds(0.9) / 1e3));
+    map.emplace("p99_ms", Value(latency.PercentileMicroseconds(0.99) / 1e3));
+
+    // Trailing empty buckets are left out
+    size_t buckets = stats::LatencyHistogram::kBuckets;
+    while (buckets > 0 && latency.Bucket(buckets - 1) == 0)
+        buckets--;
+    Value histogram(Value::Kind::list);
+    for (size_t i = 0; i < buckets; i++)
+        histogram.GetList().emplace_back(static_cast<double>(latency.Bucket(i)));
+    map.emplace("histogram_us_log2", std::move(histogram));
+    return value;
+}
+
+}  // namespace
+
+/**
+ * Counters of what the addon did since it was loaded or reset_stats was called, and what it caches right now:
+ *   calls.<entrypoint>  count, errors (conversions that threw), unchanged (nothing to send), superseded (skipped for
+ *                       a newer snapshot of the document, counted as unchanged as well), bytes_in (pixel data
+ *                       read), bytes_out (payloads), total_ms, max_ms and p50/p90/p99_ms of the latency, and
+ *                       histogram_us_log2 holding how many calls took under 2us, 2-4us, 4-8us and so on. The _async
+ *                       entrypoints count with the sync ones.
+ *   cache               bytes, memory_budget, documents (bytes per document id), hibernated (documents on disk),
+ *                       allocations and allocated_bytes of cache buffers, evictions, hibernations and restores
+ *   threads             conversion threads
+ *   queued_jobs         jobs queued with queue_job that weren't handed out completely
+ *   packed_textures     textures set up with set_packed_channel, and packed_bytes they hold
+ * Args: ()
+ */
+addon_value GetStats(addon_env env, addon_callback_info /*info*/) {
+    try {
+        Value stats_value(Value::Kind::map);
+
+        Value calls(Value::Kind::map);
+        for (size_t i = 0; i < static_cast<size_t>(stats::Call::kCount); i++) {
+            stats::Call call = static_cast<stats::Call>(i);
+            calls.GetMap().emplace(stats::CallName(call), CallStatsToValue(stats::For(call)));
+        }
+        stats_value.GetMap().emplace("calls", std::move(calls));
+
+        const stats::CacheStats& cache_stats = stats::Cache();
+        Value cache(Value::Kind::map);
+        Value::MapType& cache_map = cache.GetMap();
+        {
+            // Documents being converted count at their size when they were last converted
+            size_t bytes = 0;
+            size_t hibernated = 0;
+            Value per_document(Value::Kind::map);
+            for (DocumentShard& shard : shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (const auto& entry : shard.documents) {
+                    size_t size = entry.second->bytes.load(std::memory_order_relaxed);
+                    per_document.GetMap().emplace(std::to_string(entry.first), Value(static_cast<double>(size)));
+                    bytes += size;
+                }
+                hibernated += shard.hibernated.size();
+            }
+            cache_map.emplace("bytes", Value(static_cast<double>(bytes)));
+            cache_map.emplace("memory_budget", Value(static_cast<double>(memory_budget.load())));
+            cache_map.emplace("documents", std::move(per_document));
+            cache_map.emplace("hibernated", Value(static_cast<double>(hibernated)));
+        }
+        cache_map.emplace("allocations", Value(static_cast<double>(cache_stats.allocations.load(std::memory_order_relaxed))));
+        cache_map.emplace("allocated_bytes", Value(static_cast<double>(cache_stats.allocated_bytes.load(std::memory_order_relaxed))));
+        cache_map.emplace("evictions", Value(static_cast<double>(cache_stats.evictions.load(std::memory_order_relaxed))));
+        cache_map.emplace("hibernations", Value(static_cast<double>(cache_stats.hibernations.load(std::memory_order_relaxed))));
+        cache_map.emplace("restores", Value(static_cast<double>(cache_stats.restores.load(std::memory_order_relaxed))));
+        stats_value.GetMap().emplace("cache", std::move(cache));
+
+        stats_value.GetMap().emplace("threads", Value(static_cast<double>(ThreadPool::Shared().ThreadCount())));
+        stats_value.GetMap().emplace("queued_jobs", Value(static_cast<double>(jobs.Size())));
+        stats_value.GetMap().emplace("packed_textures", Value(static_cast<double>(packer.Size())));
+        stats_value.GetMap().emplace("packed_bytes", Value(static_cast<double>(packer.ByteSize())));
+
+        return stats_value.Convert(env);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Zero the counters get_stats returns. What is cached is left alone.
+ * Args: ()
+ */
+addon_value ResetStats(addon_env env, addon_callback_info /*info*/) {
+    try {
+        stats::Reset();
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Turn recording traces of the conversions on or off. Turning it on starts a new trace. See Trace.h.
+ * Args: (enabled)
+ */
+addon_value SetTracing(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        bool enabled;
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[0], &enabled));
+        trace::SetEnabled(enabled);
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Write what set_tracing recorded so far as Chrome trace event JSON, for chrome://tracing or ui.perfetto.dev.
+ * Args: (file path). Returns the number of spans written.
+ */
+addon_value DumpTrace(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        size_t written = trace::Dump(ReadString(env, args[0]));
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(written), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
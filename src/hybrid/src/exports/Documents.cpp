@@ -0,0 +1,264 @@
+#include "Exports.h"
+
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../DocumentStore.h"
+#include "../utilities/UxpAddon.h"
+#include "../utilities/UxpTask.h"
+
+addon_value ScheduleDocumentUpdate(addon_env env, int64_t lane, std::function<bool()> update) {
+    struct State {
+        bool result = false;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+
+    return Task::Create()->ScheduleOnWorkerThread(env, [state, update](Task& task) {
+        try {
+            state->result = update();
+        } catch (...) {
+            state->error = std::current_exception();
+        }
+
+        task.ScheduleOnScriptingThread([state](Task&, addon_env env, addon_deferred deferred) {
+            addon_value value;
+            try {
+                if (state->error) {
+                    std::rethrow_exception(state->error);
+                }
+                Check(UxpAddonApis.uxp_addon_get_boolean(env, state->result, &value));
+            }
+            catch (const std::exception& exc) {
+                UxpAddonApis.uxp_addon_reject_deferred(env, deferred, GetErrorMessage(env, exc.what()));
+                return;
+            }
+            catch (...) {
+                UxpAddonApis.uxp_addon_reject_deferred(env, deferred, CreateErrorFromException(env));
+                return;
+            }
+
+            UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, value);
+        });
+    }, static_cast<size_t>(lane));
+}
+
+/**
+ * Set how many bytes the document caches may take before the least recently used documents are evicted, 0 for no
+ * limit. Documents over the budget are evicted right away.
+ * Args: (budget in bytes). Returns the bytes the caches take now.
+ */
+addon_value SetMemoryBudget(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        double budget;
+        Check(UxpAddonApis.uxp_addon_get_value_double(env, args[0], &budget));
+        if (!(budget >= 0.0)) {
+            throw std::invalid_argument("Memory budget can't be negative");
+        }
+
+        memory_budget = static_cast<size_t>(budget);
+        EnforceMemoryBudget(DocumentLock());
+
+        size_t used = 0;
+        for (DocumentShard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (const auto& entry : shard.documents)
+                used += entry.second->bytes.load(std::memory_order_relaxed);
+        }
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(used), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Pin the document the user is looking at, so it is never evicted to make room for background documents, and its
+ * queued jobs go first.
+ * Args: (document id)
+ */
+addon_value SetActiveDocument(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t document_id;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &document_id));
+
+        active_document_id = document_id;
+        jobs.SetActive(document_id);
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Free memory under pressure and return it to the OS. The level is how much goes:
+ *   "budget"      documents over the memory budget and the conversion scratch buffers
+ *   "background"  every document except the active one
+ *   "all"         every document
+ * Evicted documents are converted from nothing the next time they are pushed.
+ * Args: (level). Returns the bytes freed from the caches.
+ */
+addon_value Trim(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        std::string level = ReadString(env, args[0]);
+        if (level != "budget" && level != "background" && level != "all") {
+            throw std::invalid_argument("Unknown trim level " + level + ", expected budget, background or all");
+        }
+
+        // Documents being converted are unlinked all the same, their memory goes when the conversion is done
+        size_t freed = 0;
+        if (level == "budget") {
+            freed = EnforceMemoryBudget(DocumentLock());
+        }
+        for (DocumentShard& shard : shards) {
+            std::vector<std::shared_ptr<DocumentEntry>> idle;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::vector<int64_t> unlink;
+                for (const auto& entry : shard.documents) {
+                    if (level == "budget" || (level == "background" && entry.first == active_document_id)) {
+                        idle.push_back(entry.second);
+                    } else {
+                        unlink.push_back(entry.first);
+                        freed += entry.second->bytes.load(std::memory_order_relaxed);
+                    }
+                }
+                for (int64_t document_id : unlink)
+                    UnlinkDocument(shard, document_id);
+            }
+
+            // The scratch buffers of documents that are kept, unless they are in use
+            for (const std::shared_ptr<DocumentEntry>& entry : idle) {
+                std::unique_lock<std::mutex> lock(entry->mutex, std::try_to_lock);
+                if (lock.owns_lock())
+                    std::vector<uint8_t>().swap(entry->previous);
+            }
+        }
+        ReleaseFreedMemory();
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(freed), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Entrypoint for hibernating every document cache, see HibernateDocuments.
+ * Args: (directory). Returns the bytes written.
+ */
+addon_value Hibernate(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        size_t written = HibernateDocuments(ReadString(env, args[0]));
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(written), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Async variant of hibernate with the same arguments. Writing gigabytes of caches to disk happens on a task worker
+ * thread, the returned promise resolves with the bytes written.
+ */
+addon_value HibernateAsync(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        struct State {
+            size_t written = 0;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        std::string directory = ReadString(env, args[0]);
+
+        return Task::Create()->ScheduleOnWorkerThread(env, [state, directory](Task& task) {
+            try {
+                state->written = HibernateDocuments(directory);
+            } catch (...) {
+                state->error = std::current_exception();
+            }
+
+            task.ScheduleOnScriptingThread([state](Task&, addon_env env, addon_deferred deferred) {
+                addon_value value;
+                try {
+                    if (state->error) {
+                        std::rethrow_exception(state->error);
+                    }
+                    Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(state->written), &value));
+                }
+                catch (const std::exception& exc) {
+                    UxpAddonApis.uxp_addon_reject_deferred(env, deferred, GetErrorMessage(env, exc.what()));
+                    return;
+                }
+                catch (...) {
+                    UxpAddonApis.uxp_addon_reject_deferred(env, deferred, CreateErrorFromException(env));
+                    return;
+                }
+
+                UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, value);
+            });
+        });
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
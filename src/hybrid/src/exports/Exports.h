@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "../api/UxpAddonTypes.h"
+
+// Entrypoints besides the conversions, registered by Init in module.cpp. Each file documents the arguments.
+
+/**
+ * Run a change to a document's cache on the worker of a lane, after the work already scheduled on it, and return a
+ * promise for the boolean it returns. Conversions use the document id as their lane. Taking the document's lock may
+ * wait for a conversion or read the document back in from disk, which must not happen on the scripting thread.
+ */
+addon_value ScheduleDocumentUpdate(addon_env env, int64_t lane, std::function<bool()> update);
+
+// Memory and the document store, see Documents.cpp
+addon_value SetMemoryBudget(addon_env env, addon_callback_info info);
+addon_value SetActiveDocument(addon_env env, addon_callback_info info);
+addon_value Trim(addon_env env, addon_callback_info info);
+addon_value Hibernate(addon_env env, addon_callback_info info);
+addon_value HibernateAsync(addon_env env, addon_callback_info info);
+
+// Threads, pacing and the job queue, see Scheduling.cpp
+addon_value SetThreadCount(addon_env env, addon_callback_info info);
+addon_value NoteEdit(addon_env env, addon_callback_info info);
+addon_value GetPacing(addon_env env, addon_callback_info info);
+addon_value QueueJob(addon_env env, addon_callback_info info);
+addon_value NextBand(addon_env env, addon_callback_info info);
+addon_value FinishJob(addon_env env, addon_callback_info info);
+addon_value SetVisibleDocuments(addon_env env, addon_callback_info info);
+
+// Packed channel textures, see PackedChannels.cpp
+addon_value SetPackedChannel(addon_env env, addon_callback_info info);
+addon_value RemovePackedTexture(addon_env env, addon_callback_info info);
+addon_value TakePackedUpdates(addon_env env, addon_callback_info info);
+
+// Stats and traces, see Diagnostics.cpp
+addon_value GetStats(addon_env env, addon_callback_info info);
+addon_value ResetStats(addon_env env, addon_callback_info info);
+addon_value SetTracing(addon_env env, addon_callback_info info);
+addon_value DumpTrace(addon_env env, addon_callback_info info);
@@ -0,0 +1,161 @@
+#include "Exports.h"
+
+#include <vector>
+
+#include "../DocumentStore.h"
+#include "../PixelOutput.h"
+#include "../utilities/UxpAddon.h"
+
+/**
+ * Feed a channel (0-2, R to B) of a packed texture with one channel (0-3, R to A) of a document, or clear it with a
+ * document id of -1. See ChannelPacking.h. The document's tile conversions write into the channel from then on.
+ * Returns a promise for whether the channel was filled from the document's cache. When it wasn't, the document has to
+ * be converted in full once, with force_full_update. Changes to one packed texture are applied in the order they were
+ * made, on its own worker lane.
+ * Args: (packed texture id, channel, document id, source channel?)
+ */
+addon_value SetPackedChannel(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 4;
+        addon_value args[4];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t packed_id;
+        int32_t channel;
+        int64_t document_id;
+        int32_t source_channel = 0;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &packed_id));
+        Check(UxpAddonApis.uxp_addon_get_value_int32(env, args[1], &channel));
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[2], &document_id));
+
+        addon_valuetype type;
+        Check(UxpAddonApis.uxp_addon_typeof(env, args[3], &type));
+        if (type != addon_undefined) {
+            Check(UxpAddonApis.uxp_addon_get_value_int32(env, args[3], &source_channel));
+        }
+
+        return ScheduleDocumentUpdate(env, packed_id, [packed_id, channel, document_id, source_channel] {
+            // Mapped under the document's lock, so a conversion in flight either writes before the channel is reset
+            // or after, when the whole cache is written here as well
+            DocumentLock document = document_id >= 0 ? LockDocument(document_id, false) : DocumentLock();
+            packer.Map(packed_id, channel, document_id, source_channel);
+            if (!document) {
+                return document_id < 0;
+            }
+
+            const DocumentCache& doc = document.entry->cache;
+            const PixelCache* full = doc.resampler ? doc.source.get() : doc.pixels.get();
+            if (full && full->BytesPerPixel() == 4 && full->TilesWritten(0, full->TilesX(), 0, full->TilesY())) {
+                packer.Write(document_id, *full, {{0, 0, full->Width(), full->Height()}});
+                return true;
+            }
+            return false;
+        });
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Drop a packed texture. Returns whether it existed.
+ * Args: (packed texture id)
+ */
+addon_value RemovePackedTexture(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t packed_id;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &packed_id));
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, packer.Remove(packed_id), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * The channel tiles of packed textures that changed since the last call, undefined when none did. Returns an array of
+ * { packed_texture, width, height, tiles } where each tile is { channel, x, y, width, height, pixels } and its pixels
+ * hold one byte per pixel of that channel, row by row. The delta format isn't available, it is sent as dense.
+ * Args: (output format?)
+ */
+addon_value TakePackedUpdates(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        OutputFormat format = GetOutputFormat(env, args[0]);
+        if (format == OutputFormat::kDelta) {
+            format = OutputFormat::kDense;
+        }
+
+        std::vector<ChannelPacker::Update> updates = packer.TakeUpdates();
+
+        addon_value value;
+        if (updates.empty()) {
+            Check(UxpAddonApis.uxp_addon_get_undefined(env, &value));
+            return value;
+        }
+
+        Check(UxpAddonApis.uxp_addon_create_array_with_length(env, updates.size(), &value));
+        for (size_t i = 0; i < updates.size(); i++) {
+            ChannelPacker::Update& update = updates[i];
+
+            addon_value packed;
+            Check(UxpAddonApis.uxp_addon_create_object(env, &packed));
+            SetNumberProperty(env, packed, "packed_texture", static_cast<double>(update.packed_id));
+            SetNumberProperty(env, packed, "width", static_cast<double>(update.width));
+            SetNumberProperty(env, packed, "height", static_cast<double>(update.height));
+
+            addon_value tiles;
+            Check(UxpAddonApis.uxp_addon_create_array_with_length(env, update.tiles.size(), &tiles));
+            for (size_t t = 0; t < update.tiles.size(); t++) {
+                const ChannelPacker::ChannelTile& channel_tile = update.tiles[t];
+
+                addon_value tile;
+                Check(UxpAddonApis.uxp_addon_create_object(env, &tile));
+                SetNumberProperty(env, tile, "channel", static_cast<double>(channel_tile.channel));
+                SetNumberProperty(env, tile, "x", static_cast<double>(channel_tile.rect.x));
+                SetNumberProperty(env, tile, "y", static_cast<double>(channel_tile.rect.y));
+                SetNumberProperty(env, tile, "width", static_cast<double>(channel_tile.rect.width));
+                SetNumberProperty(env, tile, "height", static_cast<double>(channel_tile.rect.height));
+
+                PixelPayload payload;
+                EncodePixels(channel_tile.values.data(), nullptr, channel_tile.values.size(), format, payload);
+                addon_value pixels = CreatePixelOutput(env, payload, format);
+                Check(UxpAddonApis.uxp_addon_set_named_property(env, tile, "pixels", pixels));
+
+                Check(UxpAddonApis.uxp_addon_set_element(env, tiles, static_cast<uint32_t>(t), tile));
+            }
+            Check(UxpAddonApis.uxp_addon_set_named_property(env, packed, "tiles", tiles));
+
+            Check(UxpAddonApis.uxp_addon_set_element(env, value, static_cast<uint32_t>(i), packed));
+        }
+        return value;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
@@ -0,0 +1,278 @@
+#include "Exports.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include "../DocumentStore.h"
+#include "../core/ThreadPool.h"
+#include "../utilities/UxpAddon.h"
+#include "../utilities/UxpValue.h"
+
+namespace {
+
+// Frame budget get_pacing targets when none is given
+constexpr double kDefaultFrameBudgetMilliseconds = 8.0;
+
+// The optional frame budget argument of get_pacing and next_band, in milliseconds
+double ReadFrameBudget(addon_env env, addon_value value) {
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    if (type == addon_undefined) {
+        return kDefaultFrameBudgetMilliseconds;
+    }
+
+    double frame_budget;
+    Check(UxpAddonApis.uxp_addon_get_value_double(env, value, &frame_budget));
+    if (!(frame_budget > 0.0)) {
+        throw std::invalid_argument("Frame budget must be positive");
+    }
+    return frame_budget;
+}
+
+}  // namespace
+
+/**
+ * Set how many threads conversions are split across, including the thread the conversion was called on.
+ * Args: (thread count, 0 for one per core). Returns the thread count now in effect.
+ */
+addon_value SetThreadCount(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t thread_count;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &thread_count));
+        if (thread_count < 0) {
+            throw std::invalid_argument("Thread count can't be negative");
+        }
+
+        ThreadPool::Shared().SetThreadCount(static_cast<size_t>(thread_count));
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(ThreadPool::Shared().ThreadCount()), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Tell the addon a document was edited, so get_pacing knows how fast edits come in.
+ * Args: (document id)
+ */
+addon_value NoteEdit(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t document_id;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &document_id));
+
+        pacing.RecordEdit(document_id, Pacer::Now());
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * How the plugin should pace a document, from the measured cost of its conversions and how fast it is edited. See
+ * Pacing.h. Returns {batch_pixels, throttle_ms, pixel_cost_ns, pass_ms, edit_interval_ms}: the pixels to convert per
+ * call to stay within the frame budget, and the least time between fetching the document's pixels from Photoshop.
+ * Args: (document id, optional frame budget in milliseconds, 8 by default)
+ */
+addon_value GetPacing(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 2;
+        addon_value args[2];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t document_id;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &document_id));
+
+        double frame_budget = ReadFrameBudget(env, args[1]);
+
+        Pacer::Recommendation recommendation = pacing.Recommend(document_id, frame_budget);
+
+        Value value(Value::Kind::map);
+        Value::MapType& map = value.GetMap();
+        map.emplace("batch_pixels", Value(static_cast<double>(recommendation.batch_pixels)));
+        map.emplace("throttle_ms", Value(recommendation.throttle_milliseconds));
+        map.emplace("pixel_cost_ns", Value(recommendation.pixel_cost_nanoseconds));
+        map.emplace("pass_ms", Value(recommendation.pass_milliseconds));
+        map.emplace("edit_interval_ms", Value(recommendation.edit_interval_milliseconds));
+        return value.Convert(env);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Queue a pass over a document's pixels, see JobQueue.h. The plugin keeps the pixels and converts the bands next_band
+ * hands out. Returns the job id.
+ * Args: (document id, width, height, forced full update)
+ */
+addon_value QueueJob(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 4;
+        addon_value args[4];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t document_id, width, height;
+        bool forced;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &document_id));
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[1], &width));
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[2], &height));
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[3], &forced));
+
+        int64_t job = jobs.Push(document_id, width, height, forced);
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(job), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Take the band of tile rows to convert next, from the most urgent queued job. Bands are sized like get_pacing's
+ * batch_pixels for their document, so checking for a more urgent job between bands keeps the wait for it within the
+ * frame budget. Returns {job, document_id, first_tile_row, tile_rows, last}, last being set on the band that ends its
+ * job, or undefined when nothing is queued.
+ * Args: (optional frame budget in milliseconds, 8 by default)
+ */
+addon_value NextBand(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        double frame_budget = ReadFrameBudget(env, args[0]);
+
+        JobQueue::Band band;
+        bool found = jobs.Next([frame_budget](int64_t document_id) {
+            return pacing.Recommend(document_id, frame_budget).batch_pixels;
+        }, band);
+        if (!found) {
+            addon_value result;
+            Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+            return result;
+        }
+
+        Value value(Value::Kind::map);
+        Value::MapType& map = value.GetMap();
+        map.emplace("job", Value(static_cast<double>(band.job)));
+        map.emplace("document_id", Value(static_cast<double>(band.document_id)));
+        map.emplace("first_tile_row", Value(static_cast<double>(band.first_tile_row)));
+        map.emplace("tile_rows", Value(static_cast<double>(band.tile_rows)));
+        map.emplace("last", Value(band.last));
+        return value.Convert(env);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Drop what is left of a job, when it was done another way (convert_image) or can't go on. Returns whether it was
+ * still queued.
+ * Args: (job id)
+ */
+addon_value FinishJob(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t job;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &job));
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, jobs.Finish(job), &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Tell the addon which documents have their texture on a material in the viewport. Their jobs go before those of
+ * other background documents.
+ * Args: (array of document ids)
+ */
+addon_value SetVisibleDocuments(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value args[1];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        bool is_array = false;
+        Check(UxpAddonApis.uxp_addon_is_array(env, args[0], &is_array));
+        if (!is_array) {
+            throw std::invalid_argument("Visible documents must be an array of document ids");
+        }
+
+        uint32_t length = 0;
+        Check(UxpAddonApis.uxp_addon_get_array_length(env, args[0], &length));
+        std::vector<int64_t> document_ids(length);
+        for (uint32_t i = 0; i < length; i++) {
+            addon_value element;
+            Check(UxpAddonApis.uxp_addon_get_element(env, args[0], i, &element));
+            Check(UxpAddonApis.uxp_addon_get_value_int64(env, element, &document_ids[i]));
+        }
+        jobs.SetVisible(document_ids);
+
+        addon_value result;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
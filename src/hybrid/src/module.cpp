@@ -1,15 +1,37 @@
+#include <algorithm>
 #include <exception>
+#include <filesystem>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <memory>
 #include <unordered_map>
 #include <vector>
 
+#include "./core/BlockCompression.h"
+#include "./core/ColorModes.h"
+#include "./core/DeepConversion.h"
+#include "./core/Kernels.h"
+#include "./core/MipPyramid.h"
+#include "./core/PixelCache.h"
+#include "./core/Resampler.h"
+#include "./core/Stats.h"
+#include "./core/Trace.h"
+#include "./core/ThreadPool.h"
+#include "./core/TileConversion.h"
+#include "./DocumentStore.h"
+#include "./PixelOutput.h"
+#include "./exports/Exports.h"
 #include "./utilities/UxpAddon.h"
+#include "./utilities/UxpTask.h"
 
 namespace {
-    std::unordered_map< int64_t, std::unique_ptr<std::vector<char16_t> > > document_id_to_pixel_array; // image data cache
+    // Tile rows DocumentEntry::previous holds at most, a whole image is converted in bands of this many
+    constexpr int64_t kBandTileRows = 8;
 
+    // How long a hash only document keeps the caches rebuilt for an edit without another one, in nanoseconds. A
+    // stroke arrives as many passes a few hundred milliseconds apart, each of which would rebuild them otherwise.
+    constexpr uint64_t kHashCachesIdle = uint64_t{10} * 1000 * 1000 * 1000;
 
 /**
  * Helper data structure for function parameters
@@ -21,23 +43,89 @@ public:
 
     int64_t components;
     bool is_chunky;
+    int64_t component_size;  // bits per component: 8, 16 or 32
+    color::Mode color_mode;  // tile based conversion only, batch conversion is always RGB
+
+    deep::Quantization quantization;  // how 16 and 32 bit components are brought down to the cache format
+
+    bool generate_mips;  // tile based conversion only, also return the changed texels of the mip levels
+
+    // Tile based conversion only, the size the webview previews the document at and how it is resampled to it
+    int64_t target_width;
+    int64_t target_height;
+    ResampleFilter filter;
+
+    // Tile based conversion only, send the preview as GPU compressed blocks instead of pixels
+    bool compress;
+    bc::Format block_format;
+    bc::Quality block_quality;
 
     int64_t batch_pixel_offset;
     int64_t batch_pixel_size;
-    
+
+    // Only used for tile based conversion
+    int64_t width;
+    int64_t height;
+    int64_t first_tile_row;
+    int64_t tile_row_count;
+
     bool force_full_update;
 
+    // Tile based conversion only, the job the pixels were queued as, 0 when they weren't. Pixels of a job that a newer
+    // snapshot of the document superseded are not converted.
+    int64_t generation;
+
+    OutputFormat output_format;
+
     size_t pixel_data_byte_length;
 };
 
-addon_value ConvertBatchToString(addon_env env, const TaskParams& params);
+/**
+ * Everything a conversion produces. Nothing is sent when `changed` is false.
+ * Batch conversion has a single payload, tile conversion has one payload per rect.
+ */
+struct ConversionResult {
+    bool changed = false;
+    bool superseded = false;  // skipped, a newer snapshot of the document is queued
+    OutputFormat format = OutputFormat::kString;
+    std::vector<DirtyRect> rects;
+    std::vector<PixelPayload> pixels;
+    std::vector<MipRect> mip_rects;
+    std::vector<PixelPayload> mip_pixels;
+};
+
+ConversionResult ConvertBatch(const TaskParams& params);
+ConversionResult ConvertTileRowsToPayload(const TaskParams& params);
+ConversionResult ConvertHashedTileRows(const TaskParams& p, const SourcePixels& source, int64_t bytes_per_pixel, DocumentCache& doc);
+ConversionResult ResampleDocumentToPayload(const TaskParams& params);
+template <stats::Call call, ConversionResult (*convert)(const TaskParams&)>
+ConversionResult Measured(const TaskParams& params);
+bool PrepareDocumentCache(DocumentCache& doc, int64_t width, int64_t height, int64_t bytes_per_pixel, const TaskParams& p);
+uint64_t PreviewFormat(const TaskParams& p, int64_t bytes_per_pixel);
+std::unique_ptr<TileHashes> HashDocument(const DocumentCache& doc);
+void KeepOrDropHashedCaches(DocumentCache& doc, bool changed, bool pass_done);
+void ResampleToPayload(const TaskParams& p, DocumentCache& doc, bool send_delta, ConversionResult& result);
+void ConvertMipsToPayload(const TaskParams& p, DocumentCache& doc, bool send_delta, ConversionResult& result);
+void CompressToPayload(const TaskParams& p, DocumentCache& doc, bool send_delta, ConversionResult& result);
+addon_value BatchResultToValue(addon_env env, ConversionResult& result);
+addon_value TileResultToValue(addon_env env, ConversionResult& result);
+TaskParams ReadBatchParams(addon_env env, addon_callback_info info, addon_value* buffer);
+TaskParams ReadTileParams(addon_env env, addon_callback_info info, addon_value* buffer, bool whole_image = false);
+TaskParams ReadResampleParams(addon_env env, addon_callback_info info);
+addon_value Option(addon_env env, addon_value options, const char* name);
+addon_value RequiredOption(addon_env env, addon_value options, const char* name);
+void ReadDepthParams(addon_env env, addon_value component_size, addon_value quantization, TaskParams& params);
+void ReadTargetParams(addon_env env, addon_value target_width, addon_value target_height, addon_value filter, TaskParams& params);
+color::Mode ReadColorMode(addon_env env, addon_value mode);
+void ReadCompressionParams(addon_env env, addon_value format, addon_value quality, TaskParams& params);
 
 /**
  * Clear the image data cache entry for the given document. This is invoked on the javascript thread.
  */
 addon_value CloseDocument(addon_env env, addon_callback_info info) {
+    stats::ScopedCall call(stats::Call::kCloseDocument);
     try {
-    
+
         size_t argc = 1;
         addon_value args[1];
 
@@ -47,11 +135,32 @@ addon_value CloseDocument(addon_env env, addon_callback_info info) {
 
         Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &document_id));
 
-        document_id_to_pixel_array.erase(document_id);
+        // A conversion of the document in flight keeps its entry until it's done, closing doesn't wait for it
+        std::string hibernated_path;
+        {
+            DocumentShard& shard = ShardOf(document_id);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            UnlinkDocument(shard, document_id);
+
+            auto found = shard.hibernated.find(document_id);
+            if (found != shard.hibernated.end()) {
+                hibernated_path = std::move(found->second);
+                shard.hibernated.erase(found);
+            }
+        }
+        pacing.Forget(document_id);
+        jobs.Drop(document_id);
+        packer.Unmap(document_id);
+
+        if (!hibernated_path.empty()) {
+            std::error_code error;
+            std::filesystem::remove(std::filesystem::u8path(hibernated_path), error);
+        }
 
         addon_value result;
         Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
 
+        call.Succeeded();
         return result;
     }
     catch (const std::exception& exc)
@@ -64,29 +173,211 @@ addon_value CloseDocument(addon_env env, addon_callback_info info) {
 }
 
 /**
- * Entrypoint for UXP caller, read args and pass on to ConvertBatchToString for processing.
+ * Run a conversion and record it in the stats of the entrypoint: its latency including waiting for the cache, the
+ * pixel bytes it read, the payload bytes it produced and whether anything changed. Conversions of pixels from
+ * Photoshop are also timed for pacing.
+ */
+template <stats::Call call, ConversionResult (*convert)(const TaskParams&)>
+ConversionResult Measured(const TaskParams& params) {
+    trace::Span span(stats::CallName(call), "document", params.document_id);
+    stats::ScopedCall measured(call);
+    const uint64_t begin = Pacer::Now();
+    ConversionResult result = convert(params);
+    const uint64_t end = Pacer::Now();
+
+    const uint64_t pixel_bytes = static_cast<uint64_t>(params.components * params.component_size / 8);
+    if (result.superseded) {
+        // Nothing was read, and the skip says nothing about what conversions of the document cost
+        stats::Add(measured.Stats().superseded, 1);
+    } else if (call == stats::Call::kConvertToString) {
+        stats::Add(measured.Stats().bytes_in, static_cast<uint64_t>(params.batch_pixel_size) * pixel_bytes);
+
+        // Batches see the document as one long row
+        int64_t plane_size = static_cast<int64_t>(params.pixel_data_byte_length / pixel_bytes);
+        pacing.RecordConversion(params.document_id, plane_size, 1, params.batch_pixel_size, begin, end,
+                                params.batch_pixel_offset == 0, params.batch_pixel_offset + params.batch_pixel_size >= plane_size);
+    } else if (call == stats::Call::kConvertTiles || call == stats::Call::kConvertImage) {
+        int64_t band_y = params.first_tile_row * PixelCache::kTileSize;
+        int64_t band_height = std::max<int64_t>(0, std::min(params.tile_row_count * PixelCache::kTileSize, params.height - band_y));
+        stats::Add(measured.Stats().bytes_in, static_cast<uint64_t>(band_height * params.width) * pixel_bytes);
+
+        pacing.RecordConversion(params.document_id, params.width, params.height, band_height * params.width, begin, end,
+                                params.first_tile_row == 0, band_y + band_height >= params.height);
+    }
+
+    uint64_t bytes_out = 0;
+    for (const std::vector<PixelPayload>* payloads : {&result.pixels, &result.mip_pixels}) {
+        for (const PixelPayload& payload : *payloads)
+            bytes_out += payload.bytes.size() + payload.units.size() * sizeof(char16_t);
+    }
+    stats::Add(measured.Stats().bytes_out, bytes_out);
+    if (!result.changed) {
+        stats::Add(measured.Stats().unchanged, 1);
+    }
+
+    measured.Succeeded();
+    return result;
+}
+
+/**
+ * Entrypoint for UXP caller, read args and pass on to ConvertBatch for processing.
+ * Args: (pixel buffer, document id, components, is chunky, batch pixel offset, batch pixel size, force full update,
+ *        optional output format, optional component size, optional quantization)
  */
 addon_value ConvertToString(addon_env env, addon_callback_info info) {
     try {
-        size_t argc = 7;
-        addon_value args[7];
-        
-        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+        addon_value buffer;
+        TaskParams params = ReadBatchParams(env, info, &buffer);
+
+        ConversionResult result = Measured<stats::Call::kConvertToString, ConvertBatch>(params);
+        return BatchResultToValue(env, result);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Read the arguments of convert_to_string, see ConvertToString. `buffer` receives the pixel buffer value.
+ */
+TaskParams ReadBatchParams(addon_env env, addon_callback_info info, addon_value* buffer) {
+    size_t argc = 10;
+    addon_value args[10];
+
+    Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+    TaskParams params = TaskParams();
+
+    *buffer = args[0];
+    Check(UxpAddonApis.uxp_addon_get_arraybuffer_info(env, args[0], (void**)&params.pixel_data, &params.pixel_data_byte_length));
+
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[1], &params.document_id));
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[2], &params.components));
+    Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[3], &params.is_chunky));
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[4], &params.batch_pixel_offset));
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[5], &params.batch_pixel_size));
+    Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[6], &params.force_full_update));
+
+    params.output_format = GetOutputFormat(env, args[7]);
+    ReadDepthParams(env, args[8], args[9], params);
+
+    return params;
+}
+
+/**
+ * Read the optional component size and quantization arguments. The component size is the bits per component of the
+ * pixel data, 8 when left out. The quantization is how 16 and 32 bit data is stored: "round", "ordered",
+ * "blue-noise" (the default when left out) or "half" for linear half floats.
+ */
+void ReadDepthParams(addon_env env, addon_value component_size, addon_value quantization, TaskParams& params) {
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, component_size, &type));
+    params.component_size = 8;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, component_size, &params.component_size));
+    }
+
+    if (params.component_size != 8 && params.component_size != 16 && params.component_size != 32) {
+        throw std::invalid_argument("Expected 8, 16 or 32 bit components, got " + std::to_string(params.component_size));
+    }
+
+    Check(UxpAddonApis.uxp_addon_typeof(env, quantization, &type));
+    params.quantization = deep::Quantization::kBlueNoise;
+    if (type == addon_undefined) {
+        return;
+    }
+
+    std::string mode = ReadString(env, quantization);
+    if (mode == "round") params.quantization = deep::Quantization::kRound;
+    else if (mode == "ordered") params.quantization = deep::Quantization::kOrdered;
+    else if (mode == "blue-noise") params.quantization = deep::Quantization::kBlueNoise;
+    else if (mode == "half") params.quantization = deep::Quantization::kHalf;
+    else throw std::invalid_argument("Unknown quantization " + mode + ", expected round, ordered, blue-noise or half");
+
+    if (params.quantization == deep::Quantization::kHalf && params.component_size == 8) {
+        throw std::invalid_argument("Half float output needs 16 or 32 bit pixel data");
+    }
+}
+
+/**
+ * Run a conversion on a task worker thread and return a promise for its result. The conversion itself never touches
+ * javascript values, the result is turned into one back on the scripting thread. Conversions of one document run on
+ * the same worker, in the order they were scheduled, other documents may be converted at the same time.
+ *
+ * The pixel buffer is pinned with a reference until the promise settles, so the engine can't collect it while the
+ * worker reads from it. The caller still must not dispose of the imaging data behind it before then. Conversions
+ * that only read the cache pass a null buffer.
+ */
+addon_value ScheduleConversion(addon_env env, addon_value buffer, const TaskParams& params,
+                               ConversionResult (*convert)(const TaskParams&),
+                               addon_value (*to_value)(addon_env, ConversionResult&)) {
+    addon_ref buffer_ref = nullptr;
+    if (buffer) {
+        Check(UxpAddonApis.uxp_addon_create_reference(env, buffer, 1, &buffer_ref));
+    }
+
+    struct State {
+        ConversionResult result;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
 
-        TaskParams params = TaskParams();
+    try {
+        return Task::Create()->ScheduleOnWorkerThread(env, [state, params, convert, to_value, buffer_ref](Task& task) {
+            trace::NameThread("conversion worker");
+            try {
+                state->result = convert(params);
+            } catch (...) {
+                state->error = std::current_exception();
+            }
 
-        Check(UxpAddonApis.uxp_addon_get_arraybuffer_info(env, args[0], (void**)&params.pixel_data, &params.pixel_data_byte_length));
+            task.ScheduleOnScriptingThread([state, to_value, buffer_ref](Task&, addon_env env, addon_deferred deferred) {
+                if (buffer_ref) {
+                    UxpAddonApis.uxp_addon_delete_reference(env, buffer_ref);
+                }
 
+                addon_value value;
+                try {
+                    if (state->error) {
+                        std::rethrow_exception(state->error);
+                    }
+                    value = to_value(env, state->result);
+                }
+                catch (const std::exception& exc) {
+                    UxpAddonApis.uxp_addon_reject_deferred(env, deferred, GetErrorMessage(env, exc.what()));
+                    return;
+                }
+                catch (...) {
+                    UxpAddonApis.uxp_addon_reject_deferred(env, deferred, CreateErrorFromException(env));
+                    return;
+                }
 
-        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[1], &params.document_id));
-        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[2], &params.components));
-        Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[3], &params.is_chunky));
-        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[4], &params.batch_pixel_offset));
-        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[5], &params.batch_pixel_size));
-        Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[6], &params.force_full_update));
+                UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, value);
+            });
+        }, static_cast<size_t>(params.document_id));
+    }
+    catch (...) {
+        if (buffer_ref) {
+            UxpAddonApis.uxp_addon_delete_reference(env, buffer_ref);
+        }
+        throw;
+    }
+}
 
+/**
+ * Async variant of convert_to_string with the same arguments. Returns a promise that resolves with what
+ * convert_to_string would have returned, while the diff and conversion run on a native worker thread.
+ */
+addon_value ConvertToStringAsync(addon_env env, addon_callback_info info) {
+    try {
+        addon_value buffer;
+        TaskParams params = ReadBatchParams(env, info, &buffer);
 
-        return ConvertBatchToString(env, params);
+        return ScheduleConversion(env, buffer, params, Measured<stats::Call::kConvertToString, ConvertBatch>, BatchResultToValue);
     }
     catch (const std::exception& exc)
     {
@@ -99,138 +390,1610 @@ addon_value ConvertToString(addon_env env, addon_callback_info info) {
 
 /**
  * Convert the 0-255 integral pixel data in either Planar (RRRGGGBBBAAA) or Chunky (RGBARGBARGBA) format to
- * a UTF-16 string containing the charCodes matching the given pixel data in Chunky format. Can be supplied an offset + batch size in params.
+ * a string containing the charCodes matching the given pixel data in Chunky format. Can be supplied an offset + batch size in params.
  * Regardless of whether pixel data is RGB or RGBA format, the response string will be in RGBA format.
- * 
- * The pixel data is read into a cache, and this function will return a value of undefined to the javascript caller 
- * if the data in the given batch is unchanged from the existing cached data. 
+ * The output format can instead ask for the dense string encoding, a Uint8Array of the same RGBA bytes, or a delta.
+ * 16 and 32 bit pixel data is quantized to the same RGBA bytes, or stored as RGBA half floats (8 bytes per pixel).
+ *
+ * The pixel data is read into a cache, and the result is marked unchanged, which becomes undefined for the javascript
+ * caller, if the data in the given batch is unchanged from the existing cached data.
  */
-addon_value ConvertBatchToString(addon_env env, const TaskParams& p) {
+ConversionResult ConvertBatch(const TaskParams& p) {
+    if (p.components != 3 && p.components != 4) {
+        throw std::invalid_argument("Expected RGB or RGBA pixel data, got " + std::to_string(p.components) + " components");
+    }
+
     // In PS Planar format, each "plane" consists of the pixel data in the entire document of an RGB(A) component.
-    // The plane size is just how many pixels in the batch each component should take up.  
-    size_t plane_size = p.pixel_data_byte_length / p.components;
+    // The plane size is just how many pixels in the batch each component should take up.
+    const size_t component_bytes = static_cast<size_t>(p.component_size / 8);
+    size_t plane_size = p.pixel_data_byte_length / (p.components * component_bytes);
+    const bool deep_source = p.component_size != 8;
+    const int64_t bytes_per_pixel = deep_source ? deep::CacheBytesPerPixel(p.quantization) : 4;
+
+    if (p.batch_pixel_offset < 0 || p.batch_pixel_size < 0 || static_cast<size_t>(p.batch_pixel_offset + p.batch_pixel_size) > plane_size) {
+        throw std::out_of_range("Pixel batch is outside of the pixel data");
+    }
 
+    DocumentLock document = LockDocument(p.document_id);
 
     // Either this is a new documnet or the client changed the texture resolution. Set the cache data to default of all 0 values.
-    if (document_id_to_pixel_array.find(p.document_id) == document_id_to_pixel_array.end() || document_id_to_pixel_array[p.document_id].get()->size() != plane_size * 4) {
-        document_id_to_pixel_array[p.document_id] = std::make_unique<std::vector<char16_t>>(plane_size * 4, 0); 
+    // Batches don't know the image dimensions, so the cache is sized as one long row. The layout is the same either way.
+    // Switching to or from half floats changes the pixel format, which also starts over.
+    auto& cache = document.entry->cache.pixels;
+    std::vector<uint8_t>& previous_batch = document.entry->previous;
+    if (!cache || !cache->HasFormat(static_cast<int64_t>(plane_size), 1, bytes_per_pixel)) {
+        trace::Span span("allocate cache", "pixels", static_cast<int64_t>(plane_size));
+        cache = std::make_unique<PixelCache>(static_cast<int64_t>(plane_size), 1, bytes_per_pixel);
     }
 
-    // Regardless of input data, the response must 
-    size_t length = p.batch_pixel_size * 4;
-
-    std::vector<char16_t>& data = *(document_id_to_pixel_array[p.document_id].get());
+    // Regardless of input data, the response must
+    size_t length = p.batch_pixel_size * bytes_per_pixel;
 
     // Create a pointer to the cached data at the given offset
-    char16_t* modified_pixel_data = &(data[p.batch_pixel_offset * 4]);
+    uint8_t* modified_pixel_data = cache->Data() + p.batch_pixel_offset * bytes_per_pixel;
 
-    // Whether the pixel data in the batch is different from the cached data.
+    // The cache is a single row of tiles. A delta is only possible once every tile the batch touches has been written,
+    // before that the webview may hold pixels the cache never had. A forced update means the webview starts from nothing.
+    const int64_t tile_size = PixelCache::kTileSize;
+    int64_t batch_end = p.batch_pixel_offset + p.batch_pixel_size;
+    bool send_delta = p.output_format == OutputFormat::kDelta && !p.force_full_update &&
+        cache->TilesWritten(p.batch_pixel_offset / tile_size, (batch_end + tile_size - 1) / tile_size, 0, 1);
+
+    if (send_delta) {
+        trace::Span span("copy previous", "bytes", static_cast<int64_t>(length));
+        previous_batch.assign(modified_pixel_data, modified_pixel_data + length);
+    }
+
+    // The kernels write the batch into the cache in RGBA order and report whether any cached value was different.
     // If force full update is enabled, then always assume pixels have been changed to make this cache-busting and force sending to the webview
-    bool changed = p.force_full_update;
+    const kernels::KernelSet& k = kernels::ActiveKernels();
 
-    if (p.is_chunky) {
-        // When data is already chunky, we only need to check for cache-changes and insert 255 for the alpha component if we don't have one.
-        size_t beginning = p.batch_pixel_offset * p.components;
+    // The batch is split into chunks of 32K pixels, converted on the thread pool
+    const int64_t chunk_pixels = 32 * 1024;
+    size_t chunks = static_cast<size_t>((p.batch_pixel_size + chunk_pixels - 1) / chunk_pixels);
+    std::vector<uint8_t> chunk_changed(chunks);
 
-        if (p.components == 4) {
+    ThreadPool::Shared().ParallelFor(chunks, [&](size_t chunk) {
+        int64_t offset = p.batch_pixel_offset + static_cast<int64_t>(chunk) * chunk_pixels;
+        size_t count = static_cast<size_t>(std::min(chunk_pixels, batch_end - offset));
+        trace::Span span("interleave and compare", "pixels", static_cast<int64_t>(count));
+        uint8_t* dst = cache->Data() + offset * bytes_per_pixel;
 
-            for (size_t i = beginning; i < beginning + length; i++) {
-                const char16_t& val = p.pixel_data[i];
-                if (changed || modified_pixel_data[i] != val) {
-                    modified_pixel_data[i] = val;
-                    changed = true;
-                }
+        if (deep_source) {
+            // Batches don't know the image width, so dither thresholds are laid out as if the image was 64 pixels wide.
+            // Every segment stays within one of those rows.
+            const int64_t dither_width = 64;
+            const uint8_t* src = p.pixel_data + offset * component_bytes * (p.is_chunky ? p.components : 1);
+            bool segment_changed = false;
+            for (int64_t done = 0; done < static_cast<int64_t>(count);) {
+                int64_t index = offset + done;
+                int64_t segment = std::min(dither_width - index % dither_width, static_cast<int64_t>(count) - done);
+                segment_changed |= deep::ConvertPixels(
+                    src + done * component_bytes * (p.is_chunky ? p.components : 1), plane_size * component_bytes,
+                    p.is_chunky, p.components, p.component_size, p.quantization, index, index / dither_width,
+                    dst + done * bytes_per_pixel, static_cast<size_t>(segment));
+                done += segment;
             }
+            chunk_changed[chunk] = segment_changed;
+        } else if (p.is_chunky) {
+            // When data is already chunky, we only need to check for cache-changes and insert 255 for the alpha component if we don't have one.
+            chunk_changed[chunk] = k.Chunky(p.components)(p.pixel_data + offset * p.components, dst, count);
         } else {
-            size_t current_pixel_index = 0;
-            size_t rgba_index;
-            for (size_t i = beginning; i < beginning + (p.batch_pixel_size * 3); i++) {
-                rgba_index = current_pixel_index + (i % 3);
-
-                const char16_t& val = p.pixel_data[i];
-                if (changed || modified_pixel_data[rgba_index] != val) {
-                    modified_pixel_data[rgba_index] = val;
-                    changed = true;
-                }
-                if (i % 3 == 2 && i != 0) {
-                    modified_pixel_data[rgba_index + 1] = 255;
-                    current_pixel_index += 4;
-                }
-            }
-        }
-    } else {
-        // This is the common case. PS files are usually stored in planar fashion.
-        // We just need to do the annoying conversion from planar to chunky format before doing our cache check and insertion into the result.
-        for (int component = 0; component < 4; component++) {
-            size_t batch_start_index = (plane_size * component) + p.batch_pixel_offset;
-            size_t batch_end_index = batch_start_index + p.batch_pixel_size;
-
-            size_t pixel_position = 0;
-
-            // Force alpha = 255 for every pixel when ps only sends us 3 components
-            if (p.components <= component) {
-                for (size_t i = batch_start_index; i < batch_end_index; i++ ) {
-                    modified_pixel_data[pixel_position * 4 + component] = 255;
-                    pixel_position++;
-                }
-            } else {
-                for (size_t i = batch_start_index; i < batch_end_index; i++ ) {
-                    const size_t& index = pixel_position * 4 + component;
-                    const char16_t& val = p.pixel_data[i];
-
-                    if (changed || modified_pixel_data[index] != val) {
-                        modified_pixel_data[index] = val;
-                        changed = true;
-                    }
-                    pixel_position++;
-                }
-            }
+            // This is the common case. PS files are usually stored in planar fashion.
+            // The kernel does the annoying conversion from planar to chunky format along with the cache check.
+            chunk_changed[chunk] = k.Planar(p.components)(p.pixel_data + offset, plane_size, dst, count);
         }
+    });
+
+    bool changed = std::find(chunk_changed.begin(), chunk_changed.end(), 1) != chunk_changed.end();
+
+    // Only tiles the batch covers completely are written, or the image edge ends the batch
+    int64_t last_written_tile = batch_end == cache->Width() ? cache->TilesX() : batch_end / tile_size;
+    cache->MarkTilesWritten((p.batch_pixel_offset + tile_size - 1) / tile_size, last_written_tile, 0, 1);
+
+    ConversionResult result;
+    result.format = p.output_format;
+    result.changed = changed || p.force_full_update;
+
+    if (result.changed) {
+        trace::Span span("encode", "bytes", static_cast<int64_t>(length));
+        result.pixels.resize(1);
+        EncodePixels(modified_pixel_data, send_delta ? previous_batch.data() : nullptr, length, p.output_format, result.pixels[0]);
     }
 
-    if (!changed) {
-        addon_value result;
-        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+    EnforceMemoryBudget(document);
+
+    return result;
+}
+
+/**
+ * The value convert_to_string returns for a batch: undefined when nothing changed, the pixels otherwise
+ */
+addon_value BatchResultToValue(addon_env env, ConversionResult& result) {
+    if (!result.changed) {
+        addon_value value;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &value));
 
-        return result; // We changed nothing, don't submit an update...
+        return value; // We changed nothing, don't submit an update...
     }
     else {
-        addon_value result;
+        return CreatePixelOutput(env, result.pixels[0], result.format);
+    }
+}
 
-        // This copies the buffer into the result var and will show up in js as a string.
-        Check(UxpAddonApis.uxp_addon_create_string_utf16(env, modified_pixel_data, length, &result));
-        return result;
+/**
+ * Entrypoint for UXP caller for tile based conversion, read args and pass on to ConvertTileRowsToPayload for processing.
+ * Args: (pixel buffer, options) with the options object holding
+ *   document_id, width, height, components, is_chunky
+ *   first_tile_row, tile_rows             the band to convert
+ *   force_full_update                     optional, send every tile of the band
+ *   output, component_size, quantization  optional, see convert_to_string
+ *   generate_mips                         optional, also return the changed texels of the mip levels
+ *   target_width, target_height, filter   optional, see ReadTargetParams
+ *   compression, compression_quality      optional, see ReadCompressionParams
+ *   generation, color_mode                optional, see below
+ *
+ * The generation is the job next_band handed the band out of. When a newer snapshot of the document was queued since,
+ * nothing is converted and undefined is returned: the newer job covers the rows, converting the stale ones would only
+ * send pixels that are about to be replaced.
+ *
+ * The color mode is "rgb" (the default when left out), "grayscale", "lab" or "cmyk", and the components count the
+ * mode's components plus an optional alpha. Pixels of the other modes are converted to RGBA, see ColorModes.h.
+ *
+ * The pixel buffer always holds the full resolution document. When the target size differs from it, the returned rects
+ * are of the document resampled to the target size, see ReadTargetParams.
+ *
+ * With compression, every rect starts on a block and covers whole blocks, except where it ends at the edge of the image,
+ * and its payload is the compressed blocks row by row. See ReadCompressionParams.
+ */
+addon_value ConvertToTiles(addon_env env, addon_callback_info info) {
+    try {
+        addon_value buffer;
+        TaskParams params = ReadTileParams(env, info, &buffer);
+
+        ConversionResult result = Measured<stats::Call::kConvertTiles, ConvertTileRowsToPayload>(params);
+        return TileResultToValue(env, result);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
     }
 }
 
-/** 
-* Method invoked when the addon module is being requested by javascript. Declare the functions so they can be called in JS.
+/**
+ * Async variant of convert_tiles with the same arguments, see ConvertToStringAsync
  */
-addon_value Init(addon_env env, addon_value exports, const addon_apis& addonAPIs) {
-    document_id_to_pixel_array = std::unordered_map<int64_t, std::unique_ptr<std::vector<char16_t> > >();
+addon_value ConvertToTilesAsync(addon_env env, addon_callback_info info) {
+    try {
+        addon_value buffer;
+        TaskParams params = ReadTileParams(env, info, &buffer);
 
-    addon_status status = addon_ok;
-    addon_value fn = nullptr;
+        return ScheduleConversion(env, buffer, params, Measured<stats::Call::kConvertTiles, ConvertTileRowsToPayload>, TileResultToValue);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Entrypoint for UXP caller converting a whole document in one call, see ConvertTileRowsToPayload. Returns every rect
+ * that changed anywhere in the document, or undefined when nothing did, so an unchanged document costs one call.
+ * Args: the same as convert_tiles, the options without first_tile_row and tile_rows.
+ */
+addon_value ConvertImage(addon_env env, addon_callback_info info) {
+    try {
+        addon_value buffer;
+        TaskParams params = ReadTileParams(env, info, &buffer, true);
 
+        ConversionResult result = Measured<stats::Call::kConvertImage, ConvertTileRowsToPayload>(params);
+        return TileResultToValue(env, result);
+    }
+    catch (const std::exception& exc)
     {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertToString, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
-        }
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
 
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_to_string", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
-        }
+/**
+ * Async variant of convert_image with the same arguments, see ConvertToStringAsync
+ */
+addon_value ConvertImageAsync(addon_env env, addon_callback_info info) {
+    try {
+        addon_value buffer;
+        TaskParams params = ReadTileParams(env, info, &buffer, true);
+
+        return ScheduleConversion(env, buffer, params, Measured<stats::Call::kConvertImage, ConvertTileRowsToPayload>, TileResultToValue);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Read the arguments of convert_tiles, see ConvertToTiles. `buffer` receives the pixel buffer value. A whole image,
+ * for convert_image, has no tile row options and covers every tile row.
+ */
+TaskParams ReadTileParams(addon_env env, addon_callback_info info, addon_value* buffer, bool whole_image) {
+    size_t argc = 2;
+    addon_value args[2];
+
+    Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, args[1], &type));
+    if (type != addon_object) {
+        throw std::invalid_argument("Expected the conversion options as an object");
+    }
+    const addon_value options = args[1];
+
+    TaskParams params = TaskParams();
+
+    *buffer = args[0];
+    Check(UxpAddonApis.uxp_addon_get_arraybuffer_info(env, args[0], (void**)&params.pixel_data, &params.pixel_data_byte_length));
+
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, RequiredOption(env, options, "document_id"), &params.document_id));
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, RequiredOption(env, options, "width"), &params.width));
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, RequiredOption(env, options, "height"), &params.height));
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, RequiredOption(env, options, "components"), &params.components));
+    Check(UxpAddonApis.uxp_addon_get_value_bool(env, RequiredOption(env, options, "is_chunky"), &params.is_chunky));
+
+    if (whole_image) {
+        params.first_tile_row = 0;
+        params.tile_row_count = (params.height + PixelCache::kTileSize - 1) / PixelCache::kTileSize;
+    } else {
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, RequiredOption(env, options, "first_tile_row"), &params.first_tile_row));
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, RequiredOption(env, options, "tile_rows"), &params.tile_row_count));
+    }
+
+    addon_value value = Option(env, options, "force_full_update");
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    params.force_full_update = false;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, value, &params.force_full_update));
+    }
+
+    params.output_format = GetOutputFormat(env, Option(env, options, "output"));
+    ReadDepthParams(env, Option(env, options, "component_size"), Option(env, options, "quantization"), params);
+
+    value = Option(env, options, "generate_mips");
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    params.generate_mips = false;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, value, &params.generate_mips));
+    }
+
+    ReadTargetParams(env, Option(env, options, "target_width"), Option(env, options, "target_height"),
+                     Option(env, options, "filter"), params);
+    ReadCompressionParams(env, Option(env, options, "compression"), Option(env, options, "compression_quality"), params);
+
+    value = Option(env, options, "generation");
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    params.generation = 0;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, value, &params.generation));
+    }
+
+    params.color_mode = ReadColorMode(env, Option(env, options, "color_mode"));
+
+    return params;
+}
+
+/**
+ * A property of an options object, undefined when it isn't set
+ */
+addon_value Option(addon_env env, addon_value options, const char* name) {
+    addon_value value;
+    Check(UxpAddonApis.uxp_addon_get_named_property(env, options, name, &value));
+    return value;
+}
+
+/**
+ * A property of an options object that has to be set
+ */
+addon_value RequiredOption(addon_env env, addon_value options, const char* name) {
+    addon_value value = Option(env, options, name);
+
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    if (type == addon_undefined) {
+        throw std::invalid_argument(std::string("Missing option ") + name);
+    }
+    return value;
+}
+
+/**
+ * Read the optional color mode argument of tile conversion, see ConvertToTiles
+ */
+color::Mode ReadColorMode(addon_env env, addon_value mode) {
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, mode, &type));
+    if (type == addon_undefined) {
+        return color::Mode::kRgb;
+    }
+
+    std::string value = ReadString(env, mode);
+    if (value == "rgb") return color::Mode::kRgb;
+    if (value == "grayscale") return color::Mode::kGrayscale;
+    if (value == "lab") return color::Mode::kLab;
+    if (value == "cmyk") return color::Mode::kCmyk;
+    throw std::invalid_argument("Unknown color mode " + value + ", expected rgb, grayscale, lab or cmyk");
+}
+
+/**
+ * Read the optional target size and filter arguments of tile conversion. The target size is the size the webview
+ * previews the document at, the document's own size when left out. The filter is "bilinear" or "lanczos" (the default
+ * when left out).
+ */
+void ReadTargetParams(addon_env env, addon_value target_width, addon_value target_height, addon_value filter, TaskParams& params) {
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, target_width, &type));
+    params.target_width = params.width;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, target_width, &params.target_width));
+    }
+
+    Check(UxpAddonApis.uxp_addon_typeof(env, target_height, &type));
+    params.target_height = params.height;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, target_height, &params.target_height));
+    }
+
+    if (params.target_width < 0 || params.target_height < 0) {
+        throw std::invalid_argument("Target size can't be negative");
+    }
+
+    Check(UxpAddonApis.uxp_addon_typeof(env, filter, &type));
+    params.filter = ResampleFilter::kLanczos3;
+    if (type == addon_undefined) {
+        return;
+    }
+
+    std::string mode = ReadString(env, filter);
+    if (mode == "bilinear") params.filter = ResampleFilter::kBilinear;
+    else if (mode == "lanczos") params.filter = ResampleFilter::kLanczos3;
+    else throw std::invalid_argument("Unknown filter " + mode + ", expected bilinear or lanczos");
+}
+
+/**
+ * Read the optional compression arguments of tile conversion. The compression is the block format the preview is sent
+ * in, "bc1", "bc3" or "bc7", uncompressed pixels when left out. The quality is "fast", "balanced" (the default when
+ * left out) or "high", see bc::Quality. Only RGBA8 previews can be compressed.
+ */
+void ReadCompressionParams(addon_env env, addon_value format, addon_value quality, TaskParams& params) {
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, format, &type));
+    params.compress = false;
+    if (type == addon_undefined) {
+        return;
+    }
+
+    std::string mode = ReadString(env, format);
+    if (mode == "bc1") params.block_format = bc::Format::kBc1;
+    else if (mode == "bc3") params.block_format = bc::Format::kBc3;
+    else if (mode == "bc7") params.block_format = bc::Format::kBc7;
+    else throw std::invalid_argument("Unknown compression " + mode + ", expected bc1, bc3 or bc7");
+    params.compress = true;
+
+    if (params.quantization == deep::Quantization::kHalf) {
+        throw std::invalid_argument("Half float previews can't be block compressed");
     }
 
+    Check(UxpAddonApis.uxp_addon_typeof(env, quality, &type));
+    params.block_quality = bc::Quality::kBalanced;
+    if (type == addon_undefined) {
+        return;
+    }
+
+    mode = ReadString(env, quality);
+    if (mode == "fast") params.block_quality = bc::Quality::kFast;
+    else if (mode == "balanced") params.block_quality = bc::Quality::kBalanced;
+    else if (mode == "high") params.block_quality = bc::Quality::kHigh;
+    else throw std::invalid_argument("Unknown compression quality " + mode + ", expected fast, balanced or high");
+}
+
+/**
+ * Entrypoint for UXP caller to change the size a document is previewed at without fetching it from Photoshop again.
+ * Args: (document id, target width, target height, optional output format, optional filter, optional generate mips,
+ *        optional compression, optional compression quality)
+ *
+ * Returns undefined when no pixels of the document are cached, otherwise the whole document at the new size in the
+ * same form convert_tiles returns it.
+ */
+addon_value ResampleDocument(addon_env env, addon_callback_info info) {
+    try {
+        TaskParams params = ReadResampleParams(env, info);
+
+        ConversionResult result = Measured<stats::Call::kResampleDocument, ResampleDocumentToPayload>(params);
+        return TileResultToValue(env, result);
+    }
+    catch (const std::exception& exc)
     {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, CloseDocument, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
-        }
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
 
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "close_document", fn);
+/**
+ * Async variant of resample_document with the same arguments, see ConvertToStringAsync
+ */
+addon_value ResampleDocumentAsync(addon_env env, addon_callback_info info) {
+    try {
+        TaskParams params = ReadResampleParams(env, info);
+
+        return ScheduleConversion(env, nullptr, params, Measured<stats::Call::kResampleDocument, ResampleDocumentToPayload>,
+                                  TileResultToValue);
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Read the arguments of resample_document, see ResampleDocument
+ */
+TaskParams ReadResampleParams(addon_env env, addon_callback_info info) {
+    size_t argc = 8;
+    addon_value args[8];
+
+    Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+    TaskParams params = TaskParams();
+
+    Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &params.document_id));
+    params.output_format = GetOutputFormat(env, args[3]);
+
+    // The size of the cached document isn't known here, so both target dimensions are required
+    addon_valuetype width_type, height_type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, args[1], &width_type));
+    Check(UxpAddonApis.uxp_addon_typeof(env, args[2], &height_type));
+    if (width_type == addon_undefined || height_type == addon_undefined) {
+        throw std::invalid_argument("Expected a target width and height");
+    }
+    ReadTargetParams(env, args[1], args[2], args[4], params);
+
+    addon_valuetype type;
+    Check(UxpAddonApis.uxp_addon_typeof(env, args[5], &type));
+    params.generate_mips = false;
+    if (type != addon_undefined) {
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, args[5], &params.generate_mips));
+    }
+
+    ReadCompressionParams(env, args[6], args[7], params);
+
+    return params;
+}
+
+/**
+ * Choose how changes to a document are detected. "full", the default, keeps a copy of every pixel the webview has and
+ * compares new pixels against it. "hash" keeps only a hash per tile, kilobytes instead of megabytes, for documents that
+ * are viewed but rarely edited: the first change to one then costs a conversion of the whole document, and is sent
+ * without deltas. Its caches are kept while the edits go on, see DocumentCache. Switching doesn't send the document
+ * again.
+ * Returns a promise for whether the mode changed, applied after the conversions already scheduled for the document.
+ * Args: (document id, "full" or "hash")
+ */
+addon_value SetChangeDetection(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 2;
+        addon_value args[2];
+
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+        int64_t document_id;
+        Check(UxpAddonApis.uxp_addon_get_value_int64(env, args[0], &document_id));
+
+        std::string mode = ReadString(env, args[1]);
+
+        if (mode != "full" && mode != "hash") {
+            throw std::invalid_argument("Unknown change detection: " + mode);
+        }
+
+        const bool hash_only = mode == "hash";
+        return ScheduleDocumentUpdate(env, document_id, [document_id, hash_only] {
+            // Full change detection is what every document gets, there is nothing to remember for one never converted
+            DocumentLock document = LockDocument(document_id, hash_only);
+            if (!document || document.entry->cache.hash_only == hash_only) {
+                return false;
+            }
+
+            DocumentCache& doc = document.entry->cache;
+            doc.hash_only = hash_only;
+            if (hash_only && !doc.hashes) {
+                doc.hashes = HashDocument(doc);
+                DropPixelCaches(doc);
+                document.entry->bytes.store(doc.ByteSize(), std::memory_order_relaxed);
+                ReleaseFreedMemory();
+            }
+            return true;
+        });
+    }
+    catch (const std::exception& exc)
+    {
+        return GetErrorMessage(env, exc.what());
+    }
+    catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/**
+ * Same as ConvertBatch, but the image is processed in bands of whole tile rows and only the tiles that changed
+ * are returned, as one payload per dirty rect. Each payload holds the cached pixels for that rect row by row, in the output format.
+ * The band may be the whole image, as convert_image passes it.
+ */
+ConversionResult ConvertTileRowsToPayload(const TaskParams& p) {
+    SourcePixels source = {p.pixel_data, p.pixel_data_byte_length, p.width, p.height, p.components, p.is_chunky, p.component_size,
+                           p.color_mode};
+    source.Validate();
+
+    const int64_t bytes_per_pixel = p.component_size != 8 ? deep::CacheBytesPerPixel(p.quantization) : 4;
+
+    DocumentLock document = LockDocument(p.document_id);
+    DocumentCache& doc = document.entry->cache;
+    std::vector<uint8_t>& previous_band = document.entry->previous;
+
+    // A newer snapshot may have been queued while this one waited for its turn or for the lock. The caches never go
+    // back to an older snapshot either.
+    if (p.generation != 0) {
+        if (p.generation < doc.generation || jobs.Superseded(p.document_id, p.generation)) {
+            ConversionResult result;
+            result.format = p.output_format;
+            result.superseded = true;
+            return result;
+        }
+        doc.generation = p.generation;
+    }
+
+    // Hash only documents being edited keep complete caches without hashes, see DocumentCache
+    if (doc.hashes || (doc.hash_only && !doc.pixels)) {
+        ConversionResult result = ConvertHashedTileRows(p, source, bytes_per_pixel, doc);
+        EnforceMemoryBudget(document);
+        return result;
+    }
+
+    PrepareDocumentCache(doc, p.width, p.height, bytes_per_pixel, p);
+    PixelCache& full = doc.resampler ? *doc.source : *doc.pixels;
+    const bool compress = !doc.blocks.empty();
+
+    // Keep the band as the webview has it, so dirty rects can be sent as a delta. Not possible until the band was
+    // written at least once, or when the update is forced because the webview starts from nothing.
+    bool send_delta = p.output_format == OutputFormat::kDelta && !p.force_full_update &&
+        full.TilesWritten(0, full.TilesX(), p.first_tile_row, p.first_tile_row + p.tile_row_count);
+
+    ConversionResult result;
+    result.format = p.output_format;
+
+    // Large ranges, up to the whole image, are converted a few tile rows at a time so the copy of what the webview has
+    // stays small. The resampled, mip and compressed outputs keep what the webview has themselves.
+    const bool encode_rects = !doc.resampler && !compress;
+    const bool feeds_packed = packer.Feeds(p.document_id);
+    const int64_t end_tile_row = p.first_tile_row + p.tile_row_count;
+    for (int64_t tile_row = p.first_tile_row; tile_row < end_tile_row; tile_row += kBandTileRows) {
+        int64_t band_rows = std::min(kBandTileRows, end_tile_row - tile_row);
+        int64_t band_y = tile_row * PixelCache::kTileSize;
+        if (send_delta && encode_rects) {
+            int64_t band_height = std::min(band_rows * PixelCache::kTileSize, p.height - band_y);
+            trace::Span span("copy previous", "bytes", band_height * p.width * bytes_per_pixel);
+            previous_band.assign(full.PixelAt(0, band_y), full.PixelAt(0, band_y) + band_height * p.width * bytes_per_pixel);
+        }
+
+        std::vector<DirtyRect> rects = ConvertTileRows(source, full, tile_row, band_rows, p.force_full_update, p.quantization);
+        if (feeds_packed) {
+            trace::Span span("pack channels", "rects", static_cast<int64_t>(rects.size()));
+            packer.Write(p.document_id, full, rects);
+        }
+        if (encode_rects) {
+            size_t first = result.pixels.size();
+            result.pixels.resize(first + rects.size());
+
+            // Rects are copied out of the cache into reusable buffers, then encoded into their payload on the thread pool
+            ThreadPool::Shared().ParallelFor(rects.size(), [&](size_t i) {
+                thread_local std::vector<uint8_t> rect_pixels;
+                thread_local std::vector<uint8_t> previous_rect_pixels;
+
+                const DirtyRect& rect = rects[i];
+                trace::Span span("encode", "pixels", rect.width * rect.height);
+
+                rect_pixels.resize(static_cast<size_t>(rect.width * rect.height * bytes_per_pixel));
+                CopyRect(full, rect, rect_pixels.data());
+
+                if (send_delta) {
+                    previous_rect_pixels.resize(rect_pixels.size());
+                    CopyRect(previous_band.data(), p.width, {rect.x, rect.y - band_y, rect.width, rect.height}, previous_rect_pixels.data(),
+                             bytes_per_pixel);
+                }
+
+                EncodePixels(rect_pixels.data(), send_delta ? previous_rect_pixels.data() : nullptr, rect_pixels.size(),
+                             p.output_format, result.pixels[first + i]);
+            });
+        }
+        result.rects.insert(result.rects.end(), rects.begin(), rects.end());
+    }
+    result.changed = !result.rects.empty();
+
+    if (doc.resampler) {
+        ResampleToPayload(p, doc, send_delta, result);
+    }
+
+    if (doc.mips) {
+        ConvertMipsToPayload(p, doc, send_delta, result);
+    }
+
+    if (compress) {
+        CompressToPayload(p, doc, send_delta, result);
+    }
+
+    if (doc.hash_only) {
+        KeepOrDropHashedCaches(doc, result.changed, end_tile_row == full.TilesY());
+    }
+
+    EnforceMemoryBudget(document);
+
+    return result;
+}
+
+/**
+ * ConvertTileRowsToPayload for a document whose changes are detected by tile hashes. The band is hashed first, and
+ * only when a tile changed are the caches rebuilt from the source: every tile is converted and everything derived from
+ * it brought up to date, as if the document was new, and the changed rects are then sent from them like any others.
+ * Nothing is sent as a delta, there is nothing to compute it against. Once the pass is over the caches are complete,
+ * and the hashes are dropped for them. Holds the document's lock.
+ */
+ConversionResult ConvertHashedTileRows(const TaskParams& p, const SourcePixels& source, int64_t bytes_per_pixel, DocumentCache& doc) {
+    // Size or preview settings changed, the webview starts from nothing like with PrepareDocumentCache
+    const uint64_t format = PreviewFormat(p, bytes_per_pixel);
+    if (!doc.hashes || !doc.hashes->Matches(p.width, p.height, format)) {
+        doc.hashes = std::make_unique<TileHashes>(p.width, p.height, format);
+    }
+
+    // Caches rebuilt for an earlier pass hold the pixels of an earlier snapshot
+    if (p.first_tile_row == 0) {
+        DropPixelCaches(doc);
+    }
+
+    ConversionResult result;
+    result.format = p.output_format;
+    {
+        trace::Span span("hash tiles", "rows", p.tile_row_count);
+        result.rects = HashTileRows(source, *doc.hashes, p.first_tile_row, p.tile_row_count, p.force_full_update, p.quantization);
+    }
+    result.changed = !result.rects.empty();
+
+    if (result.changed) {
+        if (!doc.pixels) {
+            trace::Span span("rebuild caches");
+            PrepareDocumentCache(doc, p.width, p.height, bytes_per_pixel, p);
+            PixelCache& full = doc.resampler ? *doc.source : *doc.pixels;
+
+            // The derived caches are brought up to date through the usual path, its payloads are thrown away
+            TaskParams everything = p;
+            everything.first_tile_row = 0;
+            everything.tile_row_count = full.TilesY();
+            everything.force_full_update = true;
+            everything.output_format = OutputFormat::kUint8Array;
+
+            ConversionResult discarded;
+            discarded.format = everything.output_format;
+            discarded.rects = ConvertTileRows(source, full, 0, full.TilesY(), true, p.quantization);
+            if (doc.resampler) {
+                ResampleToPayload(everything, doc, false, discarded);
+            }
+            if (doc.mips) {
+                ConvertMipsToPayload(everything, doc, false, discarded);
+            }
+            if (!doc.blocks.empty()) {
+                CompressToPayload(everything, doc, false, discarded);
+            }
+        }
+
+        PixelCache& full = doc.resampler ? *doc.source : *doc.pixels;
+        if (packer.Feeds(p.document_id)) {
+            trace::Span span("pack channels", "rects", static_cast<int64_t>(result.rects.size()));
+            packer.Write(p.document_id, full, result.rects);
+        }
+        if (!doc.resampler && doc.blocks.empty()) {
+            result.pixels.resize(result.rects.size());
+            ThreadPool::Shared().ParallelFor(result.rects.size(), [&](size_t i) {
+                thread_local std::vector<uint8_t> rect_pixels;
+
+                const DirtyRect& rect = result.rects[i];
+                trace::Span span("encode", "pixels", rect.width * rect.height);
+                rect_pixels.resize(static_cast<size_t>(rect.width * rect.height * bytes_per_pixel));
+                CopyRect(full, rect, rect_pixels.data());
+                EncodePixels(rect_pixels.data(), nullptr, rect_pixels.size(), p.output_format, result.pixels[i]);
+            });
+        }
+
+        if (doc.resampler) {
+            ResampleToPayload(p, doc, false, result);
+        }
+        if (doc.mips) {
+            ConvertMipsToPayload(p, doc, false, result);
+        }
+        if (!doc.blocks.empty()) {
+            CompressToPayload(p, doc, false, result);
+        }
+    }
+
+    // At the end of a pass the webview has every tile. Without rebuilt caches there is nothing to switch to yet.
+    if (result.changed) {
+        doc.changed_at = Pacer::Now();
+    }
+    if (p.first_tile_row + p.tile_row_count == doc.hashes->TilesY() && doc.pixels) {
+        doc.hashes.reset();
+    }
+
+    return result;
+}
+
+/**
+ * At the end of each band of a hash only document converted from its caches: note when it last changed, and once a
+ * pass finds nothing changed for kHashCachesIdle, go back to keeping just the hashes.
+ */
+void KeepOrDropHashedCaches(DocumentCache& doc, bool changed, bool pass_done) {
+    if (changed) {
+        doc.changed_at = Pacer::Now();
+    } else if (pass_done && Pacer::Now() - doc.changed_at >= kHashCachesIdle) {
+        trace::Span span("drop idle caches");
+        doc.hashes = HashDocument(doc);
+        DropPixelCaches(doc);
+    }
+}
+
+/**
+ * Send the whole cached document at the target size of the params, resampled from the full resolution pixels the
+ * addon already has. Nothing is sent when the document was never converted, or only its hashes are kept.
+ */
+ConversionResult ResampleDocumentToPayload(const TaskParams& p) {
+    ConversionResult result;
+    result.format = p.output_format;
+
+    DocumentLock document = LockDocument(p.document_id, false);
+    if (!document) {
+        return result;
+    }
+
+    DocumentCache& doc = document.entry->cache;
+    const PixelCache* cached = doc.resampler ? doc.source.get() : doc.pixels.get();
+    if (!cached) {
+        return result;
+    }
+
+    PrepareDocumentCache(doc, cached->Width(), cached->Height(), cached->BytesPerPixel(), p);
+    PixelCache& full = doc.resampler ? *doc.source : *doc.pixels;
+
+    // The webview gets every pixel as it is cached, in bands of tile rows like a conversion would send them
+    for (int64_t y = 0; y < full.Height(); y += PixelCache::kTileSize) {
+        result.rects.push_back({0, y, full.Width(), std::min(PixelCache::kTileSize, full.Height() - y)});
+    }
+
+    if (doc.resampler) {
+        ResampleToPayload(p, doc, false, result);
+    } else if (doc.blocks.empty()) {
+        result.pixels.resize(result.rects.size());
+        ThreadPool::Shared().ParallelFor(result.rects.size(), [&](size_t i) {
+            thread_local std::vector<uint8_t> rect_pixels;
+
+            const DirtyRect& rect = result.rects[i];
+            trace::Span span("encode", "pixels", rect.width * rect.height);
+            rect_pixels.resize(static_cast<size_t>(rect.width * rect.height * full.BytesPerPixel()));
+            CopyRect(full, rect, rect_pixels.data());
+            EncodePixels(rect_pixels.data(), nullptr, rect_pixels.size(), p.output_format, result.pixels[i]);
+        });
+    }
+
+    if (doc.mips) {
+        ConvertMipsToPayload(p, doc, false, result);
+    }
+
+    if (!doc.blocks.empty()) {
+        CompressToPayload(p, doc, false, result);
+    }
+
+    // Now the webview has everything the cache has
+    full.MarkTilesWritten(0, full.TilesX(), 0, full.TilesY());
+    result.changed = true;
+
+    EnforceMemoryBudget(document);
+
+    return result;
+}
+
+/**
+ * Make sure the document's caches fit a conversion of a `width` x `height` document previewed at the target size of
+ * the params. The full resolution pixels are kept when only the target size changes, so the preview can be resampled
+ * from them. Returns whether anything was created for the document, which means the webview's texture doesn't match
+ * anymore and every tile has to be sent again.
+ */
+bool PrepareDocumentCache(DocumentCache& doc, int64_t width, int64_t height, int64_t bytes_per_pixel, const TaskParams& p) {
+    const bool resample = p.target_width != width || p.target_height != height;
+    bool changed = false;
+
+    // The full resolution pixels move between the two caches when resampling is switched on or off
+    std::unique_ptr<PixelCache>& full = resample ? doc.source : doc.pixels;
+    std::unique_ptr<PixelCache>& other = resample ? doc.pixels : doc.source;
+    if (!full || !full->HasFormat(width, height, bytes_per_pixel)) {
+        if (other && other->HasFormat(width, height, bytes_per_pixel)) {
+            full = std::move(other);
+        } else {
+            full = std::make_unique<PixelCache>(width, height, bytes_per_pixel);
+        }
+        changed = true;
+    }
+
+    if (resample) {
+        if (!doc.resampler || !doc.resampler->Matches(width, height, p.target_width, p.target_height, p.filter)) {
+            doc.resampler = std::make_unique<Resampler>(width, height, p.target_width, p.target_height, p.filter);
+            changed = true;
+        }
+        if (!doc.pixels || !doc.pixels->HasFormat(p.target_width, p.target_height, bytes_per_pixel)) {
+            doc.pixels = std::make_unique<PixelCache>(p.target_width, p.target_height, bytes_per_pixel);
+            changed = true;
+        }
+    } else {
+        doc.source.reset();
+        doc.resampler.reset();
+    }
+
+    if (p.generate_mips) {
+        if (!doc.mips || !doc.mips->HasFormat(*doc.pixels)) {
+            doc.mips = std::make_unique<MipPyramid>(doc.pixels->Width(), doc.pixels->Height(), bytes_per_pixel);
+            changed = true;
+        }
+    } else {
+        doc.mips.reset();
+    }
+
+    if (p.compress) {
+        if (bytes_per_pixel != 4) {
+            throw std::invalid_argument("Half float previews can't be block compressed");
+        }
+
+        // One block image for the preview and each of its mip levels
+        size_t levels = static_cast<size_t>(1 + (doc.mips ? doc.mips->Levels() : 0));
+        bool matches = doc.blocks.size() == levels;
+        for (size_t level = 0; level < doc.blocks.size() && matches; level++) {
+            int64_t level_width = level == 0 ? doc.pixels->Width() : doc.mips->LevelWidth(static_cast<int64_t>(level));
+            int64_t level_height = level == 0 ? doc.pixels->Height() : doc.mips->LevelHeight(static_cast<int64_t>(level));
+            matches = doc.blocks[level].Matches(level_width, level_height, p.block_format, p.block_quality);
+        }
+
+        if (!matches) {
+            doc.blocks.clear();
+            doc.blocks.emplace_back(doc.pixels->Width(), doc.pixels->Height(), p.block_format, p.block_quality);
+            for (int64_t level = 1; level < static_cast<int64_t>(levels); level++) {
+                doc.blocks.emplace_back(doc.mips->LevelWidth(level), doc.mips->LevelHeight(level), p.block_format, p.block_quality);
+            }
+            changed = true;
+        }
+    } else {
+        doc.blocks.clear();
+    }
+
+    // Unwritten tiles are always converted and sent, which rebuilds everything derived from them
+    if (changed) {
+        (resample ? doc.source : doc.pixels)->ClearTilesWritten();
+    }
+
+    return changed;
+}
+
+/**
+ * Everything besides the size that decides the pixels the webview has for a document converted with the params, so
+ * tile hashes are only compared against hashes of the same preview
+ */
+uint64_t PreviewFormat(const TaskParams& p, int64_t bytes_per_pixel) {
+    const bool resample = p.target_width != p.width || p.target_height != p.height;
+    const int64_t fields[] = {
+        bytes_per_pixel,
+        p.target_width,
+        p.target_height,
+        resample ? static_cast<int64_t>(p.filter) : -1,
+        p.generate_mips ? 1 : 0,
+        p.compress ? static_cast<int64_t>(p.block_format) : -1,
+        p.compress ? static_cast<int64_t>(p.block_quality) : -1,
+    };
+    return HashBytes(fields, sizeof(fields));
+}
+
+/**
+ * Hashes of the full resolution pixels of a document's caches, for switching it to hash only change detection
+ * without sending it again. Null when the document has no caches.
+ */
+std::unique_ptr<TileHashes> HashDocument(const DocumentCache& doc) {
+    const PixelCache* full = doc.resampler ? doc.source.get() : doc.pixels.get();
+    if (!full) {
+        return nullptr;
+    }
+
+    TaskParams p = {};
+    p.width = full->Width();
+    p.height = full->Height();
+    p.target_width = doc.pixels->Width();
+    p.target_height = doc.pixels->Height();
+    p.filter = doc.resampler ? doc.resampler->Filter() : ResampleFilter::kBilinear;
+    p.generate_mips = doc.mips != nullptr;
+    p.compress = !doc.blocks.empty();
+    if (p.compress) {
+        p.block_format = doc.blocks[0].BlockFormat();
+        p.block_quality = doc.blocks[0].EncodeQuality();
+    }
+
+    auto hashes = std::make_unique<TileHashes>(full->Width(), full->Height(), PreviewFormat(p, full->BytesPerPixel()));
+    for (int64_t tile_y = 0; tile_y < full->TilesY(); tile_y++) {
+        for (int64_t tile_x = 0; tile_x < full->TilesX(); tile_x++) {
+            hashes->Set(tile_x, tile_y, HashTile(*full, tile_x, tile_y));
+            if (full->TilesWritten(tile_x, tile_x + 1, tile_y, tile_y + 1)) {
+                hashes->MarkWritten(tile_x, tile_y);
+            }
+        }
+    }
+    return hashes;
+}
+
+/**
+ * Whether every tile under the rect was written, see PixelCache::TilesWritten
+ */
+bool TilesWrittenUnder(const PixelCache& cache, const DirtyRect& rect) {
+    const int64_t tile_size = PixelCache::kTileSize;
+    return cache.TilesWritten(rect.x / tile_size, (rect.x + rect.width + tile_size - 1) / tile_size,
+                              rect.y / tile_size, (rect.y + rect.height + tile_size - 1) / tile_size);
+}
+
+/**
+ * Whether every tile a rect of the preview depends on was written, level 0 being the preview itself and higher levels
+ * its mip levels. The webview then has what the caches have for the rect.
+ */
+bool WrittenUnder(const DocumentCache& doc, int64_t level, const DirtyRect& rect) {
+    DirtyRect footprint = rect;
+    if (level > 0) {
+        int64_t x = rect.x << level;
+        int64_t y = rect.y << level;
+        footprint = {x, y, std::min(doc.pixels->Width(), (rect.x + rect.width) << level) - x,
+                     std::min(doc.pixels->Height(), (rect.y + rect.height) << level) - y};
+    }
+
+    if (doc.resampler) {
+        return TilesWrittenUnder(*doc.source, doc.resampler->SourceRectUnder(footprint));
+    }
+    return TilesWrittenUnder(*doc.pixels, footprint);
+}
+
+/**
+ * Resample the preview pixels under the source rects ConvertTileRows just converted, and replace the result's rects
+ * with them. A preview rect depends on source pixels outside the band, so it is only sent as a delta when all of those
+ * tiles were written before.
+ */
+void ResampleToPayload(const TaskParams& p, DocumentCache& doc, bool send_delta, ConversionResult& result) {
+    trace::Span span("resample", "rects", static_cast<int64_t>(result.rects.size()));
+    const Resampler& resampler = *doc.resampler;
+    const PixelCache& full = *doc.source;
+    PixelCache& target = *doc.pixels;
+    const int64_t bytes_per_pixel = target.BytesPerPixel();
+    const bool compress = !doc.blocks.empty();
+
+    std::vector<DirtyRect> target_rects;
+    for (const DirtyRect& rect : result.rects) {
+        DirtyRect target_rect = resampler.TargetRectUnder(rect);
+        if (target_rect.width > 0 && target_rect.height > 0) {
+            target_rects.push_back(target_rect);
+        }
+    }
+    MergeOverlappingRects(target_rects);
+
+    // Strips of tile rows spread across the thread pool and bound the scratch memory each of them needs
+    result.rects.clear();
+    for (const DirtyRect& rect : target_rects) {
+        for (int64_t y = rect.y; y < rect.y + rect.height; y += PixelCache::kTileSize) {
+            result.rects.push_back({rect.x, y, rect.width, std::min(PixelCache::kTileSize, rect.y + rect.height - y)});
+        }
+    }
+    result.changed = !result.rects.empty();
+    result.pixels.resize(compress ? 0 : result.rects.size());
+
+    // Strips never overlap, so each one is resampled and encoded on its own
+    ThreadPool::Shared().ParallelFor(result.rects.size(), [&](size_t i) {
+        thread_local std::vector<uint8_t> rect_pixels;
+        thread_local std::vector<uint8_t> previous_rect_pixels;
+
+        const DirtyRect& rect = result.rects[i];
+        if (compress) {
+            // Blocks are encoded from the resampled pixels afterwards
+            resampler.Resample(full, target, rect);
+            return;
+        }
+
+        rect_pixels.resize(static_cast<size_t>(rect.width * rect.height * bytes_per_pixel));
+
+        bool delta = send_delta && WrittenUnder(doc, 0, rect);
+        if (delta) {
+            previous_rect_pixels.resize(rect_pixels.size());
+            CopyRect(target, rect, previous_rect_pixels.data());
+        }
+
+        resampler.Resample(full, target, rect);
+        CopyRect(target, rect, rect_pixels.data());
+
+        EncodePixels(rect_pixels.data(), delta ? previous_rect_pixels.data() : nullptr, rect_pixels.size(),
+                     p.output_format, result.pixels[i]);
+    });
+}
+
+/**
+ * Bring the document's mip pyramid up to date with the rects of the preview that were just converted, and add the
+ * changed texels of every level to the result.
+ *
+ * A mip rect depends on more tiles than the band's, so it is only sent as a delta when all of those were written before.
+ */
+void ConvertMipsToPayload(const TaskParams& p, DocumentCache& doc, bool send_delta, ConversionResult& result) {
+    trace::Span span("update mips", "rects", static_cast<int64_t>(result.rects.size()));
+    MipPyramid& mips = *doc.mips;
+    const PixelCache& cache = *doc.pixels;
+
+    result.mip_rects = mips.RegionsUnder(result.rects);
+    result.changed = result.changed || !result.mip_rects.empty();
+
+    const int64_t bytes_per_pixel = cache.BytesPerPixel();
+
+    // Compressed previews encode the blocks of the levels afterwards
+    if (!doc.blocks.empty()) {
+        mips.Update(cache, result.mip_rects);
+        return;
+    }
+
+    // Keep what the webview has under each rect before updating
+    std::vector< std::vector<uint8_t> > previous_mip_pixels(result.mip_rects.size());
+    for (size_t i = 0; i < result.mip_rects.size() && send_delta; i++) {
+        const MipRect& mip = result.mip_rects[i];
+        if (!WrittenUnder(doc, mip.level, mip.rect))
+            continue;
+
+        previous_mip_pixels[i].resize(static_cast<size_t>(mip.rect.width * mip.rect.height * bytes_per_pixel));
+        CopyRect(mips.LevelData(mip.level), mips.LevelWidth(mip.level), mip.rect, previous_mip_pixels[i].data(), bytes_per_pixel);
+    }
+
+    mips.Update(cache, result.mip_rects);
+
+    result.mip_pixels.resize(result.mip_rects.size());
+    ThreadPool::Shared().ParallelFor(result.mip_rects.size(), [&](size_t i) {
+        thread_local std::vector<uint8_t> rect_pixels;
+
+        const MipRect& mip = result.mip_rects[i];
+        rect_pixels.resize(static_cast<size_t>(mip.rect.width * mip.rect.height * bytes_per_pixel));
+        CopyRect(mips.LevelData(mip.level), mips.LevelWidth(mip.level), mip.rect, rect_pixels.data(), bytes_per_pixel);
+
+        // Rects that can't be a delta are still sent in the output format, a delta payload without the delta flag
+        // just replaces the pixels
+        const std::vector<uint8_t>& previous = previous_mip_pixels[i];
+        EncodePixels(rect_pixels.data(), previous.empty() ? nullptr : previous.data(), rect_pixels.size(),
+                     p.output_format, result.mip_pixels[i]);
+    });
+}
+
+/**
+ * Re-encode the blocks under the changed rects of the preview and its mip levels, and replace the result's rects with
+ * the block aligned rects they grow to, carrying the compressed blocks. Like pixels, blocks are only sent as a delta
+ * when every tile they depend on was written before, the webview has the same blocks then.
+ */
+void CompressToPayload(const TaskParams& p, DocumentCache& doc, bool send_delta, ConversionResult& result) {
+    trace::Span span("compress blocks", "rects", static_cast<int64_t>(result.rects.size()));
+    // Rects grown to whole blocks can overlap where they didn't before
+    std::vector< std::vector<DirtyRect> > block_rects(doc.blocks.size());
+    for (const DirtyRect& rect : result.rects) {
+        block_rects[0].push_back(bc::BlocksUnder(rect));
+    }
+    for (const MipRect& mip : result.mip_rects) {
+        block_rects[static_cast<size_t>(mip.level)].push_back(bc::BlocksUnder(mip.rect));
+    }
+
+    // Split into strips of a tile row of blocks, like the resampled rects
+    const int64_t strip_blocks = PixelCache::kTileSize / bc::kBlockSize;
+    std::vector<MipRect> jobs;
+    for (size_t level = 0; level < block_rects.size(); level++) {
+        MergeOverlappingRects(block_rects[level]);
+        for (const DirtyRect& rect : block_rects[level]) {
+            for (int64_t y = rect.y; y < rect.y + rect.height; y += strip_blocks) {
+                jobs.push_back({static_cast<int64_t>(level), {rect.x, y, rect.width, std::min(strip_blocks, rect.y + rect.height - y)}});
+            }
+        }
+    }
+
+    // The pixels each job covers, clipped to its level
+    auto pixel_rect = [&](const MipRect& job) {
+        int64_t level_width = job.level == 0 ? doc.pixels->Width() : doc.mips->LevelWidth(job.level);
+        int64_t level_height = job.level == 0 ? doc.pixels->Height() : doc.mips->LevelHeight(job.level);
+        int64_t x = job.rect.x * bc::kBlockSize;
+        int64_t y = job.rect.y * bc::kBlockSize;
+        return DirtyRect{x, y, std::min(job.rect.width * bc::kBlockSize, level_width - x),
+                         std::min(job.rect.height * bc::kBlockSize, level_height - y)};
+    };
+
+    result.rects.clear();
+    result.mip_rects.clear();
+    for (const MipRect& job : jobs) {
+        if (job.level == 0) {
+            result.rects.push_back(pixel_rect(job));
+        } else {
+            result.mip_rects.push_back({job.level, pixel_rect(job)});
+        }
+    }
+    result.pixels.assign(result.rects.size(), PixelPayload());
+    result.mip_pixels.assign(result.mip_rects.size(), PixelPayload());
+    result.changed = !jobs.empty();
+
+    // Jobs are ordered by level, so the preview's come first like its rects
+    ThreadPool::Shared().ParallelFor(jobs.size(), [&](size_t i) {
+        thread_local std::vector<uint8_t> blocks;
+        thread_local std::vector<uint8_t> previous_blocks;
+
+        const MipRect& job = jobs[i];
+        bc::BlockImage& image = doc.blocks[static_cast<size_t>(job.level)];
+        const uint8_t* pixels = job.level == 0 ? doc.pixels->Data() : doc.mips->LevelData(job.level);
+        blocks.resize(static_cast<size_t>(job.rect.width * job.rect.height * image.BlockBytes()));
+
+        bool delta = send_delta && WrittenUnder(doc, job.level, pixel_rect(job));
+        if (delta) {
+            previous_blocks.resize(blocks.size());
+            CopyRect(image.Data(), image.BlocksX(), job.rect, previous_blocks.data(), image.BlockBytes());
+        }
+
+        image.Encode(pixels, job.rect);
+        CopyRect(image.Data(), image.BlocksX(), job.rect, blocks.data(), image.BlockBytes());
+
+        PixelPayload& payload = job.level == 0 ? result.pixels[i] : result.mip_pixels[i - result.rects.size()];
+        EncodePixels(blocks.data(), delta ? previous_blocks.data() : nullptr, blocks.size(), p.output_format, payload);
+    });
+}
+
+/**
+ * The value convert_tiles returns: either undefined when nothing in the band changed, or an array of
+ * { x, y, width, height, pixels } objects. With generate mips, the changed mip rects follow the document's rects with an
+ * additional level property, level 1 being half the document size.
+ */
+addon_value TileResultToValue(addon_env env, ConversionResult& result) {
+    addon_value value;
+    if (!result.changed) {
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &value));
+        return value; // We changed nothing, don't submit an update...
+    }
+
+    Check(UxpAddonApis.uxp_addon_create_array_with_length(env, result.rects.size() + result.mip_rects.size(), &value));
+
+    for (size_t i = 0; i < result.rects.size(); i++) {
+        const DirtyRect& rect = result.rects[i];
+
+        addon_value tile;
+        Check(UxpAddonApis.uxp_addon_create_object(env, &tile));
+
+        SetNumberProperty(env, tile, "x", static_cast<double>(rect.x));
+        SetNumberProperty(env, tile, "y", static_cast<double>(rect.y));
+        SetNumberProperty(env, tile, "width", static_cast<double>(rect.width));
+        SetNumberProperty(env, tile, "height", static_cast<double>(rect.height));
+
+        addon_value pixels = CreatePixelOutput(env, result.pixels[i], result.format);
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, tile, "pixels", pixels));
+
+        Check(UxpAddonApis.uxp_addon_set_element(env, value, static_cast<uint32_t>(i), tile));
+    }
+
+    for (size_t i = 0; i < result.mip_rects.size(); i++) {
+        const MipRect& mip = result.mip_rects[i];
+
+        addon_value tile;
+        Check(UxpAddonApis.uxp_addon_create_object(env, &tile));
+
+        SetNumberProperty(env, tile, "level", static_cast<double>(mip.level));
+        SetNumberProperty(env, tile, "x", static_cast<double>(mip.rect.x));
+        SetNumberProperty(env, tile, "y", static_cast<double>(mip.rect.y));
+        SetNumberProperty(env, tile, "width", static_cast<double>(mip.rect.width));
+        SetNumberProperty(env, tile, "height", static_cast<double>(mip.rect.height));
+
+        addon_value pixels = CreatePixelOutput(env, result.mip_pixels[i], result.format);
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, tile, "pixels", pixels));
+
+        Check(UxpAddonApis.uxp_addon_set_element(env, value, static_cast<uint32_t>(result.rects.size() + i), tile));
+    }
+
+    return value;
+}
+
+/**
+* Method invoked when the addon module is being requested by javascript. Declare the functions so they can be called in JS.
+ */
+addon_value Init(addon_env env, addon_value exports, const addon_apis& addonAPIs) {
+    for (DocumentShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.documents)
+            entry.second->unlinked.store(true, std::memory_order_release);
+        shard.documents = std::unordered_map<int64_t, std::shared_ptr<DocumentEntry>>();
+        shard.hibernated.clear();
+    }
+    memory_budget = kDefaultMemoryBudget;
+    active_document_id = -1;
+    pacing.Reset();
+    jobs.Clear();
+    jobs.SetActive(-1);
+    jobs.SetVisible({});
+    packer.Clear();
+
+    addon_status status = addon_ok;
+    addon_value fn = nullptr;
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertToString, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_to_string", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertToStringAsync, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_to_string_async", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertToTiles, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_tiles", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertToTilesAsync, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_tiles_async", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertImage, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_image", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConvertImageAsync, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "convert_image_async", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        // Tile edge length in pixels, so javascript can size its bands of tile rows
+        addon_value tile_size = nullptr;
+        status = addonAPIs.uxp_addon_create_double(env, static_cast<double>(PixelCache::kTileSize), &tile_size);
+        if (status == addon_ok) {
+            status = addonAPIs.uxp_addon_set_named_property(env, exports, "tile_size", tile_size);
+        }
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ResampleDocument, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "resample_document", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ResampleDocumentAsync, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "resample_document_async", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, CloseDocument, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "close_document", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetThreadCount, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_thread_count", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetMemoryBudget, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_memory_budget", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetActiveDocument, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_active_document", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetChangeDetection, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_change_detection", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, Trim, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "trim", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, Hibernate, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "hibernate", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, HibernateAsync, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "hibernate_async", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetStats, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "get_stats", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ResetStats, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "reset_stats", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetTracing, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_tracing", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, DumpTrace, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "dump_trace", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, NoteEdit, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "note_edit", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetPacing, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "get_pacing", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, QueueJob, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "queue_job", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, NextBand, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "next_band", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, FinishJob, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "finish_job", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetVisibleDocuments, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_visible_documents", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, SetPackedChannel, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "set_packed_channel", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, RemovePackedTexture, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "remove_packed_texture", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, TakePackedUpdates, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "take_packed_updates", fn);
         if (status != addon_ok) {
             addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
         }
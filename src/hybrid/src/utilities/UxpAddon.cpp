@@ -12,6 +12,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 addon_value CreateErrorFromException(addon_env env) noexcept {
     std::string message;
@@ -50,3 +51,17 @@ addon_value GetErrorMessage(addon_env env, std::string message) noexcept {
     UxpAddonApis.uxp_addon_create_error(env, errorCode, errorMessage, &error);
     return error;
 }
+
+std::string ReadString(addon_env env, addon_value value) {
+    size_t length = 0;
+    Check(UxpAddonApis.uxp_addon_get_value_string_utf8(env, value, nullptr, 0, &length));
+    std::vector<char> buffer(length + 1);
+    Check(UxpAddonApis.uxp_addon_get_value_string_utf8(env, value, buffer.data(), buffer.size(), &length));
+    return std::string(buffer.data(), length);
+}
+
+void SetNumberProperty(addon_env env, addon_value object, const char* name, double value) {
+    addon_value number;
+    Check(UxpAddonApis.uxp_addon_create_double(env, value, &number));
+    Check(UxpAddonApis.uxp_addon_set_named_property(env, object, name, number));
+}
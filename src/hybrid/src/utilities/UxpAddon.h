@@ -77,6 +77,12 @@ addon_value CreateErrorFromException(addon_env env) noexcept;
 // Actually return a caught message
 addon_value GetErrorMessage(addon_env env, std::string message) noexcept;
 
+// Read a string argument as UTF-8
+std::string ReadString(addon_env env, addon_value value);
+
+// Create a javascript number property on the object
+void SetNumberProperty(addon_env env, addon_value object, const char* name, double value);
+
 /** This class must be used to create a V8 context scope when
  tasks are scheduled onto the scripting thread
 */
@@ -10,8 +10,75 @@
 
 #include "UxpTask.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
 #include "UxpAddon.h"
 
+namespace {
+
+/**
+ * A single background thread that runs posted jobs in the order they were posted.
+ * Started on first use, and joined when the addon is unloaded.
+ */
+class WorkerThread {
+ public:
+    // Jobs of different lanes run on different threads, in parallel
+    static constexpr size_t kLanes = 4;
+
+    static WorkerThread& Shared(size_t lane) {
+        static WorkerThread workers[kLanes];
+        return workers[lane % kLanes];
+    }
+
+    void Post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back(std::move(job));
+        }
+        mWake.notify_one();
+    }
+
+    ~WorkerThread() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_one();
+        mThread.join();
+    }
+
+ private:
+    WorkerThread() : mThread([this] { Run(); }) {}
+
+    void Run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+                if (mJobs.empty())
+                    return;
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::deque<std::function<void()>> mJobs;
+    bool mStopping{false};
+    std::thread mThread;
+};
+
+}  // namespace
+
 struct TaskWrapper {
     static void MainThreadThunk(addon_task_data data);
     static void ScriptingThreadThunk(addon_task_data data);
@@ -43,7 +110,7 @@ std::shared_ptr<Task> Task::Create() {
     return std::shared_ptr<Task>(new Task);
 }
 
-addon_value Task::ScheduleOnMainThread(addon_env env, const Handler& handler) {
+addon_value Task::CreatePromise(addon_env env, const Handler& handler) {
     if (mDeferred != nullptr)
         throw "Tasks can only be used to schedule one operation";
 
@@ -52,16 +119,49 @@ addon_value Task::ScheduleOnMainThread(addon_env env, const Handler& handler) {
     addon_value promise = nullptr;
     Check(UxpAddonApis.uxp_addon_create_promise(env, &mDeferred, &promise));
 
+    mEnv = env;
+
+    return promise;
+}
+
+addon_value Task::ScheduleOnMainThread(addon_env env, const Handler& handler) {
+    addon_value promise = CreatePromise(env, handler);
+
     TaskWrapper* wrapper = new TaskWrapper;
     wrapper->task = shared_from_this();
 
-    mEnv = env;
-
     UxpAddonApis.uxp_addon_schedule_on_main_queue(env, TaskWrapper::MainThreadThunk, wrapper, TaskWrapperDestructor);
 
     return promise;
 }
 
+addon_value Task::ScheduleOnWorkerThread(addon_env env, const Handler& handler, size_t lane) {
+    addon_value promise = CreatePromise(env, handler);
+
+    std::shared_ptr<Task> task = shared_from_this();
+    WorkerThread::Shared(lane).Post([task] {
+        // A handler that throws never gets to schedule its result, so settle the promise for it
+        std::string message;
+        try {
+            task->InvokeMainThreadHandler();
+            return;
+        } catch (const std::exception& exc) {
+            message = exc.what();
+        } catch (...) {
+            message = "unknown exception";
+        }
+
+        try {
+            task->ScheduleOnScriptingThread([message](Task&, addon_env env, addon_deferred deferred) {
+                UxpAddonApis.uxp_addon_reject_deferred(env, deferred, GetErrorMessage(env, message));
+            });
+        } catch (...) {
+        }
+    });
+
+    return promise;
+}
+
 void Task::ScheduleOnScriptingThread(const ResultHandler& resultHandler) {
     mResultHandler = resultHandler;
 
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include <memory>
 
@@ -32,6 +33,11 @@ class Task : public std::enable_shared_from_this<Task> {
     using Handler = std::function<void(Task&)>;
     addon_value ScheduleOnMainThread(addon_env env, const Handler& handler);
 
+    // Same as ScheduleOnMainThread, but the handler runs on a native worker thread shared by all tasks of its lane.
+    // Use it for long running work that must not block the scripting thread. Handlers of a lane run one at a time, in
+    // order, handlers of different lanes may run at the same time.
+    addon_value ScheduleOnWorkerThread(addon_env env, const Handler& handler, size_t lane = 0);
+
     using ResultHandler = std::function<void(Task&, addon_env env, addon_deferred deferred)>;
     void ScheduleOnScriptingThread(const ResultHandler& resultHandler);
 
@@ -43,6 +49,7 @@ class Task : public std::enable_shared_from_this<Task> {
 
  private:
     friend struct TaskWrapper;
+    addon_value CreatePromise(addon_env env, const Handler& handler);
     void InvokeMainThreadHandler();
     void InvokeScriptingThreadHandler();
 
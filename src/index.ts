@@ -4,14 +4,25 @@ import throttle from 'lodash.throttle';
 import { ActionDescriptor } from 'photoshop/dom/CoreModules';
 import { imaging } from 'photoshop/dom/ImagingModule';
 
-import { WebviewTargetMessage, PluginTargetMessage } from "@api/types/Messages";
+import { WebviewTargetMessage, PluginTargetMessage, PixelEncoding, TileData, TextureCompression } from "@api/types/Messages";
 
 import { photoshop, uxp } from "./lib/globals";
-import Queue from './lib/queue';
 import SettingsManager from './lib/SettingsManager';
 import { notify } from "./api/photoshop";
 
-const BATCH_SIZE = 512 * 512;
+// Time each conversion call may take. The addon measures what converting costs for every document and recommends the
+// band size and fetch throttle that fit, see getPacing.
+const FRAME_BUDGET_MS = 8;
+// postMessage serializes everything to a string. Send changed tiles as compressed deltas against what the webview has,
+// packed two bytes per character.
+const PIXEL_ENCODING: PixelEncoding = "delta";
+// Packed textures are sent per channel, one byte per pixel. There is no delta of them.
+const PACKED_ENCODING: PixelEncoding = "dense";
+// The addon keeps the mip levels of every document and sends the texels under changed tiles, so the webview never
+// regenerates the whole chain after an update.
+const GENERATE_MIPS = true;
+// Photoshop always hands over the full resolution document, the addon resamples it to the preview size itself
+const RESAMPLE_FILTER = "lanczos";
 let addon: any;
 const app = photoshop.app;
 const core = photoshop.core;
@@ -23,12 +34,30 @@ const webview = document.getElementById("panelWebview") as unknown as HTMLWebVie
 
 let settingsManager: SettingsManager;
 let targetSizeScaling = 0.5;
-let updates = new Queue<ImageUpdateData>();
+let hdrPreview = false;
+// How hard the addon works on compressed blocks, "off" sends plain pixels
+let compressionPreset: "off" | "fast" | "balanced" | "high" = "off";
+// The block formats the webview can sample, from its Ready message
+let compressedFormats: TextureCompression[] = [];
+// Whether the pixels last read from each document had alpha, which decides the block format when it is resampled
+let documentHasAlpha = new Map<number, boolean>();
+// Documents the addon converted completely at least once. Their updates are diffed in a single convert_image call.
+let convertedDocuments = new Set<number>();
+// Fetched pixels by the addon job that converts them. The addon decides which job goes next, see processNextUpdate.
+let updates = new Map<number, ImageUpdateData>();
+// The job a band is being converted of, its pixels must stay alive until the conversion is done
+let convertingJob: number | undefined;
+// Documents to bring to a new resolution scale once the queued updates are done, see resampleDocument
+let pendingResamples = new Set<number>();
 let webviewReady = false;
+let processingUpdates = false;
 
-let documentDebouncers = new Map<number, DebouncedFunc<typeof getPixelsAndQueueForProcessing>>();
+// Per document fetch throttle, and the interval it was created with
+let documentDebouncers = new Map<number, {wait: number, fetch: DebouncedFunc<typeof getPixelsAndQueueForProcessing>}>();
 
 let lastActiveDocumentId: number;
+// The document the addon keeps a full copy of for change detection, see pinActiveDocument
+let pinnedDocumentId: number | undefined;
 
 let incorrectModeDocumentIdMessageShown = new Set<number>();
 
@@ -40,19 +69,39 @@ interface CloseDescriptor {
   _isCommand: boolean,
 }
 
+// How the addon brings 16 and 32 bit pixel data down to the texture. "half" keeps linear half floats for HDR preview.
+type Quantization = "blue-noise" | "half";
+
+// The color modes the addon converts to RGBA itself, the components of pixel data are the mode's plus an optional alpha
+type ColorMode = "rgb" | "grayscale" | "lab" | "cmyk";
+
 interface ImageUpdateData {
   documentID: number,
   width: number,
   height: number,
+  // The size the webview previews the document at
+  targetWidth: number,
+  targetHeight: number,
   components: number,
   componentSize: 8 | 16 | 32,
+  colorMode: ColorMode,
+  quantization: Quantization,
+  compression?: TextureCompression,
   pixelData: Uint8Array | Uint16Array | Float32Array;
   imagingData: imaging.PhotoshopImageData;
-  totalPixels: number,
-  pixelsPushed: number,
   forceFullUpdate: boolean,
 }
 
+// A band of tile rows of a job to convert, as handed out by the addon's next_band
+interface JobBand {
+  job: number,
+  document_id: number,
+  first_tile_row: number,
+  tile_rows: number,
+  // The band ends the job, the addon doesn't hand out any more of it
+  last: boolean,
+}
+
 
 init();
 
@@ -118,25 +167,37 @@ function init()
 }
 
 /**
- * Enter idle state, wherein we take no action when image data changes. This also sets a delay before clearing the image data cache in the C++ code
+ * Enter idle state, wherein we take no action when image data changes. This also sets a delay before the image data
+ * cache in the C++ code is hibernated to the plugin data folder, which frees its memory while keeping what the webview
+ * has so reopening only sends what changed in the meantime.
  */
 function enterIdle() {
   idle = true;
   setTimeout(async () => {
-    if (!addon) {
-      addon = await require("bolt-uxp-hybrid.uxpaddon");
+    if (!idle) return;
+    try {
+      if (!addon) {
+        addon = await require("bolt-uxp-hybrid.uxpaddon");
+      }
+      console.log("Hibernating C++ cache");
+      let dataFolder = await uxp.storage.localFileSystem.getDataFolder();
+      // The caches are written out on a native worker thread, the panel stays responsive meanwhile
+      await addon.hibernate_async(dataFolder.nativePath);
+    } catch (err) {
+      // Can't spill to disk, free the caches like before. The addon itself may have failed to load.
+      console.log("Hibernating failed", err);
+      addon?.trim("background");
     }
-    console.log("Clearing C++ cache");
-    app.documents.forEach((doc) => {
-      addon.close_document(doc.id);
-    })
   }, 30000);
 }
 
 function exitIdle() {
   idle = false;
   updateDocument();
-  pushAllUpdates();
+  // The addon still knows what the webview has, hibernated or not, so only changed tiles are sent
+  app.documents.forEach(document => {
+    handleImageChanged(document.id);
+  });
 }
 
 function pushAllUpdates() {
@@ -154,6 +215,7 @@ function handleMessage(event: MessageEvent<PluginTargetMessage>) {
   
   if (data.type === "Ready") {
     webviewReady = true;
+    compressedFormats = data.compressedFormats ?? [];
 
     // This sends settings the user has saved, or the defaults so the UI is in sync
     postToWebview({type: "PUSH_SETTINGS", settings: settingsManager.getSettings()});
@@ -165,13 +227,39 @@ function handleMessage(event: MessageEvent<PluginTargetMessage>) {
     // This is generally when a new model is loaded and new texture data is needed.
     pushAllUpdates();
   }
+  else if (data.type === "VisibleDocuments") {
+    // Documents on a material in the viewport are converted before other background documents
+    if (addon) {
+      addon.set_visible_documents(data.documentIDs);
+    }
+  }
+  else if (data.type === "PackChannel") {
+    if (addon) {
+      packChannel(data.packedTextureID, data.channel, data.documentID);
+    }
+  }
+  else if (data.type === "RemovePackedTexture") {
+    if (addon) {
+      addon.remove_packed_texture(data.packedTextureID);
+    }
+  }
   else if (data.type === "UpdateSettings") {
     let newSettings = data.settings;
     settingsManager.updateSettings(newSettings);
 
-    if (!approximatelyEqual(newSettings.displaySettings.textureResolutionScale, targetSizeScaling)) {
-      targetSizeScaling = newSettings.displaySettings.textureResolutionScale;
+    let newHdrPreview = newSettings.displaySettings.hdrPreview ?? false;
+    let newCompressionPreset = newSettings.displaySettings.textureCompression ?? "off";
+    let scaleChanged = !approximatelyEqual(newSettings.displaySettings.textureResolutionScale, targetSizeScaling);
+    let compressionChanged = newCompressionPreset != compressionPreset;
+    targetSizeScaling = newSettings.displaySettings.textureResolutionScale;
+    compressionPreset = newCompressionPreset;
+    if (newHdrPreview != hdrPreview) {
+      // The addon caches pixels in another format for HDR preview, they have to be fetched again
+      hdrPreview = newHdrPreview;
       pushAllUpdates();
+    } else if (scaleChanged || compressionChanged) {
+      // The addon still has every document at full resolution, no need to ask Photoshop for them again
+      app.documents.forEach(document => pendingResamples.add(document.id));
     }
   } else {
     console.error("Received Unknown Message:" + data);
@@ -191,14 +279,20 @@ async function handleImageChanged(documentID: number, forceFullUpdate: boolean =
   }
   if (forceFullUpdate) return getPixelsAndQueueForProcessing(documentID, forceFullUpdate); 
 
-  // Use throttle to keep PS performance up and prevent the webview from being spammed by too many texture updates
-  if (!documentDebouncers.has(documentID)) {
-    documentDebouncers.set(documentID, throttle(getPixelsAndQueueForProcessing, 1000, {trailing: true, leading: true}));
+  // Use throttle to keep PS performance up and prevent the webview from being spammed by too many texture updates.
+  // The interval follows what the addon measured for the document, the throttle is only recreated when it moved a lot.
+  if (addon) {
+    addon.note_edit(documentID);
+  }
+  let wait = getPacing(documentID).throttle_ms;
+  let debouncer = documentDebouncers.get(documentID);
+  if (!debouncer || Math.abs(debouncer.wait - wait) > debouncer.wait * 0.25) {
+    debouncer?.fetch.cancel();
+    debouncer = {wait, fetch: throttle(getPixelsAndQueueForProcessing, wait, {trailing: true, leading: true})};
+    documentDebouncers.set(documentID, debouncer);
   }
   
-  let debouncedFunc = documentDebouncers.get(documentID)!;
-  
-  return debouncedFunc(documentID, forceFullUpdate);
+  return debouncer.fetch(documentID, forceFullUpdate);
 }
 
 /**
@@ -211,22 +305,25 @@ async function getPixelsAndQueueForProcessing(documentID: number, forceFullUpdat
 {
     try {
         console.log("queuing data for " + documentID);
+        if (!addon) {
+          addon = await require("bolt-uxp-hybrid.uxpaddon");
+        }
+
         let document = app.documents.find((doc) => doc.id == documentID);
         if (!document) {
           return Promise.resolve();
         }
 
-        if (document.mode != "RGBColorMode") {
+        // Indexed, bitmap and the other modes are left to the user to convert, see updateDocument
+        let colorMode = colorModeFor(document.mode);
+        if (!colorMode) {
           return Promise.resolve();
         }
 
-        // Apply user settings for texture downscaling.
-        let targetSize = {
-          width: Math.round(document.width * targetSizeScaling),
-          height: Math.round(document.height * targetSizeScaling)
-        };
+        // Deep documents are read at their own bit depth, the addon quantizes them much faster than Photoshop down-converts
+        let bitDepth = document.bitsPerChannel == "bitDepth32" ? 32 : document.bitsPerChannel == "bitDepth16" ? 16 : 8;
 
-        let getPixelsResult = await executeAsModal((ctx,d) => imagingApi.getPixels({documentID: documentID, componentSize: 8, targetSize}), {commandName: "Updating Texture Data", interactive: true});
+        let getPixelsResult = await executeAsModal((ctx,d) => imagingApi.getPixels({documentID: documentID, componentSize: bitDepth}), {commandName: "Updating Texture Data", interactive: true});
         
         let { width, height, components, componentSize } = getPixelsResult.imageData;
         let imagingData = getPixelsResult.imageData;
@@ -236,16 +333,29 @@ async function getPixelsAndQueueForProcessing(documentID: number, forceFullUpdat
         // which we can do ourselves in the C++ code
         var pixelData = await imagingData.getData({chunky: (imagingData as any).isChunky});
       
-        updates.enqueue({
+        // Apply user settings for texture downscaling, the addon resamples the full resolution pixels
+        let target = targetSize(width, height);
+        let quantization = quantizationFor(componentSize);
+        let hasAlpha = components > colorComponents(colorMode);
+        documentHasAlpha.set(documentID, hasAlpha);
+
+        // The addon queues the job behind more urgent ones, e.g. a full push of a background document goes after
+        // edits of the active document. It supersedes the document's older job, whose pixels are stale now.
+        let job = addon.queue_job(documentID, width, height, forceFullUpdate);
+        dropUpdates(documentID);
+        updates.set(job, {
           documentID, 
           width,
           height,
+          targetWidth: target.width,
+          targetHeight: target.height,
           components,
           componentSize,
+          colorMode,
+          quantization,
+          compression: compressionFor(hasAlpha, quantization),
           pixelData,
           imagingData,
-          pixelsPushed: 0,
-          totalPixels: width * height,
           forceFullUpdate,
         });
     }
@@ -259,85 +369,353 @@ async function getPixelsAndQueueForProcessing(documentID: number, forceFullUpdat
     }
 }
 
+/**
+ * How many pixels to convert per call and how often to fetch a document, as recommended by the addon. Until the addon
+ * is loaded the plugin's old constants are used.
+ */
+function getPacing(documentID: number): {batch_pixels: number, throttle_ms: number} {
+  if (!addon) {
+    return {batch_pixels: 512 * 512, throttle_ms: 1000};
+  }
+  return addon.get_pacing(documentID, FRAME_BUDGET_MS);
+}
+
+/**
+ * The size a document is previewed at with the current resolution scale
+ */
+function targetSize(width: number, height: number) {
+  return {
+    width: Math.max(1, Math.round(width * targetSizeScaling)),
+    height: Math.max(1, Math.round(height * targetSizeScaling)),
+  };
+}
+
+/**
+ * The addon's name for a Photoshop document mode, undefined for the modes it can't convert
+ */
+function colorModeFor(mode: string): ColorMode | undefined {
+  switch (mode) {
+    case "RGBColorMode": return "rgb";
+    case "grayscaleMode": return "grayscale";
+    case "labColorMode": return "lab";
+    case "CMYKColorMode": return "cmyk";
+    default: return undefined;
+  }
+}
+
+function colorComponents(colorMode: ColorMode): number {
+  return colorMode == "grayscale" ? 1 : colorMode == "cmyk" ? 4 : 3;
+}
+
+function quantizationFor(componentSize: number): Quantization {
+  return hdrPreview && componentSize != 8 ? "half" : "blue-noise";
+}
+
+/**
+ * The block format a document's texture is sent in with the current compression preset, if any. Only 8 bit textures
+ * are compressed. BC7 is slower to encode but looks better, it's used for the quality preset when the webview has it.
+ */
+function compressionFor(hasAlpha: boolean, quantization: Quantization): TextureCompression | undefined {
+  if (compressionPreset == "off" || quantization == "half") {
+    return undefined;
+  }
+
+  if (compressedFormats.includes("bc7") && (compressionPreset == "high" || !compressedFormats.includes("bc1"))) {
+    return "bc7";
+  }
+
+  let format: TextureCompression = hasAlpha ? "bc3" : "bc1";
+  return compressedFormats.includes(format) ? format : undefined;
+}
+
 /**
  * Check if any pixel update data is queued up. If it is, pick off a batch to transform for the webview, and send the transformed batch result to the webview. 
  */
 async function processUpdates() {
-  if (!webviewReady) return;
+  // Conversions run on the addon's worker thread, so the interval can fire again while one is still awaited
+  if (!webviewReady || processingUpdates) return;
+  processingUpdates = true;
+  try {
+    await processNextUpdate();
+  } finally {
+    processingUpdates = false;
+  }
+}
 
+async function processNextUpdate() {
   if (lastActiveDocumentId != app.activeDocument.id) {
     updateDocument();
   }
 
 
-  let nextUpdate = updates.peek();
-  if (nextUpdate) {
-    let updateSent = false;
-    while (!updateSent) {
-      updateSent = await convertPixelDataToString(nextUpdate);
+  if (updates.size == 0) {
+    if (pendingResamples.size > 0) {
+      let documentID = pendingResamples.values().next().value as number;
+      pendingResamples.delete(documentID);
+      await resampleDocument(documentID);
+    }
+    return;
+  }
+
+  // The addon hands out one band at a time, from the most urgent job. An edit of the active document queued meanwhile
+  // gets the next band, the job it preempted carries on from where it stopped afterwards.
+  let updateSent = false;
+  while (!updateSent) {
+    let band: JobBand | undefined = addon.next_band(FRAME_BUDGET_MS);
+    if (!band) {
+      return;
+    }
+
+    const update = updates.get(band.job);
+    if (!update) {
+      addon.finish_job(band.job);
+      continue;
+    }
 
-      if (nextUpdate.pixelsPushed >= nextUpdate.totalPixels) {
-        if (!app.documents.find((d) => nextUpdate.documentID == d.id)) {
-          // Reaffirm that we've closed all the resources in case any snuck through the end of the queue (unlikely)
-          onClose(null, {documentID: nextUpdate.documentID, _isCommand: true}); 
-        }
+    let jobDone = false;
+    convertingJob = band.job;
+    [updateSent, jobDone] = await convertPixelDataToTiles(update, band);
+    convertingJob = undefined;
+    if (updateSent) {
+      postPackedUpdates();
+    }
+
+    // The update is dropped meanwhile when a newer snapshot of the document superseded it, or the document was closed
+    const dropped = !updates.has(band.job);
+    const closed = !app.documents.find((d) => update.documentID == d.id);
+    if (band.last || jobDone || dropped || closed) {
+      if (!band.last) {
+        addon.finish_job(band.job);
+      }
+      update.imagingData.dispose();
+      updates.delete(band.job);
 
-        nextUpdate.imagingData.dispose();
-        updates.dequeue();
-        break;
+      if (closed) {
+        // Reaffirm that we've closed all the resources in case any snuck through the end of the queue (unlikely)
+        onClose(null, {documentID: update.documentID, _isCommand: true}); 
       }
     }
   }
 }
 
 /**
- * Call into the C++ hybrid code to convert the array buffer data into a string. and optionally send that data to the webview. 
- * The c++ code will compare against cached image data to determine if sending an update to the webview is actually necessary.
+ * Forget the fetched pixels of a document whose job the addon dropped. The update being converted is disposed by
+ * processNextUpdate once its band is done.
+ */
+function dropUpdates(documentID: number) {
+  updates.forEach((update, job) => {
+    if (update.documentID == documentID) {
+      if (job != convertingJob) {
+        update.imagingData.dispose();
+      }
+      updates.delete(job);
+    }
+  });
+}
+
+/**
+ * Call into the C++ hybrid code to convert a band of tile rows from the array buffer data into strings, and optionally send that data to the webview. 
+ * The c++ code splits the image into square tiles and compares each against cached image data, only the rectangles of tiles which changed are returned.
+ * Once the addon has a document, the whole image is diffed in one call instead. An edit usually changes a small part
+ * of it, and an unchanged document then costs a single crossing instead of one per band.
  * 
  * The data being transformed into a string is necessary because postMessage to the webview always serializes the data to a string, 
  * so the string is made in C++ to do it faster than JS.
  * 
  * C++ is also faster at the cache comparison and converting planar-formatted data into chunky formatted data which three.js expects. 
  * 
- * @param update an object which contains the arraybuffer of pixel data along with batch sizing metadata
- * @returns a Promise which resolves to true if a transformed pixel data string was created.
+ * @param update an object which contains the arraybuffer of pixel data along with its format
+ * @param band the tile rows of the update to convert, sized by the addon to stay within the frame budget
+ * @returns a Promise which resolves to whether any changed tiles were sent, and whether the whole update was done.
  */
-async function convertPixelDataToString(update: ImageUpdateData): Promise<boolean> {
+async function convertPixelDataToTiles(update: ImageUpdateData, band: JobBand): Promise<[boolean, boolean]> {
   try {
     if (!addon) {
       addon = await require("bolt-uxp-hybrid.uxpaddon");
     }
 
-    const nextBatchSize = Math.min(BATCH_SIZE, update.totalPixels - update.pixelsPushed);
+    const options = {
+      document_id: update.documentID,
+      width: update.width,
+      height: update.height,
+      components: update.components,
+      is_chunky: (update.imagingData as any).isChunky,
+      force_full_update: update.forceFullUpdate,
+      output: PIXEL_ENCODING,
+      component_size: update.componentSize,
+      quantization: update.quantization,
+      generate_mips: GENERATE_MIPS,
+      target_width: update.targetWidth,
+      target_height: update.targetHeight,
+      filter: RESAMPLE_FILTER,
+      compression: update.compression,
+      compression_quality: compressionPreset,
+      generation: band.job,
+      color_mode: update.colorMode,
+    };
+
+    if (band.first_tile_row == 0 && !update.forceFullUpdate && convertedDocuments.has(update.documentID)) {
+      const result = await addon.convert_image_async(update.pixelData.buffer, options);
+
+      if (!result) {
+        return [false, true];
+      }
+
+      postTiles(update.documentID, update.targetWidth, update.targetHeight, update.quantization, update.compression, result);
+      return [true, true];
+    }
+
+    // Diffing and converting happen on a native worker thread, the panel stays responsive while it runs.
+    // The pixel buffer must stay alive until the promise settles, imagingData is only disposed after the last band.
+    // With the job as generation, the addon skips the band if a newer snapshot of the document was queued meanwhile.
+    const result = await addon.convert_tiles_async(update.pixelData.buffer, {
+      ...options,
+      first_tile_row: band.first_tile_row,
+      tile_rows: band.tile_rows,
+    });
     
-    const result = addon.convert_to_string(
-      update.pixelData.buffer, update.documentID, update.components, 
-      (update.imagingData as any).isChunky, update.pixelsPushed, nextBatchSize, update.forceFullUpdate
+    if (band.last) {
+      convertedDocuments.add(update.documentID);
+    }
+
+    if (!result) {
+      return [false, false];
+    }
+
+    postTiles(update.documentID, update.targetWidth, update.targetHeight, update.quantization, update.compression, result);
+
+    return [true, false];
+  } catch (err) {
+      console.log("Command failed", err);
+  }
+  // The rest of the update would fail the same way
+  return [false, true];
+}
+
+/**
+ * Bring a document to the current resolution scale. The addon resamples the full resolution pixels it already has
+ * and returns the whole texture at the new size, only when it has none are they fetched from Photoshop again.
+ */
+async function resampleDocument(documentID: number): Promise<void> {
+  try {
+    if (!addon) {
+      addon = await require("bolt-uxp-hybrid.uxpaddon");
+    }
+
+    let document = app.documents.find((doc) => doc.id == documentID);
+    if (!document) {
+      return;
+    }
+
+    let target = targetSize(document.width, document.height);
+    let bitDepth = document.bitsPerChannel == "bitDepth32" ? 32 : document.bitsPerChannel == "bitDepth16" ? 16 : 8;
+    let quantization = quantizationFor(bitDepth);
+    let compression = compressionFor(documentHasAlpha.get(documentID) ?? true, quantization);
+    const result = await addon.resample_document_async(
+      documentID, target.width, target.height, PIXEL_ENCODING, RESAMPLE_FILTER, GENERATE_MIPS, compression, compressionPreset
     );
-    
-    if (!update.forceFullUpdate && !result) {
-      update.pixelsPushed += nextBatchSize;  
-      return false;
+
+    if (!result) {
+      handleImageChanged(documentID, true);
+      return;
     }
 
+    postTiles(documentID, target.width, target.height, quantization, compression, result);
+  } catch (err) {
+      console.log("Command failed", err);
+  }
+}
 
-    postToWebview({
-      type: "PARTIAL_UPDATE",
-      documentID: update.documentID, 
-      width: update.width, 
-      height: update.height, 
-      componentSize: update.componentSize,
-      pixelBatchOffset: update.pixelsPushed,
-      pixelBatchSize: nextBatchSize,
-      pixelString: result
+/**
+ * Send the tiles convert_tiles, convert_image or resample_document returned to the webview. Results covering more
+ * than a batch of pixels are split into several messages, so no single message gets huge.
+ */
+function postTiles(documentID: number, width: number, height: number, quantization: Quantization,
+                   compression: TextureCompression | undefined, result: any[]) {
+  const batchPixels = getPacing(documentID).batch_pixels;
+  let tiles: TileData[] = [];
+  let pixels = 0;
+  for (const tile of result) {
+    tiles.push({
+      level: tile.level,
+      x: tile.x,
+      y: tile.y,
+      width: tile.width,
+      height: tile.height,
+      pixelString: tile.pixels,
     });
+    pixels += tile.width * tile.height;
+
+    if (pixels >= batchPixels) {
+      postTileMessage(documentID, width, height, quantization, compression, tiles);
+      tiles = [];
+      pixels = 0;
+    }
+  }
 
-    update.pixelsPushed += nextBatchSize;  
-    return true;
+  if (tiles.length > 0) {
+    postTileMessage(documentID, width, height, quantization, compression, tiles);
+  }
+}
+
+function postTileMessage(documentID: number, width: number, height: number, quantization: Quantization,
+                         compression: TextureCompression | undefined, tiles: TileData[]) {
+  postToWebview({
+    type: "TILE_UPDATE",
+    documentID, 
+    width, 
+    height, 
+    // Quantized pixels are RGBA8 whatever the document depth, half float pixels take 16 bits per component
+    componentSize: quantization == "half" ? 16 : 8,
+    encoding: PIXEL_ENCODING,
+    compression,
+    tiles,
+  });
+}
+
+
+/**
+ * Feed a channel of a packed texture with a document. The addon fills the channel from what it has of the document,
+ * when it doesn't have all of it the document is pushed in full once.
+ */
+async function packChannel(packedTextureID: number, channel: number, documentID: number) {
+  try {
+    if (!(await addon.set_packed_channel(packedTextureID, channel, documentID))) {
+      handleImageChanged(documentID, true);
+    }
+    postPackedUpdates();
   } catch (err) {
-      console.log("Command failed", err);
+    console.log("Command failed", err);
+  }
+}
+
+/**
+ * Send the channels of packed textures that changed, see set_packed_channel. A document feeding a channel only sends
+ * the tiles of that channel which changed, one byte per pixel.
+ */
+function postPackedUpdates() {
+  const result = addon.take_packed_updates(PACKED_ENCODING);
+  if (!result) {
+    return;
+  }
+
+  for (const packed of result) {
+    postToWebview({
+      type: "PACKED_UPDATE",
+      packedTextureID: packed.packed_texture,
+      width: packed.width,
+      height: packed.height,
+      encoding: PACKED_ENCODING,
+      tiles: packed.tiles.map((tile: any) => ({
+        channel: tile.channel,
+        x: tile.x,
+        y: tile.y,
+        width: tile.width,
+        height: tile.height,
+        pixelString: tile.pixels,
+      })),
+    });
   }
-  return false;
 }
 
 
@@ -354,7 +732,15 @@ async function onClose(event: string | null, descriptor: ActionDescriptor | Clos
       addon = await require("bolt-uxp-hybrid.uxpaddon");
     }
 
+    // The addon drops the document's queued job, the pixels fetched for it can go
     addon.close_document(descriptor.documentID);
+    // Channels the document fed go back to white
+    postPackedUpdates();
+    dropUpdates(descriptor.documentID);
+    convertedDocuments.delete(descriptor.documentID);
+    documentDebouncers.get(descriptor.documentID)?.fetch.cancel();
+    documentDebouncers.delete(descriptor.documentID);
+    documentHasAlpha.delete(descriptor.documentID);
     postToWebview({type: "DOCUMENT_CLOSED", documentID: descriptor.documentID});
     
     updateDocument();
@@ -364,7 +750,7 @@ async function onClose(event: string | null, descriptor: ActionDescriptor | Clos
 }
 
 function onColorModeChanged(event: string, descriptor: ActionDescriptor) {
-  if (descriptor.to._class ==="RGBColorMode") {
+  if (colorModeFor(descriptor.to._class)) {
     incorrectModeDocumentIdMessageShown.delete(app.activeDocument.id);
   }
   updateDocument();
@@ -376,17 +762,39 @@ function updateDocument() {
   let id = app.activeDocument.id;
 
   let document = app.documents.find((doc) => doc.id == id);
-  if (document && document.mode != "RGBColorMode" && !incorrectModeDocumentIdMessageShown.has(id)) {
-    notify("3D Preview: Non-RGB Color Modes are not supported at this time. Modify the color mode in Image > Mode > RGB Color.");
+  if (document && !colorModeFor(document.mode) && !incorrectModeDocumentIdMessageShown.has(id)) {
+    notify("3D Preview: Bitmap, Indexed, Duotone and Multichannel Color Modes are not supported at this time. Modify the color mode in Image > Mode > RGB Color.");
     incorrectModeDocumentIdMessageShown.add(id);
     return;
   }
 
   lastActiveDocumentId = app.activeDocument.id;
+  pinActiveDocument(lastActiveDocumentId);
 
   postToWebview({type: "DOCUMENT_CHANGED", documentID: app.activeDocument.id});
 }
 
+/**
+ * Keep the active document cached in the addon whatever the other documents take. Past its memory budget the addon
+ * evicts the least recently used background documents, they are pushed in full again when they next change.
+ * Background documents are rarely edited, so the addon only keeps tile hashes to detect their changes.
+ */
+async function pinActiveDocument(documentID: number) {
+  try {
+    if (!addon) {
+      addon = await require("bolt-uxp-hybrid.uxpaddon");
+    }
+    addon.set_active_document(documentID);
+    if (pinnedDocumentId !== undefined && pinnedDocumentId != documentID && app.documents.some((doc) => doc.id == pinnedDocumentId)) {
+      await addon.set_change_detection(pinnedDocumentId, "hash");
+    }
+    await addon.set_change_detection(documentID, "full");
+    pinnedDocumentId = documentID;
+  } catch (err) {
+      console.log("Command failed", err);
+  }
+}
+
 function postToWebview(msg: WebviewTargetMessage) {
   webview.postMessage(msg, "*", null);
 }
@@ -21,6 +21,14 @@ export function isUserSettings(obj: unknown): obj is UserSettings {
             typeof typedObj["displaySettings"] === "function") &&
         typeof typedObj["displaySettings"]["cameraFOV"] === "number" &&
         typeof typedObj["displaySettings"]["textureResolutionScale"] === "number" &&
+        (typeof typedObj["displaySettings"]["hdrPreview"] === "undefined" ||
+            typedObj["displaySettings"]["hdrPreview"] === false ||
+            typedObj["displaySettings"]["hdrPreview"] === true) &&
+        (typeof typedObj["displaySettings"]["textureCompression"] === "undefined" ||
+            typedObj["displaySettings"]["textureCompression"] === "off" ||
+            typedObj["displaySettings"]["textureCompression"] === "fast" ||
+            typedObj["displaySettings"]["textureCompression"] === "balanced" ||
+            typedObj["displaySettings"]["textureCompression"] === "high") &&
         (typedObj["controlsSettings"] !== null &&
             typeof typedObj["controlsSettings"] === "object" ||
             typeof typedObj["controlsSettings"] === "function") &&
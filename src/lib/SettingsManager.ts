@@ -15,6 +15,8 @@ const defaultUserSettings: UserSettings  = {
   displaySettings: {
     cameraFOV: 75,
     textureResolutionScale: 1.0,
+    hdrPreview: false,
+    textureCompression: "off",
   },
   controlsSettings: {
     scheme: ControlSchemeType.PHOTOSHOP
@@ -12,6 +12,9 @@ interface ContextMenuProps {
 enum CONTEXT_MENU_CHOICE  {
   FOCUS = "FOCUS",
   APPLY = "APPLY",
+  APPLY_OCCLUSION = "APPLY_OCCLUSION",
+  APPLY_ROUGHNESS = "APPLY_ROUGHNESS",
+  APPLY_METALNESS = "APPLY_METALNESS",
   NOOBJECT = "NOOBJECT",
 }
 
@@ -59,6 +62,9 @@ export default function ContextMenu(props: ContextMenuProps) {
           <ListboxItem key={CONTEXT_MENU_CHOICE.NOOBJECT}>No Object Selected</ListboxItem>
         ) : ([
           <ListboxItem key={CONTEXT_MENU_CHOICE.APPLY}>Apply Active Document</ListboxItem>,
+          <ListboxItem key={CONTEXT_MENU_CHOICE.APPLY_OCCLUSION}>Apply Active Document as Occlusion</ListboxItem>,
+          <ListboxItem key={CONTEXT_MENU_CHOICE.APPLY_ROUGHNESS}>Apply Active Document as Roughness</ListboxItem>,
+          <ListboxItem key={CONTEXT_MENU_CHOICE.APPLY_METALNESS}>Apply Active Document as Metalness</ListboxItem>,
           <ListboxItem key={CONTEXT_MENU_CHOICE.FOCUS}>Focus</ListboxItem>
         ])}
       </Listbox>
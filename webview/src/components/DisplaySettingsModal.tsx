@@ -1,6 +1,8 @@
 import React, { useState } from "react";
 import { DisplaySettings } from "@api/types/Settings";
-import { Button, ModalHeader, ModalBody, ModalFooter, Slider } from "@nextui-org/react";
+import { Button, ModalHeader, ModalBody, ModalFooter, Slider, Checkbox, Tabs, Tab } from "@nextui-org/react";
+
+type TextureCompression = NonNullable<DisplaySettings["textureCompression"]>;
 
 
 export default function DisplaySettingsModal({displaySettings, onClose}: {displaySettings: DisplaySettings, onClose: ((val: DisplaySettings) => void)}) {
@@ -8,6 +10,8 @@ export default function DisplaySettingsModal({displaySettings, onClose}: {displa
 
   const [cameraFOV, setFOV] = useState<number>(displaySettings.cameraFOV);
   const [textureResolutionScale, setTextureResolutionScale] = useState<number>(pctScale);
+  const [hdrPreview, setHdrPreview] = useState<boolean>(displaySettings.hdrPreview ?? false);
+  const [textureCompression, setTextureCompression] = useState<TextureCompression>(displaySettings.textureCompression ?? "off");
 
   return (
     <>
@@ -52,10 +56,36 @@ export default function DisplaySettingsModal({displaySettings, onClose}: {displa
             },
           ]}
         />
+        <div className="flex py-2 px-1 justify-between max-w-sm w-full">
+          <Checkbox
+            size="sm"
+            onValueChange={setHdrPreview}
+            classNames={{
+              label: "text-small",
+            }}
+            isSelected={hdrPreview}
+          >
+            HDR Preview for 16 and 32 bit documents
+          </Checkbox>
+        </div>
+        <div className="flex flex-col gap-1 py-2 px-1 max-w-sm w-full">
+          <span className="text-small">GPU Texture Compression</span>
+          <Tabs
+            fullWidth
+            size="sm"
+            selectedKey={textureCompression}
+            onSelectionChange={(key: any) => setTextureCompression(key as TextureCompression)}
+          >
+            <Tab key="off" title="Off" />
+            <Tab key="fast" title="Fast" />
+            <Tab key="balanced" title="Balanced" />
+            <Tab key="high" title="Quality" />
+          </Tabs>
+        </div>
       </ModalBody>
       <ModalFooter>
         <Button size="sm" radius="sm" color="primary" onPress={(_event) => {
-            onClose({cameraFOV, textureResolutionScale:  textureResolutionScale / 100});
+            onClose({cameraFOV, textureResolutionScale:  textureResolutionScale / 100, hdrPreview, textureCompression});
           }
         }>
           Confirm
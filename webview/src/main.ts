@@ -9,8 +9,8 @@ import { OrbitControls } from 'three/addons/controls/OrbitControls.js';
 import {Tween} from '@tweenjs/tween.js'
 
 import { ControlScheme, ControlSchemeType, InputCombination, MouseButton, UserSettings } from "@api/types/Settings";
-import { DocumentClosed, PartialUpdate, PluginTargetMessage, WebviewTargetMessage } from "@api/types/Messages";
-import { BuiltInSchemes } from "./util/util.ts"
+import { DocumentClosed, PackedUpdate, PartialUpdate, PluginTargetMessage, TextureCompression, TileData, TileUpdate, WebviewTargetMessage } from "@api/types/Messages";
+import { BuiltInSchemes, decodePixelString } from "./util/util.ts"
 import ResourceManager from './util/ResourceManager.ts';
 import { ViewportGizmo } from './three-viewport-gizmo/ViewportGizmo.ts';
 
@@ -69,6 +69,11 @@ let boxSelectionHappening: boolean = false;
 
 let flipY = true;
 
+// Ids of the packed textures, one per material that has occlusion, roughness or metalness from documents
+let nextPackedTextureID = 1;
+// The maps of MeshStandardMaterial a packed texture's R, G and B are sampled as, the same as an ORM texture
+const packedChannelMaps = ["aoMap", "roughnessMap", "metalnessMap"] as const;
+
 const raycaster = new THREE.Raycaster();
 const cameraInitialPosition = new THREE.Vector3( 3, 3.5, 2 );
 
@@ -142,6 +147,7 @@ function init() {
   selectionHelper.enabled = false;
 
   resourceManager = new ResourceManager(scene);
+  resourceManager.onPackedTextureRemoved = (packedTextureID) => postPluginMessage({type: "RemovePackedTexture", packedTextureID});
 
   window.addEventListener("message", onMessageReceived);
   window.addEventListener("resize", onWindowResize);
@@ -153,8 +159,22 @@ function init() {
 
   onWindowResize();
 
-  // Let UXP plugin know we're ready to receive document texture data
-  postPluginMessage({type: "Ready"});
+  // Let UXP plugin know we're ready to receive document texture data, and in which compressed formats
+  postPluginMessage({type: "Ready", compressedFormats: supportedCompressedFormats()});
+}
+
+/**
+ * The block formats document textures can be sent in. Only the sRGB variants are any use, the pixels are sRGB encoded.
+ */
+function supportedCompressedFormats(): TextureCompression[] {
+  let formats: TextureCompression[] = [];
+  if (renderer.extensions.has("WEBGL_compressed_texture_s3tc_srgb")) {
+    formats.push("bc1", "bc3");
+  }
+  if (renderer.extensions.has("EXT_texture_compression_bptc")) {
+    formats.push("bc7");
+  }
+  return formats;
 }
 
 // Called each frame.
@@ -175,11 +195,20 @@ function postPluginMessage(data: PluginTargetMessage) {
   window.uxpHost.postMessage(data);
 }
 
+// Let the plugin convert the documents on screen before other background documents
+function postVisibleDocuments() {
+  postPluginMessage({type: "VisibleDocuments", documentIDs: resourceManager.getVisibleDocumentIds()});
+}
+
 //#region Plugin Message Handlers
 function onMessageReceived(event: MessageEvent<WebviewTargetMessage>) {
   let data = event.data;
   if (data.type == "PARTIAL_UPDATE") {
     handleUpdate(data);
+  } else if (data.type == "TILE_UPDATE") {
+    handleTileUpdate(data);
+  } else if (data.type == "PACKED_UPDATE") {
+    handlePackedUpdate(data);
   } else if (data.type == "DOCUMENT_CHANGED") {
     activeDocument = data.documentID;
   } else if (data.type == "DOCUMENT_CLOSED") {
@@ -203,46 +232,295 @@ function handleUpdate(data: PartialUpdate) {
 
   let pixelDataLength = 4 * width * height;
   let pixelStringStartIndex = data.pixelBatchOffset * 4;
-  let pixelStringEndIndex = pixelStringStartIndex + data.pixelBatchSize * 4;
 
 
   let texture = resourceManager.getTextureForDocumentId(documentID);
 
-  if (!texture || texture.image.width != width || texture.image.height != height) {
+  if (!texture || texture.image.width != width || texture.image.height != height || texture.type != THREE.UnsignedByteType ||
+    (texture as THREE.CompressedTexture).isCompressedTexture) {
+    // Starts out all 0, only the batch is filled in
     pixelData = new Uint8Array(pixelDataLength);
+    decodePixelString(data.pixelString, data.encoding, pixelData, pixelStringStartIndex);
+
+    texture = createDocumentTexture(pixelData, width, height);
+    
+    resourceManager.setDocumentTexture(documentID, texture);
+  } else {
+    pixelData = texture.image.data as Uint8Array;
+    decodePixelString(data.pixelString, data.encoding, pixelData, pixelStringStartIndex);
+  }
 
-    for (let i = 0; i < pixelStringStartIndex; i++) {
-      pixelData[i] = 0;
+  texture.needsUpdate = true;
+}
+
+/**
+ * Create a texture for a document with the settings used for all document textures.
+ * RGBA8 pixels are sRGB encoded, half float pixels (HDR preview of 16 and 32 bit documents) are linear.
+ * With mipmapped, the texture gets a complete mip chain of empty levels that the hybrid module fills in, instead of
+ * having the driver regenerate every level on each update.
+ */
+function createDocumentTexture(pixelData: Uint8Array | Uint16Array, width: number, height: number, mipmapped: boolean = false): THREE.DataTexture {
+  let half = pixelData instanceof Uint16Array;
+  let texture = new THREE.DataTexture(pixelData, width, height, THREE.RGBAFormat, half ? THREE.HalfFloatType : THREE.UnsignedByteType);
+  texture.flipY = flipY;
+  texture.wrapS = texture.wrapT = THREE.RepeatWrapping;
+  texture.anisotropy = renderer.capabilities.getMaxAnisotropy();
+  texture.colorSpace = half ? THREE.LinearSRGBColorSpace : THREE.SRGBColorSpace;
+  texture.magFilter = texture.minFilter = THREE.LinearFilter;
+
+  if (mipmapped) {
+    // Same sizes as the hybrid module's MipPyramid: halved and rounded down until 1x1
+    texture.mipmaps = [{data: pixelData, width, height}];
+    let levelWidth = width;
+    let levelHeight = height;
+    while (levelWidth > 1 || levelHeight > 1) {
+      levelWidth = Math.max(1, Math.floor(levelWidth / 2));
+      levelHeight = Math.max(1, Math.floor(levelHeight / 2));
+      let length = 4 * levelWidth * levelHeight;
+      texture.mipmaps.push({data: half ? new Uint16Array(length) : new Uint8Array(length), width: levelWidth, height: levelHeight});
     }
-    for (let i = pixelStringStartIndex; i < pixelStringEndIndex; i++) {
-      pixelData[i] = data.pixelString.charCodeAt(i - pixelStringStartIndex);
+    texture.generateMipmaps = false;
+    texture.minFilter = THREE.LinearMipmapLinearFilter;
+  }
+  return texture;
+}
+
+/**
+ * Write the changed tiles into the document texture. A new texture is uploaded in full, an existing texture only 
+ * has the changed rectangles copied to the GPU instead of re-uploading the whole image.
+ * Tiles with a level are texels of that mip level, which the hybrid module keeps up to date alongside the document.
+ * Pixels are RGBA8 for a componentSize of 8 and RGBA half floats for 16, tiles are decoded byte for byte either way.
+ * @param data object containing the changed rectangles + associated metadata
+ */
+function handleTileUpdate(data: TileUpdate) {
+  if (data.compression) {
+    handleCompressedTileUpdate(data, data.compression);
+    return;
+  }
+
+  let width = data.width;
+  let height = data.height;
+  let half = data.componentSize == 16;
+  let textureType = half ? THREE.HalfFloatType : THREE.UnsignedByteType;
+  let bytesPerPixel = half ? 8 : 4;
+
+  let texture = resourceManager.getTextureForDocumentId(data.documentID);
+  let newTexture = !texture || texture.image.width != width || texture.image.height != height || texture.type != textureType ||
+    texture.mipmaps.length == 0 || (texture as THREE.CompressedTexture).isCompressedTexture;
+
+  if (newTexture) {
+    texture = createDocumentTexture(half ? new Uint16Array(4 * width * height) : new Uint8Array(4 * width * height), width, height, true);
+    resourceManager.setDocumentTexture(data.documentID, texture);
+  }
+
+  for (let tile of data.tiles) {
+    let level = tile.level ?? 0;
+    let mip = texture!.mipmaps[level];
+    let levelWidth = mip.width;
+    let pixelData = new Uint8Array(mip.data.buffer, mip.data.byteOffset, mip.data.byteLength);
+
+    // Deltas apply on top of the pixels we already have for the rect.
+    let rowLength = bytesPerPixel * tile.width;
+    let tileData = new Uint8Array(rowLength * tile.height);
+    if (data.encoding == "delta") {
+      for (let row = 0; row < tile.height; row++) {
+        let start = ((tile.y + row) * levelWidth + tile.x) * bytesPerPixel;
+        tileData.set(pixelData.subarray(start, start + rowLength), row * rowLength);
+      }
     }
-    for (let i = pixelStringEndIndex; i < pixelDataLength; i++) {
-      pixelData[i] = 0;
+
+    decodePixelString(tile.pixelString, data.encoding, tileData);
+
+    // Keep the CPU copy current so a later full upload (e.g. flipY changing) has the right data.
+    for (let row = 0; row < tile.height; row++) {
+      pixelData.set(tileData.subarray(row * rowLength, (row + 1) * rowLength), ((tile.y + row) * levelWidth + tile.x) * bytesPerPixel);
     }
 
-    texture = new THREE.DataTexture(pixelData, width, height);
-    texture.flipY = flipY;
-    texture.wrapS = texture.wrapT = THREE.RepeatWrapping;
-    texture.anisotropy = renderer.capabilities.getMaxAnisotropy();
-    texture.colorSpace = THREE.SRGBColorSpace;
-    texture.magFilter = texture.minFilter = THREE.LinearFilter;
-    
-    resourceManager.setDocumentTexture(documentID, texture);
+    if (newTexture) continue;
+
+    // texSubImage2D doesn't flip, the tile is flipped on upload and written to the mirrored position instead.
+    let tileTexture = new THREE.DataTexture(half ? new Uint16Array(tileData.buffer) : tileData, tile.width, tile.height, THREE.RGBAFormat, textureType);
+    tileTexture.flipY = texture!.flipY;
+    let y = texture!.flipY ? mip.height - tile.y - tile.height : tile.y;
+    renderer.copyTextureToTexture(new THREE.Vector2(tile.x, y), tileTexture, texture!, level);
+    tileTexture.dispose();
+  }
+
+  if (newTexture) {
+    texture!.needsUpdate = true;
+  }
+}
+
+const compressedTextureFormats = {
+  bc1: {format: THREE.RGB_S3TC_DXT1_Format, blockBytes: 8},
+  bc3: {format: THREE.RGBA_S3TC_DXT5_Format, blockBytes: 16},
+  bc7: {format: THREE.RGBA_BPTC_Format, blockBytes: 16},
+};
+
+/**
+ * Create a block compressed texture for a document, with a complete mip chain of empty levels like
+ * createDocumentTexture. Compressed data can't be flipped on upload, a flipped texture is mirrored through its uv
+ * transform instead.
+ */
+function createCompressedDocumentTexture(compression: TextureCompression, width: number, height: number): THREE.CompressedTexture {
+  let {format, blockBytes} = compressedTextureFormats[compression];
+  let mipmaps = [];
+  let levelWidth = width;
+  let levelHeight = height;
+  while (true) {
+    let length = Math.ceil(levelWidth / 4) * Math.ceil(levelHeight / 4) * blockBytes;
+    mipmaps.push({data: new Uint8Array(length), width: levelWidth, height: levelHeight});
+    if (levelWidth == 1 && levelHeight == 1) break;
+    levelWidth = Math.max(1, Math.floor(levelWidth / 2));
+    levelHeight = Math.max(1, Math.floor(levelHeight / 2));
+  }
+
+  let texture = new THREE.CompressedTexture(mipmaps, width, height, format as THREE.CompressedPixelFormat);
+  texture.wrapS = texture.wrapT = THREE.RepeatWrapping;
+  texture.anisotropy = renderer.capabilities.getMaxAnisotropy();
+  texture.colorSpace = THREE.SRGBColorSpace;
+  texture.magFilter = THREE.LinearFilter;
+  texture.minFilter = THREE.LinearMipmapLinearFilter;
+  texture.generateMipmaps = false;
+  texture.userData.flipWithUv = true;
+  texture.repeat.y = flipY ? -1 : 1;
+  texture.offset.y = flipY ? 1 : 0;
+  return texture;
+}
+
+/**
+ * Like handleTileUpdate for tiles of compressed blocks. The CPU copy of each level is kept as blocks, and changed
+ * rects are uploaded with compressedTexSubImage2D since three.js can't copy into compressed textures.
+ */
+function handleCompressedTileUpdate(data: TileUpdate, compression: TextureCompression) {
+  let {format, blockBytes} = compressedTextureFormats[compression];
+
+  let texture = resourceManager.getTextureForDocumentId(data.documentID) as THREE.CompressedTexture | null;
+  let newTexture = !texture || !texture.isCompressedTexture || texture.format != format ||
+    texture.image.width != data.width || texture.image.height != data.height;
+
+  if (newTexture) {
+    texture = createCompressedDocumentTexture(compression, data.width, data.height);
+    resourceManager.setDocumentTexture(data.documentID, texture);
+  }
+
+  for (let tile of data.tiles) {
+    let level = tile.level ?? 0;
+    let mip = texture!.mipmaps[level];
+    let levelBlocksX = Math.ceil(mip.width / 4);
+    let blockData = mip.data as Uint8Array;
+
+    let blockX = tile.x / 4;
+    let blockY = tile.y / 4;
+    let blocksHigh = Math.ceil(tile.height / 4);
+    let rowLength = Math.ceil(tile.width / 4) * blockBytes;
+    let tileData = new Uint8Array(rowLength * blocksHigh);
+    if (data.encoding == "delta") {
+      for (let row = 0; row < blocksHigh; row++) {
+        let start = ((blockY + row) * levelBlocksX + blockX) * blockBytes;
+        tileData.set(blockData.subarray(start, start + rowLength), row * rowLength);
+      }
+    }
+
+    decodePixelString(tile.pixelString, data.encoding, tileData);
+
+    for (let row = 0; row < blocksHigh; row++) {
+      blockData.set(tileData.subarray(row * rowLength, (row + 1) * rowLength), ((blockY + row) * levelBlocksX + blockX) * blockBytes);
+    }
+
+    if (!newTexture) {
+      uploadCompressedTile(texture!, level, tile, tileData);
+    }
+  }
+
+  if (newTexture) {
+    // Upload now, so the next update can write into the texture right away
+    renderer.initTexture(texture!);
+  }
+}
+
+// Write blocks into a rect of a mip level of the texture, which must already be on the GPU
+function uploadCompressedTile(texture: THREE.CompressedTexture, level: number, tile: TileData, blocks: Uint8Array) {
+  let gl = renderer.getContext();
+  let internalFormat: number;
+  if (texture.format == THREE.RGBA_BPTC_Format) {
+    internalFormat = renderer.extensions.get("EXT_texture_compression_bptc").COMPRESSED_SRGB_ALPHA_BPTC_UNORM_EXT;
   } else {
-    pixelData = texture.image.data as Uint8Array;
+    let s3tc = renderer.extensions.get("WEBGL_compressed_texture_s3tc_srgb");
+    internalFormat = texture.format == THREE.RGB_S3TC_DXT1_Format ? s3tc.COMPRESSED_SRGB_S3TC_DXT1_EXT : s3tc.COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+  }
+
+  // Bind through three.js' state so its cache of bound textures stays right
+  renderer.state.bindTexture(gl.TEXTURE_2D, (renderer.properties.get(texture) as any).__webglTexture);
+  gl.compressedTexSubImage2D(gl.TEXTURE_2D, level, tile.x, tile.y, tile.width, tile.height, internalFormat, blocks);
+}
 
-    for (let i = 0; i < data.pixelString.length; i++) {
-      pixelData[pixelStringStartIndex + i] = data.pixelString.charCodeAt(i); 
+/**
+ * Create a packed texture. It holds data rather than colors, and starts out white: channels no document feeds leave
+ * the material's own occlusion, roughness and metalness.
+ */
+function createPackedTexture(width: number, height: number): THREE.DataTexture {
+  let texture = createDocumentTexture(new Uint8Array(4 * width * height).fill(255), width, height);
+  texture.colorSpace = THREE.NoColorSpace;
+  return texture;
+}
+
+/**
+ * Write the changed channel tiles into a packed texture. A tile holds one channel of its rect, which is merged into the
+ * CPU copy of the texture, and the rect is copied to the GPU from there with the other channels as they were.
+ * @param data object containing the changed channel rectangles + associated metadata
+ */
+function handlePackedUpdate(data: PackedUpdate) {
+  let texture = resourceManager.getPackedTexture(data.packedTextureID);
+  if (!texture) {
+    // No material uses it anymore
+    return;
+  }
+
+  let newTexture = texture.image.width != data.width || texture.image.height != data.height;
+  if (newTexture) {
+    texture = createPackedTexture(data.width, data.height);
+    resourceManager.setPackedTexture(data.packedTextureID, texture);
+  }
+
+  let pixelData = texture.image.data as Uint8Array;
+  for (let tile of data.tiles) {
+    let channelData = new Uint8Array(tile.width * tile.height);
+    decodePixelString(tile.pixelString, data.encoding, channelData);
+
+    for (let row = 0; row < tile.height; row++) {
+      let start = ((tile.y + row) * data.width + tile.x) * 4 + tile.channel;
+      for (let x = 0; x < tile.width; x++) {
+        pixelData[start + x * 4] = channelData[row * tile.width + x];
+      }
     }
+
+    if (newTexture) continue;
+
+    let rowLength = 4 * tile.width;
+    let tileData = new Uint8Array(rowLength * tile.height);
+    for (let row = 0; row < tile.height; row++) {
+      let start = ((tile.y + row) * data.width + tile.x) * 4;
+      tileData.set(pixelData.subarray(start, start + rowLength), row * rowLength);
+    }
+
+    // Flipped on upload and written to the mirrored position, like the tiles of document textures
+    let tileTexture = new THREE.DataTexture(tileData, tile.width, tile.height, THREE.RGBAFormat, THREE.UnsignedByteType);
+    tileTexture.flipY = texture.flipY;
+    let y = texture.flipY ? data.height - tile.y - tile.height : tile.y;
+    renderer.copyTextureToTexture(new THREE.Vector2(tile.x, y), tileTexture, texture);
+    tileTexture.dispose();
   }
 
-  texture.needsUpdate = true;
+  if (newTexture) {
+    texture.needsUpdate = true;
+  }
 }
 
 
 function handleDocumentClosed(data: DocumentClosed) {
   resourceManager.removeDocument(data.documentID);
+  postVisibleDocuments();
 }
 
 //#endregion
@@ -480,11 +758,72 @@ function onContextMenuChoiceMade(key: choiceStrings) {
         }
       }
     });
+    postVisibleDocuments();
+  } else if (key == "APPLY_OCCLUSION") {
+    applyActiveDocumentToChannel(0);
+  } else if (key == "APPLY_ROUGHNESS") {
+    applyActiveDocumentToChannel(1);
+  } else if (key == "APPLY_METALNESS") {
+    applyActiveDocumentToChannel(2);
   }
 
   renderUI(false, new THREE.Vector2(0, 0)); // Close the context menu
 }
 
+/**
+ * Use the active document as the occlusion, roughness or metalness of the selected meshes' materials. The plugin packs
+ * it into one channel of the material's packed texture, so all three share a texture and an edit only sends its own
+ * channel. Meshes without a standard material get one, keeping their color map.
+ */
+function applyActiveDocumentToChannel(channel: 0 | 1 | 2) {
+  let packedTextureIDs = new Set<number>();
+  currentlySelectedObjects.forEach(obj => {
+    if (!(obj instanceof THREE.Mesh)) return;
+
+    let current = obj.material instanceof THREE.Material ? obj.material : obj.material[0];
+    let proxy = resourceManager.getMaterialByUUID(current.uuid);
+    if (!proxy) return;
+
+    if (!(proxy.litMaterial instanceof THREE.MeshStandardMaterial)) {
+      let map = proxy.litMaterial.map ?? null;
+      let newMaterial = resourceManager.createMaterialProxy(new THREE.MeshStandardMaterial({map}));
+      if (map) resourceManager.addMaterialTexture(map, newMaterial.uuid);
+      resourceManager.setMeshMaterial(obj, newMaterial);
+      proxy = newMaterial;
+    }
+
+    let material = proxy.litMaterial as THREE.MeshStandardMaterial;
+    let packedTextureID: number = material.userData.packedTextureID ?? nextPackedTextureID++;
+    material.userData.packedTextureID = packedTextureID;
+
+    let texture = resourceManager.getPackedTexture(packedTextureID);
+    if (!texture) {
+      // Replaced once the plugin sends the channels at the document's size
+      texture = createPackedTexture(1, 1);
+      resourceManager.setPackedTexture(packedTextureID, texture);
+    }
+    resourceManager.addMaterialTexture(texture, proxy.uuid);
+    resourceManager.setPackedTextureSource(packedTextureID, channel, activeDocument);
+
+    material[packedChannelMaps[channel]] = texture;
+    if (channel == 0) {
+      proxy.unlitMaterial.aoMap = texture;
+      proxy.unlitMaterial.needsUpdate = true;
+    } else {
+      // The maps scale these values, at 1 the document decides alone
+      if (channel == 1) material.roughness = 1;
+      if (channel == 2) material.metalness = 1;
+    }
+    material.needsUpdate = true;
+    packedTextureIDs.add(packedTextureID);
+  });
+
+  packedTextureIDs.forEach(packedTextureID => {
+    postPluginMessage({type: "PackChannel", packedTextureID, channel, documentID: activeDocument});
+  });
+  postVisibleDocuments();
+}
+
 function onUpdateSettings(newSettings: UserSettings, updatePlugin: boolean = true) {
   userSettings = newSettings;
   
@@ -521,6 +860,7 @@ async function onLoadButtonClicked(){
 function loadObject(objectFileURL: string, objectFileName: string) {
   if (currentObject) {
     resourceManager.removeObjectFromScene(currentObject.uuid);
+    postVisibleDocuments();
   }
   // Clear anything selected
   selectObjects([]);
@@ -60,6 +60,13 @@ export default class ResourceManager {
 
   unlitToLitUUIDs = new Map<string, string>();
 
+  // Textures packing a channel of several documents each (occlusion, roughness and metalness in R, G and B), by the
+  // id the plugin knows them by, and the documents feeding their channels (-1 for none)
+  packedTextureIdsToTextureUUID = new Map<number, string>();
+  packedTextureSources = new Map<number, number[]>();
+  // Called when a packed texture is no longer used by any material, so the plugin can drop it
+  onPackedTextureRemoved: (packedTextureID: number) => void = () => {};
+
   defaultMaterial: MaterialProxy;
 
   constructor(scene: Scene) {
@@ -95,6 +102,13 @@ export default class ResourceManager {
     return this.textures.get(textureUUID) ?? null;
   }
 
+  getPackedTexture(packedTextureID: number): Texture | null {
+    const textureUUID = this.packedTextureIdsToTextureUUID.get(packedTextureID);
+    if (!textureUUID) return null;
+
+    return this.textures.get(textureUUID) ?? null;
+  }
+
   getTexturesUsedByMaterial(uuid: string): Texture[] {
     const material = this.materials.get(uuid);
     if (!material) return [];
@@ -147,12 +161,37 @@ export default class ResourceManager {
     return this.materials.get(uuid) ?? null;
   }
 
+  // Documents whose texture is on a material in the scene
+  getVisibleDocumentIds(): number[] {
+    const result: number[] = [];
+    this.documentIdsToTextureUUID.forEach((textureUUID, documentID) => {
+      if ((this.textureUUIDsToMaterialUUIDs.get(textureUUID)?.size ?? 0) > 0) {
+        result.push(documentID);
+      }
+    });
+    // Documents feeding a packed texture on a material are on screen as well
+    this.packedTextureIdsToTextureUUID.forEach((textureUUID, packedTextureID) => {
+      if ((this.textureUUIDsToMaterialUUIDs.get(textureUUID)?.size ?? 0) > 0) {
+        for (let documentID of this.packedTextureSources.get(packedTextureID) ?? []) {
+          if (documentID >= 0 && !result.includes(documentID)) result.push(documentID);
+        }
+      }
+    });
+    return result;
+  }
+
 //#endregion
 
 
 //#region Adding To Scene
   setTexturesFlipY(val: boolean) {
     this.textures.forEach((tex, _uuid) => {
+      if (tex.userData.flipWithUv) {
+        // Compressed document textures can't be flipped on upload, see createCompressedDocumentTexture
+        tex.repeat.y = val ? -1 : 1;
+        tex.offset.y = val ? 1 : 0;
+        return;
+      }
       tex.flipY = val;
       tex.needsUpdate = true;
     })
@@ -380,6 +419,40 @@ export default class ResourceManager {
     }
   }
 
+  // Same as setDocumentTexture, for a packed texture. Materials using the previous texture get the new one.
+  setPackedTexture(packedTextureID: number, newTexture: Texture): void {
+    const currentTextureUUID = this.packedTextureIdsToTextureUUID.get(packedTextureID);
+
+    if (currentTextureUUID == newTexture.uuid) {
+      return;
+    }
+
+    this.packedTextureIdsToTextureUUID.set(packedTextureID, newTexture.uuid);
+    this.textures.set(newTexture.uuid, newTexture);
+    if (!this.packedTextureSources.has(packedTextureID)) {
+      this.packedTextureSources.set(packedTextureID, [-1, -1, -1]);
+    }
+
+    if (currentTextureUUID) {
+      let affectedMaterials = this.getMaterialsUsingTexture(currentTextureUUID);
+      for (let material of affectedMaterials) {
+        this.addMaterialTexture(newTexture, material.uuid);
+        this.textureUUIDsToMaterialUUIDs.get(currentTextureUUID)?.delete(material.uuid);
+        this.replaceMaterialTexture(material.litMaterial, currentTextureUUID, newTexture);
+        this.replaceMaterialTexture(material.unlitMaterial, currentTextureUUID, newTexture);
+      }
+
+      const currentTexture = this.textures.get(currentTextureUUID);
+      currentTexture?.dispose();
+      this.textures.delete(currentTextureUUID);
+    }
+  }
+
+  setPackedTextureSource(packedTextureID: number, channel: number, documentID: number): void {
+    const sources = this.packedTextureSources.get(packedTextureID);
+    if (sources) sources[channel] = documentID;
+  }
+
   replaceMaterialTexture(texturedMaterial: TexturedMaterial, oldTextureUUID: string, newTexture: Texture) {
     // Replace old textures with the new texture
     if (texturedMaterial.map?.uuid === oldTextureUUID) texturedMaterial.map = newTexture;
@@ -452,6 +525,7 @@ export default class ResourceManager {
           this.textureUUIDsToMaterialUUIDs.delete(texture.uuid);
           this.textures.delete(texture.uuid);
           texture.dispose(); 
+          this.removePackedTexture(texture.uuid);
         } 
         
       }
@@ -510,7 +584,24 @@ export default class ResourceManager {
     this.scene.remove(object);
   }
 
+  removePackedTexture(textureUUID: string): void {
+    this.packedTextureIdsToTextureUUID.forEach((packedTextureUUID, packedTextureID) => {
+      if (packedTextureUUID == textureUUID) {
+        this.packedTextureIdsToTextureUUID.delete(packedTextureID);
+        this.packedTextureSources.delete(packedTextureID);
+        this.onPackedTextureRemoved(packedTextureID);
+      }
+    });
+  }
+
   removeDocument(documentID: number): void {
+    // The plugin clears the channels the document fed, they go back to white
+    this.packedTextureSources.forEach((sources) => {
+      for (let channel = 0; channel < sources.length; channel++) {
+        if (sources[channel] == documentID) sources[channel] = -1;
+      }
+    });
+
     const textureUUID = this.documentIdsToTextureUUID.get(documentID);
     if (!textureUUID) return;
 
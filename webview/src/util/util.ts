@@ -1,4 +1,5 @@
 import { ControlScheme, MouseButton, ControlSchemeType } from "@api/types/Settings";
+import { PixelEncoding } from "@api/types/Messages";
 
 export function isValidNumber(value: string): boolean {
   value = value.trim();
@@ -10,6 +11,151 @@ export function isValidNumber(value: string): boolean {
   return n !== Infinity && String(n) === value && n > 0;
 };
 
+/**
+ * Decode the pixel bytes in a string sent by the hybrid module into out, starting at offset. Pixel strings always hold
+ * whole RGBA pixels.
+ * 
+ * "string": every charCode is one byte.
+ * "dense": every charCode is two bytes, high byte first. Pairs that would be UTF-16 surrogates are escaped so they
+ * survive postMessage: 0xFFFF followed by d stands for 0xD800 + d, or for 0xFFFF itself when d is 0x0800.
+ * "delta": a dense string holding a compressed payload, see applyPixelPayload. out must hold the previous pixels.
+ */
+export function decodePixelString(pixelString: string, encoding: PixelEncoding, out: Uint8Array, offset: number = 0) {
+  if (encoding == "delta") {
+    let payload = new Uint8Array(pixelString.length * 2);
+    decodePixelString(pixelString, "dense", payload);
+    applyPixelPayload(payload, out, offset);
+  } else if (encoding == "dense") {
+    let o = offset;
+    for (let i = 0; i < pixelString.length; i++) {
+      let unit = pixelString.charCodeAt(i);
+      if (unit == 0xFFFF) {
+        let escaped = pixelString.charCodeAt(++i);
+        unit = escaped == 0x0800 ? 0xFFFF : 0xD800 + escaped;
+      }
+      out[o++] = unit >> 8;
+      out[o++] = unit & 0xFF;
+    }
+  } else {
+    for (let i = 0; i < pixelString.length; i++) {
+      out[offset + i] = pixelString.charCodeAt(i);
+    }
+  }
+}
+
+/**
+ * Apply a compressed pixel payload from the hybrid module (DeltaCodec.h) to the pixels in out starting at offset.
+ * 
+ * Header, little endian: u8 version (1), u8 flags (1 = delta, 2 = LZ4), u16 reserved, u32 pixel byte count,
+ * u32 run-length stream byte count, u32 payload byte count. The payload after the header is the run-length stream,
+ * LZ4 block compressed when flagged. The stream repeats (varint zero count, varint literal count, literals) and with
+ * the delta flag each byte is XORed into the existing pixels, otherwise it replaces them.
+ */
+export function applyPixelPayload(encoded: Uint8Array, out: Uint8Array, offset: number = 0) {
+  const readU32 = (i: number) => (encoded[i] | (encoded[i + 1] << 8) | (encoded[i + 2] << 16) | (encoded[i + 3] << 24)) >>> 0;
+
+  if (encoded[0] != 1) {
+    throw new Error("Unknown pixel payload version " + encoded[0]);
+  }
+
+  let delta = (encoded[1] & 1) != 0;
+  let compressed = (encoded[1] & 2) != 0;
+  let pixelLength = readU32(4);
+  let runsLength = readU32(8);
+  let payloadLength = readU32(12);
+
+  let runs = encoded.subarray(16, 16 + payloadLength);
+  if (compressed) {
+    let decompressed = new Uint8Array(runsLength);
+    lz4DecompressBlock(runs, decompressed);
+    runs = decompressed;
+  }
+
+  let i = 0;
+  let p = offset;
+  const readVarint = () => {
+    let value = 0;
+    let scale = 1;
+    let byte;
+    do {
+      byte = runs[i++];
+      value += (byte & 0x7F) * scale;
+      scale *= 128;
+    } while (byte & 0x80);
+    return value;
+  };
+
+  while (i < runsLength) {
+    let zeros = readVarint();
+    let literals = readVarint();
+
+    if (!delta) {
+      out.fill(0, p, p + zeros);
+    }
+    p += zeros;
+
+    if (delta) {
+      for (let j = 0; j < literals; j++) {
+        out[p + j] ^= runs[i + j];
+      }
+    } else {
+      out.set(runs.subarray(i, i + literals), p);
+    }
+    p += literals;
+    i += literals;
+  }
+
+  if (p - offset != pixelLength) {
+    throw new Error("Pixel payload decoded to the wrong size");
+  }
+}
+
+/**
+ * Decompress an LZ4 block (no frame) into dst. Returns the number of bytes written.
+ */
+function lz4DecompressBlock(src: Uint8Array, dst: Uint8Array): number {
+  let i = 0;
+  let o = 0;
+
+  const readLength = (length: number) => {
+    if (length == 15) {
+      let byte;
+      do {
+        byte = src[i++];
+        length += byte;
+      } while (byte == 255);
+    }
+    return length;
+  };
+
+  while (i < src.length) {
+    let token = src[i++];
+
+    let literals = readLength(token >> 4);
+    dst.set(src.subarray(i, i + literals), o);
+    i += literals;
+    o += literals;
+
+    if (i >= src.length) break;
+
+    let matchOffset = src[i] | (src[i + 1] << 8);
+    i += 2;
+
+    let matchLength = readLength(token & 15) + 4;
+    if (matchOffset >= matchLength) {
+      dst.copyWithin(o, o - matchOffset, o - matchOffset + matchLength);
+      o += matchLength;
+    } else {
+      // Overlapping match, has to go byte by byte
+      for (let end = o + matchLength; o < end; o++) {
+        dst[o] = dst[o - matchOffset];
+      }
+    }
+  }
+
+  return o;
+}
+
 export const BuiltInSchemes = new Map<ControlSchemeType, ControlScheme>([
   [ControlSchemeType.MAYA, {
     pan: { key: "Alt", mouseButton: MouseButton.MIDDLE },